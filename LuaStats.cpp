@@ -2,17 +2,285 @@
 #include "LuaStats.h"
 #include "UnLuaEx.h"
 #include "Stats/Stats2.h"
+#include "HAL/CriticalSection.h"
+#include "Hash/CityHash.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "Misc/CommandLine.h"
+#include "Misc/CoreDelegates.h"
+#include "Misc/DelayedAutoRegister.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Parse.h"
+#include "Misc/Paths.h"
+#include "LuaStatsColumnar.h"
+#include "LuaStatsHeapWalker.h"
+#include "LuaStatsHistory.h"
+#include "LuaStatsPerfCounters.h"
+#include "LuaStatsPrivate.h"
+#include "LuaStatsRecorder.h"
+#include "LuaStatsRewriter.h"
+#include "LuaStatsSharedMemory.h"
+
+#if PLATFORM_LINUX || PLATFORM_MAC
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 DECLARE_STATS_GROUP(TEXT("Lua"), STATGROUP_Lua, STATCAT_Advanced);
 
+DEFINE_LOG_CATEGORY(LogLuaStats);
+
+static TAutoConsoleVariable<int32> CVarLuaStatsSubtractOverhead(
+    TEXT("LuaStats.SubtractOverhead"),
+    0,
+    TEXT("Times Lua cycle counters natively and subtracts the calibrated Start/Stop cost of nested scopes from their parents."),
+    ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarLuaStatsRollups(
+    TEXT("LuaStats.Rollups"),
+    0,
+    TEXT("Attributes the self time of Lua cycle counters and SimpleSeconds stats to the script file and module that opened them."),
+    ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarLuaStatsRollupModuleDepth(
+    TEXT("LuaStats.RollupModuleDepth"),
+    1,
+    TEXT("Number of leading path components of a script that name its module in LuaStats.Rollups, e.g. 1 maps UI/Menu/Main.lua to UI."),
+    ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarLuaStatsAsyncSpanWindow(
+    TEXT("LuaStats.AsyncSpanWindow"),
+    10.0f,
+    TEXT("Seconds of completed async spans that latency percentiles and completion rates are computed over."),
+    ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarLuaStatsAsyncSpanTimeout(
+    TEXT("LuaStats.AsyncSpanTimeout"),
+    300.0f,
+    TEXT("Seconds after which an async span that was never ended is dropped and counted as expired."),
+    ECVF_Default);
+
+static TAutoConsoleVariable<float> CVarLuaStatsHistoryMinutes(
+    TEXT("LuaStats.HistoryMinutes"),
+    0.0f,
+    TEXT("Minutes of per-frame values of every Lua stat kept compressed in memory for LuaStats.DumpHistory. 0 disables the history."),
+    ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarLuaStatsHistoryBudgetMB(
+    TEXT("LuaStats.HistoryBudgetMB"),
+    64,
+    TEXT("Memory cap of LuaStats.HistoryMinutes in megabytes; the oldest samples are evicted first when it is reached."),
+    ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarLuaStatsTopKeys(
+    TEXT("LuaStats.TopKeys"),
+    5,
+    TEXT("Number of heaviest keys published each frame as <Stat>@TopN for stats timed or counted with a key argument."),
+    ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarLuaStatsRewriteChunks(
+    TEXT("LuaStats.RewriteChunks"),
+    UE_BUILD_SHIPPING ? 2 : 1,
+    TEXT("Rewrites the stat calls of scripts required after LuaStats.InstallRewriter(): 0 loads them as they are, 1 binds stat functions and literal stat names to locals when the script loads, 2 removes the calls."),
+    ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarLuaStatsHeapScanBudget(
+    TEXT("LuaStats.HeapScanBudget"),
+    4000,
+    TEXT("Objects and table entries LuaStats.StartHeapScan visits per frame. Higher finishes a walk in fewer frames at a higher cost per frame."),
+    ECVF_Default);
+
+static TAutoConsoleVariable<int32> CVarLuaStatsPerfCounters(
+    TEXT("LuaStats.PerfCounters"),
+    0,
+    TEXT("Linux: publishes the retired instructions, cache misses and branch misses of every Lua cycle counter scope as <Stat>@RetiredInstructions, @CacheMisses and @BranchMisses, or its task clock and page faults where hardware counters are unavailable."),
+    ECVF_Default);
+
+static void CalibrateLuaScopeOverhead();
+
+static const TCHAR* const LuaStatTypeNames[] =
+{
+    TEXT("CycleCounter"),
+    TEXT("SimpleSeconds"),
+    TEXT("Int64"),
+    TEXT("Int64Accumulator"),
+    TEXT("Double"),
+    TEXT("DoubleAccumulator"),
+    TEXT("Memory"),
+    TEXT("AsyncSpan"),
+};
+static_assert(UE_ARRAY_COUNT(LuaStatTypeNames) == static_cast<int32>(ELuaStatType::Count), "LuaStatTypeNames out of sync");
+static_assert(UE_ARRAY_COUNT(LuaStatsSharedMemory::TypeNames) == static_cast<int32>(ELuaStatType::Count), "LuaStatsSharedMemory::TypeNames out of sync");
+
+// How many stats of each type a bulk registration is about to create.
+struct FLuaStatTypeCounts
+{
+    int32 Num[static_cast<int32>(ELuaStatType::Count)] = {};
+
+    void Add(ELuaStatType Type)
+    {
+        ++Num[static_cast<int32>(Type)];
+    }
+
+    int32 Get(ELuaStatType Type) const
+    {
+        return Num[static_cast<int32>(Type)];
+    }
+};
+
+static bool ParseLuaStatType(const TCHAR* TypeName, ELuaStatType& OutType)
+{
+    for (int32 Index = 0; Index < static_cast<int32>(UE_ARRAY_COUNT(LuaStatTypeNames)); ++Index)
+    {
+        if (FCString::Stricmp(TypeName, LuaStatTypeNames[Index]) == 0)
+        {
+            OutType = static_cast<ELuaStatType>(Index);
+            return true;
+        }
+    }
+    return false;
+}
+
+struct FLuaStatGroup
+{
+    FName Name;
+    FName GroupName;
+    TArray<ANSICHAR> GroupNameAnsi;
+    FString Desc;
+    bool bDefaultEnabled;
+};
+
+static uint32 GLuaStatsSampleSeed = 0x9E3779B9u;
+
+static FORCEINLINE uint32 NextSampleInterval(uint32 SampleRate, bool bRandomSampling)
+{
+    if (!bRandomSampling)
+    {
+        return SampleRate;
+    }
+    // xorshift32; a uniform interval in [1, 2N-1] keeps the 1-in-N mean without locking onto periodic call patterns.
+    GLuaStatsSampleSeed ^= GLuaStatsSampleSeed << 13;
+    GLuaStatsSampleSeed ^= GLuaStatsSampleSeed >> 17;
+    GLuaStatsSampleSeed ^= GLuaStatsSampleSeed << 5;
+    return 1 + GLuaStatsSampleSeed % (2 * SampleRate - 1);
+}
+
+struct FLuaStatSampler
+{
+    bool bNativeTiming = false;
+    uint32 SampleRate = 1;
+    uint32 Countdown = 1;
+    bool bRandom = false;
+    uint32 FrameCalls = 0;
+    uint32 FrameSamples = 0;
+    uint64 FrameSampledCycles = 0;
+    double FrameSampledCyclesSq = 0.0;
+    TStatIdData const* CallsStat = nullptr;
+    TStatIdData const* StdErrStat = nullptr;
+
+    FORCEINLINE bool ShouldSample()
+    {
+        ++FrameCalls;
+        if (--Countdown != 0)
+        {
+            return false;
+        }
+        Countdown = NextSampleInterval(SampleRate, bRandom);
+        return true;
+    }
+
+    FORCEINLINE void AddSample(uint64 Cycles)
+    {
+        ++FrameSamples;
+        FrameSampledCycles += Cycles;
+        FrameSampledCyclesSq += static_cast<double>(Cycles) * static_cast<double>(Cycles);
+    }
+
+    void SetRate(uint32 InSampleRate, bool bInRandom)
+    {
+        SampleRate = FMath::Max(InSampleRate, 1u);
+        bRandom = bInRandom && SampleRate > 1;
+        Countdown = NextSampleInterval(SampleRate, bRandom);
+    }
+
+    // Scales the sampled time of this frame up to all calls (ratio estimator) and returns its standard error
+    // with the finite population correction, then starts a new frame.
+    double Extrapolate(uint32& OutCalls, double& OutStdErr)
+    {
+        double Total = 0.0;
+        OutCalls = FrameCalls;
+        OutStdErr = 0.0;
+        if (FrameSamples > 0)
+        {
+            const double Calls = FrameCalls;
+            const double Samples = FrameSamples;
+            const double Mean = FrameSampledCycles / Samples;
+            Total = Mean * Calls;
+            if (FrameSamples > 1 && FrameCalls > FrameSamples)
+            {
+                const double Variance = FMath::Max(0.0, (FrameSampledCyclesSq - Samples * Mean * Mean) / (Samples - 1.0));
+                OutStdErr = Calls * FMath::Sqrt(Variance / Samples * (1.0 - Samples / Calls));
+            }
+        }
+        FrameCalls = 0;
+        FrameSamples = 0;
+        FrameSampledCycles = 0;
+        FrameSampledCyclesSq = 0.0;
+        return Total;
+    }
+};
+
+// The optional key a timing or counter call attributes its cost to: a number, string, or any other Lua value by identity.
+struct FLuaStatKey
+{
+    uint64 Hash = 0;
+    double Number = 0.0;
+    const void* Pointer = nullptr;
+    int32 LuaType = LUA_TNONE;
+
+    bool IsSet() const
+    {
+        return LuaType != LUA_TNONE;
+    }
+};
+
+struct FLuaRollupSlot
+{
+    int32 Source = INDEX_NONE;
+    uint32 FrameCalls = 0;
+    uint64 FrameCycles = 0;
+    bool bDirty = false;
+};
+
 class FLuaCycleCounter : FCycleCounter
 {
     TStatId StatId;
     bool bStart;
+    bool bSampledScope;
+    bool bTimed;
+    bool bSample;
+    uint64 StartCycles;
 public:
+    FLuaStatSampler Sampler;
+    FLuaRollupSlot Rollup;
+    TStatIdData const* NativeStat = nullptr;
+    TStatIdData const* InstructionsStat = nullptr;
+    TStatIdData const* PerfStats[LuaPerfMaxEvents] = {};
+    int32 Definition = INDEX_NONE;
+    bool bMeasureValue = false;
+    // Cycles of spans recorded from Lua timestamps this frame, reported in FLuaStats::Flush.
+    uint64 RecordedCycles = 0;
+
     FORCEINLINE_STATS FLuaCycleCounter(TStatId InStatId)
         : StatId(InStatId.GetRawPointer())
         , bStart(false)
+        , bSampledScope(false)
+        , bTimed(false)
+        , bSample(false)
+        , StartCycles(0)
     {
     }
     
@@ -21,22 +289,64 @@ public:
         Stop();
     }
 
-    void Start()
+    void Start(bool bMeasure = false)
     {
         if (!bStart)
         {
             bStart = true;
+            if (Sampler.bNativeTiming)
+            {
+                // Unsampled calls only count down; sampled ones are timed natively and extrapolated in FLuaStats::Flush.
+                // An unsampled call whose cycles are needed, e.g. for its key, is timed without becoming a sample.
+                bSampledScope = true;
+                bSample = StatId.IsValidStat() && Sampler.ShouldSample();
+                bTimed = bSample || (bMeasure && StatId.IsValidStat());
+                if (bTimed)
+                {
+                    StartCycles = FPlatformTime::Cycles64();
+                }
+                return;
+            }
+            bTimed = bMeasure && StatId.IsValidStat();
+            if (bTimed)
+            {
+                StartCycles = FPlatformTime::Cycles64();
+            }
             FCycleCounter::Start(StatId);
         }
     }
 
-    void Stop()
+    // Returns the inclusive cycles of the activation when it was timed, 0 otherwise.
+    uint64 Stop(uint64 OverheadCycles = 0)
     {
+        uint64 Elapsed = 0;
         if (bStart)
         {
             bStart = false;
+            if (bTimed)
+            {
+                bTimed = false;
+                Elapsed = FPlatformTime::Cycles64() - StartCycles;
+                Elapsed = Elapsed > OverheadCycles ? Elapsed - OverheadCycles : 0;
+            }
+            if (bSampledScope)
+            {
+                bSampledScope = false;
+                if (bSample && Elapsed > 0)
+                {
+                    Sampler.AddSample(Elapsed);
+                }
+                bSample = false;
+                return Elapsed;
+            }
             FCycleCounter::Stop();
         }
+        return Elapsed;
+    }
+
+    bool IsStarted() const
+    {
+        return bStart;
     }
 
     void Set(const uint32 Cycles) const
@@ -58,7 +368,9 @@ class FLuaSimpleSecondsStat
 public:
     FLuaSimpleSecondsStat(TStatId InStatId, double InScale = 1.0)
         : bStart(false)
-        , StartTime(0)
+        , bSampledScope(false)
+        , bTimed(false)
+        , StartCycles(0)
         , StatId(InStatId)
         , Scale(InScale)
     {
@@ -70,571 +382,4848 @@ public:
         Stop();
     }
 
-    void Start()
+    void Start(bool bMeasure = false)
     {
-        bStart = true;
-        StartTime = FPlatformTime::Seconds();
+        if (StatId.IsValidStat())
+        {
+            bStart = true;
+            if (Sampler.bNativeTiming)
+            {
+                bSampledScope = true;
+                bSample = Sampler.ShouldSample();
+                bTimed = bSample || bMeasure;
+                if (bTimed)
+                {
+                    StartCycles = FPlatformTime::Cycles64();
+                }
+                return;
+            }
+            bSampledScope = false;
+            StartCycles = FPlatformTime::Cycles64();
+        }
     }
 
-    void Stop()
+    // Returns the unscaled cycles of the activation when it was timed, 0 otherwise. Unsampled cycles are
+    // converted to seconds and reported once per frame by FLuaStats::Flush.
+    uint64 Stop()
     {
         if (bStart)
         {
             bStart = false;
-            const double TotalTime = (FPlatformTime::Seconds() - StartTime) * Scale;
-            FThreadStats::AddMessage(StatId.GetName(), EStatOperation::Add, TotalTime);
+            if (bSampledScope)
+            {
+                bSampledScope = false;
+                if (bTimed)
+                {
+                    bTimed = false;
+                    const uint64 Elapsed = FPlatformTime::Cycles64() - StartCycles;
+                    if (bSample)
+                    {
+                        Sampler.AddSample(Elapsed);
+                    }
+                    return Elapsed;
+                }
+                return 0;
+            }
+            return FPlatformTime::Cycles64() - StartCycles;
         }
+        return 0;
     }
 
+    TStatId GetStatId() const
+    {
+        return StatId;
+    }
+
+    double GetScale() const
+    {
+        return Scale;
+    }
+
+    FLuaStatSampler Sampler;
+    FLuaRollupSlot Rollup;
+    int32 Definition = INDEX_NONE;
+    FLuaStatKey ActiveKey;
+    uint64 FrameCycles = 0;
+
 private:
     bool bStart;
-    double StartTime;
+    bool bSampledScope;
+    bool bTimed;
+    bool bSample = false;
+    uint64 StartCycles;
     TStatId StatId;
     double Scale;
 };
 
-class FLuaStats
+struct FLuaValueStat
 {
-private:
-    TSparseArray<FLuaCycleCounter> CycleCounters;
-    TMap<FName, int32> NameToCycleCounter;
-    TMap<TStatIdData const*, int32> PtrToCycleCounter;
-    TArray<int32> CycleCounterStack;
+    TStatIdData const* StatId;
+    int32 Definition;
+};
 
-    TSparseArray<FLuaSimpleSecondsStat> SimpleSecondsStats;
-    TMap<FName, int32> NameToSecondsStat;
-    TMap<TStatIdData const*, int32> PtrToSecondsStat;
+struct FLuaNameStatValue
+{
+    // Lua string the stat was last set from; only compared, never read.
+    const char* LuaValue = nullptr;
+    FName Value;
+    bool bSet = false;
+};
 
-    TMap<FName, TStatIdData const*> Int64Stats;
-    TMap<FName, TStatIdData const*> DoubleStats;
-    TMap<FName, TStatIdData const*> MemoryStats;
+static constexpr int32 LuaNameStatMaxLabels = 1024;
+static const char* const LuaNameStatLabelsKey = "LuaStats.NameStatLabels";
 
-    static TStatId CreateStatId(FName StatName, const TCHAR* StatDesc, bool bShouldClearEveryFrame,
-        EStatDataType::Type InStatType, bool bCycleStat,
-        FPlatformMemory::EMemoryCounterRegion MemRegion = FPlatformMemory::MCR_Invalid);
+static void WatchLuaStateClose(lua_State* L);
+static void FlushLuaTrackers();
 
-    void StartCycleCounterInternal(int32 Index);
-    void SetCycleCounterInternal(int32 Index, const uint32 Cycles);
-    void StartSimpleSecondsInternal(int32 Index);
-    void StopSimpleSecondsInternal(int32 Index);
-public:
+struct FLuaParentStat
+{
+    FName Name;
+    ELuaStatType Type;
+    TStatIdData const* StatId = nullptr;
+    int32 Parent = INDEX_NONE;
+    double FrameValue = 0.0;
+    // Cycle parents: open scopes rolling up here, and the cycles of scopes that closed inside another of them.
+    uint32 ActiveScopes = 0;
+    double NestedCycles = 0.0;
+    double LastValue = 0.0;
+};
 
-    TStatIdData const* CreateCycleCounter(FName StatName, const TCHAR* StatDesc = nullptr);
-    TStatIdData const* CreateSimpleSeconds(FName StatName, const TCHAR* StatDesc = nullptr, double InScale = 1.0);
-    TStatIdData const* CreateInt64Counter(FName StatName, const TCHAR* StatDesc = nullptr);
-    TStatIdData const* CreateInt64Accumulator(FName StatName, const TCHAR* StatDesc = nullptr);
-    TStatIdData const* CreateDoubleCounter(FName StatName, const TCHAR* StatDesc = nullptr);
-    TStatIdData const* CreateDoubleAccumulator(FName StatName, const TCHAR* StatDesc = nullptr);
-    TStatIdData const* CreateMemoryStat(FName StatName, const TCHAR* StatDesc = nullptr);
+// VM instructions executed on this thread while LuaStats.CountInstructions is on, advanced by the count hook.
+static thread_local uint64 GLuaInstructionCount = 0;
 
-    bool StartCycleCounter(FName StatName);
-    bool StartCycleCounter(TStatIdData const* StatIdPtr);
-    bool StopCycleCounter();
-    bool SetCycleCounter(FName StatName, const uint32 Cycles);
-    bool SetCycleCounter(TStatIdData const* StatIdPtr, const uint32 Cycles);
-    
-    bool StartSimpleSeconds(FName StatName);
-    bool StartSimpleSeconds(TStatIdData const* StatIdPtr);
-    bool StopSimpleSeconds(FName StatName);
-    bool StopSimpleSeconds(TStatIdData const* StatIdPtr);
-    
-    bool AddInt64Stat(FName StatName, int64 Value) const;
-    bool AddInt64Stat(TStatIdData const* StatIdPtr, int64 Value) const;
-    bool SubtractInt64Stat(FName StatName, int64 Value) const;
-    bool SubtractInt64Stat(TStatIdData const* StatIdPtr, int64 Value) const;
-    bool SetInt64Stat(FName StatName, int64 Value) const;
-    bool SetInt64Stat(TStatIdData const* StatIdPtr, int64 Value) const;
-    
-    bool AddMemoryStat(FName StatName, int64 Value) const;
-    bool AddMemoryStat(TStatIdData const* StatIdPtr, int64 Value) const;
-    bool SubtractMemoryStat(FName StatNam, int64 Value) const;
-    bool SubtractMemoryStat(TStatIdData const* StatIdPtr, int64 Value) const;
-    bool SetMemoryStat(FName StatName, int64 Value) const;
-    bool SetMemoryStat(TStatIdData const* StatIdPtr, int64 Value) const;
-    
-    bool AddDoubleStat(FName StatName, double Value) const;
-    bool AddDoubleStat(TStatIdData const* StatIdPtr, double Value) const;
-    bool SubtractDoubleStat(FName StatName, double Value) const;
-    bool SubtractDoubleStat(TStatIdData const* StatIdPtr, double Value) const;
-    bool SetDoubleStat(FName StatName, double Value) const;
-    bool SetDoubleStat(TStatIdData const* StatIdPtr, double Value) const;
-    
-    bool SetFNameStat(FName StatName, const char* Value) const;
-    bool SetFNameStat(TStatIdData const* StatIdPtr, const char* Value) const;
+struct FLuaCycleScope
+{
+    int32 Counter;
+    uint32 NestedScopes;
+    uint64 ChildCycles;
+    uint64 NativeCycles;
+    FLuaStatKey Key;
+    uint64 StartInstructions;
+    uint64 StartPerf[LuaPerfMaxEvents];
+    bool bStartPerf;
+    bool bRollsUp;
 };
 
-bool FLuaStats::AddInt64Stat(TStatIdData const* StatIdPtr, int64 Value) const
-{
-    const FName StatName = MinimalNameToName(StatIdPtr->Name);
-    if (Value != 0 && Int64Stats.Contains(StatName) && FThreadStats::IsCollectingData())
-    {
-        FThreadStats::AddMessage(StatName, EStatOperation::Add, Value);
-        TRACE_STAT_ADD(StatName, Value);
-        return true;
-    }
-    return false;
-}
+static constexpr int32 LuaTopKeyCapacity = 64;
 
-bool FLuaStats::AddInt64Stat(FName StatName, int64 Value) const
+struct FLuaTopKeyEntry
 {
-    if (Value != 0 && Int64Stats.Contains(StatName) && FThreadStats::IsCollectingData())
-    {
-        FThreadStats::AddMessage(StatName, EStatOperation::Add, Value);
-        TRACE_STAT_ADD(StatName, Value);
-        return true;
-    }
-    return false;
-}
+    FLuaStatKey Key;
+    double Weight;
+    double Error;
+    uint32 Calls;
+};
 
-bool FLuaStats::SubtractInt64Stat(FName StatName, int64 Value) const
+// Space-Saving summary of the keys that cost a stat the most this frame. At most LuaTopKeyCapacity keys are tracked
+// however many there are; a new key replaces the lightest and inherits its weight as error, so a key heavier than
+// 1/LuaTopKeyCapacity of the frame's total is never missed. Weights are not whole counts, so instead of the
+// stream-summary's buckets of equal counts the lightest entry is kept at the root of an indexed min-heap.
+struct FLuaTopKeys
 {
-    if (Value != 0 && Int64Stats.Contains(StatName) && FThreadStats::IsCollectingData())
+    TArray<FLuaTopKeyEntry> Entries;
+    TMap<uint64, int32> KeyToEntry;
+    // Entry indices, lightest first, and the position of every entry in it.
+    TArray<int32> Heap;
+    TArray<int32> HeapIndex;
+    // The previous frame's heaviest keys in stat units, as published.
+    TArray<FLuaTopKeyEntry> Last;
+    TArray<TStatIdData const*> RankStats;
+
+    void Add(const FLuaStatKey& Key, double Weight)
     {
-        FThreadStats::AddMessage(StatName, EStatOperation::Subtract, Value);
-        TRACE_STAT_ADD(StatName, -Value);
-        return true;
+        if (const int32* Found = KeyToEntry.Find(Key.Hash))
+        {
+            Entries[*Found].Weight += Weight;
+            ++Entries[*Found].Calls;
+            // Counters can be keyed with negative amounts too.
+            if (Weight < 0.0)
+            {
+                SiftUp(HeapIndex[*Found]);
+            }
+            else
+            {
+                SiftDown(HeapIndex[*Found]);
+            }
+            return;
+        }
+        if (Entries.Num() < LuaTopKeyCapacity)
+        {
+            const int32 Index = Entries.Add({ Key, Weight, 0.0, 1 });
+            KeyToEntry.Add(Key.Hash, Index);
+            HeapIndex.Add(Heap.Add(Index));
+            SiftUp(HeapIndex[Index]);
+            return;
+        }
+        const int32 Lightest = Heap[0];
+        FLuaTopKeyEntry& Replaced = Entries[Lightest];
+        KeyToEntry.Remove(Replaced.Key.Hash);
+        KeyToEntry.Add(Key.Hash, Lightest);
+        Replaced = { Key, Replaced.Weight + Weight, Replaced.Weight, 1 };
+        SiftDown(0);
     }
-    return false;
-}
 
-bool FLuaStats::SubtractInt64Stat(TStatIdData const* StatIdPtr, int64 Value) const
-{
-    const FName StatName = MinimalNameToName(StatIdPtr->Name);
-    if (Value != 0 && Int64Stats.Contains(StatName) && FThreadStats::IsCollectingData())
+    void Reset()
     {
-        FThreadStats::AddMessage(StatName, EStatOperation::Subtract, Value);
-        TRACE_STAT_ADD(StatName, -Value);
-        return true;
+        Entries.Reset();
+        KeyToEntry.Reset();
+        Heap.Reset();
+        HeapIndex.Reset();
     }
-    return false;
-}
 
-bool FLuaStats::SetInt64Stat(FName StatName, int64 Value) const
-{
-    if (Value != 0 && Int64Stats.Contains(StatName) && FThreadStats::IsCollectingData())
+private:
+    void SwapHeap(int32 A, int32 B)
     {
-        FThreadStats::AddMessage(StatName, EStatOperation::Set, Value);
-        TRACE_STAT_SET(StatName, Value);
-        return true;
+        Swap(Heap[A], Heap[B]);
+        HeapIndex[Heap[A]] = A;
+        HeapIndex[Heap[B]] = B;
     }
-    return false;
-}
 
-bool FLuaStats::SetInt64Stat(TStatIdData const* StatIdPtr, int64 Value) const
-{
-    const FName StatName = MinimalNameToName(StatIdPtr->Name);
-    if (Value != 0 && Int64Stats.Contains(StatName) && FThreadStats::IsCollectingData())
+    void SiftUp(int32 Position)
     {
-        FThreadStats::AddMessage(StatName, EStatOperation::Set, Value);
-        TRACE_STAT_SET(StatName, Value);
-        return true;
+        while (Position > 0)
+        {
+            const int32 Parent = (Position - 1) / 2;
+            if (Entries[Heap[Parent]].Weight <= Entries[Heap[Position]].Weight)
+            {
+                break;
+            }
+            SwapHeap(Parent, Position);
+            Position = Parent;
+        }
     }
-    return false;
-}
 
-bool FLuaStats::AddMemoryStat(FName StatName, int64 Value) const
-{
-    if (Value != 0 && MemoryStats.Contains(StatName) && FThreadStats::IsCollectingData())
+    void SiftDown(int32 Position)
     {
-        FThreadStats::AddMessage(StatName, EStatOperation::Add, Value);
-        TRACE_STAT_ADD(StatName, Value);
-        return true;
+        for (;;)
+        {
+            const int32 Left = 2 * Position + 1;
+            if (Left >= Heap.Num())
+            {
+                break;
+            }
+            const int32 Right = Left + 1;
+            const int32 Child = Right < Heap.Num() && Entries[Heap[Right]].Weight < Entries[Heap[Left]].Weight ? Right : Left;
+            if (Entries[Heap[Child]].Weight >= Entries[Heap[Position]].Weight)
+            {
+                break;
+            }
+            SwapHeap(Position, Child);
+            Position = Child;
+        }
     }
-    return false;
-}
+};
 
-bool FLuaStats::AddMemoryStat(TStatIdData const* StatIdPtr, int64 Value) const
+struct FLuaRollup
 {
-    const FName StatName = MinimalNameToName(StatIdPtr->Name);
-    if (Value != 0 && MemoryStats.Contains(StatName) && FThreadStats::IsCollectingData())
-    {
-        FThreadStats::AddMessage(StatName, EStatOperation::Add, Value);
-        TRACE_STAT_ADD(StatName, Value);
-        return true;
-    }
-    return false;
-}
+    FName Name;
+    int32 Module = INDEX_NONE;
+    uint64 FrameCycles = 0;
+    uint32 FrameCalls = 0;
+    double LastMs = 0.0;
+    uint32 LastCalls = 0;
+    TStatIdData const* CyclesStat = nullptr;
+    TStatIdData const* CallsStat = nullptr;
+};
 
-bool FLuaStats::SubtractMemoryStat(FName StatName, int64 Value) const
+// Maps a chunk name to a dotted script path: "@../Content/Script/UI/Menu/Main.lua" becomes "UI.Menu.Main".
+static FString LuaSourceToScriptPath(const char* Source)
 {
-    if (Value != 0 && MemoryStats.Contains(StatName) && FThreadStats::IsCollectingData())
+    if (Source == nullptr || (Source[0] != '@' && Source[0] != '='))
     {
-        FThreadStats::AddMessage(StatName, EStatOperation::Subtract, Value);
-        TRACE_STAT_ADD(StatName, -Value);
-        return true;
+        return TEXT("(string)");
     }
-    return false;
-}
-
-bool FLuaStats::SubtractMemoryStat(TStatIdData const* StatIdPtr, int64 Value) const
-{
-    const FName StatName = MinimalNameToName(StatIdPtr->Name);
-    if (Value != 0 && MemoryStats.Contains(StatName) && FThreadStats::IsCollectingData())
+    FString Path = UTF8_TO_TCHAR(Source + 1);
+    Path.ReplaceInline(TEXT("\\"), TEXT("/"));
+    Path.RemoveFromEnd(TEXT(".lua"));
+    Path = TEXT("/") + Path;
+    for (const TCHAR* Root : { TEXT("/Scripts/"), TEXT("/Script/") })
     {
-        FThreadStats::AddMessage(StatName, EStatOperation::Subtract, Value);
-        TRACE_STAT_ADD(StatName, -Value);
-        return true;
+        const int32 Found = Path.Find(Root, ESearchCase::IgnoreCase);
+        if (Found != INDEX_NONE)
+        {
+            Path = Path.RightChop(Found + FCString::Strlen(Root));
+            break;
+        }
     }
-    return false;
-}
-
-bool FLuaStats::SetMemoryStat(FName StatName, int64 Value) const
-{
-    if (Value != 0 && MemoryStats.Contains(StatName) && FThreadStats::IsCollectingData())
+    while (Path.RemoveFromStart(TEXT("./")) || Path.RemoveFromStart(TEXT("/")))
     {
-        FThreadStats::AddMessage(StatName, EStatOperation::Set, Value);
-        TRACE_STAT_SET(StatName, Value);
-        return true;
     }
-    return false;
+    Path.ReplaceInline(TEXT("/"), TEXT("."));
+    return Path;
 }
 
-bool FLuaStats::SetMemoryStat(TStatIdData const* StatIdPtr, int64 Value) const
+static FString LuaScriptPathToModule(const FString& ScriptPath, int32 Depth)
 {
-    const FName StatName = MinimalNameToName(StatIdPtr->Name);
-    if (Value != 0 && MemoryStats.Contains(StatName) && FThreadStats::IsCollectingData())
+    int32 End = 0;
+    for (int32 Component = 0; Component < FMath::Max(Depth, 1); ++Component)
     {
-        FThreadStats::AddMessage(StatName, EStatOperation::Set, Value);
-        TRACE_STAT_SET(StatName, Value);
-        return true;
+        const int32 Dot = ScriptPath.Find(TEXT("."), ESearchCase::CaseSensitive, ESearchDir::FromStart, End);
+        if (Dot == INDEX_NONE)
+        {
+            return ScriptPath;
+        }
+        End = Dot + 1;
     }
-    return false;
+    return ScriptPath.Left(End - 1);
 }
 
-bool FLuaStats::AddDoubleStat(FName StatName, double Value) const
+static constexpr int32 LuaAsyncSpanBuckets = 128;
+
+struct FLuaAsyncSpanStat
 {
-    if (Value != 0 && DoubleStats.Contains(StatName) && FThreadStats::IsCollectingData())
-    {
-        FThreadStats::AddMessage(StatName, EStatOperation::Add, Value);
-        TRACE_STAT_ADD(StatName, Value);
-        return true;
-    }
-    return false;
-}
+    TStatIdData const* InFlightStat = nullptr;
+    TStatIdData const* RateStat = nullptr;
+    TStatIdData const* P50Stat = nullptr;
+    TStatIdData const* P90Stat = nullptr;
+    TStatIdData const* P99Stat = nullptr;
+    TStatIdData const* ExpiredStat = nullptr;
+    int32 Definition = INDEX_NONE;
+    int32 InFlight = 0;
+    uint32 FrameExpired = 0;
+    // Latency histograms of the current and the previous window, four buckets per octave of microseconds.
+    uint32 Completed[2] = { 0, 0 };
+    uint32 Histogram[2][LuaAsyncSpanBuckets] = {};
+};
 
-bool FLuaStats::AddDoubleStat(TStatIdData const* StatIdPtr, double Value) const
+struct FLuaAsyncSpan
 {
-    const FName StatName = MinimalNameToName(StatIdPtr->Name);
-    if (Value != 0 && DoubleStats.Contains(StatName) && FThreadStats::IsCollectingData())
-    {
-        FThreadStats::AddMessage(StatName, EStatOperation::Add, Value);
-        TRACE_STAT_ADD(StatName, Value);
-        return true;
-    }
-    return false;
-}
+    uint64 StartCycles = 0;
+    int32 Stat = INDEX_NONE;
+    int32 NextFree = INDEX_NONE;
+    uint32 Generation = 1;
+};
 
-bool FLuaStats::SubtractDoubleStat(FName StatName, double Value) const
+// Publishes every stat's per-frame value into a POSIX shared-memory segment laid out as in LuaStatsSharedMemory.h.
+// All syscalls happen in Open and Close; a frame costs one memcpy plus copying the names of new stats.
+class FLuaStatsSharedMemory
 {
-    if (Value != 0 && DoubleStats.Contains(StatName) && FThreadStats::IsCollectingData())
+public:
+    ~FLuaStatsSharedMemory()
     {
-        FThreadStats::AddMessage(StatName, EStatOperation::Subtract, Value);
-        TRACE_STAT_ADD(StatName, -Value);
-        return true;
+        Close();
     }
-    return false;
-}
 
-bool FLuaStats::SubtractDoubleStat(TStatIdData const* StatIdPtr, double Value) const
-{
-    const FName StatName = MinimalNameToName(StatIdPtr->Name);
-    if (Value != 0 && DoubleStats.Contains(StatName) && FThreadStats::IsCollectingData())
+    bool IsOpen() const
     {
-        FThreadStats::AddMessage(StatName, EStatOperation::Subtract, Value);
-        TRACE_STAT_ADD(StatName, -Value);
-        return true;
+        return Header != nullptr;
     }
-    return false;
-}
 
-bool FLuaStats::SetDoubleStat(FName StatName, double Value) const
-{
-    if (Value != 0 && DoubleStats.Contains(StatName) && FThreadStats::IsCollectingData())
+    const FString& GetName() const
     {
-        FThreadStats::AddMessage(StatName, EStatOperation::Set, Value);
-        TRACE_STAT_SET(StatName, Value);
-        return true;
+        return Name;
     }
-    return false;
-}
 
-bool FLuaStats::SetDoubleStat(TStatIdData const* StatIdPtr, double Value) const
-{
-    const FName StatName = MinimalNameToName(StatIdPtr->Name);
-    if (Value != 0 && Int64Stats.Contains(StatName) && FThreadStats::IsCollectingData())
-    {
-        FThreadStats::AddMessage(StatName, EStatOperation::Set, Value);
-        TRACE_STAT_SET(StatName, Value);
+    bool Open(const FString& InName, uint32 Capacity)
+    {
+        Close();
+#if PLATFORM_LINUX || PLATFORM_MAC
+        // A segment left behind by a crashed run is replaced, not reused: readers still mapping it keep their copy.
+        FTCHARToUTF8 Utf8Name(*InName);
+        shm_unlink(Utf8Name.Get());
+        const int Fd = shm_open(Utf8Name.Get(), O_CREAT | O_EXCL | O_RDWR, 0644);
+        if (Fd < 0)
+        {
+            return false;
+        }
+        const uint64 SegmentSize = LuaStatsSharedMemory::GetSegmentSize(Capacity);
+        void* Segment = ftruncate(Fd, SegmentSize) == 0 ? mmap(nullptr, SegmentSize, PROT_READ | PROT_WRITE, MAP_SHARED, Fd, 0) : MAP_FAILED;
+        close(Fd);
+        if (Segment == MAP_FAILED)
+        {
+            shm_unlink(Utf8Name.Get());
+            return false;
+        }
+        LuaStatsSharedMemory::InitHeader(Segment, Capacity, FPlatformTime::GetSecondsPerCycle64() * 1000.0);
+        Header = static_cast<LuaStatsSharedMemory::FHeader*>(Segment);
+        Size = SegmentSize;
+        Name = InName;
+        NumNames = 0;
         return true;
+#else
+        return false;
+#endif
     }
-    return false;
-}
 
-bool FLuaStats::SetFNameStat(FName StatName, const char* Value) const
-{
-    if (Value != nullptr)
+    void Close()
     {
-        FThreadStats::AddMessage(StatName, EStatOperation::SpecialMessageMarker, FName(Value));
-        return true;
+#if PLATFORM_LINUX || PLATFORM_MAC
+        if (Header)
+        {
+            munmap(Header, Size);
+            shm_unlink(TCHAR_TO_UTF8(*Name));
+        }
+#endif
+        Header = nullptr;
+        Size = 0;
+        Name.Reset();
     }
-    return false;
-}
 
-bool FLuaStats::SetFNameStat(TStatIdData const* StatIdPtr, const char* Value) const
-{
-    const FName StatName = MinimalNameToName(StatIdPtr->Name);
-    if (Value != nullptr)
+    void Publish(const TArray<FLuaStatDefinition>& Definitions, const TArray<double>& Values)
     {
-        FThreadStats::AddMessage(StatName, EStatOperation::SpecialMessageMarker, FName(Value));
-        return true;
-    }
-    return false;
-}
+        // Stats beyond the capacity chosen at Open are not exported.
+        const uint32 Num = FMath::Min<uint32>(Definitions.Num(), Header->Capacity);
+        uint8* Types = LuaStatsSharedMemory::GetTypes(Header);
+        for (; NumNames < Num; ++NumNames)
+        {
+            FCStringAnsi::Strncpy(LuaStatsSharedMemory::GetName(Header, NumNames),
+                TCHAR_TO_UTF8(*Definitions[NumNames].Name.ToString()), LuaStatsSharedMemory::NameSize);
+            Types[NumNames] = static_cast<uint8>(Definitions[NumNames].Type);
+        }
 
-TStatId FLuaStats::CreateStatId(FName StatName, const TCHAR* StatDesc, bool bShouldClearEveryFrame,
-    EStatDataType::Type InStatType, bool bCycleStat, FPlatformMemory::EMemoryCounterRegion MemRegion)
-{
-    FStartupMessages::Get().AddMetadata(StatName, StatDesc,
-        FStatGroup_STATGROUP_Lua::GetGroupName(),
-        FStatGroup_STATGROUP_Lua::GetGroupCategory(),
-        FStatGroup_STATGROUP_Lua::GetDescription(), bShouldClearEveryFrame,
-        InStatType, bCycleStat, FStatGroup_STATGROUP_Lua::GetSortByName(), MemRegion);
+        LuaStatsSharedMemory::PublishValues(Header, Values.GetData(), Num, GFrameCounter, FPlatformTime::Seconds());
+    }
 
-    const TStatId StatID = IStatGroupEnableManager::Get().GetHighPerformanceEnableForStat(StatName,
-        FStatGroup_STATGROUP_Lua::GetGroupName(),
-        FStatGroup_STATGROUP_Lua::GetGroupCategory(),
-        FStatGroup_STATGROUP_Lua::IsDefaultEnabled(),
-        bShouldClearEveryFrame, InStatType,
-        StatDesc, bCycleStat,
-        FStatGroup_STATGROUP_Lua::GetSortByName(), MemRegion);
-    return StatID;
-}
+private:
+    LuaStatsSharedMemory::FHeader* Header = nullptr;
+    uint64 Size = 0;
+    FString Name;
+    uint32 NumNames = 0;
+};
 
-TStatIdData const* FLuaStats::CreateCycleCounter(FName StatName, const TCHAR* StatDesc)
+class FLuaStats
 {
-    if (NameToCycleCounter.Contains(StatName))
+private:
+    TSparseArray<FLuaCycleCounter> CycleCounters;
+    TMap<FName, int32> NameToCycleCounter;
+    TMap<TStatIdData const*, int32> PtrToCycleCounter;
+    TArray<FLuaCycleScope> CycleCounterStack;
+
+    TSparseArray<FLuaSimpleSecondsStat> SimpleSecondsStats;
+    TMap<FName, int32> NameToSecondsStat;
+    TMap<TStatIdData const*, int32> PtrToSecondsStat;
+
+    TMap<FName, FLuaValueStat> Int64Stats;
+    TMap<FName, FLuaValueStat> DoubleStats;
+    TMap<FName, FLuaValueStat> MemoryStats;
+    // Short name of every value stat by handle.
+    TMap<TStatIdData const*, FName> PtrToValueStat;
+
+    TArray<FLuaAsyncSpanStat> AsyncSpanStats;
+    TMap<FName, int32> NameToAsyncSpan;
+    TMap<TStatIdData const*, int32> PtrToAsyncSpan;
+    TArray<FLuaAsyncSpan> AsyncSpans;
+    int32 FirstFreeAsyncSpan = INDEX_NONE;
+    int32 ActiveAsyncSpans = 0;
+    double AsyncSpanWindowStart[2] = { 0.0, 0.0 };
+    double LastAsyncSpanExpiry = 0.0;
+
+    TArray<FLuaStatDefinition> Definitions;
+    TMap<FName, int32> NameToDefinition;
+    // Native mirror of each definition's current value, as the stats system would show it.
+    TArray<double> Values;
+    TArray<FLuaParentStat> Parents;
+    TMap<FName, int32> NameToParent;
+    TArray<int32> ParentedDefinitions;
+
+    TUniquePtr<FArchive> CsvCapture;
+    int32 CsvColumns = 0;
+    FLuaStatsSharedMemory SharedMemory;
+    FLuaStatsColumnarCapture ColumnarCapture;
+    FLuaStatsHistory History;
+    TMap<int32, FLuaTopKeys> TopKeys;
+    TMap<FName, FLuaNameStatValue> NameStatValues;
+    // FName of each Lua string an FName stat was set to. The strings are pinned in the registry, so a cached
+    // pointer cannot come back as a different string until the state closes, which clears the cache.
+    TMap<const char*, FName> NameStatLabels;
+    TMap<uint64, FString> StringKeyLabels;
+    // Every cycle counter is timed natively while something consumes all values, not only the parented ones.
+    bool bMeasureAllValues = false;
+    TMap<FName, ELuaStatType> PreregisteredStats;
+
+    TArray<int32> SampledCycleCounters;
+    TArray<int32> SampledSecondsStats;
+
+    bool bSubtractOverhead = false;
+    bool bOverheadCalibrated = false;
+    bool bCountInstructions = false;
+    FLuaPerfCounters PerfCounters;
+    bool bPerfCountersRequested = false;
+    uint64 ScopeOverheadCycles = 0;
+    TStatIdData const* ScopeOverheadStat = nullptr;
+
+    TArray<FLuaStatGroup> Groups;
+    TMap<FName, int32> NameToGroup;
+    int32 ActiveGroup = INDEX_NONE;
+
+    bool bRollups = false;
+    int32 RollupModuleDepth = 1;
+    TArray<FLuaRollup> RollupSources;
+    TMap<FName, int32> NameToRollupSource;
+    TArray<FLuaRollup> RollupModules;
+    TMap<FName, int32> NameToRollupModule;
+    TArray<int32> DirtyCycleCounters;
+    TArray<int32> DirtySecondsStats;
+    // Stats with cycles waiting for FlushPendingCycles.
+    TArray<int32> PendingCycleCounters;
+    TArray<int32> PendingSecondsStats;
+
+    TStatId CreateStatId(FName StatName, const TCHAR* StatDesc, bool bShouldClearEveryFrame,
+        EStatDataType::Type InStatType, bool bCycleStat,
+        FPlatformMemory::EMemoryCounterRegion MemRegion = FPlatformMemory::MCR_Invalid);
+
+    void StartCycleCounterInternal(int32 Index, lua_State* L, const FLuaStatKey* Key);
+    void SetCycleCounterInternal(int32 Index, const uint32 Cycles);
+    void StartSimpleSecondsInternal(int32 Index, lua_State* L, const FLuaStatKey* Key);
+    void StopSimpleSecondsInternal(int32 Index);
+    void AddPendingSecondsCycles(int32 Index, uint64 Cycles);
+    void FlushPendingCycles();
+
+    bool ClaimPreregistered(FName StatName, ELuaStatType Type);
+    int32 AddDefinition(FName StatName, const TCHAR* StatDesc, ELuaStatType Type, double Scale = 1.0);
+    int32 FindOrAddParent(FName ChildName, ELuaStatType Type);
+    void FlushParents();
+    void WriteCsvRow();
+    void UpdateMeasureAllValues();
+    void AddKeyedCost(int32 Definition, const FLuaStatKey& Key, double Weight);
+    bool SetFNameStatInternal(FName StatName, FName MessageName, const char* Value, lua_State* L, int32 ValueIndex);
+    void PinNameStatLabel(lua_State* L, int32 ValueIndex);
+    void FlushTopKeys();
+    int32 FindOrAddGroup(FName GroupName, const TCHAR* GroupDesc = nullptr, bool bDefaultEnabled = false);
+    TStatIdData const* CreateCompanionStat(ELuaStatType Type, FName ParentName, const TCHAR* Suffix);
+    void UpdateSampler(FLuaStatSampler& Sampler, TArray<int32>& NativeList, int32 Index, FName StatName, bool bForceNative);
+    void SetSubtractOverhead(bool bEnable);
+    void SetPerfCounters(bool bEnable);
+    int32 FindOrAddRollup(TArray<FLuaRollup>& Rollups, TMap<FName, int32>& NameToRollup, const FString& Name, const TCHAR* Prefix);
+    void CaptureRollupSource(FLuaRollupSlot& Slot, lua_State* L);
+    void AccumulateRollup(FLuaRollupSlot& Slot, TArray<int32>& DirtyList, int32 Index, uint64 SelfCycles);
+    void SetRollupModuleDepth(int32 Depth);
+    void FlushRollups();
+    void GrowAsyncSpanPool();
+    int64 BeginAsyncSpanInternal(int32 Index);
+    void FlushAsyncSpans();
+
+    static FORCEINLINE const FLuaValueStat* FindEnabledStat(const TMap<FName, FLuaValueStat>& Stats, FName StatName)
     {
-        return nullptr;
+        const FLuaValueStat* Found = Stats.Find(StatName);
+        return Found && TStatId(Found->StatId).IsValidStat() ? Found : nullptr;
     }
-    TStatId Result = CreateStatId(StatName, StatDesc, true, EStatDataType::ST_int64, true);
-    int32 Index = CycleCounters.Emplace(Result);
-    NameToCycleCounter.Emplace(StatName, Index);
-    PtrToCycleCounter.Emplace(Result.GetRawPointer(), Index);
-    return Result.GetRawPointer();
+
+    // Handles are resolved by pointer: TStatIdData::Name is the stats system's long encoded name, not the one
+    // the stat was created under.
+    FORCEINLINE const FLuaValueStat* FindValueStat(const TMap<FName, FLuaValueStat>& Stats, TStatIdData const* StatIdPtr) const
+    {
+        const FName* StatName = TStatId(StatIdPtr).IsValidStat() ? PtrToValueStat.Find(StatIdPtr) : nullptr;
+        return StatName ? Stats.Find(*StatName) : nullptr;
+    }
+
+    template <typename ValueType>
+    bool PublishValue(const FLuaValueStat* Stat, EStatOperation::Type Op, ValueType Value, const FLuaStatKey* Key)
+    {
+        if (Stat == nullptr)
+        {
+            return false;
+        }
+        UpdateValue(Stat->Definition, Op, static_cast<double>(Value));
+        if (Key)
+        {
+            AddKeyedCost(Stat->Definition, *Key, static_cast<double>(Value));
+        }
+        if (Value != 0 && FThreadStats::IsCollectingData())
+        {
+            // Stat messages carry the long name, as GET_STATFNAME would give.
+            const FName LongName = MinimalNameToName(Stat->StatId->Name);
+            FThreadStats::AddMessage(LongName, Op, Value);
+            if (Op == EStatOperation::Set)
+            {
+                TRACE_STAT_SET(LongName, Value);
+            }
+            else
+            {
+                TRACE_STAT_ADD(LongName, Op == EStatOperation::Subtract ? -Value : Value);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    FORCEINLINE void UpdateValue(int32 Definition, EStatOperation::Type Op, double Value)
+    {
+        double& Current = Values[Definition];
+        Current = Op == EStatOperation::Set ? Value : Op == EStatOperation::Add ? Current + Value : Current - Value;
+    }
+public:
+
+    TStatIdData const* CreateCycleCounter(FName StatName, const TCHAR* StatDesc = nullptr);
+    TStatIdData const* CreateSimpleSeconds(FName StatName, const TCHAR* StatDesc = nullptr, double InScale = 1.0);
+    TStatIdData const* CreateInt64Counter(FName StatName, const TCHAR* StatDesc = nullptr);
+    TStatIdData const* CreateInt64Accumulator(FName StatName, const TCHAR* StatDesc = nullptr);
+    TStatIdData const* CreateDoubleCounter(FName StatName, const TCHAR* StatDesc = nullptr);
+    TStatIdData const* CreateDoubleAccumulator(FName StatName, const TCHAR* StatDesc = nullptr);
+    TStatIdData const* CreateMemoryStat(FName StatName, const TCHAR* StatDesc = nullptr);
+    TStatIdData const* CreateAsyncSpan(FName StatName, const TCHAR* StatDesc = nullptr);
+    TStatIdData const* CreateStat(ELuaStatType Type, FName StatName, const TCHAR* StatDesc = nullptr, double InScale = 1.0);
+    TStatIdData const* ResolveStat(ELuaStatType Type, FName StatName) const;
+    FName GetStatName(TStatIdData const* StatIdPtr) const;
+
+    // What a parent such as "AI@Sum" reported in the last flush, 0 for an unknown name.
+    double GetParentValue(FName ParentName) const
+    {
+        const int32* Found = NameToParent.Find(ParentName);
+        return Found ? Parents[*Found].LastValue : 0.0;
+    }
+
+    void ReserveStats(const FLuaStatTypeCounts& Counts);
+
+    FName SetActiveGroup(FName GroupName, const TCHAR* GroupDesc = nullptr, bool bDefaultEnabled = false);
+    bool EnableGroup(FName GroupName, bool bEnable);
+
+    static FString GetDefaultManifestPath();
+    int32 LoadManifest(const FString& Path);
+    bool SaveManifest(const FString& Path) const;
+
+    bool StartCycleCounter(FName StatName, lua_State* L = nullptr, const FLuaStatKey* Key = nullptr);
+    bool StartCycleCounter(TStatIdData const* StatIdPtr, lua_State* L = nullptr, const FLuaStatKey* Key = nullptr);
+    bool StopCycleCounter();
+    bool SetCycleCounter(FName StatName, const uint32 Cycles);
+    bool SetCycleCounter(TStatIdData const* StatIdPtr, const uint32 Cycles);
+    bool SetCycleCounterSampleRate(FName StatName, uint32 SampleRate, bool bRandom);
+    bool SetCycleCounterSampleRate(TStatIdData const* StatIdPtr, uint32 SampleRate, bool bRandom);
+    
+    bool StartSimpleSeconds(FName StatName, lua_State* L = nullptr, const FLuaStatKey* Key = nullptr);
+    bool StartSimpleSeconds(TStatIdData const* StatIdPtr, lua_State* L = nullptr, const FLuaStatKey* Key = nullptr);
+    bool StopSimpleSeconds(FName StatName);
+    bool StopSimpleSeconds(TStatIdData const* StatIdPtr);
+    bool SetSimpleSecondsSampleRate(FName StatName, uint32 SampleRate, bool bRandom);
+    bool SetSimpleSecondsSampleRate(TStatIdData const* StatIdPtr, uint32 SampleRate, bool bRandom);
+    bool RecordSpan(TStatIdData const* StatIdPtr, uint64 Cycles);
+    
+    bool AddInt64Stat(FName StatName, int64 Value, const FLuaStatKey* Key = nullptr);
+    bool AddInt64Stat(TStatIdData const* StatIdPtr, int64 Value, const FLuaStatKey* Key = nullptr);
+    bool SubtractInt64Stat(FName StatName, int64 Value);
+    bool SubtractInt64Stat(TStatIdData const* StatIdPtr, int64 Value);
+    bool SetInt64Stat(FName StatName, int64 Value);
+    bool SetInt64Stat(TStatIdData const* StatIdPtr, int64 Value);
+    
+    bool AddMemoryStat(FName StatName, int64 Value);
+    bool AddMemoryStat(TStatIdData const* StatIdPtr, int64 Value);
+    bool SubtractMemoryStat(FName StatNam, int64 Value);
+    bool SubtractMemoryStat(TStatIdData const* StatIdPtr, int64 Value);
+    bool SetMemoryStat(FName StatName, int64 Value);
+    bool SetMemoryStat(TStatIdData const* StatIdPtr, int64 Value);
+    
+    bool AddDoubleStat(FName StatName, double Value, const FLuaStatKey* Key = nullptr);
+    bool AddDoubleStat(TStatIdData const* StatIdPtr, double Value, const FLuaStatKey* Key = nullptr);
+    bool SubtractDoubleStat(FName StatName, double Value);
+    bool SubtractDoubleStat(TStatIdData const* StatIdPtr, double Value);
+    bool SetDoubleStat(FName StatName, double Value);
+    bool SetDoubleStat(TStatIdData const* StatIdPtr, double Value);
+    
+    bool SetFNameStat(FName StatName, const char* Value, lua_State* L = nullptr, int32 ValueIndex = 0);
+    bool SetFNameStat(TStatIdData const* StatIdPtr, const char* Value, lua_State* L = nullptr, int32 ValueIndex = 0);
+    // Drops the labels cached by Lua string pointer, e.g. because the state they were pinned in is closing.
+    void ForgetNameStatLabels();
+
+    bool ReadStatKey(lua_State* L, int32 Index, FLuaStatKey& OutKey);
+    FString GetKeyLabel(const FLuaStatKey& Key) const;
+    const TArray<FLuaTopKeyEntry>* GetTopKeys(FName StatName) const;
+    void LogTopKeys(const FString& Filter) const;
+
+    int64 BeginAsyncSpan(FName StatName);
+    int64 BeginAsyncSpan(TStatIdData const* StatIdPtr);
+    bool EndAsyncSpan(int64 SpanId, double& OutSeconds);
+
+    TStatIdData const* GetCalibrationCounter();
+    void SetCalibratedScopeOverhead(uint64 Cycles);
+    double GetScopeOverheadNs() const;
+
+    // Calibration can run from inside an open scope; its scopes must not count as that scope's children.
+    TArray<FLuaCycleScope> SuspendCycleScopes()
+    {
+        return MoveTemp(CycleCounterStack);
+    }
+
+    void ResumeCycleScopes(TArray<FLuaCycleScope>&& Scopes)
+    {
+        CycleCounterStack = MoveTemp(Scopes);
+    }
+
+    TStatIdData const* CreateInternalStat(FName GroupName, const TCHAR* GroupDesc, const FString& StatName, bool bCycleStat);
+    TStatIdData const* CreateInstructionStat(const FString& StatName);
+
+    void SetCountInstructions(bool bEnable)
+    {
+        bCountInstructions = bEnable;
+    }
+
+    void AddNativeCycles(uint64 Cycles)
+    {
+        if (CycleCounterStack.Num() > 0)
+        {
+            CycleCounterStack.Last().NativeCycles += Cycles;
+        }
+    }
+
+    const TArray<FLuaRollup>& GetRollups(bool bModules) const
+    {
+        return bModules ? RollupModules : RollupSources;
+    }
+
+    bool StartCsvCapture(const FString& Path);
+    void StopCsvCapture();
+    bool StartSharedMemory(const FString& Name, int32 Capacity);
+    void StopSharedMemory();
+    bool StartColumnarCapture(const FString& Path);
+    void StopColumnarCapture();
+
+    static FString GetDefaultHistoryPath();
+    bool GetHistory(FName StatName, double Seconds, TArray<double>& OutSecondsAgo, TArray<double>& OutValues) const;
+    bool DumpHistory(const FString& Path, double Seconds, double EndSecondsAgo, const FString& Filter) const;
+
+    void Flush();
+};
+
+bool FLuaStats::AddInt64Stat(FName StatName, int64 Value, const FLuaStatKey* Key)
+{
+    return PublishValue(FindEnabledStat(Int64Stats, StatName), EStatOperation::Add, Value, Key);
 }
 
-void FLuaStats::StartCycleCounterInternal(int32 Index)
+bool FLuaStats::AddInt64Stat(TStatIdData const* StatIdPtr, int64 Value, const FLuaStatKey* Key)
 {
-    check(CycleCounters.IsValidIndex(Index));
-    CycleCounterStack.Push(Index);
-    CycleCounters[Index].Start();
+    return PublishValue(FindValueStat(Int64Stats, StatIdPtr), EStatOperation::Add, Value, Key);
 }
 
-void FLuaStats::SetCycleCounterInternal(int32 Index, const uint32 Cycles)
+bool FLuaStats::SubtractInt64Stat(FName StatName, int64 Value)
 {
-    check(CycleCounters.IsValidIndex(Index));
-    CycleCounters[Index].Set(Cycles);
+    return PublishValue(FindEnabledStat(Int64Stats, StatName), EStatOperation::Subtract, Value, nullptr);
 }
 
-bool FLuaStats::StartCycleCounter(FName StatName)
+bool FLuaStats::SubtractInt64Stat(TStatIdData const* StatIdPtr, int64 Value)
 {
-    if (const auto Result = NameToCycleCounter.Find(StatName))
-    {
-        StartCycleCounterInternal(*Result);
-        return true;
-    }
-    return false;
+    return PublishValue(FindValueStat(Int64Stats, StatIdPtr), EStatOperation::Subtract, Value, nullptr);
 }
 
-bool FLuaStats::StartCycleCounter(TStatIdData const* StatIdPtr)
+bool FLuaStats::SetInt64Stat(FName StatName, int64 Value)
 {
-    if (const auto Result = PtrToCycleCounter.Find(StatIdPtr))
-    {
-        StartCycleCounterInternal(*Result);
-        return true;
-    }
-    return false;
+    return PublishValue(FindEnabledStat(Int64Stats, StatName), EStatOperation::Set, Value, nullptr);
 }
 
-bool FLuaStats::StopCycleCounter()
+bool FLuaStats::SetInt64Stat(TStatIdData const* StatIdPtr, int64 Value)
 {
-    if (CycleCounterStack.Num() == 0)
-    {
-        return false;
-    }
-    const auto Index = CycleCounterStack.Pop();
-    check(CycleCounters.IsValidIndex(Index));
-    CycleCounters[Index].Stop();
-    return true;
+    return PublishValue(FindValueStat(Int64Stats, StatIdPtr), EStatOperation::Set, Value, nullptr);
 }
 
-bool FLuaStats::SetCycleCounter(FName StatName, const uint32 Cycles)
+bool FLuaStats::AddMemoryStat(FName StatName, int64 Value)
 {
-    if (const auto Result = NameToCycleCounter.Find(StatName))
-    {
-        SetCycleCounterInternal(*Result, Cycles);
-        return true;
-    }
-    return false;
+    return PublishValue(FindEnabledStat(MemoryStats, StatName), EStatOperation::Add, Value, nullptr);
 }
 
-bool FLuaStats::SetCycleCounter(TStatIdData const* StatIdPtr, const uint32 Cycles)
+bool FLuaStats::AddMemoryStat(TStatIdData const* StatIdPtr, int64 Value)
 {
-    if (const auto Result = PtrToCycleCounter.Find(StatIdPtr))
-    {
-        SetCycleCounterInternal(*Result, Cycles);
-        return true;
-    }
-    return false;
+    return PublishValue(FindValueStat(MemoryStats, StatIdPtr), EStatOperation::Add, Value, nullptr);
 }
 
-TStatIdData const* FLuaStats::CreateSimpleSeconds(FName StatName, const TCHAR* StatDesc, double InScale)
+bool FLuaStats::SubtractMemoryStat(FName StatName, int64 Value)
 {
-    if (NameToSecondsStat.Contains(StatName))
-    {
-        return nullptr;
-    }
-    const TStatId StatId = CreateDoubleAccumulator(StatName, StatDesc);
-    auto Index = SimpleSecondsStats.Emplace(StatId, InScale);
-    NameToSecondsStat.Emplace(StatName, Index);
-    PtrToSecondsStat.Emplace(StatId.GetRawPointer(), Index);
-    return StatId.GetRawPointer();
+    return PublishValue(FindEnabledStat(MemoryStats, StatName), EStatOperation::Subtract, Value, nullptr);
 }
 
-void FLuaStats::StartSimpleSecondsInternal(int32 Index)
+bool FLuaStats::SubtractMemoryStat(TStatIdData const* StatIdPtr, int64 Value)
 {
-    check(SimpleSecondsStats.IsValidIndex(Index));
-    SimpleSecondsStats[Index].Start();
+    return PublishValue(FindValueStat(MemoryStats, StatIdPtr), EStatOperation::Subtract, Value, nullptr);
 }
 
-void FLuaStats::StopSimpleSecondsInternal(int32 Index)
+bool FLuaStats::SetMemoryStat(FName StatName, int64 Value)
 {
-    check(SimpleSecondsStats.IsValidIndex(Index));
-    SimpleSecondsStats[Index].Stop();
+    return PublishValue(FindEnabledStat(MemoryStats, StatName), EStatOperation::Set, Value, nullptr);
 }
 
-bool FLuaStats::StartSimpleSeconds(FName StatName)
+bool FLuaStats::SetMemoryStat(TStatIdData const* StatIdPtr, int64 Value)
 {
-    if (const auto Result = NameToSecondsStat.Find(StatName))
-    {
-        StartSimpleSecondsInternal(*Result);
-        return true;
-    }
-    return false;
+    return PublishValue(FindValueStat(MemoryStats, StatIdPtr), EStatOperation::Set, Value, nullptr);
 }
 
-bool FLuaStats::StartSimpleSeconds(TStatIdData const* StatIdPtr)
+bool FLuaStats::AddDoubleStat(FName StatName, double Value, const FLuaStatKey* Key)
 {
-    if (const auto Result = PtrToSecondsStat.Find(StatIdPtr))
-    {
-        StartSimpleSecondsInternal(*Result);
-        return true;
-    }
-    return false;
+    return PublishValue(FindEnabledStat(DoubleStats, StatName), EStatOperation::Add, Value, Key);
 }
 
-bool FLuaStats::StopSimpleSeconds(FName StatName)
+bool FLuaStats::AddDoubleStat(TStatIdData const* StatIdPtr, double Value, const FLuaStatKey* Key)
 {
-    if (const auto Result = NameToSecondsStat.Find(StatName))
+    return PublishValue(FindValueStat(DoubleStats, StatIdPtr), EStatOperation::Add, Value, Key);
+}
+
+bool FLuaStats::SubtractDoubleStat(FName StatName, double Value)
+{
+    return PublishValue(FindEnabledStat(DoubleStats, StatName), EStatOperation::Subtract, Value, nullptr);
+}
+
+bool FLuaStats::SubtractDoubleStat(TStatIdData const* StatIdPtr, double Value)
+{
+    return PublishValue(FindValueStat(DoubleStats, StatIdPtr), EStatOperation::Subtract, Value, nullptr);
+}
+
+bool FLuaStats::SetDoubleStat(FName StatName, double Value)
+{
+    return PublishValue(FindEnabledStat(DoubleStats, StatName), EStatOperation::Set, Value, nullptr);
+}
+
+bool FLuaStats::SetDoubleStat(TStatIdData const* StatIdPtr, double Value)
+{
+    return PublishValue(FindValueStat(DoubleStats, StatIdPtr), EStatOperation::Set, Value, nullptr);
+}
+
+bool FLuaStats::SetFNameStat(FName StatName, const char* Value, lua_State* L, int32 ValueIndex)
+{
+    return Value != nullptr && SetFNameStatInternal(StatName, StatName, Value, L, ValueIndex);
+}
+
+bool FLuaStats::SetFNameStat(TStatIdData const* StatIdPtr, const char* Value, lua_State* L, int32 ValueIndex)
+{
+    if (!TStatId(StatIdPtr).IsValidStat())
     {
-        StopSimpleSecondsInternal(*Result);
-        return true;
+        return false;
     }
-    return false;
+    // Tracked and captured under the name the stat was created with, as on the name path; the stats system gets
+    // the long name the handle carries.
+    const FName LongName = MinimalNameToName(StatIdPtr->Name);
+    const FName StatName = GetStatName(StatIdPtr);
+    return Value != nullptr && SetFNameStatInternal(StatName.IsNone() ? LongName : StatName, LongName, Value, L, ValueIndex);
 }
 
-bool FLuaStats::StopSimpleSeconds(TStatIdData const* StatIdPtr)
+bool FLuaStats::SetFNameStatInternal(FName StatName, FName MessageName, const char* Value, lua_State* L, int32 ValueIndex)
 {
-    if (const auto Result = PtrToSecondsStat.Find(StatIdPtr))
+    // With L, Value is the Lua string at ValueIndex: the same label set again is the same pointer.
+    FLuaNameStatValue& Last = NameStatValues.FindOrAdd(StatName);
+    if (L && Value == Last.LuaValue)
     {
-        StopSimpleSecondsInternal(*Result);
         return true;
     }
-    return false;
+    FName NewValue;
+    if (const FName* Cached = L ? NameStatLabels.Find(Value) : nullptr)
+    {
+        NewValue = *Cached;
+    }
+    else
+    {
+        NewValue = FName(Value);
+        if (L)
+        {
+            PinNameStatLabel(L, ValueIndex);
+            NameStatLabels.Add(Value, NewValue);
+        }
+    }
+    Last.LuaValue = L ? Value : nullptr;
+    if (Last.bSet && NewValue == Last.Value)
+    {
+        return true;
+    }
+    Last.Value = NewValue;
+    Last.bSet = true;
+    FThreadStats::AddMessage(MessageName, EStatOperation::SpecialMessageMarker, NewValue);
+    if (ColumnarCapture.IsOpen())
+    {
+        ColumnarCapture.AddEvent(StatName, NewValue);
+    }
+    return true;
 }
 
-TStatIdData const* FLuaStats::CreateInt64Counter(FName StatName, const TCHAR* StatDesc)
+void FLuaStats::ForgetNameStatLabels()
 {
-    if (Int64Stats.Contains(StatName))
+    NameStatLabels.Reset();
+    for (TPair<FName, FLuaNameStatValue>& Pair : NameStatValues)
     {
-        return nullptr;
+        Pair.Value.LuaValue = nullptr;
     }
-    const TStatId StatId = CreateStatId(StatName, StatDesc, true, EStatDataType::ST_int64, false);
-    Int64Stats.Emplace(StatName, StatId.GetRawPointer());
-    return StatId.GetRawPointer();
 }
 
-TStatIdData const* FLuaStats::CreateInt64Accumulator(FName StatName, const TCHAR* StatDesc)
+void FLuaStats::PinNameStatLabel(lua_State* L, int32 ValueIndex)
 {
-    if (Int64Stats.Contains(StatName))
+    // Labels are few in practice; a script formatting a new string per set only gets its cache rebuilt.
+    if (NameStatLabels.Num() >= LuaNameStatMaxLabels)
     {
-        return nullptr;
+        ForgetNameStatLabels();
+        lua_pushnil(L);
+        lua_setfield(L, LUA_REGISTRYINDEX, LuaNameStatLabelsKey);
     }
-    const TStatId StatId = CreateStatId(StatName, StatDesc, false, EStatDataType::ST_int64, false);
-    Int64Stats.Emplace(StatName, StatId.GetRawPointer());
-    return StatId.GetRawPointer();
+    if (lua_getfield(L, LUA_REGISTRYINDEX, LuaNameStatLabelsKey) != LUA_TTABLE)
+    {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, LUA_REGISTRYINDEX, LuaNameStatLabelsKey);
+        // The pointers cached from this state dangle once it is closed.
+        WatchLuaStateClose(L);
+    }
+    lua_pushvalue(L, ValueIndex);
+    lua_pushboolean(L, 1);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
 }
 
-TStatIdData const* FLuaStats::CreateDoubleCounter(FName StatName, const TCHAR* StatDesc)
+TStatId FLuaStats::CreateStatId(FName StatName, const TCHAR* StatDesc, bool bShouldClearEveryFrame,
+    EStatDataType::Type InStatType, bool bCycleStat, FPlatformMemory::EMemoryCounterRegion MemRegion)
 {
-    if (DoubleStats.Contains(StatName))
+    const char* GroupName = FStatGroup_STATGROUP_Lua::GetGroupName();
+    const TCHAR* GroupDesc = FStatGroup_STATGROUP_Lua::GetDescription();
+    bool bDefaultEnabled = FStatGroup_STATGROUP_Lua::IsDefaultEnabled();
+    if (Groups.IsValidIndex(ActiveGroup))
     {
-        return nullptr;
+        GroupName = Groups[ActiveGroup].GroupNameAnsi.GetData();
+        GroupDesc = *Groups[ActiveGroup].Desc;
+        bDefaultEnabled = Groups[ActiveGroup].bDefaultEnabled;
     }
-    const TStatId StatId = CreateStatId(StatName, StatDesc, true, EStatDataType::ST_double, false);
-    DoubleStats.Emplace(StatName, StatId.GetRawPointer());
-    return StatId.GetRawPointer();
+
+    FStartupMessages::Get().AddMetadata(StatName, StatDesc,
+        GroupName,
+        FStatGroup_STATGROUP_Lua::GetGroupCategory(),
+        GroupDesc, bShouldClearEveryFrame,
+        InStatType, bCycleStat, FStatGroup_STATGROUP_Lua::GetSortByName(), MemRegion);
+
+    const TStatId StatID = IStatGroupEnableManager::Get().GetHighPerformanceEnableForStat(StatName,
+        GroupName,
+        FStatGroup_STATGROUP_Lua::GetGroupCategory(),
+        bDefaultEnabled,
+        bShouldClearEveryFrame, InStatType,
+        StatDesc, bCycleStat,
+        FStatGroup_STATGROUP_Lua::GetSortByName(), MemRegion);
+    return StatID;
 }
 
-TStatIdData const* FLuaStats::CreateDoubleAccumulator(FName StatName, const TCHAR* StatDesc)
+int32 FLuaStats::FindOrAddGroup(FName GroupName, const TCHAR* GroupDesc, bool bDefaultEnabled)
 {
-    if (DoubleStats.Contains(StatName))
+    if (GroupName.IsNone())
     {
-        return nullptr;
+        return INDEX_NONE;
     }
-    const TStatId StatId = CreateStatId(StatName, StatDesc, false, EStatDataType::ST_double, false);
-    DoubleStats.Emplace(StatName, StatId.GetRawPointer());
-    return StatId.GetRawPointer();
+    if (const int32* Found = NameToGroup.Find(GroupName))
+    {
+        return *Found;
+    }
+
+    // Lua groups live next to STATGROUP_Lua, so "stat LuaAI" toggles only the stats created under Group("AI").
+    // They start disabled unless asked otherwise: until enabled their stats resolve to the disabled TStatId.
+    FLuaStatGroup Group;
+    Group.Name = GroupName;
+    const FString FullName = FString(TEXT("STATGROUP_Lua")) + GroupName.ToString();
+    Group.GroupName = FName(*FullName);
+    const auto AnsiName = StringCast<ANSICHAR>(*FullName);
+    Group.GroupNameAnsi.Append(AnsiName.Get(), AnsiName.Length() + 1);
+    Group.Desc = GroupDesc ? FString(GroupDesc) : FString(TEXT("Lua")) + GroupName.ToString();
+    Group.bDefaultEnabled = bDefaultEnabled;
+    const int32 Index = Groups.Add(MoveTemp(Group));
+    NameToGroup.Emplace(GroupName, Index);
+    return Index;
 }
 
-TStatIdData const* FLuaStats::CreateMemoryStat(FName StatName, const TCHAR* StatDesc)
+FName FLuaStats::SetActiveGroup(FName GroupName, const TCHAR* GroupDesc, bool bDefaultEnabled)
 {
-    if (MemoryStats.Contains(StatName))
+    const FName Previous = Groups.IsValidIndex(ActiveGroup) ? Groups[ActiveGroup].Name : FName();
+    ActiveGroup = FindOrAddGroup(GroupName, GroupDesc, bDefaultEnabled);
+    return Previous;
+}
+
+bool FLuaStats::EnableGroup(FName GroupName, bool bEnable)
+{
+    FName StatGroupName = FStatGroup_STATGROUP_Lua::GetGroupName();
+    if (!GroupName.IsNone())
     {
-        return nullptr;
+        const int32* Found = NameToGroup.Find(GroupName);
+        if (Found == nullptr)
+        {
+            return false;
+        }
+        StatGroupName = Groups[*Found].GroupName;
     }
-    const TStatId StatId = CreateStatId(StatName, StatDesc, false, EStatDataType::ST_int64, false,
-        FPlatformMemory::MCR_Physical);
-    MemoryStats.Emplace(StatName, StatId.GetRawPointer());
-    return StatId.GetRawPointer();
+    IStatGroupEnableManager::Get().SetHighPerformanceEnableForGroup(StatGroupName, bEnable);
+    return true;
 }
 
-FLuaStats GLuaStats;
-
-int32 CycleCounter_Create(lua_State* L)
+TStatIdData const* FLuaStats::CreateCycleCounter(FName StatName, const TCHAR* StatDesc)
 {
-    const int32 ParamNum = lua_gettop(L);
-    if (ParamNum <= 0 || ParamNum > 2)
+    if (const auto Existing = NameToCycleCounter.Find(StatName))
     {
-        lua_pushnil(L);
-        return 1;
+        return ClaimPreregistered(StatName, ELuaStatType::CycleCounter) ? CycleCounters[*Existing].GetStatId().GetRawPointer() : nullptr;
     }
-    if (!lua_isstring(L, 1))
+    if (NameToParent.Contains(StatName))
     {
-        lua_pushnil(L);
-        return 1;
+        return nullptr;
+    }
+    TStatId Result = CreateStatId(StatName, StatDesc, true, EStatDataType::ST_int64, true);
+    int32 Index = CycleCounters.Emplace(Result);
+    NameToCycleCounter.Emplace(StatName, Index);
+    PtrToCycleCounter.Emplace(Result.GetRawPointer(), Index);
+    FLuaCycleCounter& Counter = CycleCounters[Index];
+    Counter.Definition = AddDefinition(StatName, StatDesc, ELuaStatType::CycleCounter);
+    // Parents need this counter's cycles, which the engine's scope path does not hand back.
+    Counter.bMeasureValue = Definitions[Counter.Definition].Parent != INDEX_NONE;
+    if (bSubtractOverhead)
+    {
+        UpdateSampler(CycleCounters[Index].Sampler, SampledCycleCounters, Index, StatName, true);
+    }
+    return Result.GetRawPointer();
+}
+
+void FLuaStats::StartCycleCounterInternal(int32 Index, lua_State* L, const FLuaStatKey* Key)
+{
+    check(CycleCounters.IsValidIndex(Index));
+    FLuaCycleCounter& Counter = CycleCounters[Index];
+    if (bRollups && Counter.Rollup.Source == INDEX_NONE)
+    {
+        CaptureRollupSource(Counter.Rollup, L);
+    }
+    // An enclosing scope that reports self time subtracts this one's cycles, so they are needed even when the
+    // sampler skips this call; an untimed child would leave its whole cost in the parent.
+    const bool bParentNeedsSelfTime = bRollups && CycleCounterStack.Num() > 0
+        && CycleCounters[CycleCounterStack.Last().Counter].Rollup.Source != INDEX_NONE;
+    // Counted in each parent it rolls up into, so that a scope closing inside another one under the same parent
+    // is not summed twice there. A counter already running, e.g. on recursion, is counted by its first scope.
+    const bool bRollsUp = Definitions[Counter.Definition].Parent != INDEX_NONE && !Counter.IsStarted();
+    if (bRollsUp)
+    {
+        for (int32 Parent = Definitions[Counter.Definition].Parent; Parent != INDEX_NONE; Parent = Parents[Parent].Parent)
+        {
+            ++Parents[Parent].ActiveScopes;
+        }
+    }
+    CycleCounterStack.Push({ Index, 0, 0, 0, Key ? *Key : FLuaStatKey(), GLuaInstructionCount, {}, false, bRollsUp });
+    if (PerfCounters.IsOpen())
+    {
+        FLuaCycleScope& Scope = CycleCounterStack.Last();
+        Scope.bStartPerf = PerfCounters.Read(Scope.StartPerf);
+    }
+    Counter.Start(Counter.bMeasureValue || bMeasureAllValues || Key != nullptr || bParentNeedsSelfTime
+        || (bRollups && Counter.Rollup.Source != INDEX_NONE));
+}
+
+void FLuaStats::SetCycleCounterInternal(int32 Index, const uint32 Cycles)
+{
+    check(CycleCounters.IsValidIndex(Index));
+    FLuaCycleCounter& Counter = CycleCounters[Index];
+    if (Counter.GetStatId().IsValidStat())
+    {
+        Counter.Set(Cycles);
+        Values[Counter.Definition] = Cycles;
+    }
+}
+
+bool FLuaStats::StartCycleCounter(FName StatName, lua_State* L, const FLuaStatKey* Key)
+{
+    if (const auto Result = NameToCycleCounter.Find(StatName))
+    {
+        StartCycleCounterInternal(*Result, L, Key);
+        return true;
+    }
+    return false;
+}
+
+bool FLuaStats::StartCycleCounter(TStatIdData const* StatIdPtr, lua_State* L, const FLuaStatKey* Key)
+{
+    if (const auto Result = PtrToCycleCounter.Find(StatIdPtr))
+    {
+        StartCycleCounterInternal(*Result, L, Key);
+        return true;
+    }
+    return false;
+}
+
+bool FLuaStats::StopCycleCounter()
+{
+    if (CycleCounterStack.Num() == 0)
+    {
+        return false;
+    }
+    const FLuaCycleScope Scope = CycleCounterStack.Pop();
+    check(CycleCounters.IsValidIndex(Scope.Counter));
+    FLuaCycleCounter& Counter = CycleCounters[Scope.Counter];
+    // Every scope opened inside this one cost a Start/Stop binding round trip that landed in our time.
+    const uint64 Elapsed = Counter.Stop(Scope.NestedScopes * ScopeOverheadCycles);
+    uint64 StopPerf[LuaPerfMaxEvents] = {};
+    if (PerfCounters.IsOpen() && Scope.bStartPerf && Counter.GetStatId().IsValidStat() && PerfCounters.Read(StopPerf))
+    {
+        for (int32 Event = 0; Event < PerfCounters.GetNumEvents(); ++Event)
+        {
+            if (Counter.PerfStats[Event] == nullptr)
+            {
+                Counter.PerfStats[Event] = CreateCompanionStat(ELuaStatType::Int64Counter, Definitions[Counter.Definition].Name, PerfCounters.GetSuffix(Event));
+            }
+            AddInt64Stat(Counter.PerfStats[Event], static_cast<int64>(StopPerf[Event] - Scope.StartPerf[Event]));
+        }
+    }
+    if (!Counter.Sampler.bNativeTiming)
+    {
+        Values[Counter.Definition] += Elapsed;
+    }
+    if (Scope.bRollsUp)
+    {
+        // The lowest parent an enclosing open scope also rolls up into has these cycles in that scope's time
+        // already. They are taken out there, and the parents above get the corrected sum.
+        bool bNested = false;
+        for (int32 Parent = Definitions[Counter.Definition].Parent; Parent != INDEX_NONE; Parent = Parents[Parent].Parent)
+        {
+            FLuaParentStat& ParentStat = Parents[Parent];
+            --ParentStat.ActiveScopes;
+            if (!bNested && ParentStat.ActiveScopes > 0)
+            {
+                ParentStat.NestedCycles += Elapsed;
+                bNested = true;
+            }
+        }
+    }
+    if (Counter.Rollup.Source != INDEX_NONE && bRollups)
+    {
+        AccumulateRollup(Counter.Rollup, DirtyCycleCounters, Scope.Counter, Elapsed > Scope.ChildCycles ? Elapsed - Scope.ChildCycles : 0);
+    }
+    if (Scope.Key.IsSet() && Elapsed > 0)
+    {
+        AddKeyedCost(Counter.Definition, Scope.Key, Elapsed);
+    }
+    // Inclusive like the time, and counted on every call: instruction counts are never sampled.
+    if (bCountInstructions && Counter.GetStatId().IsValidStat())
+    {
+        if (Counter.InstructionsStat == nullptr)
+        {
+            Counter.InstructionsStat = CreateCompanionStat(ELuaStatType::Int64Counter, Definitions[Counter.Definition].Name, TEXT("@Instructions"));
+        }
+        AddInt64Stat(Counter.InstructionsStat, static_cast<int64>(GLuaInstructionCount - Scope.StartInstructions));
+    }
+    if (Scope.NativeCycles > 0 && Counter.GetStatId().IsValidStat())
+    {
+        // Creating the companion can grow CycleCounters, so Counter is not used past this point.
+        TStatIdData const* NativeStat = Counter.NativeStat;
+        if (NativeStat == nullptr)
+        {
+            NativeStat = CreateCompanionStat(ELuaStatType::CycleCounter, Definitions[Counter.Definition].Name, TEXT("@Native"));
+            CycleCounters[Scope.Counter].NativeStat = NativeStat;
+        }
+        if (const int32* Native = NativeStat ? PtrToCycleCounter.Find(NativeStat) : nullptr)
+        {
+            const uint32 NativeCycles = static_cast<uint32>(FMath::Min<uint64>(Scope.NativeCycles, MAX_uint32));
+            Values[CycleCounters[*Native].Definition] += NativeCycles;
+            if (FThreadStats::IsCollectingData())
+            {
+                FThreadStats::AddMessage(MinimalNameToName(NativeStat->Name), EStatOperation::Add, static_cast<int64>(NativeCycles), true);
+            }
+        }
+    }
+    if (CycleCounterStack.Num() > 0)
+    {
+        CycleCounterStack.Last().NestedScopes += Scope.NestedScopes + 1;
+        CycleCounterStack.Last().ChildCycles += Elapsed;
+        CycleCounterStack.Last().NativeCycles += Scope.NativeCycles;
+    }
+    return true;
+}
+
+bool FLuaStats::SetCycleCounter(FName StatName, const uint32 Cycles)
+{
+    if (const auto Result = NameToCycleCounter.Find(StatName))
+    {
+        SetCycleCounterInternal(*Result, Cycles);
+        return true;
+    }
+    return false;
+}
+
+bool FLuaStats::SetCycleCounter(TStatIdData const* StatIdPtr, const uint32 Cycles)
+{
+    if (const auto Result = PtrToCycleCounter.Find(StatIdPtr))
+    {
+        SetCycleCounterInternal(*Result, Cycles);
+        return true;
+    }
+    return false;
+}
+
+TStatIdData const* FLuaStats::CreateSimpleSeconds(FName StatName, const TCHAR* StatDesc, double InScale)
+{
+    if (NameToSecondsStat.Contains(StatName))
+    {
+        return ClaimPreregistered(StatName, ELuaStatType::SimpleSeconds) ? DoubleStats.FindChecked(StatName).StatId : nullptr;
+    }
+    if (DoubleStats.Contains(StatName) || NameToParent.Contains(StatName))
+    {
+        return nullptr;
+    }
+    const TStatId StatId = CreateStatId(StatName, StatDesc, false, EStatDataType::ST_double, false);
+    const int32 Definition = AddDefinition(StatName, StatDesc, ELuaStatType::SimpleSeconds, InScale);
+    DoubleStats.Emplace(StatName, FLuaValueStat{ StatId.GetRawPointer(), Definition });
+    PtrToValueStat.Emplace(StatId.GetRawPointer(), StatName);
+    auto Index = SimpleSecondsStats.Emplace(StatId, InScale);
+    SimpleSecondsStats[Index].Definition = Definition;
+    NameToSecondsStat.Emplace(StatName, Index);
+    PtrToSecondsStat.Emplace(StatId.GetRawPointer(), Index);
+    return StatId.GetRawPointer();
+}
+
+void FLuaStats::StartSimpleSecondsInternal(int32 Index, lua_State* L, const FLuaStatKey* Key)
+{
+    check(SimpleSecondsStats.IsValidIndex(Index));
+    FLuaSimpleSecondsStat& Stat = SimpleSecondsStats[Index];
+    if (bRollups && Stat.Rollup.Source == INDEX_NONE)
+    {
+        CaptureRollupSource(Stat.Rollup, L);
+    }
+    Stat.ActiveKey = Key ? *Key : FLuaStatKey();
+    Stat.Start(Key != nullptr);
+}
+
+void FLuaStats::StopSimpleSecondsInternal(int32 Index)
+{
+    check(SimpleSecondsStats.IsValidIndex(Index));
+    FLuaSimpleSecondsStat& Stat = SimpleSecondsStats[Index];
+    const uint64 Elapsed = Stat.Stop();
+    if (!Stat.Sampler.bNativeTiming)
+    {
+        AddPendingSecondsCycles(Index, Elapsed);
+    }
+    if (Stat.Rollup.Source != INDEX_NONE && bRollups)
+    {
+        AccumulateRollup(Stat.Rollup, DirtySecondsStats, Index, Elapsed);
+    }
+    if (Stat.ActiveKey.IsSet())
+    {
+        if (Elapsed > 0)
+        {
+            AddKeyedCost(Stat.Definition, Stat.ActiveKey, Elapsed * FPlatformTime::GetSecondsPerCycle64() * Stat.GetScale());
+        }
+        Stat.ActiveKey = FLuaStatKey();
+    }
+}
+
+bool FLuaStats::StartSimpleSeconds(FName StatName, lua_State* L, const FLuaStatKey* Key)
+{
+    if (const auto Result = NameToSecondsStat.Find(StatName))
+    {
+        StartSimpleSecondsInternal(*Result, L, Key);
+        return true;
+    }
+    return false;
+}
+
+bool FLuaStats::StartSimpleSeconds(TStatIdData const* StatIdPtr, lua_State* L, const FLuaStatKey* Key)
+{
+    if (const auto Result = PtrToSecondsStat.Find(StatIdPtr))
+    {
+        StartSimpleSecondsInternal(*Result, L, Key);
+        return true;
+    }
+    return false;
+}
+
+bool FLuaStats::StopSimpleSeconds(FName StatName)
+{
+    if (const auto Result = NameToSecondsStat.Find(StatName))
+    {
+        StopSimpleSecondsInternal(*Result);
+        return true;
+    }
+    return false;
+}
+
+bool FLuaStats::StopSimpleSeconds(TStatIdData const* StatIdPtr)
+{
+    if (const auto Result = PtrToSecondsStat.Find(StatIdPtr))
+    {
+        StopSimpleSecondsInternal(*Result);
+        return true;
+    }
+    return false;
+}
+
+void FLuaStats::AddPendingSecondsCycles(int32 Index, uint64 Cycles)
+{
+    FLuaSimpleSecondsStat& Stat = SimpleSecondsStats[Index];
+    if (Cycles > 0)
+    {
+        if (Stat.FrameCycles == 0)
+        {
+            PendingSecondsStats.Add(Index);
+        }
+        Stat.FrameCycles += Cycles;
+    }
+}
+
+bool FLuaStats::RecordSpan(TStatIdData const* StatIdPtr, uint64 Cycles)
+{
+    // A span timed by the script itself: it adds to the stat like a Start/Stop pair would, without nesting.
+    if (const auto Result = PtrToCycleCounter.Find(StatIdPtr))
+    {
+        FLuaCycleCounter& Counter = CycleCounters[*Result];
+        if (Cycles > 0 && Counter.GetStatId().IsValidStat())
+        {
+            if (Counter.RecordedCycles == 0)
+            {
+                PendingCycleCounters.Add(*Result);
+            }
+            Counter.RecordedCycles += Cycles;
+        }
+        return true;
+    }
+    if (const auto Result = PtrToSecondsStat.Find(StatIdPtr))
+    {
+        if (SimpleSecondsStats[*Result].GetStatId().IsValidStat())
+        {
+            AddPendingSecondsCycles(*Result, Cycles);
+        }
+        return true;
+    }
+    return false;
+}
+
+void FLuaStats::FlushPendingCycles()
+{
+    const bool bCollecting = FThreadStats::IsCollectingData();
+    for (const int32 Index : PendingCycleCounters)
+    {
+        FLuaCycleCounter& Counter = CycleCounters[Index];
+        Values[Counter.Definition] += Counter.RecordedCycles;
+        if (bCollecting)
+        {
+            FThreadStats::AddMessage(Counter.GetStatId().GetName(), EStatOperation::Add,
+                static_cast<int64>(FMath::Min<uint64>(Counter.RecordedCycles, MAX_uint32)), true);
+        }
+        Counter.RecordedCycles = 0;
+    }
+    PendingCycleCounters.Reset();
+    const double SecondsPerCycle = FPlatformTime::GetSecondsPerCycle64();
+    for (const int32 Index : PendingSecondsStats)
+    {
+        FLuaSimpleSecondsStat& Stat = SimpleSecondsStats[Index];
+        const double Seconds = Stat.FrameCycles * SecondsPerCycle * Stat.GetScale();
+        Values[Stat.Definition] += Seconds;
+        if (bCollecting)
+        {
+            FThreadStats::AddMessage(Stat.GetStatId().GetName(), EStatOperation::Add, Seconds);
+        }
+        Stat.FrameCycles = 0;
+    }
+    PendingSecondsStats.Reset();
+}
+
+void FLuaStats::UpdateSampler(FLuaStatSampler& Sampler, TArray<int32>& NativeList, int32 Index, FName StatName, bool bForceNative)
+{
+    Sampler.bNativeTiming = Sampler.SampleRate > 1 || bForceNative;
+    if (Sampler.bNativeTiming)
+    {
+        // Natively timed scopes no longer feed the engine's call count, so it is published next to the time.
+        if (Sampler.CallsStat == nullptr)
+        {
+            Sampler.CallsStat = CreateCompanionStat(ELuaStatType::Int64Counter, StatName, TEXT("@Calls"));
+        }
+        if (Sampler.StdErrStat == nullptr && Sampler.SampleRate > 1)
+        {
+            Sampler.StdErrStat = CreateCompanionStat(ELuaStatType::DoubleCounter, StatName, TEXT("@StdErr"));
+        }
+        NativeList.AddUnique(Index);
+    }
+    else
+    {
+        NativeList.Remove(Index);
+    }
+}
+
+bool FLuaStats::SetCycleCounterSampleRate(FName StatName, uint32 SampleRate, bool bRandom)
+{
+    if (const auto Result = NameToCycleCounter.Find(StatName))
+    {
+        CycleCounters[*Result].Sampler.SetRate(SampleRate, bRandom);
+        UpdateSampler(CycleCounters[*Result].Sampler, SampledCycleCounters, *Result, StatName, bSubtractOverhead);
+        return true;
+    }
+    return false;
+}
+
+bool FLuaStats::SetCycleCounterSampleRate(TStatIdData const* StatIdPtr, uint32 SampleRate, bool bRandom)
+{
+    if (const auto Result = PtrToCycleCounter.Find(StatIdPtr))
+    {
+        const FName StatName = GetStatName(StatIdPtr);
+        if (!StatName.IsNone())
+        {
+            CycleCounters[*Result].Sampler.SetRate(SampleRate, bRandom);
+            UpdateSampler(CycleCounters[*Result].Sampler, SampledCycleCounters, *Result, StatName, bSubtractOverhead);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool FLuaStats::SetSimpleSecondsSampleRate(FName StatName, uint32 SampleRate, bool bRandom)
+{
+    if (const auto Result = NameToSecondsStat.Find(StatName))
+    {
+        SimpleSecondsStats[*Result].Sampler.SetRate(SampleRate, bRandom);
+        UpdateSampler(SimpleSecondsStats[*Result].Sampler, SampledSecondsStats, *Result, StatName, false);
+        return true;
+    }
+    return false;
+}
+
+bool FLuaStats::SetSimpleSecondsSampleRate(TStatIdData const* StatIdPtr, uint32 SampleRate, bool bRandom)
+{
+    if (const auto Result = PtrToSecondsStat.Find(StatIdPtr))
+    {
+        const FName StatName = GetStatName(StatIdPtr);
+        if (!StatName.IsNone())
+        {
+            SimpleSecondsStats[*Result].Sampler.SetRate(SampleRate, bRandom);
+            UpdateSampler(SimpleSecondsStats[*Result].Sampler, SampledSecondsStats, *Result, StatName, false);
+            return true;
+        }
+    }
+    return false;
+}
+
+TStatIdData const* FLuaStats::CreateInt64Counter(FName StatName, const TCHAR* StatDesc)
+{
+    if (const auto Existing = Int64Stats.Find(StatName))
+    {
+        return ClaimPreregistered(StatName, ELuaStatType::Int64Counter) ? Existing->StatId : nullptr;
+    }
+    if (NameToParent.Contains(StatName))
+    {
+        return nullptr;
+    }
+    const TStatId StatId = CreateStatId(StatName, StatDesc, true, EStatDataType::ST_int64, false);
+    const int32 Definition = AddDefinition(StatName, StatDesc, ELuaStatType::Int64Counter);
+    Int64Stats.Emplace(StatName, FLuaValueStat{ StatId.GetRawPointer(), Definition });
+    PtrToValueStat.Emplace(StatId.GetRawPointer(), StatName);
+    return StatId.GetRawPointer();
+}
+
+TStatIdData const* FLuaStats::CreateInt64Accumulator(FName StatName, const TCHAR* StatDesc)
+{
+    if (const auto Existing = Int64Stats.Find(StatName))
+    {
+        return ClaimPreregistered(StatName, ELuaStatType::Int64Accumulator) ? Existing->StatId : nullptr;
+    }
+    if (NameToParent.Contains(StatName))
+    {
+        return nullptr;
+    }
+    const TStatId StatId = CreateStatId(StatName, StatDesc, false, EStatDataType::ST_int64, false);
+    const int32 Definition = AddDefinition(StatName, StatDesc, ELuaStatType::Int64Accumulator);
+    Int64Stats.Emplace(StatName, FLuaValueStat{ StatId.GetRawPointer(), Definition });
+    PtrToValueStat.Emplace(StatId.GetRawPointer(), StatName);
+    return StatId.GetRawPointer();
+}
+
+TStatIdData const* FLuaStats::CreateDoubleCounter(FName StatName, const TCHAR* StatDesc)
+{
+    if (const auto Existing = DoubleStats.Find(StatName))
+    {
+        return ClaimPreregistered(StatName, ELuaStatType::DoubleCounter) ? Existing->StatId : nullptr;
+    }
+    if (NameToParent.Contains(StatName))
+    {
+        return nullptr;
+    }
+    const TStatId StatId = CreateStatId(StatName, StatDesc, true, EStatDataType::ST_double, false);
+    const int32 Definition = AddDefinition(StatName, StatDesc, ELuaStatType::DoubleCounter);
+    DoubleStats.Emplace(StatName, FLuaValueStat{ StatId.GetRawPointer(), Definition });
+    PtrToValueStat.Emplace(StatId.GetRawPointer(), StatName);
+    return StatId.GetRawPointer();
+}
+
+TStatIdData const* FLuaStats::CreateDoubleAccumulator(FName StatName, const TCHAR* StatDesc)
+{
+    if (const auto Existing = DoubleStats.Find(StatName))
+    {
+        return ClaimPreregistered(StatName, ELuaStatType::DoubleAccumulator) ? Existing->StatId : nullptr;
+    }
+    if (NameToParent.Contains(StatName))
+    {
+        return nullptr;
+    }
+    const TStatId StatId = CreateStatId(StatName, StatDesc, false, EStatDataType::ST_double, false);
+    const int32 Definition = AddDefinition(StatName, StatDesc, ELuaStatType::DoubleAccumulator);
+    DoubleStats.Emplace(StatName, FLuaValueStat{ StatId.GetRawPointer(), Definition });
+    PtrToValueStat.Emplace(StatId.GetRawPointer(), StatName);
+    return StatId.GetRawPointer();
+}
+
+TStatIdData const* FLuaStats::CreateMemoryStat(FName StatName, const TCHAR* StatDesc)
+{
+    if (const auto Existing = MemoryStats.Find(StatName))
+    {
+        return ClaimPreregistered(StatName, ELuaStatType::Memory) ? Existing->StatId : nullptr;
+    }
+    if (NameToParent.Contains(StatName))
+    {
+        return nullptr;
+    }
+    const TStatId StatId = CreateStatId(StatName, StatDesc, false, EStatDataType::ST_int64, false,
+        FPlatformMemory::MCR_Physical);
+    const int32 Definition = AddDefinition(StatName, StatDesc, ELuaStatType::Memory);
+    MemoryStats.Emplace(StatName, FLuaValueStat{ StatId.GetRawPointer(), Definition });
+    PtrToValueStat.Emplace(StatId.GetRawPointer(), StatName);
+    return StatId.GetRawPointer();
+}
+
+bool FLuaStats::ClaimPreregistered(FName StatName, ELuaStatType Type)
+{
+    const ELuaStatType* PreregisteredType = PreregisteredStats.Find(StatName);
+    if (PreregisteredType == nullptr)
+    {
+        return false;
+    }
+    if (*PreregisteredType != Type)
+    {
+        UE_LOG(LogLuaStats, Warning, TEXT("Stat %s was preregistered as %s but created as %s"), *StatName.ToString(),
+            LuaStatTypeNames[static_cast<int32>(*PreregisteredType)], LuaStatTypeNames[static_cast<int32>(Type)]);
+        return false;
+    }
+    PreregisteredStats.Remove(StatName);
+    return true;
+}
+
+int32 FLuaStats::AddDefinition(FName StatName, const TCHAR* StatDesc, ELuaStatType Type, double Scale)
+{
+    const int32 Index = Definitions.Add({ StatName, StatDesc ? FString(StatDesc) : FString(), Type, Scale, ActiveGroup, false });
+    NameToDefinition.Emplace(StatName, Index);
+    Values.Add(0.0);
+    Definitions[Index].Parent = FindOrAddParent(StatName, Type);
+    if (Definitions[Index].Parent != INDEX_NONE)
+    {
+        ParentedDefinitions.Add(Index);
+    }
+    return Index;
+}
+
+int32 FLuaStats::FindOrAddParent(FName ChildName, ELuaStatType Type)
+{
+    // "AI.Pathing.Query" rolls up into "AI.Pathing@Sum" and "AI@Sum". Every parent gets a suffix, so a script
+    // can still create a stat named "AI" in any order, and a prefix can hold several kinds of value. Companions
+    // ("Name@Suffix") never roll up.
+    const TCHAR* Suffix;
+    switch (Type)
+    {
+    case ELuaStatType::CycleCounter:
+        Suffix = TEXT("@Sum");
+        break;
+    case ELuaStatType::SimpleSeconds:
+        Suffix = TEXT("@Seconds");
+        break;
+    case ELuaStatType::Int64Counter:
+    case ELuaStatType::Int64Accumulator:
+        Type = ELuaStatType::Int64Counter;
+        Suffix = TEXT("@Int64");
+        break;
+    case ELuaStatType::DoubleCounter:
+    case ELuaStatType::DoubleAccumulator:
+        Type = ELuaStatType::DoubleCounter;
+        Suffix = TEXT("@Double");
+        break;
+    case ELuaStatType::Memory:
+        Suffix = TEXT("@Memory");
+        break;
+    default:
+        return INDEX_NONE;
+    }
+    const FString Child = ChildName.ToString();
+    int32 Dot;
+    if (Child.Contains(TEXT("@")) || !Child.FindLastChar(TEXT('.'), Dot) || Dot == 0)
+    {
+        return INDEX_NONE;
+    }
+    const FString Prefix = Child.Left(Dot);
+    const FName ParentName(*(Prefix + Suffix));
+    if (const int32* Found = NameToParent.Find(ParentName))
+    {
+        return *Found;
+    }
+    if (NameToDefinition.Contains(ParentName))
+    {
+        // Only a script naming a stat like a companion gets here.
+        UE_LOG(LogLuaStats, Warning, TEXT("Stat %s is not rolled up: its parent name %s is taken by a stat"), *Child, *ParentName.ToString());
+        return INDEX_NONE;
+    }
+
+    // Grandparents are created first, so a parent always has a lower index than its children.
+    const int32 GrandParent = FindOrAddParent(FName(*Prefix), Type);
+    FLuaParentStat Parent;
+    Parent.Name = ParentName;
+    Parent.Type = Type;
+    Parent.Parent = GrandParent;
+    const FString ParentDesc = FString::Printf(TEXT("Sum of %s.*"), *Prefix);
+    const bool bCycleStat = Type == ELuaStatType::CycleCounter;
+    const EStatDataType::Type DataType = Type == ELuaStatType::SimpleSeconds || Type == ELuaStatType::DoubleCounter ? EStatDataType::ST_double : EStatDataType::ST_int64;
+    Parent.StatId = CreateStatId(ParentName, *ParentDesc, true, DataType, bCycleStat,
+        Type == ELuaStatType::Memory ? FPlatformMemory::MCR_Physical : FPlatformMemory::MCR_Invalid).GetRawPointer();
+    const int32 Index = Parents.Add(MoveTemp(Parent));
+    NameToParent.Emplace(ParentName, Index);
+    return Index;
+}
+
+void FLuaStats::FlushParents()
+{
+    for (const int32 Definition : ParentedDefinitions)
+    {
+        Parents[Definitions[Definition].Parent].FrameValue += Values[Definition];
+    }
+    const bool bCollecting = FThreadStats::IsCollectingData();
+    for (int32 Index = Parents.Num() - 1; Index >= 0; --Index)
+    {
+        FLuaParentStat& Parent = Parents[Index];
+        Parent.FrameValue = FMath::Max(Parent.FrameValue - Parent.NestedCycles, 0.0);
+        Parent.NestedCycles = 0.0;
+        if (Parent.Parent != INDEX_NONE)
+        {
+            Parents[Parent.Parent].FrameValue += Parent.FrameValue;
+        }
+        if (Parent.FrameValue != 0.0 && bCollecting && TStatId(Parent.StatId).IsValidStat())
+        {
+            const FName StatName = MinimalNameToName(Parent.StatId->Name);
+            switch (Parent.Type)
+            {
+            case ELuaStatType::CycleCounter:
+                FThreadStats::AddMessage(StatName, EStatOperation::Add, static_cast<int64>(FMath::Min(Parent.FrameValue, static_cast<double>(MAX_uint32))), true);
+                break;
+            case ELuaStatType::Int64Counter:
+            case ELuaStatType::Memory:
+                FThreadStats::AddMessage(StatName, EStatOperation::Set, static_cast<int64>(Parent.FrameValue));
+                break;
+            default:
+                FThreadStats::AddMessage(StatName, EStatOperation::Set, Parent.FrameValue);
+                break;
+            }
+        }
+        Parent.LastValue = Parent.FrameValue;
+        Parent.FrameValue = 0.0;
+    }
+}
+
+TStatIdData const* FLuaStats::CreateStat(ELuaStatType Type, FName StatName, const TCHAR* StatDesc, double InScale)
+{
+    switch (Type)
+    {
+    case ELuaStatType::CycleCounter:
+        return CreateCycleCounter(StatName, StatDesc);
+    case ELuaStatType::SimpleSeconds:
+        return CreateSimpleSeconds(StatName, StatDesc, InScale);
+    case ELuaStatType::Int64Counter:
+        return CreateInt64Counter(StatName, StatDesc);
+    case ELuaStatType::Int64Accumulator:
+        return CreateInt64Accumulator(StatName, StatDesc);
+    case ELuaStatType::DoubleCounter:
+        return CreateDoubleCounter(StatName, StatDesc);
+    case ELuaStatType::DoubleAccumulator:
+        return CreateDoubleAccumulator(StatName, StatDesc);
+    case ELuaStatType::Memory:
+        return CreateMemoryStat(StatName, StatDesc);
+    case ELuaStatType::AsyncSpan:
+        return CreateAsyncSpan(StatName, StatDesc);
+    default:
+        return nullptr;
+    }
+}
+
+FName FLuaStats::GetStatName(TStatIdData const* StatIdPtr) const
+{
+    // The name a handle was created under; disabled stats all share one handle and have none.
+    if (!TStatId(StatIdPtr).IsValidStat())
+    {
+        return NAME_None;
+    }
+    if (const int32* Found = PtrToCycleCounter.Find(StatIdPtr))
+    {
+        return Definitions[CycleCounters[*Found].Definition].Name;
+    }
+    if (const FName* Found = PtrToValueStat.Find(StatIdPtr))
+    {
+        return *Found;
+    }
+    if (const int32* Found = PtrToAsyncSpan.Find(StatIdPtr))
+    {
+        return Definitions[AsyncSpanStats[*Found].Definition].Name;
+    }
+    return NAME_None;
+}
+
+TStatIdData const* FLuaStats::ResolveStat(ELuaStatType Type, FName StatName) const
+{
+    // Never creates: a later Create of the same name would fail, and scripts keep the handle Create returns.
+    switch (Type)
+    {
+    case ELuaStatType::CycleCounter:
+    {
+        const int32* Found = NameToCycleCounter.Find(StatName);
+        return Found ? CycleCounters[*Found].GetStatId().GetRawPointer() : nullptr;
+    }
+    case ELuaStatType::SimpleSeconds:
+        return NameToSecondsStat.Contains(StatName) ? DoubleStats.FindChecked(StatName).StatId : nullptr;
+    case ELuaStatType::Int64Counter:
+    case ELuaStatType::Int64Accumulator:
+    {
+        const FLuaValueStat* Found = Int64Stats.Find(StatName);
+        return Found ? Found->StatId : nullptr;
+    }
+    case ELuaStatType::DoubleCounter:
+    case ELuaStatType::DoubleAccumulator:
+    {
+        const FLuaValueStat* Found = DoubleStats.Find(StatName);
+        return Found ? Found->StatId : nullptr;
+    }
+    case ELuaStatType::Memory:
+    {
+        const FLuaValueStat* Found = MemoryStats.Find(StatName);
+        return Found ? Found->StatId : nullptr;
+    }
+    case ELuaStatType::AsyncSpan:
+    {
+        const int32* Found = NameToAsyncSpan.Find(StatName);
+        return Found ? AsyncSpanStats[*Found].InFlightStat : nullptr;
+    }
+    default:
+        return nullptr;
+    }
+}
+
+TStatIdData const* FLuaStats::CreateCompanionStat(ELuaStatType Type, FName ParentName, const TCHAR* Suffix)
+{
+    const FName StatName(*(ParentName.ToString() + Suffix));
+    const int32* ParentDefinition = NameToDefinition.Find(ParentName);
+    const int32 SavedGroup = ActiveGroup;
+    ActiveGroup = ParentDefinition ? Definitions[*ParentDefinition].Group : INDEX_NONE;
+    TStatIdData const* Result = CreateStat(Type, StatName);
+    ActiveGroup = SavedGroup;
+    if (Result)
+    {
+        Definitions[NameToDefinition.FindChecked(StatName)].bCompanion = true;
+    }
+    return Result;
+}
+
+void FLuaStats::ReserveStats(const FLuaStatTypeCounts& Counts)
+{
+    // Bulk registration knows its size up front, so grow each table once, by the stats of its own kind, instead
+    // of rehashing per stat. Seconds stats also hold their value in DoubleStats, and every async span brings
+    // four Double companions and one Int64 companion.
+    const int32 NumCycle = Counts.Get(ELuaStatType::CycleCounter);
+    const int32 NumSeconds = Counts.Get(ELuaStatType::SimpleSeconds);
+    const int32 NumSpans = Counts.Get(ELuaStatType::AsyncSpan);
+    const int32 NumInt64 = Counts.Get(ELuaStatType::Int64Counter) + Counts.Get(ELuaStatType::Int64Accumulator) + NumSpans;
+    const int32 NumDouble = Counts.Get(ELuaStatType::DoubleCounter) + Counts.Get(ELuaStatType::DoubleAccumulator) + NumSeconds + NumSpans * 4;
+    const int32 NumMemory = Counts.Get(ELuaStatType::Memory);
+    const int32 NumDefinitions = NumCycle + NumInt64 + NumDouble + NumMemory + NumSpans;
+
+    Definitions.Reserve(Definitions.Num() + NumDefinitions);
+    NameToDefinition.Reserve(NameToDefinition.Num() + NumDefinitions);
+    Values.Reserve(Values.Num() + NumDefinitions);
+    CycleCounters.Reserve(CycleCounters.Num() + NumCycle);
+    NameToCycleCounter.Reserve(NameToCycleCounter.Num() + NumCycle);
+    PtrToCycleCounter.Reserve(PtrToCycleCounter.Num() + NumCycle);
+    SimpleSecondsStats.Reserve(SimpleSecondsStats.Num() + NumSeconds);
+    NameToSecondsStat.Reserve(NameToSecondsStat.Num() + NumSeconds);
+    PtrToSecondsStat.Reserve(PtrToSecondsStat.Num() + NumSeconds);
+    Int64Stats.Reserve(Int64Stats.Num() + NumInt64);
+    DoubleStats.Reserve(DoubleStats.Num() + NumDouble);
+    MemoryStats.Reserve(MemoryStats.Num() + NumMemory);
+    PtrToValueStat.Reserve(PtrToValueStat.Num() + NumInt64 + NumDouble + NumMemory);
+    AsyncSpanStats.Reserve(AsyncSpanStats.Num() + NumSpans);
+    NameToAsyncSpan.Reserve(NameToAsyncSpan.Num() + NumSpans);
+    PtrToAsyncSpan.Reserve(PtrToAsyncSpan.Num() + NumSpans);
+}
+
+FString FLuaStats::GetDefaultManifestPath()
+{
+    FString Path;
+    if (!FParse::Value(FCommandLine::Get(), TEXT("LuaStatsManifest="), Path))
+    {
+        Path = FPaths::ProjectSavedDir() / TEXT("LuaStats") / TEXT("StatManifest.txt");
+    }
+    return Path;
+}
+
+int32 FLuaStats::LoadManifest(const FString& Path)
+{
+    TArray<FString> Lines;
+    if (!FFileHelper::LoadFileToStringArray(Lines, *Path))
+    {
+        return 0;
+    }
+    FLuaStatTypeCounts Counts;
+    for (const FString& Line : Lines)
+    {
+        int32 Tab;
+        ELuaStatType Type;
+        if (Line.FindChar(TEXT('\t'), Tab) && ParseLuaStatType(*Line.Left(Tab), Type))
+        {
+            Counts.Add(Type);
+        }
+    }
+    ReserveStats(Counts);
+    PreregisteredStats.Reserve(PreregisteredStats.Num() + Lines.Num());
+
+    int32 NumLoaded = 0;
+    const int32 SavedGroup = ActiveGroup;
+    TArray<FString> Fields;
+    for (const FString& Line : Lines)
+    {
+        // Type \t Name \t Scale \t Group \t Desc
+        Fields.Reset();
+        Line.ParseIntoArray(Fields, TEXT("\t"), false);
+        ELuaStatType Type;
+        if (Fields.Num() < 2 || Fields[1].IsEmpty() || !ParseLuaStatType(*Fields[0], Type))
+        {
+            continue;
+        }
+        const FName StatName(*Fields[1]);
+        const double Scale = Fields.Num() > 2 ? FCString::Atod(*Fields[2]) : 1.0;
+        ActiveGroup = Fields.Num() > 3 && !Fields[3].IsEmpty() ? FindOrAddGroup(FName(*Fields[3])) : INDEX_NONE;
+        const TCHAR* StatDesc = Fields.Num() > 4 && !Fields[4].IsEmpty() ? *Fields[4] : nullptr;
+        if (CreateStat(Type, StatName, StatDesc, Scale != 0.0 ? Scale : 1.0))
+        {
+            PreregisteredStats.Emplace(StatName, Type);
+            ++NumLoaded;
+        }
+    }
+    ActiveGroup = SavedGroup;
+    UE_LOG(LogLuaStats, Log, TEXT("Preregistered %d Lua stats from %s"), NumLoaded, *Path);
+    return NumLoaded;
+}
+
+bool FLuaStats::SaveManifest(const FString& Path) const
+{
+    FString Content;
+    Content.Reserve(Definitions.Num() * 64);
+    for (const FLuaStatDefinition& Definition : Definitions)
+    {
+        if (Definition.bCompanion)
+        {
+            continue;
+        }
+        FString Desc = Definition.Desc.Replace(TEXT("\t"), TEXT(" ")).Replace(TEXT("\n"), TEXT(" "));
+        const FString GroupName = Groups.IsValidIndex(Definition.Group) ? Groups[Definition.Group].Name.ToString() : FString();
+        Content += FString::Printf(TEXT("%s\t%s\t%g\t%s\t%s\n"), LuaStatTypeNames[static_cast<int32>(Definition.Type)],
+            *Definition.Name.ToString(), Definition.Scale, *GroupName, *Desc);
+    }
+    return FFileHelper::SaveStringToFile(Content, *Path, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM);
+}
+
+void FLuaStats::SetPerfCounters(bool bEnable)
+{
+    bPerfCountersRequested = bEnable;
+    PerfCounters.Close();
+    if (bEnable && !PerfCounters.Open())
+    {
+        UE_LOG(LogLuaStats, Warning, TEXT("perf_event_open is unavailable, Lua scopes are published without performance counters"));
+    }
+    // Hardware and software counters publish under different suffixes.
+    for (FLuaCycleCounter& Counter : CycleCounters)
+    {
+        FMemory::Memzero(Counter.PerfStats);
+    }
+}
+
+void FLuaStats::SetSubtractOverhead(bool bEnable)
+{
+    bSubtractOverhead = bEnable;
+    if (bEnable && !bOverheadCalibrated)
+    {
+        CalibrateLuaScopeOverhead();
+    }
+    for (const auto& Pair : NameToCycleCounter)
+    {
+        UpdateSampler(CycleCounters[Pair.Value].Sampler, SampledCycleCounters, Pair.Value, Pair.Key, bEnable);
+    }
+}
+
+TStatIdData const* FLuaStats::GetCalibrationCounter()
+{
+    static const FName CalibrationStatName(TEXT("LuaStats@Calibration"));
+    if (const auto Result = NameToCycleCounter.Find(CalibrationStatName))
+    {
+        // Calibration always measures the native timing path, since that is the one overhead is subtracted from.
+        CycleCounters[*Result].Sampler.bNativeTiming = true;
+        return CycleCounters[*Result].GetStatId().GetRawPointer();
+    }
+    return CreateCompanionStat(ELuaStatType::CycleCounter, TEXT("LuaStats"), TEXT("@Calibration")) ? GetCalibrationCounter() : nullptr;
+}
+
+void FLuaStats::SetCalibratedScopeOverhead(uint64 Cycles)
+{
+    bOverheadCalibrated = true;
+    ScopeOverheadCycles = Cycles;
+    if (ScopeOverheadStat == nullptr)
+    {
+        ScopeOverheadStat = CreateCompanionStat(ELuaStatType::DoubleAccumulator, TEXT("LuaStats"), TEXT("@ScopeOverheadNs"));
+    }
+    UE_LOG(LogLuaStats, Log, TEXT("Calibrated Lua cycle counter scope overhead: %.1f ns"), GetScopeOverheadNs());
+}
+
+double FLuaStats::GetScopeOverheadNs() const
+{
+    return ScopeOverheadCycles * FPlatformTime::GetSecondsPerCycle64() * 1e9;
+}
+
+TStatIdData const* FLuaStats::CreateAsyncSpan(FName StatName, const TCHAR* StatDesc)
+{
+    if (const auto Existing = NameToAsyncSpan.Find(StatName))
+    {
+        return ClaimPreregistered(StatName, ELuaStatType::AsyncSpan) ? AsyncSpanStats[*Existing].InFlightStat : nullptr;
+    }
+    if (Int64Stats.Contains(StatName) || NameToParent.Contains(StatName))
+    {
+        return nullptr;
+    }
+    // The stat itself is the in-flight count; rate, percentiles and expiries are companions.
+    const TStatId StatId = CreateStatId(StatName, StatDesc, true, EStatDataType::ST_int64, false);
+    FLuaAsyncSpanStat SpanStat;
+    SpanStat.Definition = AddDefinition(StatName, StatDesc, ELuaStatType::AsyncSpan);
+    SpanStat.InFlightStat = StatId.GetRawPointer();
+    SpanStat.RateStat = CreateCompanionStat(ELuaStatType::DoubleCounter, StatName, TEXT("@PerSecond"));
+    SpanStat.P50Stat = CreateCompanionStat(ELuaStatType::DoubleCounter, StatName, TEXT("@P50Ms"));
+    SpanStat.P90Stat = CreateCompanionStat(ELuaStatType::DoubleCounter, StatName, TEXT("@P90Ms"));
+    SpanStat.P99Stat = CreateCompanionStat(ELuaStatType::DoubleCounter, StatName, TEXT("@P99Ms"));
+    SpanStat.ExpiredStat = CreateCompanionStat(ELuaStatType::Int64Counter, StatName, TEXT("@Expired"));
+    const int32 Index = AsyncSpanStats.Add(MoveTemp(SpanStat));
+    NameToAsyncSpan.Emplace(StatName, Index);
+    PtrToAsyncSpan.Emplace(StatId.GetRawPointer(), Index);
+    if (AsyncSpans.Num() == 0)
+    {
+        GrowAsyncSpanPool();
+        AsyncSpanWindowStart[0] = AsyncSpanWindowStart[1] = LastAsyncSpanExpiry = FPlatformTime::Seconds();
+    }
+    return StatId.GetRawPointer();
+}
+
+void FLuaStats::GrowAsyncSpanPool()
+{
+    const int32 OldNum = AsyncSpans.Num();
+    const int32 NewNum = FMath::Max(OldNum * 2, 256);
+    AsyncSpans.SetNum(NewNum);
+    for (int32 Index = NewNum - 1; Index >= OldNum; --Index)
+    {
+        AsyncSpans[Index].NextFree = FirstFreeAsyncSpan;
+        FirstFreeAsyncSpan = Index;
+    }
+}
+
+int64 FLuaStats::BeginAsyncSpanInternal(int32 Index)
+{
+    if (FirstFreeAsyncSpan == INDEX_NONE)
+    {
+        GrowAsyncSpanPool();
+    }
+    const int32 Slot = FirstFreeAsyncSpan;
+    FLuaAsyncSpan& Span = AsyncSpans[Slot];
+    FirstFreeAsyncSpan = Span.NextFree;
+    Span.NextFree = INDEX_NONE;
+    Span.Stat = Index;
+    Span.StartCycles = FPlatformTime::Cycles64();
+    ++AsyncSpanStats[Index].InFlight;
+    ++ActiveAsyncSpans;
+    // The generation in the high bits makes ids of ended or expired spans stale once their slot is reused.
+    return (static_cast<int64>(Span.Generation) << 32) | Slot;
+}
+
+int64 FLuaStats::BeginAsyncSpan(FName StatName)
+{
+    if (const auto Result = NameToAsyncSpan.Find(StatName))
+    {
+        return BeginAsyncSpanInternal(*Result);
+    }
+    return 0;
+}
+
+int64 FLuaStats::BeginAsyncSpan(TStatIdData const* StatIdPtr)
+{
+    if (const auto Result = PtrToAsyncSpan.Find(StatIdPtr))
+    {
+        return BeginAsyncSpanInternal(*Result);
+    }
+    return 0;
+}
+
+bool FLuaStats::EndAsyncSpan(int64 SpanId, double& OutSeconds)
+{
+    const int32 Slot = static_cast<int32>(SpanId & 0xffffffff);
+    if (!AsyncSpans.IsValidIndex(Slot))
+    {
+        return false;
+    }
+    FLuaAsyncSpan& Span = AsyncSpans[Slot];
+    if (Span.Stat == INDEX_NONE || Span.Generation != static_cast<uint32>(SpanId >> 32))
+    {
+        return false;
+    }
+    OutSeconds = (FPlatformTime::Cycles64() - Span.StartCycles) * FPlatformTime::GetSecondsPerCycle64();
+    FLuaAsyncSpanStat& SpanStat = AsyncSpanStats[Span.Stat];
+    const double Microseconds = OutSeconds * 1000000.0;
+    const int32 Bucket = Microseconds < 1.0 ? 0 : FMath::Min(static_cast<int32>(FMath::Log2(Microseconds) * 4.0), LuaAsyncSpanBuckets - 1);
+    ++SpanStat.Histogram[1][Bucket];
+    ++SpanStat.Completed[1];
+    --SpanStat.InFlight;
+    --ActiveAsyncSpans;
+
+    Span.Stat = INDEX_NONE;
+    Span.Generation = Span.Generation == MAX_uint32 ? 1 : Span.Generation + 1;
+    Span.NextFree = FirstFreeAsyncSpan;
+    FirstFreeAsyncSpan = Slot;
+    return true;
+}
+
+void FLuaStats::FlushAsyncSpans()
+{
+    const double Now = FPlatformTime::Seconds();
+    if (ActiveAsyncSpans > 0 && Now - LastAsyncSpanExpiry >= 1.0)
+    {
+        LastAsyncSpanExpiry = Now;
+        const uint64 TimeoutCycles = static_cast<uint64>(CVarLuaStatsAsyncSpanTimeout.GetValueOnGameThread() / FPlatformTime::GetSecondsPerCycle64());
+        const uint64 NowCycles = FPlatformTime::Cycles64();
+        for (int32 Slot = 0; Slot < AsyncSpans.Num(); ++Slot)
+        {
+            FLuaAsyncSpan& Span = AsyncSpans[Slot];
+            if (Span.Stat != INDEX_NONE && NowCycles - Span.StartCycles > TimeoutCycles)
+            {
+                FLuaAsyncSpanStat& SpanStat = AsyncSpanStats[Span.Stat];
+                --SpanStat.InFlight;
+                ++SpanStat.FrameExpired;
+                --ActiveAsyncSpans;
+                Span.Stat = INDEX_NONE;
+                Span.Generation = Span.Generation == MAX_uint32 ? 1 : Span.Generation + 1;
+                Span.NextFree = FirstFreeAsyncSpan;
+                FirstFreeAsyncSpan = Slot;
+            }
+        }
+    }
+
+    // Two windows are kept so the percentiles never drop to an almost empty histogram right after a swap.
+    const bool bSwapWindows = Now - AsyncSpanWindowStart[1] >= FMath::Max(CVarLuaStatsAsyncSpanWindow.GetValueOnGameThread(), 0.1f);
+    const double WindowSeconds = FMath::Max(Now - AsyncSpanWindowStart[0], 0.001);
+    for (FLuaAsyncSpanStat& SpanStat : AsyncSpanStats)
+    {
+        Values[SpanStat.Definition] = SpanStat.InFlight;
+        if (TStatId(SpanStat.InFlightStat).IsValidStat())
+        {
+            // The companions reach Values[] through the setters whether or not the stats thread is listening.
+            if (FThreadStats::IsCollectingData())
+            {
+                FThreadStats::AddMessage(MinimalNameToName(SpanStat.InFlightStat->Name), EStatOperation::Set, static_cast<int64>(SpanStat.InFlight));
+            }
+            SetInt64Stat(SpanStat.ExpiredStat, SpanStat.FrameExpired);
+            const uint32 Completed = SpanStat.Completed[0] + SpanStat.Completed[1];
+            SetDoubleStat(SpanStat.RateStat, Completed / WindowSeconds);
+            if (Completed > 0)
+            {
+                TStatIdData const* const PercentileStats[] = { SpanStat.P50Stat, SpanStat.P90Stat, SpanStat.P99Stat };
+                const double Percentiles[] = { 0.5, 0.9, 0.99 };
+                const int32 NumPercentiles = static_cast<int32>(UE_ARRAY_COUNT(Percentiles));
+                int32 Next = 0;
+                uint32 Seen = 0;
+                for (int32 Bucket = 0; Bucket < LuaAsyncSpanBuckets && Next < NumPercentiles; ++Bucket)
+                {
+                    Seen += SpanStat.Histogram[0][Bucket] + SpanStat.Histogram[1][Bucket];
+                    while (Next < NumPercentiles && Seen >= Percentiles[Next] * Completed)
+                    {
+                        // Geometric middle of the bucket, in milliseconds.
+                        SetDoubleStat(PercentileStats[Next++], FMath::Pow(2.0, (Bucket + 0.5) / 4.0) / 1000.0);
+                    }
+                }
+            }
+        }
+        SpanStat.FrameExpired = 0;
+        if (bSwapWindows)
+        {
+            FMemory::Memcpy(SpanStat.Histogram[0], SpanStat.Histogram[1], sizeof(SpanStat.Histogram[1]));
+            FMemory::Memzero(SpanStat.Histogram[1], sizeof(SpanStat.Histogram[1]));
+            SpanStat.Completed[0] = SpanStat.Completed[1];
+            SpanStat.Completed[1] = 0;
+        }
+    }
+    if (bSwapWindows)
+    {
+        AsyncSpanWindowStart[0] = AsyncSpanWindowStart[1];
+        AsyncSpanWindowStart[1] = Now;
+    }
+}
+
+TStatIdData const* FLuaStats::CreateInternalStat(FName GroupName, const TCHAR* GroupDesc, const FString& StatName, bool bCycleStat)
+{
+    // Stats fed by native instrumentation rather than scripts: kept out of the definitions and the manifest.
+    const int32 PreviousGroup = ActiveGroup;
+    ActiveGroup = FindOrAddGroup(GroupName, GroupDesc);
+    const TStatId StatId = CreateStatId(FName(*StatName), *StatName, true, EStatDataType::ST_int64, bCycleStat);
+    ActiveGroup = PreviousGroup;
+    return StatId.GetRawPointer();
+}
+
+TStatIdData const* FLuaStats::CreateInstructionStat(const FString& StatName)
+{
+    // Unlike internal stats these are definitions, so captures and history record them next to the scope companions.
+    // Their group starts disabled like the internal ones: "stat LuaInstructions" turns it on.
+    const FName Name(*StatName);
+    const int32 SavedGroup = ActiveGroup;
+    ActiveGroup = FindOrAddGroup(TEXT("Instructions"), TEXT("Lua VM instructions"));
+    TStatIdData const* Result = CreateStat(ELuaStatType::Int64Counter, Name);
+    ActiveGroup = SavedGroup;
+    if (Result)
+    {
+        Definitions[NameToDefinition.FindChecked(Name)].bCompanion = true;
+    }
+    return Result;
+}
+
+int32 FLuaStats::FindOrAddRollup(TArray<FLuaRollup>& Rollups, TMap<FName, int32>& NameToRollup, const FString& Name, const TCHAR* Prefix)
+{
+    const FName RollupName(*Name);
+    if (const int32* Found = NameToRollup.Find(RollupName))
+    {
+        return *Found;
+    }
+    FLuaRollup Rollup;
+    Rollup.Name = RollupName;
+    const FString StatName = FString(Prefix) + Name;
+    Rollup.CyclesStat = CreateInternalStat(TEXT("Rollups"), TEXT("Lua time by script"), StatName, true);
+    Rollup.CallsStat = CreateInternalStat(TEXT("Rollups"), TEXT("Lua time by script"), StatName + TEXT("@Calls"), false);
+    const int32 Index = Rollups.Add(MoveTemp(Rollup));
+    NameToRollup.Emplace(RollupName, Index);
+    return Index;
+}
+
+void FLuaStats::CaptureRollupSource(FLuaRollupSlot& Slot, lua_State* L)
+{
+    // A stat is attributed to the script that first opens it; level 1 is the Lua caller of the binding.
+    lua_Debug Ar;
+    if (L == nullptr || !lua_getstack(L, 1, &Ar) || !lua_getinfo(L, "S", &Ar))
+    {
+        return;
+    }
+    const FString ScriptPath = LuaSourceToScriptPath(Ar.source);
+    Slot.Source = FindOrAddRollup(RollupSources, NameToRollupSource, ScriptPath, TEXT("Lua.Source."));
+    FLuaRollup& Source = RollupSources[Slot.Source];
+    if (Source.Module == INDEX_NONE)
+    {
+        Source.Module = FindOrAddRollup(RollupModules, NameToRollupModule, LuaScriptPathToModule(ScriptPath, RollupModuleDepth), TEXT("Lua.Module."));
+    }
+}
+
+void FLuaStats::AccumulateRollup(FLuaRollupSlot& Slot, TArray<int32>& DirtyList, int32 Index, uint64 SelfCycles)
+{
+    Slot.FrameCycles += SelfCycles;
+    ++Slot.FrameCalls;
+    if (!Slot.bDirty)
+    {
+        Slot.bDirty = true;
+        DirtyList.Add(Index);
+    }
+}
+
+void FLuaStats::SetRollupModuleDepth(int32 Depth)
+{
+    RollupModuleDepth = Depth;
+    for (FLuaRollup& Source : RollupSources)
+    {
+        Source.Module = FindOrAddRollup(RollupModules, NameToRollupModule, LuaScriptPathToModule(Source.Name.ToString(), Depth), TEXT("Lua.Module."));
+    }
+}
+
+void FLuaStats::FlushRollups()
+{
+    // Sampled stats only time some calls, so their self time is scaled up by the same ratio the sampler uses.
+    auto Collect = [this](FLuaRollupSlot& Slot, const FLuaStatSampler& Sampler)
+    {
+        double Cycles = static_cast<double>(Slot.FrameCycles);
+        if (Sampler.SampleRate > 1 && Sampler.FrameSamples > 0)
+        {
+            Cycles *= static_cast<double>(Sampler.FrameCalls) / Sampler.FrameSamples;
+        }
+        FLuaRollup& Source = RollupSources[Slot.Source];
+        Source.FrameCycles += static_cast<uint64>(Cycles);
+        Source.FrameCalls += Slot.FrameCalls;
+        FLuaRollup& Module = RollupModules[Source.Module];
+        Module.FrameCycles += static_cast<uint64>(Cycles);
+        Module.FrameCalls += Slot.FrameCalls;
+        Slot.FrameCycles = 0;
+        Slot.FrameCalls = 0;
+        Slot.bDirty = false;
+    };
+    for (const int32 Index : DirtyCycleCounters)
+    {
+        Collect(CycleCounters[Index].Rollup, CycleCounters[Index].Sampler);
+    }
+    for (const int32 Index : DirtySecondsStats)
+    {
+        Collect(SimpleSecondsStats[Index].Rollup, SimpleSecondsStats[Index].Sampler);
+    }
+    DirtyCycleCounters.Reset();
+    DirtySecondsStats.Reset();
+
+    const double MillisecondsPerCycle = FPlatformTime::GetSecondsPerCycle64() * 1000.0;
+    const bool bCollecting = FThreadStats::IsCollectingData();
+    for (TArray<FLuaRollup>* Rollups : { &RollupSources, &RollupModules })
+    {
+        for (FLuaRollup& Rollup : *Rollups)
+        {
+            Rollup.LastMs = Rollup.FrameCycles * MillisecondsPerCycle;
+            Rollup.LastCalls = Rollup.FrameCalls;
+            if (Rollup.FrameCalls > 0 && bCollecting && TStatId(Rollup.CyclesStat).IsValidStat())
+            {
+                FThreadStats::AddMessage(MinimalNameToName(Rollup.CyclesStat->Name), EStatOperation::Add,
+                    static_cast<int64>(FMath::Min<uint64>(Rollup.FrameCycles, MAX_uint32)), true);
+                FThreadStats::AddMessage(MinimalNameToName(Rollup.CallsStat->Name), EStatOperation::Set, static_cast<int64>(Rollup.FrameCalls));
+            }
+            Rollup.FrameCycles = 0;
+            Rollup.FrameCalls = 0;
+        }
+    }
+}
+
+void FLuaStats::Flush()
+{
+    // The native trackers publish through the registry, so their values are in this frame's snapshot.
+    FlushLuaTrackers();
+    const bool bWantSubtractOverhead = CVarLuaStatsSubtractOverhead.GetValueOnGameThread() != 0;
+    if (bWantSubtractOverhead != bSubtractOverhead)
+    {
+        SetSubtractOverhead(bWantSubtractOverhead);
+    }
+    if (ScopeOverheadStat && FThreadStats::IsCollectingData())
+    {
+        SetDoubleStat(ScopeOverheadStat, GetScopeOverheadNs());
+    }
+    // Counters open on this thread, and only between scopes so none is read half before and half after.
+    const bool bWantPerfCounters = CVarLuaStatsPerfCounters.GetValueOnGameThread() != 0;
+    if (bWantPerfCounters != bPerfCountersRequested && CycleCounterStack.Num() == 0)
+    {
+        SetPerfCounters(bWantPerfCounters);
+    }
+    const int32 WantModuleDepth = FMath::Max(CVarLuaStatsRollupModuleDepth.GetValueOnGameThread(), 1);
+    if (WantModuleDepth != RollupModuleDepth)
+    {
+        SetRollupModuleDepth(WantModuleDepth);
+    }
+    if (bRollups || DirtyCycleCounters.Num() > 0 || DirtySecondsStats.Num() > 0)
+    {
+        FlushRollups();
+    }
+    bRollups = CVarLuaStatsRollups.GetValueOnGameThread() != 0;
+    const double HistorySeconds = CVarLuaStatsHistoryMinutes.GetValueOnGameThread() * 60.0;
+    const int64 HistoryBudget = static_cast<int64>(FMath::Max(CVarLuaStatsHistoryBudgetMB.GetValueOnGameThread(), 1)) << 20;
+    if (!History.IsConfigured(HistorySeconds, HistoryBudget))
+    {
+        History.Configure(HistorySeconds, HistoryBudget);
+        UpdateMeasureAllValues();
+    }
+    if (AsyncSpanStats.Num() > 0)
+    {
+        FlushAsyncSpans();
+    }
+    if (TopKeys.Num() > 0)
+    {
+        FlushTopKeys();
+    }
+
+    if (PendingCycleCounters.Num() > 0 || PendingSecondsStats.Num() > 0)
+    {
+        FlushPendingCycles();
+    }
+
+    const double MillisecondsPerCycle = FPlatformTime::GetSecondsPerCycle64() * 1000.0;
+    for (const int32 Index : SampledCycleCounters)
+    {
+        FLuaCycleCounter& Counter = CycleCounters[Index];
+        uint32 Calls;
+        double StdErr;
+        const double Cycles = Counter.Sampler.Extrapolate(Calls, StdErr);
+        Values[Counter.Definition] += Cycles;
+        if (Calls > 0 && Counter.GetStatId().IsValidStat() && FThreadStats::IsCollectingData())
+        {
+            FThreadStats::AddMessage(Counter.GetStatId().GetName(), EStatOperation::Add,
+                static_cast<int64>(FMath::Min(Cycles, static_cast<double>(MAX_uint32))), true);
+            SetInt64Stat(Counter.Sampler.CallsStat, Calls);
+            if (Counter.Sampler.StdErrStat)
+            {
+                SetDoubleStat(Counter.Sampler.StdErrStat, StdErr * MillisecondsPerCycle);
+            }
+        }
+    }
+    const double SecondsPerCycle = FPlatformTime::GetSecondsPerCycle64();
+    for (const int32 Index : SampledSecondsStats)
+    {
+        FLuaSimpleSecondsStat& Stat = SimpleSecondsStats[Index];
+        uint32 Calls;
+        double StdErr;
+        const double Cycles = Stat.Sampler.Extrapolate(Calls, StdErr);
+        Values[Stat.Definition] += Cycles * SecondsPerCycle * Stat.GetScale();
+        if (Calls > 0 && Stat.GetStatId().IsValidStat() && FThreadStats::IsCollectingData())
+        {
+            FThreadStats::AddMessage(Stat.GetStatId().GetName(), EStatOperation::Add, Cycles * SecondsPerCycle * Stat.GetScale());
+            SetInt64Stat(Stat.Sampler.CallsStat, Calls);
+            if (Stat.Sampler.StdErrStat)
+            {
+                SetDoubleStat(Stat.Sampler.StdErrStat, StdErr * SecondsPerCycle * Stat.GetScale());
+            }
+        }
+    }
+
+    if (Parents.Num() > 0)
+    {
+        FlushParents();
+    }
+    if (CsvCapture)
+    {
+        WriteCsvRow();
+    }
+    if (SharedMemory.IsOpen())
+    {
+        SharedMemory.Publish(Definitions, Values);
+    }
+    if (ColumnarCapture.IsOpen())
+    {
+        ColumnarCapture.Append(Definitions, Values);
+    }
+    if (History.IsEnabled())
+    {
+        History.Record(Values);
+    }
+    // Counters start every frame from zero in the stats system, and so do their mirrors.
+    for (int32 Index = 0; Index < Definitions.Num(); ++Index)
+    {
+        const ELuaStatType Type = Definitions[Index].Type;
+        if (Type == ELuaStatType::CycleCounter || Type == ELuaStatType::Int64Counter || Type == ELuaStatType::DoubleCounter)
+        {
+            Values[Index] = 0.0;
+        }
+    }
+}
+
+bool FLuaStats::StartCsvCapture(const FString& Path)
+{
+    // One column per stat known when the capture starts, one row per frame: the input of Tools/LuaStatsCompare.
+    StopCsvCapture();
+    CsvCapture.Reset(IFileManager::Get().CreateFileWriter(*Path));
+    if (!CsvCapture)
+    {
+        return false;
+    }
+    CsvColumns = Definitions.Num();
+    UpdateMeasureAllValues();
+    FString Header;
+    for (int32 Index = 0; Index < CsvColumns; ++Index)
+    {
+        Header += Index > 0 ? TEXT(",") : TEXT("");
+        Header += Definitions[Index].Name.ToString();
+    }
+    Header += TEXT("\n");
+    FTCHARToUTF8 Utf8(*Header);
+    CsvCapture->Serialize(const_cast<ANSICHAR*>(Utf8.Get()), Utf8.Length());
+    return true;
+}
+
+void FLuaStats::StopCsvCapture()
+{
+    if (CsvCapture)
+    {
+        CsvCapture->Close();
+        CsvCapture.Reset();
+        UpdateMeasureAllValues();
+    }
+}
+
+bool FLuaStats::StartSharedMemory(const FString& Name, int32 Capacity)
+{
+    // Room for the stats registered so far and as many again, unless asked for more.
+    const bool bOpened = SharedMemory.Open(Name, FMath::Max3(Capacity, Definitions.Num() * 2, 1024));
+    UpdateMeasureAllValues();
+    return bOpened;
+}
+
+void FLuaStats::StopSharedMemory()
+{
+    SharedMemory.Close();
+    UpdateMeasureAllValues();
+}
+
+bool FLuaStats::StartColumnarCapture(const FString& Path)
+{
+    const bool bOpened = ColumnarCapture.Open(Path);
+    UpdateMeasureAllValues();
+    return bOpened;
+}
+
+void FLuaStats::StopColumnarCapture()
+{
+    ColumnarCapture.Close();
+    UpdateMeasureAllValues();
+}
+
+void FLuaStats::UpdateMeasureAllValues()
+{
+    bMeasureAllValues = CsvCapture.IsValid() || SharedMemory.IsOpen() || ColumnarCapture.IsOpen() || History.IsEnabled();
+}
+
+bool FLuaStats::ReadStatKey(lua_State* L, int32 Index, FLuaStatKey& OutKey)
+{
+    OutKey.LuaType = lua_type(L, Index);
+    switch (OutKey.LuaType)
+    {
+    case LUA_TNONE:
+    case LUA_TNIL:
+        OutKey.LuaType = LUA_TNONE;
+        return false;
+    case LUA_TNUMBER:
+    case LUA_TBOOLEAN:
+        OutKey.Number = OutKey.LuaType == LUA_TNUMBER ? lua_tonumber(L, Index) : lua_toboolean(L, Index);
+        FMemory::Memcpy(&OutKey.Hash, &OutKey.Number, sizeof(OutKey.Hash));
+        break;
+    case LUA_TSTRING:
+    {
+        // Only the hash travels with the key; the text is cached for labels, and the cache is bounded too.
+        size_t Length = 0;
+        const char* String = lua_tolstring(L, Index, &Length);
+        OutKey.Hash = CityHash64(String, Length);
+        if (!StringKeyLabels.Contains(OutKey.Hash))
+        {
+            if (StringKeyLabels.Num() >= 4096)
+            {
+                StringKeyLabels.Reset();
+            }
+            StringKeyLabels.Add(OutKey.Hash, UTF8_TO_TCHAR(String));
+        }
+        break;
+    }
+    default:
+        OutKey.Pointer = lua_topointer(L, Index);
+        OutKey.Hash = static_cast<uint64>(reinterpret_cast<UPTRINT>(OutKey.Pointer));
+        break;
+    }
+    OutKey.Hash ^= static_cast<uint64>(OutKey.LuaType) * 0x9E3779B97F4A7C15ull;
+    return true;
+}
+
+FString FLuaStats::GetKeyLabel(const FLuaStatKey& Key) const
+{
+    static const TCHAR* const LuaTypeNames[] = { TEXT("nil"), TEXT("boolean"), TEXT("lightuserdata"), TEXT("number"), TEXT("string"),
+        TEXT("table"), TEXT("function"), TEXT("userdata"), TEXT("thread") };
+    switch (Key.LuaType)
+    {
+    case LUA_TNUMBER:
+        return FString::Printf(TEXT("%.14g"), Key.Number);
+    case LUA_TBOOLEAN:
+        return Key.Number != 0.0 ? TEXT("true") : TEXT("false");
+    case LUA_TSTRING:
+        if (const FString* Label = StringKeyLabels.Find(Key.Hash))
+        {
+            return *Label;
+        }
+        return FString::Printf(TEXT("string %016llx"), Key.Hash);
+    default:
+        return FString::Printf(TEXT("%s %p"), Key.LuaType >= 0 && Key.LuaType < static_cast<int32>(UE_ARRAY_COUNT(LuaTypeNames)) ? LuaTypeNames[Key.LuaType] : TEXT("?"), Key.Pointer);
+    }
+}
+
+void FLuaStats::AddKeyedCost(int32 Definition, const FLuaStatKey& Key, double Weight)
+{
+    TopKeys.FindOrAdd(Definition).Add(Key, Weight);
+}
+
+void FLuaStats::FlushTopKeys()
+{
+    const int32 NumPublished = FMath::Clamp(CVarLuaStatsTopKeys.GetValueOnGameThread(), 0, LuaTopKeyCapacity);
+    const double MillisecondsPerCycle = FPlatformTime::GetSecondsPerCycle64() * 1000.0;
+    const bool bCollecting = FThreadStats::IsCollectingData();
+    for (TPair<int32, FLuaTopKeys>& Pair : TopKeys)
+    {
+        FLuaTopKeys& Keys = Pair.Value;
+        // Copies: creating the rank stats below adds definitions, which can reallocate Definitions.
+        const FName StatName = Definitions[Pair.Key].Name;
+        const ELuaStatType Type = Definitions[Pair.Key].Type;
+        const double Scale = Type == ELuaStatType::CycleCounter ? MillisecondsPerCycle : 1.0;
+        Keys.Entries.Sort([](const FLuaTopKeyEntry& A, const FLuaTopKeyEntry& B) { return A.Weight > B.Weight; });
+        Keys.Last.Reset();
+        for (int32 Rank = 0; Rank < Keys.Entries.Num() && Rank < NumPublished; ++Rank)
+        {
+            FLuaTopKeyEntry& Entry = Keys.Last.Add_GetRef(Keys.Entries[Rank]);
+            Entry.Weight *= Scale;
+            Entry.Error *= Scale;
+        }
+        Keys.Reset();
+
+        while (Keys.RankStats.Num() < Keys.Last.Num())
+        {
+            Keys.RankStats.Add(CreateCompanionStat(ELuaStatType::DoubleCounter, StatName, *FString::Printf(TEXT("@Top%d"), Keys.RankStats.Num() + 1)));
+        }
+        for (int32 Rank = 0; bCollecting && Rank < Keys.Last.Num(); ++Rank)
+        {
+            if (Keys.RankStats[Rank])
+            {
+                SetDoubleStat(Keys.RankStats[Rank], Keys.Last[Rank].Weight);
+            }
+        }
+    }
+}
+
+const TArray<FLuaTopKeyEntry>* FLuaStats::GetTopKeys(FName StatName) const
+{
+    const int32* Definition = NameToDefinition.Find(StatName);
+    const FLuaTopKeys* Keys = Definition ? TopKeys.Find(*Definition) : nullptr;
+    return Keys ? &Keys->Last : nullptr;
+}
+
+void FLuaStats::LogTopKeys(const FString& Filter) const
+{
+    for (const TPair<int32, FLuaTopKeys>& Pair : TopKeys)
+    {
+        const FString StatName = Definitions[Pair.Key].Name.ToString();
+        if (Pair.Value.Last.Num() == 0 || (!Filter.IsEmpty() && !StatName.Contains(Filter)))
+        {
+            continue;
+        }
+        UE_LOG(LogLuaStats, Display, TEXT("%s"), *StatName);
+        for (const FLuaTopKeyEntry& Entry : Pair.Value.Last)
+        {
+            UE_LOG(LogLuaStats, Display, TEXT("    %-40s %12.4f  (%u calls, error <= %.4f)"), *GetKeyLabel(Entry.Key), Entry.Weight, Entry.Calls, Entry.Error);
+        }
+    }
+}
+
+FString FLuaStats::GetDefaultHistoryPath()
+{
+    return FPaths::ProjectSavedDir() / TEXT("LuaStats") / FString::Printf(TEXT("History-%s.csv"), *FDateTime::Now().ToString());
+}
+
+bool FLuaStats::GetHistory(FName StatName, double Seconds, TArray<double>& OutSecondsAgo, TArray<double>& OutValues) const
+{
+    const int32* Definition = NameToDefinition.Find(StatName);
+    FLuaHistoryWindow Window;
+    TBitArray<> Recorded;
+    TArray<double> Samples;
+    if (!Definition || !History.GetWindow(Seconds, 0.0, Window) || !History.ReadSeries(*Definition, Window, Recorded, Samples))
+    {
+        return false;
+    }
+    const double Scale = Definitions[*Definition].Type == ELuaStatType::CycleCounter ? FPlatformTime::GetSecondsPerCycle64() * 1000.0 : 1.0;
+    for (int32 Index = 0; Index < Samples.Num(); ++Index)
+    {
+        if (Recorded[Index])
+        {
+            OutSecondsAgo.Add(Window.SecondsAgo[Index]);
+            OutValues.Add(Samples[Index] * Scale);
+        }
+    }
+    return true;
+}
+
+bool FLuaStats::DumpHistory(const FString& Path, double Seconds, double EndSecondsAgo, const FString& Filter) const
+{
+    // Same layout as LuaStats.CaptureCsv plus the frame and its age, so the comparison tools read it too.
+    FLuaHistoryWindow Window;
+    if (!History.GetWindow(Seconds, EndSecondsAgo, Window))
+    {
+        return false;
+    }
+    const int32 NumSamples = Window.Frames.Num();
+    const double MillisecondsPerCycle = FPlatformTime::GetSecondsPerCycle64() * 1000.0;
+    TArray<FString> Rows;
+    Rows.SetNum(NumSamples + 1);
+    Rows[0] = TEXT("Frame,SecondsAgo");
+    for (int32 Index = 0; Index < NumSamples; ++Index)
+    {
+        Rows[Index + 1] = FString::Printf(TEXT("%llu,%.4f"), Window.Frames[Index], Window.SecondsAgo[Index]);
+    }
+    TBitArray<> Recorded;
+    TArray<double> Samples;
+    for (int32 Definition = 0; Definition < Definitions.Num(); ++Definition)
+    {
+        const FString Name = Definitions[Definition].Name.ToString();
+        if ((!Filter.IsEmpty() && !Name.Contains(Filter)) || !History.ReadSeries(Definition, Window, Recorded, Samples))
+        {
+            continue;
+        }
+        const double Scale = Definitions[Definition].Type == ELuaStatType::CycleCounter ? MillisecondsPerCycle : 1.0;
+        Rows[0] += TEXT(",") + Name;
+        for (int32 Index = 0; Index < NumSamples; ++Index)
+        {
+            Rows[Index + 1] += Recorded[Index] ? FString::Printf(TEXT(",%.6g"), Samples[Index] * Scale) : FString(TEXT(","));
+        }
+    }
+    return FFileHelper::SaveStringToFile(FString::Join(Rows, TEXT("\n")) + TEXT("\n"), *Path, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM);
+}
+
+void FLuaStats::WriteCsvRow()
+{
+    // Cycle counters are written in milliseconds so captures from different machines compare.
+    const double MillisecondsPerCycle = FPlatformTime::GetSecondsPerCycle64() * 1000.0;
+    FString Row;
+    Row.Reserve(CsvColumns * 8);
+    for (int32 Index = 0; Index < CsvColumns; ++Index)
+    {
+        const double Value = Definitions[Index].Type == ELuaStatType::CycleCounter ? Values[Index] * MillisecondsPerCycle : Values[Index];
+        Row += Index > 0 ? TEXT(",") : TEXT("");
+        Row += FString::Printf(TEXT("%.6g"), Value);
+    }
+    Row += TEXT("\n");
+    FTCHARToUTF8 Utf8(*Row);
+    CsvCapture->Serialize(const_cast<ANSICHAR*>(Utf8.Get()), Utf8.Length());
+}
+
+FLuaStats GLuaStats;
+
+FName GetLuaStatName(TStatIdData const* StatIdPtr)
+{
+    return GLuaStats.GetStatName(StatIdPtr);
+}
+
+TStatIdData const* ResolveLuaStat(ELuaStatType Type, FName StatName)
+{
+    return GLuaStats.ResolveStat(Type, StatName);
+}
+
+void FlushLuaStats()
+{
+    GLuaStats.Flush();
+}
+
+bool StopLuaCycleCounter()
+{
+    return GLuaStats.StopCycleCounter();
+}
+
+double GetLuaParentValue(FName ParentName)
+{
+    return GLuaStats.GetParentValue(ParentName);
+}
+
+static FDelayedAutoRegisterHelper GLuaStatsManifestLoader(EDelayedRegisterRunPhase::EndOfEngineInit, []()
+{
+    // Runs before any game Lua is loaded, so scripts only claim handles instead of paying for stat setup.
+    GLuaStats.LoadManifest(FLuaStats::GetDefaultManifestPath());
+    FCoreDelegates::OnEndFrame.AddRaw(&GLuaStats, &FLuaStats::Flush);
+    // The columnar writer thread has to be joined before static destruction.
+    FCoreDelegates::OnPreExit.AddRaw(&GLuaStats, &FLuaStats::StopColumnarCapture);
+    FString SharedMemoryName;
+    if (FParse::Value(FCommandLine::Get(), TEXT("LuaStatsSharedMemory="), SharedMemoryName) && !GLuaStats.StartSharedMemory(SharedMemoryName, 0))
+    {
+        UE_LOG(LogLuaStats, Warning, TEXT("Failed to open Lua stat shared memory %s"), *SharedMemoryName);
+    }
+});
+
+static FAutoConsoleCommand GLuaStatsSaveManifestCommand(
+    TEXT("LuaStats.SaveManifest"),
+    TEXT("Writes every registered Lua stat to the manifest preloaded on the next run. Optional argument: file path."),
+    FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+    {
+        const FString Path = Args.Num() > 0 ? Args[0] : FLuaStats::GetDefaultManifestPath();
+        if (!GLuaStats.SaveManifest(Path))
+        {
+            UE_LOG(LogLuaStats, Warning, TEXT("Failed to write Lua stat manifest to %s"), *Path);
+        }
+    }));
+
+static FAutoConsoleCommand GLuaStatsCaptureCsvCommand(
+    TEXT("LuaStats.CaptureCsv"),
+    TEXT("Starts writing every Lua stat's per-frame value to a CSV file, or stops with \"stop\". Optional argument: file path."),
+    FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+    {
+        if (Args.Num() > 0 && Args[0] == TEXT("stop"))
+        {
+            GLuaStats.StopCsvCapture();
+            return;
+        }
+        const FString Path = Args.Num() > 0 ? Args[0]
+            : FPaths::ProjectSavedDir() / TEXT("LuaStats") / FString::Printf(TEXT("Capture-%s.csv"), *FDateTime::Now().ToString());
+        if (!GLuaStats.StartCsvCapture(Path))
+        {
+            UE_LOG(LogLuaStats, Warning, TEXT("Failed to open Lua stat capture %s"), *Path);
+        }
+    }));
+
+static FAutoConsoleCommand GLuaStatsCaptureColumnarCommand(
+    TEXT("LuaStats.CaptureColumnar"),
+    TEXT("Starts writing every Lua stat's per-frame value to a compressed columnar .lscf file from a background thread, or stops with \"stop\". Optional argument: file path."),
+    FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+    {
+        if (Args.Num() > 0 && Args[0] == TEXT("stop"))
+        {
+            GLuaStats.StopColumnarCapture();
+            return;
+        }
+        const FString Path = Args.Num() > 0 ? Args[0]
+            : FPaths::ProjectSavedDir() / TEXT("LuaStats") / FString::Printf(TEXT("Capture-%s.lscf"), *FDateTime::Now().ToString());
+        if (!GLuaStats.StartColumnarCapture(Path))
+        {
+            UE_LOG(LogLuaStats, Warning, TEXT("Failed to open Lua stat capture %s"), *Path);
+        }
+    }));
+
+static FAutoConsoleCommand GLuaStatsDumpHistoryCommand(
+    TEXT("LuaStats.DumpHistory"),
+    TEXT("Writes the last seconds of LuaStats.HistoryMinutes to a CSV file. Optional arguments: seconds (default 120), file path, stat name filter."),
+    FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+    {
+        const double Seconds = Args.Num() > 0 ? FCString::Atod(*Args[0]) : 120.0;
+        const FString Path = Args.Num() > 1 ? Args[1] : FLuaStats::GetDefaultHistoryPath();
+        const FString Filter = Args.Num() > 2 ? Args[2] : FString();
+        if (GLuaStats.DumpHistory(Path, Seconds, 0.0, Filter))
+        {
+            UE_LOG(LogLuaStats, Log, TEXT("Wrote Lua stat history to %s"), *Path);
+        }
+        else
+        {
+            UE_LOG(LogLuaStats, Warning, TEXT("Failed to write Lua stat history to %s, is LuaStats.HistoryMinutes set?"), *Path);
+        }
+    }));
+
+static FAutoConsoleCommand GLuaStatsDumpTopKeysCommand(
+    TEXT("LuaStats.DumpTopKeys"),
+    TEXT("Logs the last frame's heaviest keys of every Lua stat timed or counted with a key. Optional argument: stat name filter."),
+    FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+    {
+        GLuaStats.LogTopKeys(Args.Num() > 0 ? Args[0] : FString());
+    }));
+
+static FAutoConsoleCommand GLuaStatsSharedMemoryCommand(
+    TEXT("LuaStats.SharedMemory"),
+    TEXT("Publishes every Lua stat's per-frame value to a shared-memory segment read by Tools/LuaStatsMonitor, or stops with \"stop\". Optional arguments: segment name, capacity."),
+    FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+    {
+        if (Args.Num() > 0 && Args[0] == TEXT("stop"))
+        {
+            GLuaStats.StopSharedMemory();
+            return;
+        }
+        const FString Name = Args.Num() > 0 ? Args[0] : FString::Printf(TEXT("/LuaStats.%u"), FPlatformProcess::GetCurrentProcessId());
+        const int32 Capacity = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 0;
+        if (GLuaStats.StartSharedMemory(Name, Capacity))
+        {
+            UE_LOG(LogLuaStats, Log, TEXT("Publishing Lua stats to shared memory %s"), *Name);
+        }
+        else
+        {
+            UE_LOG(LogLuaStats, Warning, TEXT("Failed to open Lua stat shared memory %s"), *Name);
+        }
+    }));
+
+static FAutoConsoleCommand GLuaStatsCalibrateCommand(
+    TEXT("LuaStats.Calibrate"),
+    TEXT("Measures the cost of a nested Lua cycle counter scope on this machine, as subtracted by LuaStats.SubtractOverhead."),
+    FConsoleCommandDelegate::CreateLambda([]()
+    {
+        CalibrateLuaScopeOverhead();
+    }));
+
+static FAutoConsoleCommand GLuaStatsEnableGroupCommand(
+    TEXT("LuaStats.EnableGroup"),
+    TEXT("Enables or disables one Lua stat group. Arguments: group name (as passed to LuaStats.Group), 1/0."),
+    FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+    {
+        if (Args.Num() > 0)
+        {
+            const bool bEnable = Args.Num() < 2 || FCString::ToBool(*Args[1]);
+            if (!GLuaStats.EnableGroup(FName(*Args[0]), bEnable))
+            {
+                UE_LOG(LogLuaStats, Warning, TEXT("Unknown Lua stat group %s"), *Args[0]);
+            }
+        }
+    }));
+
+static void LuaStatsHook(lua_State* L, lua_Debug* Ar);
+static void OnLuaStateClosed(lua_State* L);
+static void HookLuaThreads(lua_State* L);
+static bool IsLuaStatsBinding(lua_CFunction Function);
+
+struct FLuaLineChunk
+{
+    FString Source;
+    TArray<ANSICHAR> SourceAnsi;
+    TArray<uint32> Hits;
+    TArray<uint64> Cycles;
+};
+
+struct FLuaCachedSource
+{
+    TArray<ANSICHAR> Text;
+    int32 Chunk;
+};
+
+class FLuaLineProfiler
+{
+private:
+    lua_State* State = nullptr;
+    TArray<FString> Allowlist;
+    TArray<FLuaLineChunk> Chunks;
+    TMap<const char*, FLuaCachedSource> SourceToChunk;
+    const char* LastSource = nullptr;
+    int32 LastChunk = INDEX_NONE;
+
+    lua_State* PendingState = nullptr;
+    int32 PendingChunk = INDEX_NONE;
+    int32 PendingLine = 0;
+    uint64 PendingCycles = 0;
+    // Allowlisted frames open per coroutine, counted on call and return; coroutines without any are not in the map.
+    // Errors and tail calls can leave a count too high but never too low, so a return with none open skips the
+    // caller lookup: the caller cannot be allowlisted.
+    TMap<lua_State*, int32> ProfiledFrames;
+
+    int32 FindChunk(const char* Source);
+    void SetLineHook(lua_State* L, bool bEnable) const;
+    void ClosePending(uint64 Now);
+
+public:
+    bool IsActive() const
+    {
+        return State != nullptr;
+    }
+
+    int32 GetHookMask() const
+    {
+        return State ? LUA_MASKCALL | LUA_MASKRET : 0;
+    }
+
+    bool Start(lua_State* L, TArray<FString>&& InAllowlist);
+    void Stop();
+    void OnStateClosed(lua_State* L);
+    void OnHook(lua_State* L, lua_Debug* Ar);
+    bool Dump(const FString& Path, int32 MaxLines) const;
+
+    static FString GetDefaultDumpPath()
+    {
+        return FPaths::ProjectSavedDir() / TEXT("LuaStats") / TEXT("LineProfile.txt");
+    }
+};
+
+FLuaLineProfiler GLuaLineProfiler;
+
+struct FLuaNativeFunction
+{
+    FName Name;
+    uint64 FrameCycles = 0;
+    uint32 FrameCalls = 0;
+    TStatIdData const* CyclesStat = nullptr;
+    TStatIdData const* CallsStat = nullptr;
+};
+
+struct FLuaNativeFrame
+{
+    // INDEX_NONE for Lua functions and for our own stat bindings, which are not billed as native work.
+    int32 Function;
+    const void* Closure;
+};
+
+// Pushes the table the registry keeps under Key, with weak keys, creating it on first use.
+static void PushLuaWeakKeyTable(lua_State* L, const void* Key)
+{
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, Key) != LUA_TTABLE)
+    {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_createtable(L, 0, 1);
+        lua_pushstring(L, "k");
+        lua_setfield(L, -2, "__mode");
+        lua_setmetatable(L, -2);
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, Key);
+    }
+}
+
+// Call stacks mirrored per coroutine. The coroutines seen are also kept in a weak-keyed registry table: one that
+// was collected drops out of it, so its stack is discarded at the next Prune, and a new coroutine allocated at
+// the same address starts from an empty stack instead of inheriting the dead one's frames.
+template <typename FrameType>
+class TLuaThreadStacks
+{
+public:
+    TArray<FrameType>& Find(lua_State* L)
+    {
+        if (L != LastState)
+        {
+            LastState = L;
+            LastStack = &Stacks.FindOrAdd(L);
+            if (!Watch(L))
+            {
+                LastStack->Reset();
+            }
+        }
+        return *LastStack;
+    }
+
+    // Drops the stacks of coroutines collected since they were first seen; MainState is the state they ran on.
+    void Prune(lua_State* MainState)
+    {
+        TSet<lua_State*> Live;
+        if (lua_rawgetp(MainState, LUA_REGISTRYINDEX, this) == LUA_TTABLE)
+        {
+            lua_pushnil(MainState);
+            while (lua_next(MainState, -2))
+            {
+                Live.Add(lua_tothread(MainState, -2));
+                lua_pop(MainState, 1);
+            }
+        }
+        lua_pop(MainState, 1);
+        for (auto It = Stacks.CreateIterator(); It; ++It)
+        {
+            if (!Live.Contains(It.Key()))
+            {
+                It.RemoveCurrent();
+            }
+        }
+        LastState = nullptr;
+        LastStack = nullptr;
+    }
+
+    // Forgets every stack, and the registry table too unless MainState is null because the state is closing.
+    void Reset(lua_State* MainState)
+    {
+        if (MainState)
+        {
+            lua_pushnil(MainState);
+            lua_rawsetp(MainState, LUA_REGISTRYINDEX, this);
+        }
+        Stacks.Reset();
+        LastState = nullptr;
+        LastStack = nullptr;
+    }
+
+private:
+    // Returns whether L was seen before, and remembers it if not.
+    bool Watch(lua_State* L)
+    {
+        PushLuaWeakKeyTable(L, this);
+        lua_pushthread(L);
+        const bool bKnown = lua_rawget(L, -2) != LUA_TNIL;
+        lua_pop(L, 1);
+        if (!bKnown)
+        {
+            lua_pushthread(L);
+            lua_pushboolean(L, 1);
+            lua_rawset(L, -3);
+        }
+        lua_pop(L, 1);
+        return bKnown;
+    }
+
+    TMap<lua_State*, TArray<FrameType>> Stacks;
+    lua_State* LastState = nullptr;
+    TArray<FrameType>* LastStack = nullptr;
+};
+
+class FLuaNativeTracker
+{
+private:
+    lua_State* State = nullptr;
+    TArray<FLuaNativeFunction> Functions;
+    TMap<FName, int32> NameToFunction;
+    TLuaThreadStacks<FLuaNativeFrame> Stacks;
+    int32 RunningFunction = INDEX_NONE;
+    uint64 LastCycles = 0;
+
+    int32 FindFunction(lua_State* L, lua_Debug* Ar, const void*& OutClosure);
+
+public:
+    bool IsActive() const
+    {
+        return State != nullptr;
+    }
+
+    int32 GetHookMask() const
+    {
+        return State ? LUA_MASKCALL | LUA_MASKRET : 0;
+    }
+
+    bool Start(lua_State* L);
+    void Stop();
+    void OnStateClosed(lua_State* L);
+    void OnHook(lua_State* L, lua_Debug* Ar);
+    void Flush();
+};
+
+FLuaNativeTracker GLuaNativeTracker;
+
+struct FLuaInstructionFunction
+{
+    FName Name;
+    uint64 FrameInstructions = 0;
+    TStatIdData const* Stat = nullptr;
+};
+
+struct FLuaInstructionFrame
+{
+    // INDEX_NONE for C functions, which execute no VM instructions of their own.
+    int32 Function;
+    const void* Closure;
+};
+
+struct FLuaInstructionClosure
+{
+    int32 Function;
+    // The prototype the closure was created from: a collected closure's address can be reused by another function.
+    const char* Source;
+    int32 LineDefined;
+};
+
+// Counts VM instructions with a count hook every Period instructions, so costs are machine independent: with a
+// period of 1 a scope reports the same count on every run of the same script. Optionally also attributes
+// instructions to the Lua function that executed them, through call and return events.
+class FLuaInstructionCounter
+{
+private:
+    lua_State* State = nullptr;
+    bool bFunctions = false;
+    int32 Period = 1;
+    TArray<FLuaInstructionFunction> Functions;
+    TMap<FName, int32> NameToFunction;
+    TMap<const void*, FLuaInstructionClosure> ClosureToFunction;
+    TLuaThreadStacks<FLuaInstructionFrame> Stacks;
+    int32 RunningFunction = INDEX_NONE;
+    uint64 LastCount = 0;
+
+    int32 FindFunction(lua_State* L, lua_Debug* Ar, const void*& OutClosure);
+
+public:
+    bool IsActive() const
+    {
+        return State != nullptr;
+    }
+
+    int32 GetHookMask() const
+    {
+        return State ? LUA_MASKCOUNT | (bFunctions ? LUA_MASKCALL | LUA_MASKRET : 0) : 0;
+    }
+
+    int32 GetHookCount() const
+    {
+        return State ? Period : 0;
+    }
+
+    FORCEINLINE void OnCount()
+    {
+        GLuaInstructionCount += Period;
+    }
+
+    bool Start(lua_State* L, bool bInFunctions, int32 InPeriod);
+    void Stop();
+    void OnStateClosed(lua_State* L);
+    void OnHook(lua_State* L, lua_Debug* Ar);
+    void Flush();
+};
+
+FLuaInstructionCounter GLuaInstructionCounter;
+
+// All native hooks share the single lua_sethook slot of a state; each feature contributes to the mask.
+static int32 GetLuaStatsHookMask()
+{
+    return GLuaLineProfiler.GetHookMask() | GLuaNativeTracker.GetHookMask() | GLuaInstructionCounter.GetHookMask();
+}
+
+static int32 GetLuaStatsHookCount()
+{
+    return GLuaInstructionCounter.GetHookCount();
+}
+
+static bool UpdateLuaStatsHook(lua_State* L)
+{
+    const lua_Hook Existing = lua_gethook(L);
+    if (Existing != nullptr && Existing != LuaStatsHook)
+    {
+        UE_LOG(LogLuaStats, Warning, TEXT("Lua state already has a debug hook installed, native Lua profiling is unavailable"));
+        return false;
+    }
+    const int32 Mask = GetLuaStatsHookMask();
+    lua_sethook(L, Mask ? LuaStatsHook : nullptr, Mask, GetLuaStatsHookCount());
+    return true;
+}
+
+static void LuaStatsHook(lua_State* L, lua_Debug* Ar)
+{
+    if (Ar->event == LUA_HOOKCOUNT && GLuaInstructionCounter.IsActive())
+    {
+        // By far the most frequent event while counting, and nothing else listens to it.
+        GLuaInstructionCounter.OnCount();
+        return;
+    }
+    const int32 Mask = GetLuaStatsHookMask();
+    if (!GLuaLineProfiler.IsActive() && (lua_gethookmask(L) != Mask || lua_gethookcount(L) != GetLuaStatsHookCount()))
+    {
+        // Coroutines that inherited the hook while a profiler ran pick up the current mask on their next event.
+        lua_sethook(L, Mask ? LuaStatsHook : nullptr, Mask, GetLuaStatsHookCount());
+        if (Mask == 0)
+        {
+            return;
+        }
+    }
+    if (Ar->event == LUA_HOOKCOUNT)
+    {
+        return;
+    }
+    if (GLuaInstructionCounter.IsActive())
+    {
+        GLuaInstructionCounter.OnHook(L, Ar);
+    }
+    if (GLuaNativeTracker.IsActive())
+    {
+        GLuaNativeTracker.OnHook(L, Ar);
+    }
+    if (GLuaLineProfiler.IsActive())
+    {
+        GLuaLineProfiler.OnHook(L, Ar);
+    }
+}
+
+static lua_State* GetLuaMainThread(lua_State* L)
+{
+    lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+    lua_State* MainThread = lua_tothread(L, -1);
+    lua_pop(L, 1);
+    return MainThread ? MainThread : L;
+}
+
+static int32 LuaStateSentinel_Finalize(lua_State* L)
+{
+    // lua_close runs the remaining finalizers on the main thread, before any of the state is freed.
+    OnLuaStateClosed(L);
+    return 0;
+}
+
+// Profilers keep the main thread of the state they watch. A userdata only the registry references is finalized
+// when the state closes, which tells them to let go of it instead of touching freed memory later.
+static void WatchLuaStateClose(lua_State* L)
+{
+    static const char SentinelKey = 0;
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, &SentinelKey) == LUA_TNIL)
+    {
+        lua_newuserdata(L, 0);
+        lua_createtable(L, 0, 1);
+        lua_pushcfunction(L, LuaStateSentinel_Finalize);
+        lua_setfield(L, -2, "__gc");
+        lua_setmetatable(L, -2);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, &SentinelKey);
+    }
+    lua_pop(L, 1);
+}
+
+bool FLuaLineProfiler::Start(lua_State* L, TArray<FString>&& InAllowlist)
+{
+    if (State != nullptr)
+    {
+        Stop();
+    }
+    Allowlist = MoveTemp(InAllowlist);
+    Chunks.Reset();
+    SourceToChunk.Reset();
+    LastSource = nullptr;
+    LastChunk = INDEX_NONE;
+    PendingState = nullptr;
+    PendingChunk = INDEX_NONE;
+    ProfiledFrames.Reset();
+
+    // Hooks are per coroutine; ones created from the main thread after this point inherit it.
+    State = GetLuaMainThread(L);
+    if (!UpdateLuaStatsHook(State))
+    {
+        State = nullptr;
+        return false;
+    }
+    if (L != State)
+    {
+        UpdateLuaStatsHook(L);
+    }
+    // Allowlisted functions already running on the calling thread get no call event.
+    int32 OpenFrames = 0;
+    lua_Debug Frame;
+    for (int32 Level = 0; lua_getstack(L, Level, &Frame); ++Level)
+    {
+        OpenFrames += lua_getinfo(L, "S", &Frame) && FindChunk(Frame.source) != INDEX_NONE ? 1 : 0;
+    }
+    if (OpenFrames > 0)
+    {
+        ProfiledFrames.Add(L, OpenFrames);
+    }
+    WatchLuaStateClose(State);
+    return true;
+}
+
+void FLuaLineProfiler::Stop()
+{
+    if (State == nullptr)
+    {
+        return;
+    }
+    lua_State* const OldState = State;
+    OnStateClosed(State);
+    UpdateLuaStatsHook(OldState);
+}
+
+void FLuaLineProfiler::OnStateClosed(lua_State* L)
+{
+    if (State == nullptr || State != L)
+    {
+        return;
+    }
+    // The collected lines stay for Dump; the cached source pointers belong to the state.
+    ClosePending(FPlatformTime::Cycles64());
+    State = nullptr;
+    PendingState = nullptr;
+    ProfiledFrames.Reset();
+    SourceToChunk.Reset();
+    LastSource = nullptr;
+    LastChunk = INDEX_NONE;
+}
+
+int32 FLuaLineProfiler::FindChunk(const char* Source)
+{
+    if (Source == LastSource)
+    {
+        return LastChunk;
+    }
+    // Chunk names are interned Lua strings, so the pointer identifies a chunk until it is collected;
+    // the text is compared on a hit in case the address was reused by a reloaded script.
+    FLuaCachedSource* Cached = SourceToChunk.Find(Source);
+    if (Cached == nullptr || FCStringAnsi::Strcmp(Cached->Text.GetData(), Source) != 0)
+    {
+        const int32 Length = FCStringAnsi::Strlen(Source);
+        const FString SourceName = UTF8_TO_TCHAR(Source);
+        int32 Chunk = INDEX_NONE;
+        for (const FString& Pattern : Allowlist)
+        {
+            if (SourceName.Contains(Pattern))
+            {
+                Chunk = Chunks.IndexOfByPredicate([Source](const FLuaLineChunk& Existing)
+                {
+                    return FCStringAnsi::Strcmp(Existing.SourceAnsi.GetData(), Source) == 0;
+                });
+                if (Chunk == INDEX_NONE)
+                {
+                    Chunk = Chunks.AddDefaulted();
+                    Chunks[Chunk].Source = SourceName;
+                    Chunks[Chunk].SourceAnsi.Append(Source, Length + 1);
+                }
+                break;
+            }
+        }
+        Cached = &SourceToChunk.Add(Source);
+        Cached->Text.Reset();
+        Cached->Text.Append(Source, Length + 1);
+        Cached->Chunk = Chunk;
+    }
+    LastSource = Source;
+    LastChunk = Cached->Chunk;
+    return LastChunk;
+}
+
+void FLuaLineProfiler::SetLineHook(lua_State* L, bool bEnable) const
+{
+    const int32 Mask = GetLuaStatsHookMask() | (bEnable ? LUA_MASKLINE : 0);
+    if (lua_gethookmask(L) != Mask)
+    {
+        lua_sethook(L, LuaStatsHook, Mask, GetLuaStatsHookCount());
+    }
+}
+
+void FLuaLineProfiler::ClosePending(uint64 Now)
+{
+    if (PendingChunk != INDEX_NONE)
+    {
+        Chunks[PendingChunk].Cycles[PendingLine] += Now - PendingCycles;
+        PendingChunk = INDEX_NONE;
+    }
+}
+
+void FLuaLineProfiler::OnHook(lua_State* L, lua_Debug* Ar)
+{
+    const uint64 Now = FPlatformTime::Cycles64();
+    if (L != PendingState)
+    {
+        // Another coroutine resumed: the time since the last line belongs to that line, as if it called out.
+        ClosePending(Now);
+        PendingState = L;
+    }
+    switch (Ar->event)
+    {
+    case LUA_HOOKCALL:
+    case LUA_HOOKTAILCALL:
+    {
+        // Line events are only requested while an allowlisted chunk is on top of the stack.
+        lua_getinfo(L, "S", Ar);
+        const bool bEnteringProfiled = FindChunk(Ar->source) != INDEX_NONE;
+        if (bEnteringProfiled)
+        {
+            ++ProfiledFrames.FindOrAdd(L);
+        }
+        SetLineHook(L, bEnteringProfiled);
+        break;
+    }
+    case LUA_HOOKRET:
+    {
+        lua_getinfo(L, "S", Ar);
+        const bool bLeavingProfiled = FindChunk(Ar->source) != INDEX_NONE;
+        int32* Frames = ProfiledFrames.Num() > 0 ? ProfiledFrames.Find(L) : nullptr;
+        bool bCallerProfiled = false;
+        if (Frames)
+        {
+            *Frames -= bLeavingProfiled ? 1 : 0;
+            lua_Debug Caller;
+            if (*Frames > 0 && lua_getstack(L, 1, &Caller))
+            {
+                bCallerProfiled = lua_getinfo(L, "S", &Caller) && FindChunk(Caller.source) != INDEX_NONE;
+            }
+            else
+            {
+                // None left, or the coroutine's last frame is returning: whatever errors left counted is gone too.
+                ProfiledFrames.Remove(L);
+            }
+        }
+        if (bLeavingProfiled && !bCallerProfiled)
+        {
+            ClosePending(Now);
+        }
+        SetLineHook(L, bCallerProfiled);
+        break;
+    }
+    case LUA_HOOKLINE:
+    {
+        lua_getinfo(L, "S", Ar);
+        const int32 Chunk = FindChunk(Ar->source);
+        ClosePending(Now);
+        if (Chunk == INDEX_NONE || Ar->currentline < 0)
+        {
+            SetLineHook(L, false);
+            break;
+        }
+        FLuaLineChunk& LineChunk = Chunks[Chunk];
+        if (LineChunk.Hits.Num() <= Ar->currentline)
+        {
+            LineChunk.Hits.SetNumZeroed(Ar->currentline + 1);
+            LineChunk.Cycles.SetNumZeroed(Ar->currentline + 1);
+        }
+        ++LineChunk.Hits[Ar->currentline];
+        PendingChunk = Chunk;
+        PendingLine = Ar->currentline;
+        // Restart the clock after our own bookkeeping so the hook is not billed to the line.
+        PendingCycles = FPlatformTime::Cycles64();
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+bool FLuaLineProfiler::Dump(const FString& Path, int32 MaxLines) const
+{
+    struct FLineCost
+    {
+        int32 Chunk;
+        int32 Line;
+        uint64 Cycles;
+        uint32 Hits;
+    };
+    TArray<FLineCost> Lines;
+    TArray<uint64> ChunkCycles;
+    ChunkCycles.SetNumZeroed(Chunks.Num());
+    for (int32 Chunk = 0; Chunk < Chunks.Num(); ++Chunk)
+    {
+        for (int32 Line = 0; Line < Chunks[Chunk].Hits.Num(); ++Line)
+        {
+            if (Chunks[Chunk].Hits[Line] > 0)
+            {
+                Lines.Add({ Chunk, Line, Chunks[Chunk].Cycles[Line], Chunks[Chunk].Hits[Line] });
+                ChunkCycles[Chunk] += Chunks[Chunk].Cycles[Line];
+            }
+        }
+    }
+    Lines.Sort([](const FLineCost& A, const FLineCost& B)
+    {
+        return A.Cycles > B.Cycles;
+    });
+
+    // Source text is loaded from disk only for chunks named after a file ("@path").
+    TArray<TArray<FString>> SourceLines;
+    SourceLines.SetNum(Chunks.Num());
+    for (int32 Chunk = 0; Chunk < Chunks.Num(); ++Chunk)
+    {
+        if (Chunks[Chunk].Source.StartsWith(TEXT("@")))
+        {
+            const FString File = Chunks[Chunk].Source.RightChop(1);
+            if (!FFileHelper::LoadFileToStringArray(SourceLines[Chunk], *File))
+            {
+                FFileHelper::LoadFileToStringArray(SourceLines[Chunk], *(FPaths::ProjectContentDir() / TEXT("Script") / File));
+            }
+        }
+    }
+
+    const double MillisecondsPerCycle = FPlatformTime::GetSecondsPerCycle64() * 1000.0;
+    FString Output = TEXT("Lua line profile\n\n");
+    for (int32 Chunk = 0; Chunk < Chunks.Num(); ++Chunk)
+    {
+        Output += FString::Printf(TEXT("%10.3f ms  %s\n"), ChunkCycles[Chunk] * MillisecondsPerCycle, *Chunks[Chunk].Source);
+    }
+    Output += TEXT("\n        ms        hits  line\n");
+    const int32 NumLines = MaxLines > 0 ? FMath::Min(MaxLines, Lines.Num()) : Lines.Num();
+    for (int32 Index = 0; Index < NumLines; ++Index)
+    {
+        const FLineCost& Cost = Lines[Index];
+        const TArray<FString>& Text = SourceLines[Cost.Chunk];
+        Output += FString::Printf(TEXT("%10.3f  %10u  %s:%d  %s\n"), Cost.Cycles * MillisecondsPerCycle, Cost.Hits,
+            *Chunks[Cost.Chunk].Source, Cost.Line, Text.IsValidIndex(Cost.Line - 1) ? *Text[Cost.Line - 1].TrimStartAndEnd() : TEXT(""));
+    }
+    return FFileHelper::SaveStringToFile(Output, *Path);
+}
+
+static FAutoConsoleCommand GLuaStatsDumpLineProfileCommand(
+    TEXT("LuaStats.DumpLineProfile"),
+    TEXT("Writes the Lua line profile started by LuaStats.ProfileLines, hottest lines first. Optional arguments: file path, line count."),
+    FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+    {
+        const FString Path = Args.Num() > 0 ? Args[0] : FLuaLineProfiler::GetDefaultDumpPath();
+        const int32 MaxLines = Args.Num() > 1 ? FCString::Atoi(*Args[1]) : 200;
+        if (!GLuaLineProfiler.Dump(Path, MaxLines))
+        {
+            UE_LOG(LogLuaStats, Warning, TEXT("Failed to write Lua line profile to %s"), *Path);
+        }
+    }));
+
+bool FLuaNativeTracker::Start(lua_State* L)
+{
+    if (State != nullptr)
+    {
+        return true;
+    }
+    State = GetLuaMainThread(L);
+    if (!UpdateLuaStatsHook(State))
+    {
+        State = nullptr;
+        return false;
+    }
+    if (L != State)
+    {
+        UpdateLuaStatsHook(L);
+    }
+    WatchLuaStateClose(State);
+    Stacks.Reset(State);
+    RunningFunction = INDEX_NONE;
+    LastCycles = FPlatformTime::Cycles64();
+    return true;
+}
+
+void FLuaNativeTracker::Stop()
+{
+    if (State == nullptr)
+    {
+        return;
+    }
+    lua_State* const OldState = State;
+    Stacks.Reset(State);
+    // Closures may be collected while we are not watching, so their identities are not kept across sessions.
+    lua_pushnil(State);
+    lua_rawsetp(State, LUA_REGISTRYINDEX, this);
+    OnStateClosed(State);
+    UpdateLuaStatsHook(OldState);
+}
+
+void FLuaNativeTracker::OnStateClosed(lua_State* L)
+{
+    if (State == nullptr || State != L)
+    {
+        return;
+    }
+    State = nullptr;
+    Stacks.Reset(nullptr);
+    RunningFunction = INDEX_NONE;
+}
+
+int32 FLuaNativeTracker::FindFunction(lua_State* L, lua_Debug* Ar, const void*& OutClosure)
+{
+    lua_getinfo(L, "f", Ar);
+    OutClosure = lua_topointer(L, -1);
+    // Indices by closure in a weak-keyed registry table: a collected closure drops out of it, so another one
+    // allocated at its address is looked up afresh instead of being billed to the dead one's function.
+    PushLuaWeakKeyTable(L, this);
+    lua_pushvalue(L, -2);
+    if (lua_rawget(L, -2) == LUA_TNUMBER)
+    {
+        const int32 Found = static_cast<int32>(lua_tointeger(L, -1));
+        lua_pop(L, 3);
+        return Found;
+    }
+    lua_pop(L, 1);
+    const lua_CFunction Function = lua_tocfunction(L, -2);
+    int32 Index = INDEX_NONE;
+    if (!IsLuaStatsBinding(Function))
+    {
+        // UnLua binds most UFunctions through one shared thunk, so identity is the closure and the name is the field it was called through.
+        lua_getinfo(L, "n", Ar);
+        const FName Name(Ar->name ? UTF8_TO_TCHAR(Ar->name) : *FString::Printf(TEXT("0x%p"), Function));
+        if (const int32* Existing = NameToFunction.Find(Name))
+        {
+            Index = *Existing;
+        }
+        else
+        {
+            FLuaNativeFunction NativeFunction;
+            NativeFunction.Name = Name;
+            const FString StatName = FString(TEXT("Lua.Native.")) + Name.ToString();
+            NativeFunction.CyclesStat = GLuaStats.CreateInternalStat(TEXT("Native"), TEXT("Lua native calls"), StatName, true);
+            NativeFunction.CallsStat = GLuaStats.CreateInternalStat(TEXT("Native"), TEXT("Lua native calls"), StatName + TEXT("@Calls"), false);
+            Index = Functions.Add(MoveTemp(NativeFunction));
+            NameToFunction.Emplace(Name, Index);
+        }
+    }
+    lua_pushvalue(L, -2);
+    lua_pushinteger(L, Index);
+    lua_rawset(L, -3);
+    lua_pop(L, 2);
+    return Index;
+}
+
+void FLuaNativeTracker::OnHook(lua_State* L, lua_Debug* Ar)
+{
+    // The time since the previous event belongs to whatever ran on top of the stack meanwhile.
+    const uint64 Now = FPlatformTime::Cycles64();
+    if (RunningFunction != INDEX_NONE)
+    {
+        const uint64 Elapsed = Now - LastCycles;
+        Functions[RunningFunction].FrameCycles += Elapsed;
+        GLuaStats.AddNativeCycles(Elapsed);
+    }
+    TArray<FLuaNativeFrame>& Stack = Stacks.Find(L);
+
+    lua_getinfo(L, "S", Ar);
+    const bool bNative = Ar->what != nullptr && Ar->what[0] == 'C';
+    if (Ar->event == LUA_HOOKCALL || Ar->event == LUA_HOOKTAILCALL)
+    {
+        FLuaNativeFrame Frame = { INDEX_NONE, nullptr };
+        if (bNative)
+        {
+            Frame.Function = FindFunction(L, Ar, Frame.Closure);
+            if (Frame.Function != INDEX_NONE)
+            {
+                ++Functions[Frame.Function].FrameCalls;
+            }
+        }
+        if (Ar->event == LUA_HOOKTAILCALL && Stack.Num() > 0)
+        {
+            Stack.Last() = Frame;
+        }
+        else
+        {
+            Stack.Add(Frame);
+        }
+    }
+    else if (Ar->event == LUA_HOOKRET)
+    {
+        // Errors unwind frames without return events; the next return of a frame further down resynchronises.
+        if (bNative)
+        {
+            const void* Closure;
+            FindFunction(L, Ar, Closure);
+            while (Stack.Num() > 0 && Stack.Pop().Closure != Closure)
+            {
+            }
+        }
+        else
+        {
+            while (Stack.Num() > 0 && Stack.Pop().Closure != nullptr)
+            {
+            }
+        }
+    }
+    RunningFunction = Stack.Num() > 0 ? Stack.Last().Function : INDEX_NONE;
+    LastCycles = FPlatformTime::Cycles64();
+}
+
+void FLuaNativeTracker::Flush()
+{
+    if (State != nullptr)
+    {
+        Stacks.Prune(State);
+    }
+    const bool bCollecting = FThreadStats::IsCollectingData();
+    for (FLuaNativeFunction& Function : Functions)
+    {
+        if (Function.FrameCalls > 0 && bCollecting && TStatId(Function.CyclesStat).IsValidStat())
+        {
+            FThreadStats::AddMessage(MinimalNameToName(Function.CyclesStat->Name), EStatOperation::Add,
+                static_cast<int64>(FMath::Min<uint64>(Function.FrameCycles, MAX_uint32)), true);
+            FThreadStats::AddMessage(MinimalNameToName(Function.CallsStat->Name), EStatOperation::Set, static_cast<int64>(Function.FrameCalls));
+        }
+        Function.FrameCycles = 0;
+        Function.FrameCalls = 0;
+    }
+}
+
+bool FLuaInstructionCounter::Start(lua_State* L, bool bInFunctions, int32 InPeriod)
+{
+    if (State != nullptr)
+    {
+        Stop();
+    }
+    bFunctions = bInFunctions;
+    Period = FMath::Max(InPeriod, 1);
+    State = GetLuaMainThread(L);
+    if (!UpdateLuaStatsHook(State))
+    {
+        State = nullptr;
+        return false;
+    }
+    if (L != State)
+    {
+        UpdateLuaStatsHook(L);
+    }
+    // Coroutines created before now did not inherit the hook from the main thread; they are hooked over the next frames.
+    HookLuaThreads(L);
+    WatchLuaStateClose(State);
+    Stacks.Reset(State);
+    RunningFunction = INDEX_NONE;
+    LastCount = GLuaInstructionCount;
+    GLuaStats.SetCountInstructions(true);
+    return true;
+}
+
+void FLuaInstructionCounter::Stop()
+{
+    if (State == nullptr)
+    {
+        return;
+    }
+    lua_State* const OldState = State;
+    Stacks.Reset(State);
+    OnStateClosed(State);
+    UpdateLuaStatsHook(OldState);
+}
+
+void FLuaInstructionCounter::OnStateClosed(lua_State* L)
+{
+    if (State == nullptr || State != L)
+    {
+        return;
+    }
+    State = nullptr;
+    GLuaStats.SetCountInstructions(false);
+    ClosureToFunction.Reset();
+    Stacks.Reset(nullptr);
+    RunningFunction = INDEX_NONE;
+}
+
+int32 FLuaInstructionCounter::FindFunction(lua_State* L, lua_Debug* Ar, const void*& OutClosure)
+{
+    lua_getinfo(L, "Sf", Ar);
+    OutClosure = lua_topointer(L, -1);
+    const bool bNative = lua_iscfunction(L, -1) != 0;
+    lua_pop(L, 1);
+    if (const FLuaInstructionClosure* Found = ClosureToFunction.Find(OutClosure))
+    {
+        if (Found->Source == Ar->source && Found->LineDefined == Ar->linedefined)
+        {
+            return Found->Function;
+        }
+    }
+    int32 Index = INDEX_NONE;
+    if (!bNative)
+    {
+        // Closures of one prototype share a name: "Lua.Instructions.UI.Menu.Main:42", rolled up by script path.
+        const FString Line = Ar->what && FCStringAnsi::Strcmp(Ar->what, "main") == 0 ? FString(TEXT("main")) : FString::FromInt(Ar->linedefined);
+        const FName Name(*(LuaSourceToScriptPath(Ar->source) + TEXT(":") + Line));
+        if (const int32* Existing = NameToFunction.Find(Name))
+        {
+            Index = *Existing;
+        }
+        else
+        {
+            FLuaInstructionFunction Function;
+            Function.Name = Name;
+            Function.Stat = GLuaStats.CreateInstructionStat(FString(TEXT("Lua.Instructions.")) + Name.ToString());
+            Index = Functions.Add(MoveTemp(Function));
+            NameToFunction.Emplace(Name, Index);
+        }
+    }
+    ClosureToFunction.Emplace(OutClosure, FLuaInstructionClosure{ Index, Ar->source, Ar->linedefined });
+    return Index;
+}
+
+void FLuaInstructionCounter::OnHook(lua_State* L, lua_Debug* Ar)
+{
+    if (!bFunctions)
+    {
+        return;
+    }
+    // The instructions since the previous event were executed by whatever was on top of the stack meanwhile.
+    const uint64 Count = GLuaInstructionCount;
+    if (RunningFunction != INDEX_NONE)
+    {
+        Functions[RunningFunction].FrameInstructions += Count - LastCount;
+    }
+    LastCount = Count;
+    TArray<FLuaInstructionFrame>& Stack = Stacks.Find(L);
+
+    FLuaInstructionFrame Frame = { INDEX_NONE, nullptr };
+    Frame.Function = FindFunction(L, Ar, Frame.Closure);
+    if (Ar->event == LUA_HOOKCALL || Ar->event == LUA_HOOKTAILCALL)
+    {
+        if (Ar->event == LUA_HOOKTAILCALL && Stack.Num() > 0)
+        {
+            Stack.Last() = Frame;
+        }
+        else
+        {
+            Stack.Add(Frame);
+        }
+    }
+    else if (Ar->event == LUA_HOOKRET)
+    {
+        // Errors unwind frames without return events; the next return of a frame further down resynchronises.
+        while (Stack.Num() > 0 && Stack.Pop().Closure != Frame.Closure)
+        {
+        }
+    }
+    RunningFunction = Stack.Num() > 0 ? Stack.Last().Function : INDEX_NONE;
+}
+
+void FLuaInstructionCounter::Flush()
+{
+    if (State != nullptr)
+    {
+        Stacks.Prune(State);
+    }
+    for (FLuaInstructionFunction& Function : Functions)
+    {
+        if (Function.FrameInstructions > 0)
+        {
+            GLuaStats.SetInt64Stat(Function.Stat, static_cast<int64>(Function.FrameInstructions));
+        }
+        Function.FrameInstructions = 0;
+    }
+}
+
+struct FLuaObjectClass
+{
+    FName Name;
+    int64 Live = 0;
+    int64 Peak = 0;
+    uint32 FrameCreated = 0;
+    uint32 FrameDestroyed = 0;
+    TStatIdData const* LiveStat = nullptr;
+    TStatIdData const* PeakStat = nullptr;
+    TStatIdData const* CreatedStat = nullptr;
+    TStatIdData const* DestroyedStat = nullptr;
+};
+
+class FLuaObjectCounts
+{
+private:
+    TArray<FLuaObjectClass> Classes;
+    TMap<FName, int32> NameToClass;
+    TMap<const void*, int32> MetatableToClass;
+
+public:
+    int32 AddClass(FName ClassName);
+
+    void BindMetatable(const void* Metatable, int32 Class)
+    {
+        MetatableToClass.Emplace(Metatable, Class);
+    }
+
+    int32 FindClass(const void* Metatable) const
+    {
+        const int32* Found = MetatableToClass.Find(Metatable);
+        return Found ? *Found : INDEX_NONE;
+    }
+
+    void Created(int32 Class)
+    {
+        FLuaObjectClass& ObjectClass = Classes[Class];
+        ++ObjectClass.FrameCreated;
+        ObjectClass.Peak = FMath::Max(ObjectClass.Peak, ++ObjectClass.Live);
+    }
+
+    void Destroyed(int32 Class)
+    {
+        FLuaObjectClass& ObjectClass = Classes[Class];
+        ++ObjectClass.FrameDestroyed;
+        --ObjectClass.Live;
+    }
+
+    const TArray<FLuaObjectClass>& GetClasses() const
+    {
+        return Classes;
+    }
+
+    void Flush();
+};
+
+FLuaObjectCounts GLuaObjectCounts;
+
+int32 FLuaObjectCounts::AddClass(FName ClassName)
+{
+    if (const int32* Found = NameToClass.Find(ClassName))
+    {
+        return *Found;
+    }
+    FLuaObjectClass ObjectClass;
+    ObjectClass.Name = ClassName;
+    const FString StatName = FString(TEXT("Lua.Objects.")) + ClassName.ToString();
+    const FName PreviousGroup = GLuaStats.SetActiveGroup(TEXT("Objects"));
+    ObjectClass.LiveStat = GLuaStats.CreateInt64Counter(FName(*StatName));
+    ObjectClass.PeakStat = GLuaStats.CreateInt64Counter(FName(*(StatName + TEXT("@Peak"))));
+    ObjectClass.CreatedStat = GLuaStats.CreateInt64Counter(FName(*(StatName + TEXT("@Created"))));
+    ObjectClass.DestroyedStat = GLuaStats.CreateInt64Counter(FName(*(StatName + TEXT("@Destroyed"))));
+    GLuaStats.SetActiveGroup(PreviousGroup);
+    const int32 Index = Classes.Add(MoveTemp(ObjectClass));
+    NameToClass.Emplace(ClassName, Index);
+    return Index;
+}
+
+void FLuaObjectCounts::Flush()
+{
+    for (FLuaObjectClass& ObjectClass : Classes)
+    {
+        // Instances that existed before the class was tracked can still be finalized through it, hence the clamp.
+        GLuaStats.SetInt64Stat(ObjectClass.LiveStat, FMath::Max<int64>(ObjectClass.Live, 0));
+        GLuaStats.SetInt64Stat(ObjectClass.PeakStat, ObjectClass.Peak);
+        GLuaStats.SetInt64Stat(ObjectClass.CreatedStat, ObjectClass.FrameCreated);
+        GLuaStats.SetInt64Stat(ObjectClass.DestroyedStat, ObjectClass.FrameDestroyed);
+        ObjectClass.FrameCreated = 0;
+        ObjectClass.FrameDestroyed = 0;
+    }
+}
+
+static void FlushLuaTrackers()
+{
+    GLuaNativeTracker.Flush();
+    GLuaInstructionCounter.Flush();
+    GLuaObjectCounts.Flush();
+}
+
+static int32 LuaObjectClass_Finalize(lua_State* L)
+{
+    // Upvalues: tracked class index, and the __gc the metatable had before it was tracked.
+    if (lua_isfunction(L, lua_upvalueindex(2)))
+    {
+        lua_pushvalue(L, lua_upvalueindex(2));
+        lua_pushvalue(L, 1);
+        lua_call(L, 1, 0);
+    }
+    GLuaObjectCounts.Destroyed(static_cast<int32>(lua_tointeger(L, lua_upvalueindex(1))));
+    return 0;
+}
+
+static int32 LuaObjectClass_Construct(lua_State* L)
+{
+    // Upvalue: the class's own constructor. The new instance is counted under the class its metatable is
+    // tracked as, so a derived class reaching this through __index is counted as itself.
+    const int32 Base = lua_gettop(L);
+    lua_pushvalue(L, lua_upvalueindex(1));
+    lua_insert(L, 1);
+    lua_call(L, Base, LUA_MULTRET);
+    if (lua_gettop(L) >= 1 && lua_getmetatable(L, 1))
+    {
+        const int32 Class = GLuaObjectCounts.FindClass(lua_topointer(L, -1));
+        lua_pop(L, 1);
+        if (Class != INDEX_NONE)
+        {
+            GLuaObjectCounts.Created(Class);
+        }
+    }
+    return lua_gettop(L);
+}
+
+// Hooks the coroutines that existed before a profiler started, which did not inherit its hook. They are found by
+// a heap walk spread over frames like LuaStats.StartHeapScan's, so starting a profiler on a large heap does not
+// hitch; a coroutine only runs unhooked until the walk reaches it. lua_topointer of a thread is its lua_State.
+class FLuaThreadHooker : public FLuaHeapWalker
+{
+public:
+    void Start(lua_State* L)
+    {
+        Begin(GetLuaMainThread(L));
+        WatchLuaStateClose(L);
+        if (!bTickRegistered)
+        {
+            bTickRegistered = true;
+            FCoreDelegates::OnEndFrame.AddRaw(this, &FLuaThreadHooker::Tick);
+        }
+    }
+
+    void Tick()
+    {
+        if (!IsWalking())
+        {
+            return;
+        }
+        // A walk outliving every profiler has nothing left to hook.
+        if (GetLuaStatsHookMask() == 0)
+        {
+            Abort();
+            return;
+        }
+        Step(FMath::Max(CVarLuaStatsHeapScanBudget.GetValueOnGameThread(), 1));
+    }
+
+protected:
+    virtual void OnObject(const void* Object, ELuaHeapType Type, int64 /*Size*/, int32 /*Owner*/, uint32 /*Path*/) override
+    {
+        if (Type != ELuaHeapType::Thread)
+        {
+            return;
+        }
+        lua_State* Thread = static_cast<lua_State*>(const_cast<void*>(Object));
+        const lua_Hook Existing = lua_gethook(Thread);
+        if (Existing == nullptr || Existing == LuaStatsHook)
+        {
+            const int32 Mask = GetLuaStatsHookMask();
+            lua_sethook(Thread, Mask ? LuaStatsHook : nullptr, Mask, GetLuaStatsHookCount());
+        }
+    }
+
+private:
+    bool bTickRegistered = false;
+};
+
+FLuaThreadHooker GLuaThreadHooker;
+
+static void HookLuaThreads(lua_State* L)
+{
+    // L, the calling thread, is hooked by the caller.
+    GLuaThreadHooker.Start(L);
+}
+
+struct FLuaHeapTotal
+{
+    int64 Bytes = 0;
+    int64 Count = 0;
+};
+
+// Runs heap walks over frames for LuaStats.StartHeapScan and publishes each finished walk as memory stats:
+// Lua.Heap@<Type> bytes and Lua.Heap@<Type>Count per object type, Lua.Heap.<Module> per owning module
+// (rolling up into Lua.Heap@Memory, the reachable total) and Lua.Heap@Total, the collector's own count.
+class FLuaHeapScanner : public FLuaHeapWalker
+{
+public:
+    bool Start(lua_State* L, bool bInContinuous)
+    {
+        bContinuous = bInContinuous;
+        Begin(GetLuaMainThread(L));
+        WatchLuaStateClose(L);
+        ResetTotals();
+        if (!bTickRegistered)
+        {
+            bTickRegistered = true;
+            FCoreDelegates::OnEndFrame.AddRaw(this, &FLuaHeapScanner::Tick);
+        }
+        return true;
+    }
+
+    void Stop()
+    {
+        bContinuous = false;
+        Abort();
+    }
+
+    bool HasResult() const
+    {
+        return LastFrames > 0;
+    }
+
+    void PushResult(lua_State* L) const;
+
+protected:
+    virtual void OnObject(const void* /*Object*/, ELuaHeapType Type, int64 Size, int32 Owner, uint32 /*Path*/) override
+    {
+        FLuaHeapTotal& TypeTotal = Types[static_cast<int32>(Type)];
+        TypeTotal.Bytes += Size;
+        ++TypeTotal.Count;
+        if (Owner >= OwnerTotals.Num())
+        {
+            OwnerTotals.SetNum(Owner + 1);
+        }
+        OwnerTotals[Owner].Bytes += Size;
+        ++OwnerTotals[Owner].Count;
+    }
+
+private:
+    void ResetTotals()
+    {
+        for (FLuaHeapTotal& Total : Types)
+        {
+            Total = FLuaHeapTotal();
+        }
+        OwnerTotals.Reset();
+        Frames = 0;
+        StartSeconds = FPlatformTime::Seconds();
+    }
+
+    void Tick();
+    void Publish(lua_State* L);
+
+    bool bContinuous = false;
+    bool bTickRegistered = false;
+    FLuaHeapTotal Types[static_cast<int32>(ELuaHeapType::Count)];
+    TArray<FLuaHeapTotal> OwnerTotals;
+    int32 Frames = 0;
+    double StartSeconds = 0.0;
+
+    // Results of the last finished walk.
+    FLuaHeapTotal LastTypes[static_cast<int32>(ELuaHeapType::Count)];
+    TArray<TPair<FName, FLuaHeapTotal>> LastOwners;
+    int64 LastTotal = 0;
+    int32 LastFrames = 0;
+    double LastSeconds = 0.0;
+
+    TStatIdData const* TypeBytesStats[static_cast<int32>(ELuaHeapType::Count)] = {};
+    TStatIdData const* TypeCountStats[static_cast<int32>(ELuaHeapType::Count)] = {};
+    TStatIdData const* TotalStat = nullptr;
+    TMap<FName, TStatIdData const*> OwnerStats;
+};
+
+FLuaHeapScanner GLuaHeapScanner;
+
+void FLuaHeapScanner::Tick()
+{
+    if (!IsWalking())
+    {
+        return;
+    }
+    ++Frames;
+    lua_State* L = GetState();
+    if (Step(FMath::Max(CVarLuaStatsHeapScanBudget.GetValueOnGameThread(), 1)))
+    {
+        Publish(L);
+        if (bContinuous)
+        {
+            Begin(L);
+            ResetTotals();
+        }
+    }
+}
+
+void FLuaHeapScanner::Publish(lua_State* L)
+{
+    const int32 NumTypes = static_cast<int32>(ELuaHeapType::Count);
+    const FName PreviousGroup = GLuaStats.SetActiveGroup(TEXT("Heap"));
+    for (int32 Index = 0; Index < NumTypes; ++Index)
+    {
+        if (!TypeBytesStats[Index])
+        {
+            TypeBytesStats[Index] = GLuaStats.CreateMemoryStat(FName(*FString::Printf(TEXT("Lua.Heap@%s"), LuaHeapTypeNames[Index])));
+            TypeCountStats[Index] = GLuaStats.CreateInt64Accumulator(FName(*FString::Printf(TEXT("Lua.Heap@%sCount"), LuaHeapTypeNames[Index])));
+        }
+        GLuaStats.SetMemoryStat(TypeBytesStats[Index], Types[Index].Bytes);
+        GLuaStats.SetInt64Stat(TypeCountStats[Index], Types[Index].Count);
+        LastTypes[Index] = Types[Index];
+    }
+    if (!TotalStat)
+    {
+        TotalStat = GLuaStats.CreateMemoryStat(TEXT("Lua.Heap@Total"));
+    }
+    LastTotal = static_cast<int64>(lua_gc(L, LUA_GCCOUNT, 0)) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+    GLuaStats.SetMemoryStat(TotalStat, LastTotal);
+    LastOwners.Reset();
+    const TArray<FName>& OwnerNames = GetOwners();
+    for (int32 Owner = 0; Owner < OwnerTotals.Num() && Owner < OwnerNames.Num(); ++Owner)
+    {
+        TStatIdData const*& Stat = OwnerStats.FindOrAdd(OwnerNames[Owner]);
+        if (!Stat)
+        {
+            Stat = GLuaStats.CreateMemoryStat(FName(*(TEXT("Lua.Heap.") + OwnerNames[Owner].ToString())));
+        }
+        GLuaStats.SetMemoryStat(Stat, OwnerTotals[Owner].Bytes);
+        LastOwners.Emplace(OwnerNames[Owner], OwnerTotals[Owner]);
+    }
+    GLuaStats.SetActiveGroup(PreviousGroup);
+    LastFrames = Frames;
+    LastSeconds = FPlatformTime::Seconds() - StartSeconds;
+}
+
+void FLuaHeapScanner::PushResult(lua_State* L) const
+{
+    // { Total = bytes, Frames = n, Seconds = s, Types = { Table = { Bytes = ..., Count = ... }, ... }, Owners = { [name] = { ... } } }
+    auto PushTotal = [L](const FLuaHeapTotal& Total)
+    {
+        lua_createtable(L, 0, 2);
+        lua_pushinteger(L, Total.Bytes);
+        lua_setfield(L, -2, "Bytes");
+        lua_pushinteger(L, Total.Count);
+        lua_setfield(L, -2, "Count");
+    };
+    lua_createtable(L, 0, 5);
+    lua_pushinteger(L, LastTotal);
+    lua_setfield(L, -2, "Total");
+    lua_pushinteger(L, LastFrames);
+    lua_setfield(L, -2, "Frames");
+    lua_pushnumber(L, LastSeconds);
+    lua_setfield(L, -2, "Seconds");
+    lua_createtable(L, 0, static_cast<int32>(ELuaHeapType::Count));
+    for (int32 Index = 0; Index < static_cast<int32>(ELuaHeapType::Count); ++Index)
+    {
+        PushTotal(LastTypes[Index]);
+        lua_setfield(L, -2, TCHAR_TO_UTF8(LuaHeapTypeNames[Index]));
+    }
+    lua_setfield(L, -2, "Types");
+    lua_createtable(L, 0, LastOwners.Num());
+    for (const TPair<FName, FLuaHeapTotal>& Owner : LastOwners)
+    {
+        PushTotal(Owner.Value);
+        lua_setfield(L, -2, TCHAR_TO_UTF8(*Owner.Key.ToString()));
+    }
+    lua_setfield(L, -2, "Owners");
+}
+
+// One object of a snapshot: 16 bytes, so a snapshot costs a fraction of the heap it describes.
+struct FLuaHeapSnapshotEntry
+{
+    uint64 Address;
+    uint32 Path;
+    uint32 Size : 28;
+    uint32 Type : 4;
+};
+static_assert(sizeof(FLuaHeapSnapshotEntry) == 16, "FLuaHeapSnapshotEntry should stay compact");
+
+struct FLuaHeapDiffGroup
+{
+    uint32 Path = 0;
+    int64 Bytes = 0;
+    int64 Count = 0;
+};
+
+// The objects reachable at one point, sorted by address, with the path each was first reached through. Taken
+// in one go with the collector stopped: the walk frees nothing, and stopping it spares a collection cycle
+// traversing the visited set again each time it grows.
+class FLuaHeapSnapshot : public FLuaHeapWalker
+{
+public:
+    void Take(lua_State* L)
+    {
+        const double StartSeconds = FPlatformTime::Seconds();
+        const bool bCollecting = lua_gc(L, LUA_GCISRUNNING, 0) != 0;
+        lua_gc(L, LUA_GCSTOP, 0);
+        // Nothing moves or is freed while the collector is stopped, so addresses identify objects.
+        Begin(L, true, true);
+        while (!Step(MAX_int32))
+        {
+        }
+        if (bCollecting)
+        {
+            lua_gc(L, LUA_GCRESTART, 0);
+        }
+        Entries.Shrink();
+        Entries.Sort([](const FLuaHeapSnapshotEntry& A, const FLuaHeapSnapshotEntry& B)
+        {
+            return A.Address < B.Address;
+        });
+        UE_LOG(LogLuaStats, Log, TEXT("Lua heap snapshot: %d objects, %lld bytes in %.2f s"), Entries.Num(), Bytes, FPlatformTime::Seconds() - StartSeconds);
+    }
+
+    const TArray<FLuaHeapSnapshotEntry>& GetEntries() const
+    {
+        return Entries;
+    }
+
+    int64 GetBytes() const
+    {
+        return Bytes;
+    }
+
+protected:
+    virtual void OnObject(const void* Object, ELuaHeapType Type, int64 Size, int32 /*Owner*/, uint32 Path) override
+    {
+        const uint32 ClampedSize = static_cast<uint32>(FMath::Min<int64>(Size, (1 << 28) - 1));
+        Entries.Add({ static_cast<uint64>(reinterpret_cast<UPTRINT>(Object)), Path, ClampedSize, static_cast<uint32>(Type) });
+        Bytes += Size;
+    }
+
+private:
+    TArray<FLuaHeapSnapshotEntry> Entries;
+    int64 Bytes = 0;
+};
+
+// Indexed by snapshot id - 1; freed slots stay empty so ids are never reused.
+TArray<TUniquePtr<FLuaHeapSnapshot>> GLuaHeapSnapshots;
+
+static FLuaHeapSnapshot* FindLuaHeapSnapshot(lua_State* L, int32 Index)
+{
+    const int32 Id = lua_isinteger(L, Index) ? static_cast<int32>(lua_tointeger(L, Index)) : 0;
+    return GLuaHeapSnapshots.IsValidIndex(Id - 1) ? GLuaHeapSnapshots[Id - 1].Get() : nullptr;
+}
+
+// Objects of After that were not in Before, grouped by path, heaviest first. An object matches one of Before by
+// address, type, path and size, so an address freed and reused by another object between the snapshots, which
+// is most likely reached through another path or has another size, counts as new. With a dump path every new object is also written out as CSV while
+// the two snapshots are merged, so the dump costs no memory of its own.
+static TArray<FLuaHeapDiffGroup> DiffLuaHeapSnapshots(const FLuaHeapSnapshot& Before, const FLuaHeapSnapshot& After, const FString& DumpPath)
+{
+    TUniquePtr<FArchive> Dump;
+    TArray<ANSICHAR> Buffer;
+    TMap<uint32, TArray<ANSICHAR>> DumpPathNames;
+    if (!DumpPath.IsEmpty())
+    {
+        Dump.Reset(IFileManager::Get().CreateFileWriter(*DumpPath));
+        if (Dump)
+        {
+            static const char Header[] = "Address,Type,Bytes,Path\n";
+            Buffer.Append(Header, UE_ARRAY_COUNT(Header) - 1);
+        }
+    }
+
+    ANSICHAR TypeNames[static_cast<int32>(ELuaHeapType::Count)][16];
+    for (int32 Index = 0; Index < static_cast<int32>(ELuaHeapType::Count); ++Index)
+    {
+        FCStringAnsi::Strncpy(TypeNames[Index], TCHAR_TO_UTF8(LuaHeapTypeNames[Index]), UE_ARRAY_COUNT(TypeNames[Index]));
+    }
+
+    TMap<uint32, FLuaHeapDiffGroup> Groups;
+    const TArray<FLuaHeapSnapshotEntry>& Old = Before.GetEntries();
+    int32 OldIndex = 0;
+    for (const FLuaHeapSnapshotEntry& Entry : After.GetEntries())
+    {
+        while (OldIndex < Old.Num() && Old[OldIndex].Address < Entry.Address)
+        {
+            ++OldIndex;
+        }
+        if (OldIndex < Old.Num() && Old[OldIndex].Address == Entry.Address && Old[OldIndex].Type == Entry.Type
+            && Old[OldIndex].Path == Entry.Path && Old[OldIndex].Size == Entry.Size)
+        {
+            continue;
+        }
+        FLuaHeapDiffGroup& Group = Groups.FindOrAdd(Entry.Path);
+        Group.Path = Entry.Path;
+        Group.Bytes += Entry.Size;
+        ++Group.Count;
+        if (!Dump)
+        {
+            continue;
+        }
+        const TArray<ANSICHAR>* PathName = DumpPathNames.Find(Entry.Path);
+        if (!PathName)
+        {
+            const FTCHARToUTF8 Utf8(*After.GetPathName(Entry.Path));
+            TArray<ANSICHAR>& Added = DumpPathNames.Add(Entry.Path);
+            Added.Append(Utf8.Get(), Utf8.Length());
+            PathName = &Added;
+        }
+        ANSICHAR Line[64];
+        const int32 Length = FCStringAnsi::Snprintf(Line, sizeof(Line), "0x%llx,%s,%u,", static_cast<unsigned long long>(Entry.Address),
+            TypeNames[Entry.Type], static_cast<uint32>(Entry.Size));
+        Buffer.Append(Line, FMath::Min<int32>(Length, sizeof(Line) - 1));
+        Buffer.Append(*PathName);
+        Buffer.Add('\n');
+        if (Buffer.Num() >= 64 * 1024)
+        {
+            Dump->Serialize(Buffer.GetData(), Buffer.Num());
+            Buffer.Reset();
+        }
+    }
+    if (Dump)
+    {
+        Dump->Serialize(Buffer.GetData(), Buffer.Num());
+        Dump->Close();
+    }
+
+    TArray<FLuaHeapDiffGroup> Result;
+    Groups.GenerateValueArray(Result);
+    Result.Sort([](const FLuaHeapDiffGroup& A, const FLuaHeapDiffGroup& B)
+    {
+        return A.Bytes > B.Bytes;
+    });
+    return Result;
+}
+
+int32 CycleCounter_Create(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::CycleCounterCreate);
+    const int32 ParamNum = lua_gettop(L);
+    if (ParamNum <= 0 || ParamNum > 2)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    if (!lua_isstring(L, 1))
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    FString StatDesc;
+    if (ParamNum > 1 && lua_isstring(L, 2))
+    {
+        StatDesc = lua_tostring(L, 2);
+    }
+    const FName StatName = lua_tostring(L, 1);
+    const auto StatIdPtr = GLuaStats.CreateCycleCounter(StatName, StatDesc.IsEmpty() ? nullptr : *StatDesc);
+    if (StatIdPtr)
+    {
+        lua_pushlightuserdata(L, (void*)StatIdPtr);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+int32 CycleCounter_Start(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::CycleCounterStart);
+    const int32 ParamNum = lua_gettop(L);
+    FLuaStatKey Key;
+    const FLuaStatKey* KeyPtr = ParamNum >= 2 && GLuaStats.ReadStatKey(L, 2, Key) ? &Key : nullptr;
+    if (ParamNum < 1)
+    {
+        lua_pushnil(L);
+    }
+    else if (lua_isstring(L, 1))
+    {
+        const bool Result = GLuaStats.StartCycleCounter(lua_tostring(L, 1), L, KeyPtr);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else if (lua_islightuserdata(L, 1))
+    {
+        const bool Result = GLuaStats.StartCycleCounter(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), L, KeyPtr);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+int32 CycleCounter_Stop(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::CycleCounterStop);
+    const bool Result = GLuaStats.StopCycleCounter();
+    lua_pushboolean(L, Result ? 1 : 0);
+    return 1;
+}
+
+int32 CycleCounter_Set(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::CycleCounterSet);
+    const int32 ParamNum = lua_gettop(L);
+    if (ParamNum < 2 || !lua_isnumber(L, 2))
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    const uint32 Cycles = static_cast<uint32>(FMath::Clamp<lua_Integer>(lua_tointeger(L, 2), 0, MAX_uint32));
+    if (lua_isstring(L, 1))
+    {
+        const bool Result = GLuaStats.SetCycleCounter(lua_tostring(L, 1), Cycles);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else if (lua_islightuserdata(L, 1))
+    {
+        const bool Result = GLuaStats.SetCycleCounter(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Cycles);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+int32 CycleCounter_SetSampleRate(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::CycleCounterSetSampleRate);
+    const int32 ParamNum = lua_gettop(L);
+    if (ParamNum < 2 || !lua_isnumber(L, 2))
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    const uint32 SampleRate = static_cast<uint32>(FMath::Max<lua_Integer>(lua_tointeger(L, 2), 1));
+    const bool bRandom = ParamNum >= 3 && lua_toboolean(L, 3) != 0;
+    if (lua_isstring(L, 1))
+    {
+        const bool Result = GLuaStats.SetCycleCounterSampleRate(lua_tostring(L, 1), SampleRate, bRandom);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else if (lua_islightuserdata(L, 1))
+    {
+        const bool Result = GLuaStats.SetCycleCounterSampleRate(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), SampleRate, bRandom);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+int32 SimpleSeconds_Create(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::SimpleSecondsCreate);
+    const int32 ParamNum = lua_gettop(L);
+    if (ParamNum <= 0 || ParamNum > 2)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    if (!lua_isstring(L, 1))
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    FString StatDesc;
+    if (ParamNum > 1 && lua_isstring(L, 2))
+    {
+        StatDesc = lua_tostring(L, 2);
+    }
+    double Scale = 1.0;
+    if (ParamNum > 2 && lua_isnumber(L, 3))
+    {
+        Scale = lua_tonumber(L, 3);
+    }
+    const FName StatName = lua_tostring(L, 1);
+    const auto StatIdPtr = GLuaStats.CreateSimpleSeconds(StatName, StatDesc.IsEmpty() ? nullptr : *StatDesc, Scale);
+    if (StatIdPtr)
+    {
+        lua_pushlightuserdata(L, (void*)StatIdPtr);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+int32 SimpleSeconds_Start(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::SimpleSecondsStart);
+    const int32 ParamNum = lua_gettop(L);
+    FLuaStatKey Key;
+    const FLuaStatKey* KeyPtr = ParamNum >= 2 && GLuaStats.ReadStatKey(L, 2, Key) ? &Key : nullptr;
+    if (ParamNum < 1)
+    {
+        lua_pushnil(L);
+    }
+    else if (lua_isstring(L, 1))
+    {
+        const bool Result = GLuaStats.StartSimpleSeconds(lua_tostring(L, 1), L, KeyPtr);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else if (lua_islightuserdata(L, 1))
+    {
+        const bool Result = GLuaStats.StartSimpleSeconds(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), L, KeyPtr);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+int32 SimpleSeconds_Stop(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::SimpleSecondsStop);
+    const int32 ParamNum = lua_gettop(L);
+    if (ParamNum < 1)
+    {
+        lua_pushnil(L);
+    }
+    else if (lua_isstring(L, 1))
+    {
+        const bool Result = GLuaStats.StopSimpleSeconds(lua_tostring(L, 1));
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else if (lua_islightuserdata(L, 1))
+    {
+        const bool Result = GLuaStats.StopSimpleSeconds(static_cast<TStatIdData const*>(lua_touserdata(L, 1)));
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+int32 SimpleSeconds_SetSampleRate(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::SimpleSecondsSetSampleRate);
+    const int32 ParamNum = lua_gettop(L);
+    if (ParamNum < 2 || !lua_isnumber(L, 2))
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    const uint32 SampleRate = static_cast<uint32>(FMath::Max<lua_Integer>(lua_tointeger(L, 2), 1));
+    const bool bRandom = ParamNum >= 3 && lua_toboolean(L, 3) != 0;
+    if (lua_isstring(L, 1))
+    {
+        const bool Result = GLuaStats.SetSimpleSecondsSampleRate(lua_tostring(L, 1), SampleRate, bRandom);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else if (lua_islightuserdata(L, 1))
+    {
+        const bool Result = GLuaStats.SetSimpleSecondsSampleRate(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), SampleRate, bRandom);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+int32 Int64Stat_Create(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::Int64Create);
+    const int32 ParamNum = lua_gettop(L);
+    if (ParamNum <= 0 || ParamNum > 2)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    if (!lua_isstring(L, 1))
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    FString StatDesc;
+    const FName StatName = lua_tostring(L, 1);
+    if (ParamNum > 1 && lua_isstring(L, 2))
+    {
+        StatDesc = lua_tostring(L, 2);
+    }
+    bool bCounter = true;
+    if (ParamNum > 2 && lua_isboolean(L, 3))
+    {
+        bCounter = (lua_toboolean(L, 3) != 0);
+    }
+    TStatIdData const* StatIdPtr;
+    if (bCounter)
+    {
+        StatIdPtr = GLuaStats.CreateInt64Counter(StatName, StatDesc.IsEmpty() ? nullptr : *StatDesc);
+    }
+    else
+    {
+        StatIdPtr = GLuaStats.CreateInt64Accumulator(StatName, StatDesc.IsEmpty() ? nullptr : *StatDesc);
+    }
+    if (StatIdPtr)
+    {
+        lua_pushlightuserdata(L, (void*)StatIdPtr);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+int32 Int64Stat_Add(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::Int64Add);
+    const int32 ParamNum = lua_gettop(L);
+    FLuaStatKey Key;
+    const FLuaStatKey* KeyPtr = ParamNum >= 3 && GLuaStats.ReadStatKey(L, 3, Key) ? &Key : nullptr;
+    if (ParamNum < 1)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    int64 Value = 1;
+    if (ParamNum >= 2 && lua_isnumber(L, 2))
+    {
+        Value = lua_tonumber(L, 2);
+    }
+    if (lua_isstring(L, 1))
+    {
+        const bool Result = GLuaStats.AddInt64Stat(lua_tostring(L, 1), Value, KeyPtr);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else if (lua_islightuserdata(L, 1))
+    {
+        const bool Result = GLuaStats.AddInt64Stat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value, KeyPtr);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+int32 Int64Stat_Subtract(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::Int64Subtract);
+    const int32 ParamNum = lua_gettop(L);
+    if (ParamNum < 1)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    int64 Value = 1;
+    if (ParamNum >= 2 && lua_isnumber(L, 2))
+    {
+        Value = lua_tonumber(L, 2);
+    }
+    if (lua_isstring(L, 1))
+    {
+        const bool Result = GLuaStats.SubtractInt64Stat(lua_tostring(L, 1), Value);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else if (lua_islightuserdata(L, 1))
+    {
+        const bool Result = GLuaStats.SubtractInt64Stat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+int32 Int64Stat_Set(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::Int64Set);
+    const int32 ParamNum = lua_gettop(L);
+    if (ParamNum < 1)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    int64 Value = 1;
+    if (ParamNum >= 2 && lua_isnumber(L, 2))
+    {
+        Value = lua_tonumber(L, 2);
+    }
+    if (lua_isstring(L, 1))
+    {
+        const bool Result = GLuaStats.SetInt64Stat(lua_tostring(L, 1), Value);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else if (lua_islightuserdata(L, 1))
+    {
+        const bool Result = GLuaStats.SetInt64Stat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+int32 DoubleStat_Create(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::DoubleCreate);
+    const int32 ParamNum = lua_gettop(L);
+    if (ParamNum <= 0 || ParamNum > 2)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    if (!lua_isstring(L, 1))
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    FString StatDesc;
+    const FName StatName = lua_tostring(L, 1);
+    if (ParamNum > 1 && lua_isstring(L, 2))
+    {
+        StatDesc = lua_tostring(L, 2);
+    }
+    bool bCounter = true;
+    if (ParamNum > 2 && lua_isboolean(L, 3))
+    {
+        bCounter = (lua_toboolean(L, 3) != 0);
+    }
+    TStatIdData const* StatIdPtr;
+    if (bCounter)
+    {
+        StatIdPtr = GLuaStats.CreateDoubleCounter(StatName, StatDesc.IsEmpty() ? nullptr : *StatDesc);
+    }
+    else
+    {
+        StatIdPtr = GLuaStats.CreateDoubleAccumulator(StatName, StatDesc.IsEmpty() ? nullptr : *StatDesc);
+    }
+    if (StatIdPtr)
+    {
+        lua_pushlightuserdata(L, (void*)StatIdPtr);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 1;
+
+}
+
+int32 DoubleStat_Add(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::DoubleAdd);
+    const int32 ParamNum = lua_gettop(L);
+    FLuaStatKey Key;
+    const FLuaStatKey* KeyPtr = ParamNum >= 3 && GLuaStats.ReadStatKey(L, 3, Key) ? &Key : nullptr;
+    if (ParamNum < 1)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    double Value = 1;
+    if (ParamNum >= 2 && lua_isnumber(L, 2))
+    {
+        Value = lua_tonumber(L, 2);
+    }
+    if (lua_isstring(L, 1))
+    {
+        const bool Result = GLuaStats.AddDoubleStat(lua_tostring(L, 1), Value, KeyPtr);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else if (lua_islightuserdata(L, 1))
+    {
+        const bool Result = GLuaStats.AddDoubleStat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value, KeyPtr);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+int32 DoubleStat_Subtract(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::DoubleSubtract);
+    const int32 ParamNum = lua_gettop(L);
+    if (ParamNum < 1)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    double Value = 1;
+    if (ParamNum >= 2 && lua_isnumber(L, 2))
+    {
+        Value = lua_tonumber(L, 2);
+    }
+    if (lua_isstring(L, 1))
+    {
+        const bool Result = GLuaStats.SubtractDoubleStat(lua_tostring(L, 1), Value);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else if (lua_islightuserdata(L, 1))
+    {
+        const bool Result = GLuaStats.SubtractDoubleStat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+int32 DoubleStat_Set(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::DoubleSet);
+    const int32 ParamNum = lua_gettop(L);
+    if (ParamNum < 1)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    double Value = 1;
+    if (ParamNum >= 2 && lua_isnumber(L, 2))
+    {
+        Value = lua_tonumber(L, 2);
+    }
+    if (lua_isstring(L, 1))
+    {
+        const bool Result = GLuaStats.SetDoubleStat(lua_tostring(L, 1), Value);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else if (lua_islightuserdata(L, 1))
+    {
+        const bool Result = GLuaStats.SetDoubleStat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+int32 FNameStat_Set(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::FNameSet);
+    const int32 ParamNum = lua_gettop(L);
+    if (ParamNum < 1)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    const char* Value = nullptr;
+    if (ParamNum >= 2 && lua_isstring(L, 2))
+    {
+        Value = lua_tostring(L, 2);
+    }
+    // Numbers are converted to a fresh string on every call, so only real strings go through the label cache.
+    lua_State* LabelState = ParamNum >= 2 && lua_type(L, 2) == LUA_TSTRING ? L : nullptr;
+    if (lua_isstring(L, 1))
+    {
+        const bool Result = GLuaStats.SetFNameStat(lua_tostring(L, 1), Value, LabelState, 2);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else if (lua_islightuserdata(L, 1))
+    {
+        const bool Result = GLuaStats.SetFNameStat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value, LabelState, 2);
+        lua_pushboolean(L, Result ? 1 : 0);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 1;
+}
+
+int32 MemoryStat_Create(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::MemoryCreate);
+    const int32 ParamNum = lua_gettop(L);
+    if (ParamNum <= 0 || ParamNum > 2)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    if (!lua_isstring(L, 1))
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    FString StatDesc;
+    const FName StatName = lua_tostring(L, 1);
+    if (ParamNum > 1 && lua_isstring(L, 2))
+    {
+        StatDesc = lua_tostring(L, 2);
+    }
+
+    TStatIdData const* StatIdPtr = GLuaStats.CreateMemoryStat(StatName, StatDesc.IsEmpty() ? nullptr : *StatDesc);
+    if (StatIdPtr)
+    {
+        lua_pushlightuserdata(L, (void*)StatIdPtr);
+    }
+    else
+    {
+        lua_pushnil(L);
+    }
+    return 1;
+
+}
+
+int32 MemoryStat_Add(lua_State* L)
+{
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::MemoryAdd);
+    const int32 ParamNum = lua_gettop(L);
+    if (ParamNum < 1)
+    {
+        lua_pushnil(L);
+        return 1;
+    }
+    int64 Value = 1;
+    if (ParamNum >= 2 && lua_isnumber(L, 2))
+    {
+        Value = lua_tonumber(L, 2);
     }
-
-    FString StatDesc;
-    if (ParamNum > 1 && lua_isstring(L, 2))
+    if (lua_isstring(L, 1))
     {
-        StatDesc = lua_tostring(L, 2);
+        const bool Result = GLuaStats.AddMemoryStat(lua_tostring(L, 1), Value);
+        lua_pushboolean(L, Result ? 1 : 0);
     }
-    const FName StatName = lua_tostring(L, 1);
-    const auto StatIdPtr = GLuaStats.CreateCycleCounter(StatName, StatDesc.IsEmpty() ? nullptr : *StatDesc);
-    if (StatIdPtr)
+    else if (lua_islightuserdata(L, 1))
     {
-        lua_pushlightuserdata(L, (void*)StatIdPtr);
+        const bool Result = GLuaStats.AddMemoryStat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value);
+        lua_pushboolean(L, Result ? 1 : 0);
     }
     else
     {
@@ -643,21 +5232,28 @@ int32 CycleCounter_Create(lua_State* L)
     return 1;
 }
 
-int32 CycleCounter_Start(lua_State* L)
+int32 MemoryStat_Subtract(lua_State* L)
 {
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::MemorySubtract);
     const int32 ParamNum = lua_gettop(L);
     if (ParamNum < 1)
     {
         lua_pushnil(L);
+        return 1;
     }
-    else if (lua_isstring(L, 1))
+    int64 Value = 1;
+    if (ParamNum >= 2 && lua_isnumber(L, 2))
+    {
+        Value = lua_tonumber(L, 2);
+    }
+    if (lua_isstring(L, 1))
     {
-        const bool Result = GLuaStats.StartCycleCounter(lua_tostring(L, 1));
+        const bool Result = GLuaStats.SubtractMemoryStat(lua_tostring(L, 1), Value);
         lua_pushboolean(L, Result ? 1 : 0);
     }
     else if (lua_islightuserdata(L, 1))
     {
-        const bool Result = GLuaStats.StartCycleCounter(static_cast<TStatIdData const*>(lua_touserdata(L, 1)));
+        const bool Result = GLuaStats.SubtractMemoryStat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value);
         lua_pushboolean(L, Result ? 1 : 0);
     }
     else
@@ -667,28 +5263,28 @@ int32 CycleCounter_Start(lua_State* L)
     return 1;
 }
 
-int32 CycleCounter_Stop(lua_State* L)
-{
-    const bool Result = GLuaStats.StopCycleCounter();
-    lua_pushboolean(L, Result ? 1 : 0);
-    return 1;
-}
-
-int32 CycleCounter_Set(lua_State* L)
+int32 MemoryStat_Set(lua_State* L)
 {
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::MemorySet);
     const int32 ParamNum = lua_gettop(L);
     if (ParamNum < 1)
     {
         lua_pushnil(L);
+        return 1;
     }
-    else if (lua_isstring(L, 1))
+    int64 Value = 1;
+    if (ParamNum >= 2 && lua_isnumber(L, 2))
+    {
+        Value = lua_tonumber(L, 2);
+    }
+    if (lua_isstring(L, 1))
     {
-        const bool Result = GLuaStats.StartCycleCounter(lua_tostring(L, 1));
+        const bool Result = GLuaStats.SetMemoryStat(lua_tostring(L, 1), Value);
         lua_pushboolean(L, Result ? 1 : 0);
     }
     else if (lua_islightuserdata(L, 1))
     {
-        const bool Result = GLuaStats.StartCycleCounter(static_cast<TStatIdData const*>(lua_touserdata(L, 1)));
+        const bool Result = GLuaStats.SetMemoryStat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value);
         lua_pushboolean(L, Result ? 1 : 0);
     }
     else
@@ -698,32 +5294,24 @@ int32 CycleCounter_Set(lua_State* L)
     return 1;
 }
 
-int32 SimpleSeconds_Create(lua_State* L)
+int32 AsyncSpan_Create(lua_State* L)
 {
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::AsyncSpanCreate);
     const int32 ParamNum = lua_gettop(L);
-    if (ParamNum <= 0 || ParamNum > 2)
-    {
-        lua_pushnil(L);
-        return 1;
-    }
-    if (!lua_isstring(L, 1))
+    if (ParamNum <= 0 || ParamNum > 2 || !lua_isstring(L, 1))
     {
         lua_pushnil(L);
         return 1;
     }
 
     FString StatDesc;
+    const FName StatName = lua_tostring(L, 1);
     if (ParamNum > 1 && lua_isstring(L, 2))
     {
         StatDesc = lua_tostring(L, 2);
     }
-    double Scale = 1.0;
-    if (ParamNum > 2 && lua_isnumber(L, 3))
-    {
-        Scale = lua_tonumber(L, 3);
-    }
-    const FName StatName = lua_tostring(L, 1);
-    const auto StatIdPtr = GLuaStats.CreateSimpleSeconds(StatName, StatDesc.IsEmpty() ? nullptr : *StatDesc, Scale);
+
+    TStatIdData const* StatIdPtr = GLuaStats.CreateAsyncSpan(StatName, StatDesc.IsEmpty() ? nullptr : *StatDesc);
     if (StatIdPtr)
     {
         lua_pushlightuserdata(L, (void*)StatIdPtr);
@@ -735,22 +5323,22 @@ int32 SimpleSeconds_Create(lua_State* L)
     return 1;
 }
 
-int32 SimpleSeconds_Start(lua_State* L)
+int32 AsyncSpan_Begin(lua_State* L)
 {
-    const int32 ParamNum = lua_gettop(L);
-    if (ParamNum < 1)
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::AsyncSpanBegin);
+    int64 SpanId = 0;
+    if (lua_gettop(L) >= 1 && lua_isstring(L, 1))
     {
-        lua_pushnil(L);
+        SpanId = GLuaStats.BeginAsyncSpan(lua_tostring(L, 1));
     }
-    else if (lua_isstring(L, 1))
+    else if (lua_gettop(L) >= 1 && lua_islightuserdata(L, 1))
     {
-        const bool Result = GLuaStats.StartSimpleSeconds(lua_tostring(L, 1));
-        lua_pushboolean(L, Result ? 1 : 0);
+        SpanId = GLuaStats.BeginAsyncSpan(static_cast<TStatIdData const*>(lua_touserdata(L, 1)));
     }
-    else if (lua_islightuserdata(L, 1))
+    GLuaCallRecorder.RecordResult(SpanId);
+    if (SpanId != 0)
     {
-        const bool Result = GLuaStats.StartSimpleSeconds(static_cast<TStatIdData const*>(lua_touserdata(L, 1)));
-        lua_pushboolean(L, Result ? 1 : 0);
+        lua_pushinteger(L, SpanId);
     }
     else
     {
@@ -759,22 +5347,14 @@ int32 SimpleSeconds_Start(lua_State* L)
     return 1;
 }
 
-int32 SimpleSeconds_Stop(lua_State* L)
+int32 AsyncSpan_End(lua_State* L)
 {
-    const int32 ParamNum = lua_gettop(L);
-    if (ParamNum < 1)
-    {
-        lua_pushnil(L);
-    }
-    else if (lua_isstring(L, 1))
-    {
-        const bool Result = GLuaStats.StopSimpleSeconds(lua_tostring(L, 1));
-        lua_pushboolean(L, Result ? 1 : 0);
-    }
-    else if (lua_islightuserdata(L, 1))
+    // Returns the span's latency in seconds, or nil for an unknown, already ended or expired id.
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::AsyncSpanEnd);
+    double Seconds = 0.0;
+    if (lua_gettop(L) >= 1 && lua_isinteger(L, 1) && GLuaStats.EndAsyncSpan(lua_tointeger(L, 1), Seconds))
     {
-        const bool Result = GLuaStats.StopSimpleSeconds(static_cast<TStatIdData const*>(lua_touserdata(L, 1)));
-        lua_pushboolean(L, Result ? 1 : 0);
+        lua_pushnumber(L, Seconds);
     }
     else
     {
@@ -783,133 +5363,582 @@ int32 SimpleSeconds_Stop(lua_State* L)
     return 1;
 }
 
-int32 Int64Stat_Create(lua_State* L)
+static constexpr int32 LuaBenchmarkStats = 64;
+
+// The single lock the registry would need to be called from several threads, instrumented: FLuaStats itself
+// has no locking and is only ever called from the game thread.
+struct FLuaBenchmarkLock
 {
-    const int32 ParamNum = lua_gettop(L);
-    if (ParamNum <= 0 || ParamNum > 2)
+    FCriticalSection Mutex;
+    std::atomic<uint64> Acquisitions { 0 };
+    std::atomic<uint64> Contended { 0 };
+    std::atomic<uint64> WaitCycles { 0 };
+
+    void Lock()
     {
-        lua_pushnil(L);
-        return 1;
+        if (!Mutex.TryLock())
+        {
+            const uint64 Start = FPlatformTime::Cycles64();
+            Mutex.Lock();
+            Contended.fetch_add(1, std::memory_order_relaxed);
+            WaitCycles.fetch_add(FPlatformTime::Cycles64() - Start, std::memory_order_relaxed);
+        }
+        Acquisitions.fetch_add(1, std::memory_order_relaxed);
     }
-    if (!lua_isstring(L, 1))
+
+    void Unlock()
     {
-        lua_pushnil(L);
-        return 1;
+        Mutex.Unlock();
     }
+};
 
-    FString StatDesc;
-    const FName StatName = lua_tostring(L, 1);
-    if (ParamNum > 1 && lua_isstring(L, 2))
+enum class ELuaBenchmarkMode : uint8
+{
+    // One registry behind the lock, every thread timing the same names.
+    SharedNames,
+    // One registry behind the lock, every thread timing names of its own.
+    DisjointNames,
+    // A registry per thread and no lock: what sharding the registry by thread could reach at best.
+    PerThread,
+};
+
+struct FLuaBenchmarkRun
+{
+    ELuaBenchmarkMode Mode = ELuaBenchmarkMode::SharedNames;
+    // The registry the workers share; null in PerThread mode.
+    FLuaStats* SharedStats = nullptr;
+    FLuaBenchmarkLock Lock;
+    std::atomic<int32> Ready { 0 };
+    std::atomic<bool> bGo { false };
+};
+
+// One benchmark thread with a Lua state of its own, timing a scope and counting into a stat through the native
+// FLuaStats paths. The registries are scratch instances, not GLuaStats, so a run leaves no definitions behind.
+// The lock is held for the whole scope: cycle counter scopes of different threads must not interleave on a
+// registry's one scope stack.
+class FLuaBenchmarkWorker : public FRunnable
+{
+public:
+    FLuaBenchmarkWorker(int32 InIndex, int32 InIterations, FLuaBenchmarkRun& InBenchmarkRun)
+        : Index(InIndex)
+        , Iterations(InIterations)
+        , BenchmarkRun(InBenchmarkRun)
     {
-        StatDesc = lua_tostring(L, 2);
     }
-    bool bCounter = true;
-    if (ParamNum > 2 && lua_isboolean(L, 3))
+
+    virtual uint32 Run() override
     {
-        bCounter = (lua_toboolean(L, 3) != 0);
+        lua_State* L = luaL_newstate();
+        TUniquePtr<FLuaStats> OwnStats;
+        FLuaStats* Stats = BenchmarkRun.SharedStats;
+        if (Stats == nullptr)
+        {
+            OwnStats = MakeUnique<FLuaStats>();
+            OwnStats->SetActiveGroup(TEXT("Benchmark"), nullptr, true);
+            Stats = OwnStats.Get();
+        }
+        const bool bLocked = BenchmarkRun.SharedStats != nullptr;
+        const FString Owner = BenchmarkRun.Mode == ELuaBenchmarkMode::SharedNames ? FString(TEXT("Shared")) : FString::Printf(TEXT("T%d"), Index);
+        TArray<FName> ScopeNames;
+        TArray<FName> CountNames;
+        for (int32 Stat = 0; Stat < LuaBenchmarkStats; ++Stat)
+        {
+            ScopeNames.Add(FName(*FString::Printf(TEXT("Bench.%s.Scope%d"), *Owner, Stat)));
+            CountNames.Add(FName(*FString::Printf(TEXT("Bench.%s.Count%d"), *Owner, Stat)));
+            // Only the first thread to create a shared name gets it; everyone times by name afterwards anyway.
+            uint64 Start = FPlatformTime::Cycles64();
+            LockIf(bLocked);
+            Stats->CreateCycleCounter(ScopeNames.Last());
+            UnlockIf(bLocked);
+            CreateLatency.Add(FPlatformTime::Cycles64() - Start);
+            Start = FPlatformTime::Cycles64();
+            LockIf(bLocked);
+            Stats->CreateInt64Counter(CountNames.Last());
+            UnlockIf(bLocked);
+            CreateLatency.Add(FPlatformTime::Cycles64() - Start);
+        }
+
+        BenchmarkRun.Ready.fetch_add(1, std::memory_order_release);
+        while (!BenchmarkRun.bGo.load(std::memory_order_acquire))
+        {
+            FPlatformProcess::Sleep(0.0f);
+        }
+        for (int32 Iteration = 0; Iteration < Iterations; ++Iteration)
+        {
+            const int32 Stat = Iteration % LuaBenchmarkStats;
+            const uint64 Start = FPlatformTime::Cycles64();
+            LockIf(bLocked);
+            Stats->StartCycleCounter(ScopeNames[Stat], L);
+            Stats->AddInt64Stat(CountNames[Stat], Stat);
+            Stats->StopCycleCounter();
+            UnlockIf(bLocked);
+            Latency.Add(FPlatformTime::Cycles64() - Start);
+        }
+        // A scope whose stat is disabled costs a lookup and nothing else, which is not what the run is after.
+        LockIf(bLocked);
+        bCollected = FThreadStats::IsCollectingData() && TStatId(Stats->ResolveStat(ELuaStatType::CycleCounter, ScopeNames[0])).IsValidStat();
+        UnlockIf(bLocked);
+        OwnStats.Reset();
+        lua_close(L);
+        return 0;
     }
-    TStatIdData const* StatIdPtr;
-    if (bCounter)
+
+    // Per scope: Start, Add and Stop.
+    FLuaCallLatency Latency;
+    // Per Create call, two per stat.
+    FLuaCallLatency CreateLatency;
+    bool bCollected = false;
+
+private:
+    void LockIf(bool bLocked)
     {
-        StatIdPtr = GLuaStats.CreateInt64Counter(StatName, StatDesc.IsEmpty() ? nullptr : *StatDesc);
+        if (bLocked)
+        {
+            BenchmarkRun.Lock.Lock();
+        }
     }
-    else
+
+    void UnlockIf(bool bLocked)
     {
-        StatIdPtr = GLuaStats.CreateInt64Accumulator(StatName, StatDesc.IsEmpty() ? nullptr : *StatDesc);
+        if (bLocked)
+        {
+            BenchmarkRun.Lock.Unlock();
+        }
     }
-    if (StatIdPtr)
+
+    int32 Index;
+    int32 Iterations;
+    FLuaBenchmarkRun& BenchmarkRun;
+};
+
+// Runs the workers for 1, 2, 4 ... MaxThreads threads in every mode and logs throughput, its scaling against
+// one thread, latency percentiles and lock contention, one row for creating the stats and one for timing with
+// them; with a path, also as CSV for CI. FLuaStats is only ever called from the game thread, so the locked modes
+// cannot scale past one thread: they measure what serialising script threads on today's registry costs, and
+// PerThread is the bound a concurrent registry would approach. Stat collection is switched on for the run and
+// the benchmark group is created enabled, so scopes take the path they take under "stat Lua" in a headless run too.
+static void RunLuaStatsBenchmark(int32 MaxThreads, int32 Iterations, const FString& CsvPath)
+{
+    StatsPrimaryEnableAdd();
+    const double NanosecondsPerCycle = FPlatformTime::GetSecondsPerCycle64() * 1e9;
+    FString Csv = TEXT("Mode,Phase,Threads,CallsPerSecond,Scaling,P50Ns,P99Ns,P999Ns,MaxNs,Acquisitions,Contended,WaitNsPerOp,Collected\n");
+    UE_LOG(LogLuaStats, Log, TEXT("%-10s %-6s %7s %14s %8s %9s %9s %9s %10s %10s %11s %9s"), TEXT("Mode"), TEXT("Phase"), TEXT("Threads"),
+        TEXT("Calls/s"), TEXT("Scaling"), TEXT("P50 ns"), TEXT("P99 ns"), TEXT("P99.9 ns"), TEXT("Max ns"), TEXT("Contended"), TEXT("Wait ns/op"),
+        TEXT("Collected"));
+    for (const ELuaBenchmarkMode Mode : { ELuaBenchmarkMode::SharedNames, ELuaBenchmarkMode::DisjointNames, ELuaBenchmarkMode::PerThread })
+    {
+        const TCHAR* ModeName = Mode == ELuaBenchmarkMode::SharedNames ? TEXT("shared") : Mode == ELuaBenchmarkMode::DisjointNames ? TEXT("disjoint") : TEXT("perthread");
+        double SingleThreadCalls[2] = {};
+        for (int32 NumThreads = 1; NumThreads <= MaxThreads; NumThreads *= 2)
+        {
+            FLuaBenchmarkRun Run;
+            Run.Mode = Mode;
+            TUniquePtr<FLuaStats> SharedStats;
+            if (Mode != ELuaBenchmarkMode::PerThread)
+            {
+                SharedStats = MakeUnique<FLuaStats>();
+                SharedStats->SetActiveGroup(TEXT("Benchmark"), nullptr, true);
+                Run.SharedStats = SharedStats.Get();
+            }
+            FLuaBenchmarkLock& Lock = Run.Lock;
+            TArray<TUniquePtr<FLuaBenchmarkWorker>> Workers;
+            TArray<FRunnableThread*> Threads;
+            const double CreateStartSeconds = FPlatformTime::Seconds();
+            for (int32 Index = 0; Index < NumThreads; ++Index)
+            {
+                Workers.Add(MakeUnique<FLuaBenchmarkWorker>(Index, Iterations, Run));
+                Threads.Add(FRunnableThread::Create(Workers.Last().Get(), *FString::Printf(TEXT("LuaStatsBenchmark%d"), Index)));
+            }
+            // The scope clock starts once every worker has its stats; the create phase includes starting the threads.
+            while (Run.Ready.load(std::memory_order_acquire) < NumThreads)
+            {
+                FPlatformProcess::Sleep(0.001f);
+            }
+            const double CreateSeconds = FPlatformTime::Seconds() - CreateStartSeconds;
+            const uint64 SetupAcquisitions = Lock.Acquisitions.load();
+            const uint64 SetupContended = Lock.Contended.load();
+            const uint64 SetupWaitCycles = Lock.WaitCycles.load();
+            const double StartSeconds = FPlatformTime::Seconds();
+            Run.bGo.store(true, std::memory_order_release);
+            for (FRunnableThread* Thread : Threads)
+            {
+                Thread->WaitForCompletion();
+                delete Thread;
+            }
+            const double Seconds = FPlatformTime::Seconds() - StartSeconds;
+
+            FLuaCallLatency CreateLatency;
+            FLuaCallLatency Latency;
+            bool bCollected = true;
+            for (const TUniquePtr<FLuaBenchmarkWorker>& Worker : Workers)
+            {
+                CreateLatency.Merge(Worker->CreateLatency);
+                Latency.Merge(Worker->Latency);
+                bCollected &= Worker->bCollected;
+            }
+            struct FPhase
+            {
+                const TCHAR* Name;
+                const FLuaCallLatency& Latency;
+                // Registry calls per latency sample: an op is one Create, or one scope of Start, Add and Stop.
+                double CallsPerSample;
+                double Seconds;
+                uint64 Acquisitions;
+                uint64 Contended;
+                uint64 WaitCycles;
+            };
+            const FPhase Phases[] =
+            {
+                { TEXT("create"), CreateLatency, 1.0, CreateSeconds, SetupAcquisitions, SetupContended, SetupWaitCycles },
+                { TEXT("scope"), Latency, 3.0, Seconds, Lock.Acquisitions.load() - SetupAcquisitions, Lock.Contended.load() - SetupContended,
+                    Lock.WaitCycles.load() - SetupWaitCycles },
+            };
+            for (int32 PhaseIndex = 0; PhaseIndex < static_cast<int32>(UE_ARRAY_COUNT(Phases)); ++PhaseIndex)
+            {
+                const FPhase& Phase = Phases[PhaseIndex];
+                const double CallsPerSecond = Phase.Seconds > 0.0 ? Phase.CallsPerSample * Phase.Latency.Calls / Phase.Seconds : 0.0;
+                SingleThreadCalls[PhaseIndex] = NumThreads == 1 ? CallsPerSecond : SingleThreadCalls[PhaseIndex];
+                const double Scaling = SingleThreadCalls[PhaseIndex] > 0.0 ? CallsPerSecond / SingleThreadCalls[PhaseIndex] : 0.0;
+                const double WaitNsPerOp = Phase.Latency.Calls > 0 ? Phase.WaitCycles * NanosecondsPerCycle / Phase.Latency.Calls : 0.0;
+                const double P50 = Phase.Latency.GetPercentile(0.5) * NanosecondsPerCycle;
+                const double P99 = Phase.Latency.GetPercentile(0.99) * NanosecondsPerCycle;
+                const double P999 = Phase.Latency.GetPercentile(0.999) * NanosecondsPerCycle;
+                const double Max = Phase.Latency.MaxCycles * NanosecondsPerCycle;
+                UE_LOG(LogLuaStats, Log, TEXT("%-10s %-6s %7d %14.0f %8.2f %9.0f %9.0f %9.0f %10.0f %9.1f%% %11.1f %9s"), ModeName, Phase.Name, NumThreads,
+                    CallsPerSecond, Scaling, P50, P99, P999, Max, Phase.Acquisitions > 0 ? 100.0 * Phase.Contended / Phase.Acquisitions : 0.0, WaitNsPerOp,
+                    bCollected ? TEXT("yes") : TEXT("no"));
+                Csv += FString::Printf(TEXT("%s,%s,%d,%.0f,%.3f,%.0f,%.0f,%.0f,%.0f,%llu,%llu,%.1f,%d\n"), ModeName, Phase.Name, NumThreads, CallsPerSecond,
+                    Scaling, P50, P99, P999, Max, Phase.Acquisitions, Phase.Contended, WaitNsPerOp, bCollected ? 1 : 0);
+            }
+            if (!bCollected)
+            {
+                UE_LOG(LogLuaStats, Warning, TEXT("Lua stats benchmark: stats were not collected in %s mode with %d threads, so scopes only looked up their names"),
+                    ModeName, NumThreads);
+            }
+        }
+    }
+    StatsPrimaryEnableSubtract();
+    if (!CsvPath.IsEmpty() && !FFileHelper::SaveStringToFile(Csv, *CsvPath, FFileHelper::EEncodingOptions::ForceUTF8WithoutBOM))
     {
-        lua_pushlightuserdata(L, (void*)StatIdPtr);
+        UE_LOG(LogLuaStats, Warning, TEXT("Failed to write Lua stats benchmark results to %s"), *CsvPath);
     }
-    else
+}
+
+static FAutoConsoleCommand GLuaStatsBenchmarkCommand(
+    TEXT("LuaStats.Benchmark"),
+    TEXT("Times scopes and counts through scratch stat registries from 1 to N threads, each with its own Lua state: shared and disjoint names on one locked registry, and a registry per thread. Logs throughput scaling, latency percentiles and lock contention of creating the stats and of timing with them. Optional arguments: max threads (default 64), iterations per thread (default 100000), CSV path."),
+    FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+    {
+        const int32 MaxThreads = Args.Num() > 0 ? FMath::Clamp(FCString::Atoi(*Args[0]), 1, 64) : 64;
+        const int32 Iterations = Args.Num() > 1 ? FMath::Max(FCString::Atoi(*Args[1]), 1) : 100000;
+        RunLuaStatsBenchmark(MaxThreads, Iterations, Args.Num() > 2 ? Args[2] : FString());
+    }));
+
+static void OnLuaStateClosed(lua_State* L)
+{
+    GLuaLineProfiler.OnStateClosed(L);
+    GLuaNativeTracker.OnStateClosed(L);
+    GLuaInstructionCounter.OnStateClosed(L);
+    GLuaHeapScanner.OnStateClosed(L);
+    GLuaThreadHooker.OnStateClosed(L);
+    GLuaStats.ForgetNameStatLabels();
+}
+
+static int32 GetDefinitionField(lua_State* L, int32 Index, const char* Field, int32 Position)
+{
+    const int32 Type = lua_getfield(L, Index, Field);
+    if (Type != LUA_TNIL)
     {
-        lua_pushnil(L);
+        return Type;
     }
-    return 1;
+    lua_pop(L, 1);
+    return lua_rawgeti(L, Index, Position);
 }
 
-int32 Int64Stat_Add(lua_State* L)
+int32 LuaStats_Register(lua_State* L)
 {
     const int32 ParamNum = lua_gettop(L);
-    if (ParamNum < 1)
+    if (ParamNum < 1 || !lua_istable(L, 1))
     {
         lua_pushnil(L);
         return 1;
     }
-    int64 Value = 1;
-    if (ParamNum >= 2 && lua_isnumber(L, 2))
+
+    // Each entry is { Name = "X", Type = "CycleCounter", Desc = "...", Scale = 1.0, Group = "AI" }
+    // or the positional { "X", "CycleCounter", ... }. A Group field on the outer table applies to every entry.
+    const int32 Count = static_cast<int32>(lua_rawlen(L, 1));
+    FLuaStatTypeCounts Counts;
+    for (int32 Index = 1; Index <= Count; ++Index)
+    {
+        ELuaStatType Type = ELuaStatType::CycleCounter;
+        if (lua_rawgeti(L, 1, Index) == LUA_TTABLE)
+        {
+            GetDefinitionField(L, 2, "Type", 2);
+            if (lua_isnil(L, -1) || (lua_isstring(L, -1) && ParseLuaStatType(UTF8_TO_TCHAR(lua_tostring(L, -1)), Type)))
+            {
+                Counts.Add(Type);
+            }
+        }
+        lua_settop(L, 1);
+    }
+    GLuaStats.ReserveStats(Counts);
+    lua_settop(L, 1);
+    lua_getfield(L, 1, "Group");
+    const FName BatchGroup = lua_isstring(L, -1) ? FName(lua_tostring(L, -1)) : FName();
+    const FName SavedGroup = lua_isstring(L, -1) ? GLuaStats.SetActiveGroup(BatchGroup) : FName();
+    lua_settop(L, 1);
+    lua_createtable(L, 0, Count);
+    // The second result lists the indices of the entries that did not give a handle, each also logged.
+    lua_newtable(L);
+    int32 NumFailed = 0;
+    auto Fail = [L, &NumFailed](int32 Index, const TCHAR* Reason)
+    {
+        UE_LOG(LogLuaStats, Warning, TEXT("LuaStats.Register: entry %d skipped, %s"), Index, Reason);
+        lua_pushinteger(L, Index);
+        lua_rawseti(L, 3, ++NumFailed);
+    };
+    for (int32 Index = 1; Index <= Count; ++Index)
+    {
+        if (lua_rawgeti(L, 1, Index) != LUA_TTABLE)
+        {
+            Fail(Index, TEXT("not a table"));
+            lua_settop(L, 3);
+            continue;
+        }
+        GetDefinitionField(L, 4, "Name", 1);
+        GetDefinitionField(L, 4, "Type", 2);
+        GetDefinitionField(L, 4, "Desc", 3);
+        GetDefinitionField(L, 4, "Scale", 4);
+        GetDefinitionField(L, 4, "Group", 5);
+        ELuaStatType Type = ELuaStatType::CycleCounter;
+        if (!lua_isstring(L, 5))
+        {
+            Fail(Index, TEXT("its Name is not a string"));
+        }
+        else if (!lua_isnil(L, 6) && !(lua_isstring(L, 6) && ParseLuaStatType(UTF8_TO_TCHAR(lua_tostring(L, 6)), Type)))
+        {
+            Fail(Index, *FString::Printf(TEXT("unknown Type %s"), lua_isstring(L, 6) ? UTF8_TO_TCHAR(lua_tostring(L, 6)) : UTF8_TO_TCHAR(luaL_typename(L, 6))));
+        }
+        else
+        {
+            FString StatDesc;
+            if (lua_isstring(L, 7))
+            {
+                StatDesc = UTF8_TO_TCHAR(lua_tostring(L, 7));
+            }
+            const double Scale = lua_isnumber(L, 8) ? lua_tonumber(L, 8) : 1.0;
+            const bool bEntryGroup = lua_isstring(L, 9) != 0;
+            const FName EntrySavedGroup = bEntryGroup ? GLuaStats.SetActiveGroup(lua_tostring(L, 9)) : FName();
+            const auto StatIdPtr = GLuaStats.CreateStat(Type, lua_tostring(L, 5), StatDesc.IsEmpty() ? nullptr : *StatDesc, Scale);
+            if (bEntryGroup)
+            {
+                GLuaStats.SetActiveGroup(EntrySavedGroup);
+            }
+            if (StatIdPtr)
+            {
+                lua_pushvalue(L, 5);
+                lua_pushlightuserdata(L, (void*)StatIdPtr);
+                lua_rawset(L, 2);
+            }
+            else
+            {
+                Fail(Index, TEXT("a stat or parent of that name exists already"));
+            }
+        }
+        lua_settop(L, 3);
+    }
+    if (!BatchGroup.IsNone())
     {
-        Value = lua_tonumber(L, 2);
+        GLuaStats.SetActiveGroup(SavedGroup);
     }
-    if (lua_isstring(L, 1))
+    return 2;
+}
+
+int32 LuaStats_SaveManifest(lua_State* L)
+{
+    const FString Path = lua_gettop(L) >= 1 && lua_isstring(L, 1) ? FString(UTF8_TO_TCHAR(lua_tostring(L, 1))) : FLuaStats::GetDefaultManifestPath();
+    lua_pushboolean(L, GLuaStats.SaveManifest(Path) ? 1 : 0);
+    return 1;
+}
+
+int32 LuaStats_Group(lua_State* L)
+{
+    const int32 ParamNum = lua_gettop(L);
+    FName GroupName;
+    if (ParamNum >= 1 && lua_isstring(L, 1))
     {
-        const bool Result = GLuaStats.AddInt64Stat(lua_tostring(L, 1), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
+        GroupName = lua_tostring(L, 1);
     }
-    else if (lua_islightuserdata(L, 1))
+    FString GroupDesc;
+    if (ParamNum >= 2 && lua_isstring(L, 2))
     {
-        const bool Result = GLuaStats.AddInt64Stat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
+        GroupDesc = lua_tostring(L, 2);
     }
-    else
+    const bool bDefaultEnabled = ParamNum >= 3 && lua_toboolean(L, 3) != 0;
+    const FName Previous = GLuaStats.SetActiveGroup(GroupName, GroupDesc.IsEmpty() ? nullptr : *GroupDesc, bDefaultEnabled);
+    if (Previous.IsNone())
     {
         lua_pushnil(L);
     }
+    else
+    {
+        lua_pushstring(L, TCHAR_TO_UTF8(*Previous.ToString()));
+    }
     return 1;
 }
 
-int32 Int64Stat_Subtract(lua_State* L)
+int32 LuaStats_EnableGroup(lua_State* L)
 {
     const int32 ParamNum = lua_gettop(L);
-    if (ParamNum < 1)
+    FName GroupName;
+    if (ParamNum >= 1 && lua_isstring(L, 1))
     {
-        lua_pushnil(L);
-        return 1;
+        GroupName = lua_tostring(L, 1);
     }
-    int64 Value = 1;
-    if (ParamNum >= 2 && lua_isnumber(L, 2))
+    const bool bEnable = ParamNum < 2 || lua_toboolean(L, 2) != 0;
+    lua_pushboolean(L, GLuaStats.EnableGroup(GroupName, bEnable) ? 1 : 0);
+    return 1;
+}
+
+static const luaL_Reg CycleCounterLib[] =
+{
+    { "Create", CycleCounter_Create },
+    { "Start", CycleCounter_Start },
+    { "Stop", CycleCounter_Stop },
+    { "Set", CycleCounter_Set },
+    { "SetSampleRate", CycleCounter_SetSampleRate },
+    { nullptr, nullptr }
+};
+
+static void CalibrateLuaScopeOverhead()
+{
+    // Times Start(Stat) Stop() pairs through the real bindings in a scratch VM against an empty loop of the same length;
+    // the difference per iteration is what one nested scope adds to its parent on this machine.
+    static const char* const ScopedChunk =
+        "local Stat, Count = ... local Start, Stop = FCycleCounter.Start, FCycleCounter.Stop "
+        "for Index = 1, Count do Start(Stat) Stop() end";
+    static const char* const EmptyChunk =
+        "local Stat, Count = ... local Start, Stop = FCycleCounter.Start, FCycleCounter.Stop "
+        "for Index = 1, Count do end";
+    constexpr int32 Iterations = 10000;
+    constexpr int32 Rounds = 5;
+
+    TStatIdData const* CalibrationStat = GLuaStats.GetCalibrationCounter();
+    lua_State* L = CalibrationStat ? luaL_newstate() : nullptr;
+    if (L == nullptr)
     {
-        Value = lua_tonumber(L, 2);
+        return;
     }
-    if (lua_isstring(L, 1))
+    luaL_newlib(L, CycleCounterLib);
+    lua_setglobal(L, "FCycleCounter");
+
+    TArray<FLuaCycleScope> OpenScopes = GLuaStats.SuspendCycleScopes();
+    uint64 BestScoped = MAX_uint64;
+    uint64 BestEmpty = MAX_uint64;
+    if (luaL_loadstring(L, ScopedChunk) == LUA_OK && luaL_loadstring(L, EmptyChunk) == LUA_OK)
     {
-        const bool Result = GLuaStats.SubtractInt64Stat(lua_tostring(L, 1), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
+        for (int32 Round = 0; Round < Rounds; ++Round)
+        {
+            for (int32 Chunk = 1; Chunk <= 2; ++Chunk)
+            {
+                lua_pushvalue(L, Chunk);
+                lua_pushlightuserdata(L, (void*)CalibrationStat);
+                lua_pushinteger(L, Iterations);
+                const uint64 StartCycles = FPlatformTime::Cycles64();
+                if (lua_pcall(L, 2, 0, 0) != LUA_OK)
+                {
+                    UE_LOG(LogLuaStats, Warning, TEXT("Lua scope overhead calibration failed: %s"), UTF8_TO_TCHAR(lua_tostring(L, -1)));
+                    lua_close(L);
+                    GLuaStats.ResumeCycleScopes(MoveTemp(OpenScopes));
+                    return;
+                }
+                uint64& Best = Chunk == 1 ? BestScoped : BestEmpty;
+                Best = FMath::Min(Best, FPlatformTime::Cycles64() - StartCycles);
+            }
+        }
     }
-    else if (lua_islightuserdata(L, 1))
+    lua_close(L);
+    GLuaStats.ResumeCycleScopes(MoveTemp(OpenScopes));
+    if (BestScoped != MAX_uint64 && BestEmpty != MAX_uint64)
     {
-        const bool Result = GLuaStats.SubtractInt64Stat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
+        GLuaStats.SetCalibratedScopeOverhead(BestScoped > BestEmpty ? (BestScoped - BestEmpty) / Iterations : 0);
     }
-    else
+}
+
+int32 LuaStats_Calibrate(lua_State* L)
+{
+    CalibrateLuaScopeOverhead();
+    lua_pushnumber(L, GLuaStats.GetScopeOverheadNs());
+    return 1;
+}
+
+int32 LuaStats_GetRollups(lua_State* L)
+{
+    // Returns { [name] = { Ms = ..., Calls = ... } } for the last frame, by "Module" (default) or "Source".
+    const bool bModules = lua_gettop(L) < 1 || !lua_isstring(L, 1) || FCStringAnsi::Stricmp(lua_tostring(L, 1), "Source") != 0;
+    const TArray<FLuaRollup>& Rollups = GLuaStats.GetRollups(bModules);
+    lua_createtable(L, 0, Rollups.Num());
+    for (const FLuaRollup& Rollup : Rollups)
     {
-        lua_pushnil(L);
+        if (Rollup.LastCalls == 0)
+        {
+            continue;
+        }
+        lua_pushstring(L, TCHAR_TO_UTF8(*Rollup.Name.ToString()));
+        lua_createtable(L, 0, 2);
+        lua_pushnumber(L, Rollup.LastMs);
+        lua_setfield(L, -2, "Ms");
+        lua_pushinteger(L, Rollup.LastCalls);
+        lua_setfield(L, -2, "Calls");
+        lua_rawset(L, -3);
     }
     return 1;
 }
 
-int32 Int64Stat_Set(lua_State* L)
+int32 LuaStats_ProfileLines(lua_State* L)
 {
-    const int32 ParamNum = lua_gettop(L);
-    if (ParamNum < 1)
+    // Accepts one chunk name pattern or an array of them; a chunk is profiled when its name contains a pattern.
+    TArray<FString> Allowlist;
+    if (lua_gettop(L) >= 1 && lua_istable(L, 1))
     {
-        lua_pushnil(L);
-        return 1;
+        const int32 Num = static_cast<int32>(lua_rawlen(L, 1));
+        for (int32 Index = 1; Index <= Num; ++Index)
+        {
+            lua_rawgeti(L, 1, Index);
+            if (lua_isstring(L, -1))
+            {
+                Allowlist.Add(UTF8_TO_TCHAR(lua_tostring(L, -1)));
+            }
+            lua_pop(L, 1);
+        }
     }
-    int64 Value = 1;
-    if (ParamNum >= 2 && lua_isnumber(L, 2))
+    else if (lua_gettop(L) >= 1 && lua_isstring(L, 1))
     {
-        Value = lua_tonumber(L, 2);
+        Allowlist.Add(UTF8_TO_TCHAR(lua_tostring(L, 1)));
     }
-    if (lua_isstring(L, 1))
+    if (Allowlist.Num() == 0)
     {
-        const bool Result = GLuaStats.SetInt64Stat(lua_tostring(L, 1), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
+        lua_pushnil(L);
+        return 1;
     }
-    else if (lua_islightuserdata(L, 1))
+    const bool Result = GLuaLineProfiler.Start(L, MoveTemp(Allowlist));
+    lua_pushboolean(L, Result ? 1 : 0);
+    return 1;
+}
+
+int32 LuaStats_StopLineProfile(lua_State* /*L*/)
+{
+    GLuaLineProfiler.Stop();
+    return 0;
+}
+
+int32 LuaStats_DumpLineProfile(lua_State* L)
+{
+    const FString Path = lua_gettop(L) >= 1 && lua_isstring(L, 1) ? FString(UTF8_TO_TCHAR(lua_tostring(L, 1))) : FLuaLineProfiler::GetDefaultDumpPath();
+    const int32 MaxLines = lua_gettop(L) >= 2 && lua_isnumber(L, 2) ? static_cast<int32>(lua_tointeger(L, 2)) : 200;
+    if (GLuaLineProfiler.Dump(Path, MaxLines))
     {
-        const bool Result = GLuaStats.SetInt64Stat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
+        lua_pushstring(L, TCHAR_TO_UTF8(*Path));
     }
     else
     {
@@ -918,74 +5947,154 @@ int32 Int64Stat_Set(lua_State* L)
     return 1;
 }
 
-int32 DoubleStat_Create(lua_State* L)
+int32 LuaStats_TrackNative(lua_State* L)
 {
-    const int32 ParamNum = lua_gettop(L);
-    if (ParamNum <= 0 || ParamNum > 2)
+    const bool bEnable = lua_gettop(L) < 1 || lua_toboolean(L, 1) != 0;
+    if (!bEnable)
     {
-        lua_pushnil(L);
+        GLuaNativeTracker.Stop();
+        lua_pushboolean(L, 1);
         return 1;
     }
-    if (!lua_isstring(L, 1))
+    const bool Result = GLuaNativeTracker.Start(L);
+    lua_pushboolean(L, Result ? 1 : 0);
+    return 1;
+}
+
+int32 LuaStats_CountInstructions(lua_State* L)
+{
+    // LuaStats.CountInstructions(Enable[, PerFunction[, Period]]): publishes Name@Instructions for every cycle counter.
+    const bool bEnable = lua_gettop(L) < 1 || lua_toboolean(L, 1) != 0;
+    if (!bEnable)
     {
-        lua_pushnil(L);
+        GLuaInstructionCounter.Stop();
+        lua_pushboolean(L, 1);
         return 1;
     }
+    const bool bFunctions = lua_gettop(L) >= 2 && lua_toboolean(L, 2) != 0;
+    const int32 Period = lua_gettop(L) >= 3 && lua_isnumber(L, 3) ? static_cast<int32>(lua_tointeger(L, 3)) : 1;
+    const bool Result = GLuaInstructionCounter.Start(L, bFunctions, Period);
+    lua_pushboolean(L, Result ? 1 : 0);
+    return 1;
+}
 
-    FString StatDesc;
-    const FName StatName = lua_tostring(L, 1);
-    if (ParamNum > 1 && lua_isstring(L, 2))
+int32 LuaStats_TrackClass(lua_State* L)
+{
+    // LuaStats.TrackClass(Metatable, Name[, Constructor]): counts instances returned by Metatable[Constructor]
+    // ("new" by default) or passed to CountObject.
+    if (lua_gettop(L) < 2 || !lua_istable(L, 1) || !lua_isstring(L, 2))
     {
-        StatDesc = lua_tostring(L, 2);
+        lua_pushnil(L);
+        return 1;
     }
-    bool bCounter = true;
-    if (ParamNum > 2 && lua_isboolean(L, 3))
+    const char* Constructor = lua_gettop(L) >= 3 && lua_isstring(L, 3) ? lua_tostring(L, 3) : "new";
+    const int32 Class = GLuaObjectCounts.AddClass(FName(UTF8_TO_TCHAR(lua_tostring(L, 2))));
+    const void* Metatable = lua_topointer(L, 1);
+    if (GLuaObjectCounts.FindClass(Metatable) == INDEX_NONE)
     {
-        bCounter = (lua_toboolean(L, 3) != 0);
+        // The registry reference pins the metatable, so its address stays a valid identity.
+        lua_pushvalue(L, 1);
+        luaL_ref(L, LUA_REGISTRYINDEX);
+        GLuaObjectCounts.BindMetatable(Metatable, Class);
+
+        // Raw access: a derived metatable must not wrap the __gc it inherits from a tracked base through __index.
+        lua_pushinteger(L, Class);
+        lua_pushstring(L, "__gc");
+        lua_rawget(L, 1);
+        lua_pushcclosure(L, LuaObjectClass_Finalize, 2);
+        lua_pushstring(L, "__gc");
+        lua_insert(L, -2);
+        lua_rawset(L, 1);
     }
-    TStatIdData const* StatIdPtr;
-    if (bCounter)
+
+    // Only this class's constructor is wrapped; setmetatable itself is left alone. An inherited constructor that
+    // is already wrapped counts by the instance's metatable, so it is not wrapped twice.
+    lua_getfield(L, 1, Constructor);
+    if (lua_isfunction(L, -1) && lua_tocfunction(L, -1) != LuaObjectClass_Construct)
     {
-        StatIdPtr = GLuaStats.CreateDoubleCounter(StatName, StatDesc.IsEmpty() ? nullptr : *StatDesc);
+        lua_pushcclosure(L, LuaObjectClass_Construct, 1);
+        lua_pushstring(L, Constructor);
+        lua_insert(L, -2);
+        lua_rawset(L, 1);
     }
     else
     {
-        StatIdPtr = GLuaStats.CreateDoubleAccumulator(StatName, StatDesc.IsEmpty() ? nullptr : *StatDesc);
+        lua_pop(L, 1);
     }
-    if (StatIdPtr)
+    lua_pushboolean(L, 1);
+    return 1;
+}
+
+int32 LuaStats_CountObject(lua_State* L)
+{
+    // For instances created outside the tracked constructor, e.g. by a factory function or from C++.
+    if (lua_gettop(L) >= 1 && lua_getmetatable(L, 1))
     {
-        lua_pushlightuserdata(L, (void*)StatIdPtr);
+        const int32 Class = GLuaObjectCounts.FindClass(lua_topointer(L, -1));
+        lua_pop(L, 1);
+        if (Class != INDEX_NONE)
+        {
+            GLuaObjectCounts.Created(Class);
+        }
     }
-    else
+    lua_settop(L, 1);
+    return 1;
+}
+
+int32 LuaStats_GetObjectCounts(lua_State* L)
+{
+    const TArray<FLuaObjectClass>& Classes = GLuaObjectCounts.GetClasses();
+    lua_createtable(L, 0, Classes.Num());
+    for (const FLuaObjectClass& ObjectClass : Classes)
     {
-        lua_pushnil(L);
+        lua_pushinteger(L, FMath::Max<int64>(ObjectClass.Live, 0));
+        lua_setfield(L, -2, TCHAR_TO_UTF8(*ObjectClass.Name.ToString()));
     }
     return 1;
-
 }
 
-int32 DoubleStat_Add(lua_State* L)
+int32 LuaStats_GetHistory(lua_State* L)
 {
+    // Returns the recorded values of one stat over the last seconds and how long ago each was, oldest first.
     const int32 ParamNum = lua_gettop(L);
-    if (ParamNum < 1)
+    FName StatName;
+    if (ParamNum >= 1 && lua_isstring(L, 1))
     {
-        lua_pushnil(L);
-        return 1;
+        StatName = FName(UTF8_TO_TCHAR(lua_tostring(L, 1)));
     }
-    double Value = 1;
-    if (ParamNum >= 2 && lua_isnumber(L, 2))
+    else if (ParamNum >= 1 && lua_islightuserdata(L, 1))
     {
-        Value = lua_tonumber(L, 2);
+        StatName = GLuaStats.GetStatName(static_cast<TStatIdData const*>(lua_touserdata(L, 1)));
     }
-    if (lua_isstring(L, 1))
+    const double Seconds = ParamNum >= 2 && lua_isnumber(L, 2) ? lua_tonumber(L, 2) : 60.0;
+    TArray<double> SecondsAgo;
+    TArray<double> Values;
+    if (StatName.IsNone() || !GLuaStats.GetHistory(StatName, Seconds, SecondsAgo, Values))
     {
-        const bool Result = GLuaStats.AddDoubleStat(lua_tostring(L, 1), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
+        lua_pushnil(L);
+        return 1;
     }
-    else if (lua_islightuserdata(L, 1))
+    lua_createtable(L, Values.Num(), 0);
+    lua_createtable(L, SecondsAgo.Num(), 0);
+    for (int32 Index = 0; Index < Values.Num(); ++Index)
     {
-        const bool Result = GLuaStats.AddDoubleStat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
+        lua_pushnumber(L, Values[Index]);
+        lua_rawseti(L, -3, Index + 1);
+        lua_pushnumber(L, SecondsAgo[Index]);
+        lua_rawseti(L, -2, Index + 1);
+    }
+    return 2;
+}
+
+int32 LuaStats_DumpHistory(lua_State* L)
+{
+    const int32 ParamNum = lua_gettop(L);
+    const double Seconds = ParamNum >= 1 && lua_isnumber(L, 1) ? lua_tonumber(L, 1) : 120.0;
+    const FString Path = ParamNum >= 2 && lua_isstring(L, 2) ? FString(UTF8_TO_TCHAR(lua_tostring(L, 2))) : FLuaStats::GetDefaultHistoryPath();
+    const FString Filter = ParamNum >= 3 && lua_isstring(L, 3) ? FString(UTF8_TO_TCHAR(lua_tostring(L, 3))) : FString();
+    if (GLuaStats.DumpHistory(Path, Seconds, 0.0, Filter))
+    {
+        lua_pushstring(L, TCHAR_TO_UTF8(*Path));
     }
     else
     {
@@ -994,118 +6103,189 @@ int32 DoubleStat_Add(lua_State* L)
     return 1;
 }
 
-int32 DoubleStat_Subtract(lua_State* L)
+int32 LuaStats_GetTopKeys(lua_State* L)
 {
+    // Returns the last frame's heaviest keys of a stat, heaviest first: { { Key = ..., Value = ..., Calls = ..., Error = ... }, ... }
     const int32 ParamNum = lua_gettop(L);
-    if (ParamNum < 1)
-    {
-        lua_pushnil(L);
-        return 1;
-    }
-    double Value = 1;
-    if (ParamNum >= 2 && lua_isnumber(L, 2))
-    {
-        Value = lua_tonumber(L, 2);
-    }
-    if (lua_isstring(L, 1))
+    FName StatName;
+    if (ParamNum >= 1 && lua_isstring(L, 1))
     {
-        const bool Result = GLuaStats.SubtractDoubleStat(lua_tostring(L, 1), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
+        StatName = FName(UTF8_TO_TCHAR(lua_tostring(L, 1)));
     }
-    else if (lua_islightuserdata(L, 1))
+    else if (ParamNum >= 1 && lua_islightuserdata(L, 1))
     {
-        const bool Result = GLuaStats.SubtractDoubleStat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
+        StatName = GLuaStats.GetStatName(static_cast<TStatIdData const*>(lua_touserdata(L, 1)));
     }
-    else
+    const TArray<FLuaTopKeyEntry>* Entries = StatName.IsNone() ? nullptr : GLuaStats.GetTopKeys(StatName);
+    if (!Entries)
     {
         lua_pushnil(L);
+        return 1;
+    }
+    lua_createtable(L, Entries->Num(), 0);
+    for (int32 Index = 0; Index < Entries->Num(); ++Index)
+    {
+        const FLuaTopKeyEntry& Entry = (*Entries)[Index];
+        lua_createtable(L, 0, 4);
+        lua_pushstring(L, TCHAR_TO_UTF8(*GLuaStats.GetKeyLabel(Entry.Key)));
+        lua_setfield(L, -2, "Key");
+        lua_pushnumber(L, Entry.Weight);
+        lua_setfield(L, -2, "Value");
+        lua_pushinteger(L, Entry.Calls);
+        lua_setfield(L, -2, "Calls");
+        lua_pushnumber(L, Entry.Error);
+        lua_setfield(L, -2, "Error");
+        lua_rawseti(L, -2, Index + 1);
     }
     return 1;
 }
 
-int32 DoubleStat_Set(lua_State* L)
+int32 LuaStats_Now(lua_State* L)
 {
-    const int32 ParamNum = lua_gettop(L);
-    if (ParamNum < 1)
+    // Raw platform cycles, for spans timed across callbacks and reported later through LuaStats.RecordSpans.
+    lua_pushinteger(L, static_cast<lua_Integer>(FPlatformTime::Cycles64()));
+    return 1;
+}
+
+int32 LuaStats_RecordSpans(lua_State* L)
+{
+    // LuaStats.RecordSpans{ stat, startCycles, endCycles, stat, startCycles, endCycles, ... } adds each span to its
+    // cycle counter or SimpleSeconds stat; returns the number of spans recorded.
+    if (lua_gettop(L) < 1 || !lua_istable(L, 1))
     {
         lua_pushnil(L);
         return 1;
     }
-    double Value = 1;
-    if (ParamNum >= 2 && lua_isnumber(L, 2))
+    const int32 Num = static_cast<int32>(lua_rawlen(L, 1));
+    // Batches usually repeat a few stats; interned Lua strings make the name of the previous span cheap to recognise.
+    const char* LastName = nullptr;
+    TStatIdData const* LastStat = nullptr;
+    int32 Recorded = 0;
+    for (int32 Index = 1; Index + 2 <= Num; Index += 3)
+    {
+        lua_rawgeti(L, 1, Index);
+        lua_rawgeti(L, 1, Index + 1);
+        lua_rawgeti(L, 1, Index + 2);
+        TStatIdData const* StatIdPtr = nullptr;
+        if (lua_type(L, -3) == LUA_TSTRING)
+        {
+            const char* Name = lua_tostring(L, -3);
+            if (Name != LastName)
+            {
+                const FName StatName(UTF8_TO_TCHAR(Name));
+                LastName = Name;
+                LastStat = GLuaStats.ResolveStat(ELuaStatType::CycleCounter, StatName);
+                LastStat = LastStat ? LastStat : GLuaStats.ResolveStat(ELuaStatType::SimpleSeconds, StatName);
+            }
+            StatIdPtr = LastStat;
+        }
+        else if (lua_islightuserdata(L, -3))
+        {
+            StatIdPtr = static_cast<TStatIdData const*>(lua_touserdata(L, -3));
+        }
+        int32 bStartValid = 0;
+        int32 bEndValid = 0;
+        const uint64 StartCycles = static_cast<uint64>(lua_tointegerx(L, -2, &bStartValid));
+        const uint64 EndCycles = static_cast<uint64>(lua_tointegerx(L, -1, &bEndValid));
+        if (StatIdPtr && bStartValid && bEndValid && EndCycles >= StartCycles && GLuaStats.RecordSpan(StatIdPtr, EndCycles - StartCycles))
+        {
+            ++Recorded;
+        }
+        lua_pop(L, 3);
+    }
+    lua_pushinteger(L, Recorded);
+    return 1;
+}
+
+static ELuaChunkRewrite GetLuaChunkRewriteMode()
+{
+    return static_cast<ELuaChunkRewrite>(FMath::Clamp(CVarLuaStatsRewriteChunks.GetValueOnGameThread(), 0, 2));
+}
+
+static int32 LuaStats_SearchRewritten(lua_State* L)
+{
+    // A package.searchers entry for Content/Script, ahead of the searchers that would load the file untouched.
+    const ELuaChunkRewrite Mode = GetLuaChunkRewriteMode();
+    const FString ModuleName = UTF8_TO_TCHAR(luaL_checkstring(L, 1));
+    if (Mode == ELuaChunkRewrite::None)
     {
-        Value = lua_tonumber(L, 2);
+        lua_pushstring(L, "\n\tLuaStats.RewriteChunks is 0");
+        return 1;
     }
-    if (lua_isstring(L, 1))
+    const FString Path = FPaths::ProjectContentDir() / TEXT("Script") / ModuleName.Replace(TEXT("."), TEXT("/")) + TEXT(".lua");
+    const FTCHARToUTF8 PathUtf8(*Path);
+    TArray<uint8> Data;
+    if (!FFileHelper::LoadFileToArray(Data, *Path, FILEREAD_Silent))
     {
-        const bool Result = GLuaStats.SetDoubleStat(lua_tostring(L, 1), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
+        lua_pushfstring(L, "\n\tno file '%s'", PathUtf8.Get());
+        return 1;
     }
-    else if (lua_islightuserdata(L, 1))
+    const int32 Offset = Data.Num() >= 3 && Data[0] == 0xEF && Data[1] == 0xBB && Data[2] == 0xBF ? 3 : 0;
+    const ANSICHAR* Source = reinterpret_cast<const ANSICHAR*>(Data.GetData()) + Offset;
+    const int32 Length = Data.Num() - Offset;
+    const FTCHARToUTF8 ChunkName(*(TEXT("@") + Path));
+    TArray<ANSICHAR> Rewritten;
+    if (RewriteLuaChunk(Source, Length, Mode, Rewritten) > 0)
     {
-        const bool Result = GLuaStats.SetDoubleStat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
+        if (luaL_loadbuffer(L, Rewritten.GetData(), Rewritten.Num(), ChunkName.Get()) == LUA_OK)
+        {
+            lua_pushstring(L, PathUtf8.Get());
+            return 2;
+        }
+        UE_LOG(LogLuaStats, Warning, TEXT("Loading %s without rewriting its stat calls: %s"), *Path, UTF8_TO_TCHAR(lua_tostring(L, -1)));
+        lua_pop(L, 1);
     }
-    else
+    if (luaL_loadbuffer(L, Source, Length, ChunkName.Get()) != LUA_OK)
     {
-        lua_pushnil(L);
+        return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s", lua_tostring(L, 1), PathUtf8.Get(), lua_tostring(L, -1));
     }
-    return 1;
+    lua_pushstring(L, PathUtf8.Get());
+    return 2;
 }
 
-int32 FNameStat_Set(lua_State* L)
+int32 LuaStats_InstallRewriter(lua_State* L)
 {
-    const int32 ParamNum = lua_gettop(L);
-    if (ParamNum < 1)
+    // Scripts required from then on are rewritten as LuaStats.RewriteChunks says; already loaded ones stay as they are.
+    lua_getglobal(L, "package");
+    if (!lua_istable(L, -1) || lua_getfield(L, -1, "searchers") != LUA_TTABLE)
     {
-        lua_pushnil(L);
+        lua_pushboolean(L, 0);
         return 1;
     }
-    const char* Value = nullptr;
-    if (ParamNum >= 2 && lua_isstring(L, 2))
-    {
-        Value = lua_tostring(L, 2);
-    }
-    if (lua_isstring(L, 1))
-    {
-        const bool Result = GLuaStats.SetFNameStat(lua_tostring(L, 1), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
-    }
-    else if (lua_islightuserdata(L, 1))
+    const int32 Num = static_cast<int32>(lua_rawlen(L, -1));
+    for (int32 Index = 1; Index <= Num; ++Index)
     {
-        const bool Result = GLuaStats.SetFNameStat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
+        lua_rawgeti(L, -1, Index);
+        const bool bInstalled = lua_tocfunction(L, -1) == LuaStats_SearchRewritten;
+        lua_pop(L, 1);
+        if (bInstalled)
+        {
+            lua_pushboolean(L, 1);
+            return 1;
+        }
     }
-    else
+    // Second, after the preload searcher.
+    for (int32 Index = Num; Index >= 2; --Index)
     {
-        lua_pushnil(L);
+        lua_rawgeti(L, -1, Index);
+        lua_rawseti(L, -2, Index + 1);
     }
+    lua_pushcfunction(L, LuaStats_SearchRewritten);
+    lua_rawseti(L, -2, FMath::Min(Num + 1, 2));
+    lua_pushboolean(L, 1);
     return 1;
 }
 
-int32 MemoryStat_Create(lua_State* L)
+int32 LuaStats_Resolve(lua_State* L)
 {
-    const int32 ParamNum = lua_gettop(L);
-    if (ParamNum <= 0 || ParamNum > 2)
-    {
-        lua_pushnil(L);
-        return 1;
-    }
-    if (!lua_isstring(L, 1))
+    // LuaStats.Resolve(type, name): handle of an existing stat, nil when there is none. Used by rewritten chunks.
+    ELuaStatType Type;
+    if (lua_gettop(L) < 2 || !lua_isstring(L, 1) || !lua_isstring(L, 2) || !ParseLuaStatType(UTF8_TO_TCHAR(lua_tostring(L, 1)), Type))
     {
         lua_pushnil(L);
         return 1;
     }
-
-    FString StatDesc;
-    const FName StatName = lua_tostring(L, 1);
-    if (ParamNum > 1 && lua_isstring(L, 2))
-    {
-        StatDesc = lua_tostring(L, 2);
-    }
-
-    TStatIdData const* StatIdPtr = GLuaStats.CreateMemoryStat(StatName, StatDesc.IsEmpty() ? nullptr : *StatDesc);
+    TStatIdData const* StatIdPtr = GLuaStats.ResolveStat(Type, FName(UTF8_TO_TCHAR(lua_tostring(L, 2))));
     if (StatIdPtr)
     {
         lua_pushlightuserdata(L, (void*)StatIdPtr);
@@ -1115,61 +6295,59 @@ int32 MemoryStat_Create(lua_State* L)
         lua_pushnil(L);
     }
     return 1;
-
 }
 
-int32 MemoryStat_Add(lua_State* L)
+int32 LuaStats_RewriteChunk(lua_State* L)
 {
-    const int32 ParamNum = lua_gettop(L);
-    if (ParamNum < 1)
+    // LuaStats.RewriteChunk(source[, "resolve"|"strip"]): the source as the rewriter would load it, and the number of calls rewritten.
+    if (lua_gettop(L) < 1 || !lua_isstring(L, 1))
     {
         lua_pushnil(L);
         return 1;
     }
-    int64 Value = 1;
-    if (ParamNum >= 2 && lua_isnumber(L, 2))
-    {
-        Value = lua_tonumber(L, 2);
-    }
-    if (lua_isstring(L, 1))
+    ELuaChunkRewrite Mode = GetLuaChunkRewriteMode();
+    if (lua_gettop(L) >= 2 && lua_isstring(L, 2))
     {
-        const bool Result = GLuaStats.AddMemoryStat(lua_tostring(L, 1), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
+        const char* ModeName = lua_tostring(L, 2);
+        Mode = FCStringAnsi::Stricmp(ModeName, "strip") == 0 ? ELuaChunkRewrite::Strip
+            : FCStringAnsi::Stricmp(ModeName, "resolve") == 0 ? ELuaChunkRewrite::Resolve : ELuaChunkRewrite::None;
     }
-    else if (lua_islightuserdata(L, 1))
+    size_t Length = 0;
+    const char* Source = lua_tolstring(L, 1, &Length);
+    TArray<ANSICHAR> Rewritten;
+    const int32 Count = RewriteLuaChunk(Source, static_cast<int32>(Length), Mode, Rewritten);
+    if (Count > 0)
     {
-        const bool Result = GLuaStats.AddMemoryStat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
+        lua_pushlstring(L, Rewritten.GetData(), Rewritten.Num());
     }
     else
     {
-        lua_pushnil(L);
+        lua_pushvalue(L, 1);
     }
+    lua_pushinteger(L, Count);
+    return 2;
+}
+
+int32 LuaStats_StartHeapScan(lua_State* L)
+{
+    // LuaStats.StartHeapScan([continuous]): walks the heap over the next frames; continuous starts a new walk when one finishes.
+    const bool bContinuous = lua_gettop(L) >= 1 && lua_toboolean(L, 1) != 0;
+    const bool Result = GLuaHeapScanner.Start(L, bContinuous);
+    lua_pushboolean(L, Result ? 1 : 0);
     return 1;
 }
 
-int32 MemoryStat_Subtract(lua_State* L)
+int32 LuaStats_StopHeapScan(lua_State* /*L*/)
 {
-    const int32 ParamNum = lua_gettop(L);
-    if (ParamNum < 1)
-    {
-        lua_pushnil(L);
-        return 1;
-    }
-    int64 Value = 1;
-    if (ParamNum >= 2 && lua_isnumber(L, 2))
-    {
-        Value = lua_tonumber(L, 2);
-    }
-    if (lua_isstring(L, 1))
-    {
-        const bool Result = GLuaStats.SubtractMemoryStat(lua_tostring(L, 1), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
-    }
-    else if (lua_islightuserdata(L, 1))
+    GLuaHeapScanner.Stop();
+    return 0;
+}
+
+int32 LuaStats_GetHeapScan(lua_State* L)
+{
+    if (GLuaHeapScanner.HasResult())
     {
-        const bool Result = GLuaStats.SubtractMemoryStat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
+        GLuaHeapScanner.PushResult(L);
     }
     else
     {
@@ -1178,50 +6356,71 @@ int32 MemoryStat_Subtract(lua_State* L)
     return 1;
 }
 
-int32 MemoryStat_Set(lua_State* L)
+int32 LuaStats_Snapshot(lua_State* L)
 {
-    const int32 ParamNum = lua_gettop(L);
-    if (ParamNum < 1)
+    // LuaStats.Snapshot(): records every reachable object and returns the snapshot's id for LuaStats.Diff.
+    TUniquePtr<FLuaHeapSnapshot> Snapshot = MakeUnique<FLuaHeapSnapshot>();
+    Snapshot->Take(L);
+    lua_pushinteger(L, GLuaHeapSnapshots.Add(MoveTemp(Snapshot)) + 1);
+    return 1;
+}
+
+int32 LuaStats_Diff(lua_State* L)
+{
+    // LuaStats.Diff(before, after[, dumpPath[, maxGroups]]): { { Path = ..., Count = ..., Bytes = ... }, ... } of the objects
+    // created since before and still alive at after, heaviest path first, and their total bytes.
+    const FLuaHeapSnapshot* Before = lua_gettop(L) >= 2 ? FindLuaHeapSnapshot(L, 1) : nullptr;
+    const FLuaHeapSnapshot* After = lua_gettop(L) >= 2 ? FindLuaHeapSnapshot(L, 2) : nullptr;
+    if (!Before || !After)
     {
         lua_pushnil(L);
         return 1;
     }
-    int64 Value = 1;
-    if (ParamNum >= 2 && lua_isnumber(L, 2))
-    {
-        Value = lua_tonumber(L, 2);
-    }
-    if (lua_isstring(L, 1))
-    {
-        const bool Result = GLuaStats.SetMemoryStat(lua_tostring(L, 1), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
-    }
-    else if (lua_islightuserdata(L, 1))
+    const FString DumpPath = lua_gettop(L) >= 3 && lua_isstring(L, 3) ? FString(UTF8_TO_TCHAR(lua_tostring(L, 3))) : FString();
+    const int32 MaxGroups = lua_gettop(L) >= 4 && lua_isnumber(L, 4) ? static_cast<int32>(lua_tointeger(L, 4)) : 50;
+    const TArray<FLuaHeapDiffGroup> Groups = DiffLuaHeapSnapshots(*Before, *After, DumpPath);
+    const int32 Num = MaxGroups > 0 ? FMath::Min(MaxGroups, Groups.Num()) : Groups.Num();
+    int64 Bytes = 0;
+    lua_createtable(L, Num, 0);
+    for (int32 Index = 0; Index < Groups.Num(); ++Index)
     {
-        const bool Result = GLuaStats.SetMemoryStat(static_cast<TStatIdData const*>(lua_touserdata(L, 1)), Value);
-        lua_pushboolean(L, Result ? 1 : 0);
-    }
-    else
+        Bytes += Groups[Index].Bytes;
+        if (Index >= Num)
+        {
+            continue;
+        }
+        lua_createtable(L, 0, 3);
+        lua_pushstring(L, TCHAR_TO_UTF8(*After->GetPathName(Groups[Index].Path)));
+        lua_setfield(L, -2, "Path");
+        lua_pushinteger(L, Groups[Index].Count);
+        lua_setfield(L, -2, "Count");
+        lua_pushinteger(L, Groups[Index].Bytes);
+        lua_setfield(L, -2, "Bytes");
+        lua_rawseti(L, -2, Index + 1);
+    }
+    lua_pushinteger(L, Bytes);
+    return 2;
+}
+
+int32 LuaStats_FreeSnapshot(lua_State* L)
+{
+    const int32 Id = lua_gettop(L) >= 1 && lua_isinteger(L, 1) ? static_cast<int32>(lua_tointeger(L, 1)) : 0;
+    if (!GLuaHeapSnapshots.IsValidIndex(Id - 1) || !GLuaHeapSnapshots[Id - 1])
     {
-        lua_pushnil(L);
+        lua_pushboolean(L, 0);
+        return 1;
     }
+    GLuaHeapSnapshots[Id - 1].Reset();
+    lua_pushboolean(L, 1);
     return 1;
 }
 
-static const luaL_Reg CycleCounterLib[] =
-{
-    { "Create", CycleCounter_Create },
-    { "Start", CycleCounter_Start },
-    { "Stop", CycleCounter_Stop },
-    { "Set", CycleCounter_Set },
-    { nullptr, nullptr }
-};
-
 static const luaL_Reg SimpleSecondsLib[] =
 {
     { "Create", SimpleSeconds_Create },
     { "Start", SimpleSeconds_Start },
     { "Stop", SimpleSeconds_Stop },
+    { "SetSampleRate", SimpleSeconds_SetSampleRate },
     { nullptr, nullptr }
 };
 
@@ -1258,6 +6457,65 @@ static const luaL_Reg MemoryStatLib[] =
     { nullptr, nullptr }
 };
 
+static const luaL_Reg AsyncSpanLib[] =
+{
+    { "Create", AsyncSpan_Create },
+    { "Begin", AsyncSpan_Begin },
+    { "End", AsyncSpan_End },
+    { nullptr, nullptr }
+};
+
+static const luaL_Reg LuaStatsLib[] =
+{
+    { "Register", LuaStats_Register },
+    { "SaveManifest", LuaStats_SaveManifest },
+    { "Group", LuaStats_Group },
+    { "EnableGroup", LuaStats_EnableGroup },
+    { "Calibrate", LuaStats_Calibrate },
+    { "GetRollups", LuaStats_GetRollups },
+    { "ProfileLines", LuaStats_ProfileLines },
+    { "StopLineProfile", LuaStats_StopLineProfile },
+    { "DumpLineProfile", LuaStats_DumpLineProfile },
+    { "TrackNative", LuaStats_TrackNative },
+    { "CountInstructions", LuaStats_CountInstructions },
+    { "TrackClass", LuaStats_TrackClass },
+    { "CountObject", LuaStats_CountObject },
+    { "GetObjectCounts", LuaStats_GetObjectCounts },
+    { "GetHistory", LuaStats_GetHistory },
+    { "DumpHistory", LuaStats_DumpHistory },
+    { "GetTopKeys", LuaStats_GetTopKeys },
+    { "InstallRewriter", LuaStats_InstallRewriter },
+    { "Resolve", LuaStats_Resolve },
+    { "RewriteChunk", LuaStats_RewriteChunk },
+    { "Now", LuaStats_Now },
+    { "RecordSpans", LuaStats_RecordSpans },
+    { "StartHeapScan", LuaStats_StartHeapScan },
+    { "StopHeapScan", LuaStats_StopHeapScan },
+    { "GetHeapScan", LuaStats_GetHeapScan },
+    { "Snapshot", LuaStats_Snapshot },
+    { "Diff", LuaStats_Diff },
+    { "FreeSnapshot", LuaStats_FreeSnapshot },
+    { nullptr, nullptr }
+};
+
+// Every binding above: they run on behalf of the script calling them and are not billed as native work.
+static bool IsLuaStatsBinding(lua_CFunction Function)
+{
+    static const TArray<lua_CFunction> Bindings = []()
+    {
+        TArray<lua_CFunction> Result;
+        for (const luaL_Reg* Lib : { CycleCounterLib, SimpleSecondsLib, Int64StatLib, DoubleStatLib, FNameStatLib, MemoryStatLib, AsyncSpanLib, LuaStatsLib })
+        {
+            for (const luaL_Reg* Entry = Lib; Entry->name != nullptr; ++Entry)
+            {
+                Result.Add(Entry->func);
+            }
+        }
+        return Result;
+    }();
+    return Bindings.Contains(Function);
+}
+
 EXPORT_UNTYPED_CLASS(FCycleCounter, false, CycleCounterLib)
 IMPLEMENT_EXPORTED_CLASS(FCycleCounter)
 
@@ -1275,3 +6533,9 @@ IMPLEMENT_EXPORTED_CLASS(FNameStat)
 
 EXPORT_UNTYPED_CLASS(FMemoryStat, false, MemoryStatLib)
 IMPLEMENT_EXPORTED_CLASS(FMemoryStat)
+
+EXPORT_UNTYPED_CLASS(FAsyncSpan, false, AsyncSpanLib)
+IMPLEMENT_EXPORTED_CLASS(FAsyncSpan)
+
+EXPORT_UNTYPED_CLASS(LuaStats, false, LuaStatsLib)
+IMPLEMENT_EXPORTED_CLASS(LuaStats)
@@ -8,10 +8,12 @@ int32 CycleCounter_Create(lua_State* L);
 int32 CycleCounter_Start(lua_State* L);
 int32 CycleCounter_Stop(lua_State* L);
 int32 CycleCounter_Set(lua_State* L);
+int32 CycleCounter_SetSampleRate(lua_State* L);
 
 int32 SimpleSeconds_Create(lua_State* L);
 int32 SimpleSeconds_Start(lua_State* L);
 int32 SimpleSeconds_Stop(lua_State* L);
+int32 SimpleSeconds_SetSampleRate(lua_State* L);
 
 int32 Int64Stat_Create(lua_State* L);
 int32 Int64Stat_Add(lua_State* L);
@@ -29,3 +31,36 @@ int32 MemoryStat_Create(lua_State* L);
 int32 MemoryStat_Add(lua_State* L);
 int32 MemoryStat_Subtract(lua_State* L);
 int32 MemoryStat_Set(lua_State* L);
+
+int32 AsyncSpan_Create(lua_State* L);
+int32 AsyncSpan_Begin(lua_State* L);
+int32 AsyncSpan_End(lua_State* L);
+
+int32 LuaStats_Register(lua_State* L);
+int32 LuaStats_SaveManifest(lua_State* L);
+int32 LuaStats_Group(lua_State* L);
+int32 LuaStats_EnableGroup(lua_State* L);
+int32 LuaStats_Calibrate(lua_State* L);
+int32 LuaStats_GetRollups(lua_State* L);
+int32 LuaStats_ProfileLines(lua_State* L);
+int32 LuaStats_StopLineProfile(lua_State* L);
+int32 LuaStats_DumpLineProfile(lua_State* L);
+int32 LuaStats_TrackNative(lua_State* L);
+int32 LuaStats_CountInstructions(lua_State* L);
+int32 LuaStats_TrackClass(lua_State* L);
+int32 LuaStats_CountObject(lua_State* L);
+int32 LuaStats_GetObjectCounts(lua_State* L);
+int32 LuaStats_GetHistory(lua_State* L);
+int32 LuaStats_DumpHistory(lua_State* L);
+int32 LuaStats_GetTopKeys(lua_State* L);
+int32 LuaStats_InstallRewriter(lua_State* L);
+int32 LuaStats_Resolve(lua_State* L);
+int32 LuaStats_RewriteChunk(lua_State* L);
+int32 LuaStats_Now(lua_State* L);
+int32 LuaStats_RecordSpans(lua_State* L);
+int32 LuaStats_StartHeapScan(lua_State* L);
+int32 LuaStats_StopHeapScan(lua_State* L);
+int32 LuaStats_GetHeapScan(lua_State* L);
+int32 LuaStats_Snapshot(lua_State* L);
+int32 LuaStats_Diff(lua_State* L);
+int32 LuaStats_FreeSnapshot(lua_State* L);
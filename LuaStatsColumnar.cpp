@@ -0,0 +1,177 @@
+// LuaStatsColumnar.cpp
+#include "LuaStatsColumnar.h"
+#include "HAL/FileManager.h"
+#include "Misc/Compression.h"
+
+bool FLuaStatsColumnarCapture::Open(const FString& Path)
+{
+    Close();
+    Archive.Reset(IFileManager::Get().CreateFileWriter(*Path));
+    if (!Archive)
+    {
+        return false;
+    }
+    ANSICHAR Magic[4] = { 'L', 'S', 'C', 'F' };
+    uint32 Version = 2;
+    double MillisecondsPerCycle = FPlatformTime::GetSecondsPerCycle64() * 1000.0;
+    Archive->Serialize(Magic, sizeof(Magic));
+    *Archive << Version << MillisecondsPerCycle;
+
+    Columns = 0;
+    Filling = MakeUnique<FLuaColumnarGroup>();
+    bStopping = false;
+    WorkEvent = FPlatformProcess::GetSynchEventFromPool(false);
+    Thread = FRunnableThread::Create(this, TEXT("LuaStatsColumnar"), 0, TPri_BelowNormal);
+    return true;
+}
+
+void FLuaStatsColumnarCapture::Close()
+{
+    if (!Thread)
+    {
+        return;
+    }
+    if (Filling->Frames.Num() > 0 || Filling->Events.Num() > 0)
+    {
+        Submit();
+    }
+    bStopping = true;
+    WorkEvent->Trigger();
+    Thread->WaitForCompletion();
+    delete Thread;
+    Thread = nullptr;
+    FPlatformProcess::ReturnSynchEventToPool(WorkEvent);
+    WorkEvent = nullptr;
+    Archive->Close();
+    Archive.Reset();
+    Filling.Reset();
+    TUniquePtr<FLuaColumnarGroup> Group;
+    while (Recycled.Dequeue(Group))
+    {
+    }
+}
+
+void FLuaStatsColumnarCapture::Append(const TArray<FLuaStatDefinition>& Definitions, const TArray<double>& Values)
+{
+    const int32 Num = Definitions.Num();
+    if (Num != Columns)
+    {
+        if (Filling->Frames.Num() > 0)
+        {
+            Submit();
+        }
+        for (int32 Index = Columns; Index < Num; ++Index)
+        {
+            Filling->NewColumns.Emplace(Definitions[Index].Name.ToString(), static_cast<uint8>(Definitions[Index].Type));
+        }
+        Columns = Num;
+        Filling->Columns = Num;
+    }
+    Filling->Frames.Add(GFrameCounter);
+    Filling->Seconds.Add(FPlatformTime::Seconds());
+    Filling->Rows.Append(Values.GetData(), Num);
+    if (Filling->Frames.Num() == LuaColumnarRowsPerGroup)
+    {
+        Submit();
+    }
+}
+
+uint32 FLuaStatsColumnarCapture::Run()
+{
+    for (;;)
+    {
+        const bool bLast = bStopping;
+        TUniquePtr<FLuaColumnarGroup> Group;
+        bool bWrote = false;
+        while (Pending.Dequeue(Group))
+        {
+            WriteGroup(*Group);
+            Group->Frames.Reset();
+            Group->Seconds.Reset();
+            Group->Rows.Reset();
+            Group->NewColumns.Reset();
+            Group->Events.Reset();
+            Recycled.Enqueue(MoveTemp(Group));
+            bWrote = true;
+        }
+        if (bWrote)
+        {
+            // A run that crashes keeps every row group written so far.
+            Archive->Flush();
+        }
+        if (bLast)
+        {
+            return 0;
+        }
+        WorkEvent->Wait();
+    }
+}
+
+void FLuaStatsColumnarCapture::Submit()
+{
+    Pending.Enqueue(MoveTemp(Filling));
+    WorkEvent->Trigger();
+    if (!Recycled.Dequeue(Filling))
+    {
+        Filling = MakeUnique<FLuaColumnarGroup>();
+    }
+    Filling->Columns = Columns;
+}
+
+void FLuaStatsColumnarCapture::WriteGroup(FLuaColumnarGroup& Group)
+{
+    uint32 Column = Group.Columns - Group.NewColumns.Num();
+    for (TPair<FString, uint8>& NewColumn : Group.NewColumns)
+    {
+        FTCHARToUTF8 Utf8Name(*NewColumn.Key);
+        uint8 Tag = 'C';
+        uint32 NameLength = Utf8Name.Length();
+        *Archive << Tag << Column << NewColumn.Value << NameLength;
+        Archive->Serialize(const_cast<ANSICHAR*>(Utf8Name.Get()), NameLength);
+        ++Column;
+    }
+    for (FLuaColumnarEvent& Event : Group.Events)
+    {
+        FTCHARToUTF8 Utf8Stat(*Event.Stat.ToString());
+        FTCHARToUTF8 Utf8Value(*Event.Value.ToString());
+        uint8 Tag = 'E';
+        uint32 StatLength = Utf8Stat.Length();
+        uint32 ValueLength = Utf8Value.Length();
+        *Archive << Tag << Event.Frame << Event.Seconds << StatLength;
+        Archive->Serialize(const_cast<ANSICHAR*>(Utf8Stat.Get()), StatLength);
+        *Archive << ValueLength;
+        Archive->Serialize(const_cast<ANSICHAR*>(Utf8Value.Get()), ValueLength);
+    }
+
+    uint32 NumRows = Group.Frames.Num();
+    if (NumRows == 0)
+    {
+        return;
+    }
+    uint32 NumColumns = Group.Columns;
+    uint32 RawSize = NumRows * (2 + NumColumns) * sizeof(uint64);
+    Raw.SetNumUninitialized(RawSize);
+    uint64* Out = reinterpret_cast<uint64*>(Raw.GetData());
+    FMemory::Memcpy(Out, Group.Frames.GetData(), NumRows * sizeof(uint64));
+    FMemory::Memcpy(Out + NumRows, Group.Seconds.GetData(), NumRows * sizeof(double));
+    Out += 2 * NumRows;
+    const uint64* Rows = reinterpret_cast<const uint64*>(Group.Rows.GetData());
+    for (uint32 Index = 0; Index < NumColumns; ++Index)
+    {
+        uint64 Previous = 0;
+        for (uint32 Row = 0; Row < NumRows; ++Row)
+        {
+            const uint64 Bits = Rows[Row * NumColumns + Index];
+            *Out++ = Bits ^ Previous;
+            Previous = Bits;
+        }
+    }
+
+    Compressed.SetNumUninitialized(FCompression::CompressMemoryBound(NAME_Zlib, RawSize));
+    int32 CompressedSize = Compressed.Num();
+    const bool bCompressed = FCompression::CompressMemory(NAME_Zlib, Compressed.GetData(), CompressedSize, Raw.GetData(), RawSize);
+    uint8 Tag = 'G';
+    uint32 StoredSize = bCompressed ? CompressedSize : 0;
+    *Archive << Tag << NumRows << NumColumns << RawSize << StoredSize;
+    Archive->Serialize(bCompressed ? Compressed.GetData() : Raw.GetData(), bCompressed ? CompressedSize : RawSize);
+}
@@ -0,0 +1,84 @@
+// LuaStatsColumnar.h
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/Queue.h"
+#include "HAL/Event.h"
+#include "HAL/Runnable.h"
+#include "HAL/RunnableThread.h"
+#include "LuaStatsPrivate.h"
+#include <atomic>
+
+static constexpr int32 LuaColumnarRowsPerGroup = 256;
+
+// Frames of a columnar capture, appended row-major on the game thread and transposed on the writer thread.
+struct FLuaColumnarEvent
+{
+    uint64 Frame;
+    double Seconds;
+    FName Stat;
+    FName Value;
+};
+
+struct FLuaColumnarGroup
+{
+    TArray<uint64> Frames;
+    TArray<double> Seconds;
+    TArray<double> Rows;
+    int32 Columns = 0;
+    // Stats that became columns with this group, written ahead of it.
+    TArray<TPair<FString, uint8>> NewColumns;
+    // FName stat transitions during the frames of the group.
+    TArray<FLuaColumnarEvent> Events;
+};
+
+// Writes captures in the .lscf format loaded by Tools/LuaStatsColumnar/lscf.py, little endian:
+//   header  "LSCF", uint32 version, double milliseconds per cycle
+//   'C'     uint32 column, uint8 stat type, uint32 name length, UTF-8 name
+//   'G'     uint32 rows, uint32 columns, uint32 raw size, uint32 compressed size (0 when stored raw), then the
+//           zlib payload: uint64 frames[rows], double seconds[rows], then each column's values, each XORed
+//           with the column's previous row so unchanged stats compress to zeros.
+//   'E'     uint64 frame, double seconds, uint32 stat length, UTF-8 stat, uint32 value length, UTF-8 value:
+//           an FName stat changed value (version 2).
+// Columns are only ever appended, so a row group covers a prefix of them and earlier groups stay valid.
+class FLuaStatsColumnarCapture : public FRunnable
+{
+public:
+    virtual ~FLuaStatsColumnarCapture()
+    {
+        Close();
+    }
+
+    bool IsOpen() const
+    {
+        return Thread != nullptr;
+    }
+
+    bool Open(const FString& Path);
+    void Close();
+
+    // Game thread: one copy of the value mirror per frame, everything else happens on the writer thread.
+    void Append(const TArray<FLuaStatDefinition>& Definitions, const TArray<double>& Values);
+
+    void AddEvent(FName Stat, FName Value)
+    {
+        Filling->Events.Add({ GFrameCounter, FPlatformTime::Seconds(), Stat, Value });
+    }
+
+    virtual uint32 Run() override;
+
+private:
+    void Submit();
+    void WriteGroup(FLuaColumnarGroup& Group);
+
+    TUniquePtr<FArchive> Archive;
+    FRunnableThread* Thread = nullptr;
+    FEvent* WorkEvent = nullptr;
+    std::atomic<bool> bStopping { false };
+    TQueue<TUniquePtr<FLuaColumnarGroup>, EQueueMode::Spsc> Pending;
+    TQueue<TUniquePtr<FLuaColumnarGroup>, EQueueMode::Spsc> Recycled;
+    TUniquePtr<FLuaColumnarGroup> Filling;
+    int32 Columns = 0;
+    TArray<uint8> Raw;
+    TArray<uint8> Compressed;
+};
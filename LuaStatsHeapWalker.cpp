@@ -0,0 +1,429 @@
+// LuaStatsHeapWalker.cpp
+#include "LuaStatsHeapWalker.h"
+#include "Hash/CityHash.h"
+#include "LuaStatsPrivate.h"
+
+// Approximate object sizes of a 64-bit Lua 5.4: headers plus what each object points to that no other object
+// shares. Prototypes, whose size the API does not expose, are not counted.
+static constexpr int64 LuaHeapTableSize = 56;
+static constexpr int64 LuaHeapArraySlotSize = 16;
+static constexpr int64 LuaHeapNodeSize = 32;
+static constexpr int64 LuaHeapStringSize = 25;
+static constexpr int64 LuaHeapClosureSize = 32;
+static constexpr int64 LuaHeapUpvalueSize = 40;
+static constexpr int64 LuaHeapUserdataSize = 40;
+static constexpr int64 LuaHeapThreadSize = 208;
+static constexpr int64 LuaHeapStackSlotSize = 16;
+static constexpr int32 LuaHeapMaxPathNames = 65536;
+static constexpr int32 LuaHeapMaxPathKey = 64;
+
+void FLuaHeapWalker::Begin(lua_State* L, bool bInRecordPaths, bool bInNativeVisited)
+{
+    Abort();
+    State = L;
+    Owners.Reset();
+    StackEntries.Reset();
+    StackTop = 0;
+    bIterating = false;
+    bRecordPaths = bInRecordPaths;
+    PathNames.Reset();
+    bNativeVisited = bInNativeVisited;
+    NativeVisited.Reset();
+
+    lua_createtable(L, 0, 4);
+    WalkIndex = lua_gettop(L);
+    if (!bNativeVisited)
+    {
+        lua_newtable(L);
+        lua_createtable(L, 0, 1);
+        lua_pushstring(L, "k");
+        lua_setfield(L, -2, "__mode");
+        lua_setmetatable(L, -2);
+        lua_setfield(L, WalkIndex, "Visited");
+    }
+    lua_newtable(L);
+    lua_setfield(L, WalkIndex, "Stack");
+    lua_pushvalue(L, WalkIndex);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, this);
+
+    lua_getfield(L, WalkIndex, "Visited");
+    VisitedIndex = lua_gettop(L);
+    lua_getfield(L, WalkIndex, "Stack");
+    StackIndex = lua_gettop(L);
+    // The walk's own tables hang off the registry too; they are not part of what is measured.
+    MarkVisited(L, WalkIndex);
+    // The stack is LIFO: modules are claimed last so they are followed first, then the globals, then the rest
+    // of the registry.
+    Owners.Add(TEXT("_Registry"));
+    lua_pushvalue(L, LUA_REGISTRYINDEX);
+    Visit(L, lua_gettop(L), 0, GetChildPath(0, "_Registry", 9));
+    lua_pop(L, 1);
+    Owners.Add(TEXT("_G"));
+    lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+    Visit(L, lua_gettop(L), 1, GetChildPath(0, "_G", 2));
+    lua_pop(L, 1);
+    if (lua_getfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE) == LUA_TTABLE)
+    {
+        const int32 Loaded = lua_gettop(L);
+        lua_pushnil(L);
+        while (lua_next(L, Loaded))
+        {
+            if (lua_type(L, -2) == LUA_TSTRING)
+            {
+                size_t Length = 0;
+                const char* Module = lua_tolstring(L, -2, &Length);
+                Owners.Add(UTF8_TO_TCHAR(Module));
+                Visit(L, lua_gettop(L), Owners.Num() - 1, GetChildPath(0, Module, static_cast<int32>(Length)));
+            }
+            lua_pop(L, 1);
+        }
+    }
+    lua_settop(L, WalkIndex - 1);
+}
+
+bool FLuaHeapWalker::Step(int32 Budget)
+{
+    if (!State)
+    {
+        return true;
+    }
+    lua_State* L = State;
+    const int32 Top = lua_gettop(L);
+    lua_pushcfunction(L, &FLuaHeapWalker::StepProtected);
+    lua_pushlightuserdata(L, this);
+    lua_pushinteger(L, Budget);
+    bool bDone = false;
+    if (lua_pcall(L, 2, 1, 0) == LUA_OK)
+    {
+        bDone = lua_toboolean(L, -1) != 0;
+    }
+    else
+    {
+        // A table changed under its iteration key between steps; count what was seen of it and move on.
+        UE_LOG(LogLuaStats, Verbose, TEXT("Heap walk skipped the rest of a table: %s"), UTF8_TO_TCHAR(lua_tostring(L, -1)));
+        if (bIterating)
+        {
+            FinishTable();
+        }
+    }
+    lua_settop(L, Top);
+    if (bDone)
+    {
+        Abort();
+    }
+    return bDone;
+}
+
+void FLuaHeapWalker::Abort()
+{
+    if (State)
+    {
+        lua_pushnil(State);
+        lua_rawsetp(State, LUA_REGISTRYINDEX, this);
+        State = nullptr;
+    }
+    StackEntries.Reset();
+    StackTop = 0;
+    bIterating = false;
+    NativeVisited.Empty();
+}
+
+void FLuaHeapWalker::OnStateClosed(lua_State* L)
+{
+    if (State == nullptr || State != L)
+    {
+        return;
+    }
+    State = nullptr;
+    StackEntries.Reset();
+    StackTop = 0;
+    bIterating = false;
+    NativeVisited.Empty();
+}
+
+int32 FLuaHeapWalker::StepProtected(lua_State* L)
+{
+    FLuaHeapWalker* Walker = static_cast<FLuaHeapWalker*>(lua_touserdata(L, 1));
+    const int32 Budget = static_cast<int32>(lua_tointeger(L, 2));
+    lua_pushboolean(L, Walker->StepUnprotected(L, Budget) ? 1 : 0);
+    return 1;
+}
+
+bool FLuaHeapWalker::StepUnprotected(lua_State* L, int32 Budget)
+{
+    lua_rawgetp(L, LUA_REGISTRYINDEX, this);
+    WalkIndex = lua_gettop(L);
+    lua_getfield(L, WalkIndex, "Visited");
+    VisitedIndex = lua_gettop(L);
+    lua_getfield(L, WalkIndex, "Stack");
+    StackIndex = lua_gettop(L);
+    const int32 Base = lua_gettop(L);
+    while (Budget > 0)
+    {
+        if (bIterating)
+        {
+            lua_getfield(L, WalkIndex, "Current");
+            const int32 Current = lua_gettop(L);
+            lua_getfield(L, WalkIndex, "Key");
+            for (; Budget > 0; --Budget)
+            {
+                if (!lua_next(L, Current))
+                {
+                    FinishTable();
+                    break;
+                }
+                ++CurrentEntries;
+                if (!bCurrentWeakKeys)
+                {
+                    Visit(L, lua_gettop(L) - 1, CurrentOwner, GetChildPath(CurrentPath, "(key)", 5));
+                }
+                if (!bCurrentWeakValues)
+                {
+                    Visit(L, lua_gettop(L), CurrentOwner, GetKeyPath(L, lua_gettop(L) - 1, CurrentPath));
+                }
+                lua_pop(L, 1);
+            }
+            if (bIterating)
+            {
+                lua_setfield(L, WalkIndex, "Key");
+            }
+            lua_settop(L, Base);
+            continue;
+        }
+        if (StackTop == 0)
+        {
+            return true;
+        }
+        lua_rawgeti(L, StackIndex, StackTop);
+        lua_pushnil(L);
+        lua_rawseti(L, StackIndex, StackTop);
+        --StackTop;
+        const FLuaHeapPending Pending = StackEntries.Pop(false);
+        Expand(L, lua_gettop(L), Pending.Owner, Pending.Path);
+        lua_settop(L, Base);
+        --Budget;
+    }
+    return false;
+}
+
+void FLuaHeapWalker::Visit(lua_State* L, int32 Index, int32 Owner, uint32 Path)
+{
+    ELuaHeapType Type;
+    switch (lua_type(L, Index))
+    {
+    case LUA_TTABLE:
+        Type = ELuaHeapType::Table;
+        break;
+    case LUA_TSTRING:
+        Type = ELuaHeapType::String;
+        break;
+    case LUA_TFUNCTION:
+        Type = ELuaHeapType::Function;
+        break;
+    case LUA_TUSERDATA:
+        Type = ELuaHeapType::Userdata;
+        break;
+    case LUA_TTHREAD:
+        Type = ELuaHeapType::Thread;
+        break;
+    default:
+        return;
+    }
+    if (MarkVisited(L, Index))
+    {
+        return;
+    }
+
+    const void* Object = lua_topointer(L, Index);
+    switch (Type)
+    {
+    case ELuaHeapType::String:
+        // Leaves: nothing to follow.
+        OnObject(Object, Type, LuaHeapStringSize + static_cast<int64>(lua_rawlen(L, Index)), Owner, Path);
+        return;
+    case ELuaHeapType::Function:
+    {
+        lua_Debug Ar;
+        lua_pushvalue(L, Index);
+        lua_getinfo(L, ">u", &Ar);
+        const int64 UpvalueSize = lua_iscfunction(L, Index) ? LuaHeapStackSlotSize : LuaHeapUpvalueSize + 8;
+        OnObject(Object, Type, LuaHeapClosureSize + Ar.nups * UpvalueSize, Owner, Path);
+        if (Ar.nups == 0)
+        {
+            return;
+        }
+        break;
+    }
+    case ELuaHeapType::Userdata:
+        OnObject(Object, Type, LuaHeapUserdataSize + static_cast<int64>(lua_rawlen(L, Index)), Owner, Path);
+        break;
+    case ELuaHeapType::Thread:
+    {
+        lua_State* Thread = lua_tothread(L, Index);
+        OnObject(Object, Type, LuaHeapThreadSize + (lua_gettop(Thread) + LUA_MINSTACK) * LuaHeapStackSlotSize, Owner, Path);
+        break;
+    }
+    default:
+        // Tables are reported once iterated, when their entry count is known.
+        break;
+    }
+    lua_pushvalue(L, Index);
+    lua_rawseti(L, StackIndex, ++StackTop);
+    StackEntries.Add({ Owner, Path });
+}
+
+bool FLuaHeapWalker::MarkVisited(lua_State* L, int32 Index)
+{
+    if (bNativeVisited)
+    {
+        bool bVisited = false;
+        NativeVisited.Add(lua_topointer(L, Index), &bVisited);
+        return bVisited;
+    }
+    lua_pushvalue(L, Index);
+    const bool bVisited = lua_rawget(L, VisitedIndex) != LUA_TNIL;
+    lua_pop(L, 1);
+    if (!bVisited)
+    {
+        lua_pushvalue(L, Index);
+        lua_pushboolean(L, 1);
+        lua_rawset(L, VisitedIndex);
+    }
+    return bVisited;
+}
+
+void FLuaHeapWalker::Expand(lua_State* L, int32 Index, int32 Owner, uint32 Path)
+{
+    switch (lua_type(L, Index))
+    {
+    case LUA_TTABLE:
+    {
+        bCurrentWeakKeys = false;
+        bCurrentWeakValues = false;
+        if (lua_getmetatable(L, Index))
+        {
+            Visit(L, lua_gettop(L), Owner, GetChildPath(Path, "(metatable)", 11));
+            lua_pushstring(L, "__mode");
+            if (lua_rawget(L, -2) == LUA_TSTRING)
+            {
+                const char* Mode = lua_tostring(L, -1);
+                bCurrentWeakKeys = FCStringAnsi::Strchr(Mode, 'k') != nullptr;
+                bCurrentWeakValues = FCStringAnsi::Strchr(Mode, 'v') != nullptr;
+            }
+            lua_pop(L, 2);
+        }
+        bIterating = true;
+        CurrentTable = lua_topointer(L, Index);
+        CurrentOwner = Owner;
+        CurrentPath = Path;
+        CurrentArrayNum = static_cast<int64>(lua_rawlen(L, Index));
+        CurrentEntries = 0;
+        lua_pushvalue(L, Index);
+        lua_setfield(L, WalkIndex, "Current");
+        lua_pushnil(L);
+        lua_setfield(L, WalkIndex, "Key");
+        break;
+    }
+    case LUA_TFUNCTION:
+        for (int32 Upvalue = 1; const char* Name = lua_getupvalue(L, Index, Upvalue); ++Upvalue)
+        {
+            // C function upvalues have empty names.
+            Visit(L, lua_gettop(L), Owner, *Name ? GetChildPath(Path, Name, FCStringAnsi::Strlen(Name)) : GetChildPath(Path, "(upvalue)", 9));
+            lua_pop(L, 1);
+        }
+        break;
+    case LUA_TUSERDATA:
+        if (lua_getmetatable(L, Index))
+        {
+            Visit(L, lua_gettop(L), Owner, GetChildPath(Path, "(metatable)", 11));
+            lua_pop(L, 1);
+        }
+        for (int32 UserValue = 1; lua_getiuservalue(L, Index, UserValue) != LUA_TNONE; ++UserValue)
+        {
+            Visit(L, lua_gettop(L), Owner, GetChildPath(Path, "(uservalue)", 11));
+            lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+        break;
+    case LUA_TTHREAD:
+    {
+        // The walking thread's stack is the walk itself, and a coroutine that died of an error has no usable stack.
+        lua_State* Thread = lua_tothread(L, Index);
+        if (Thread == L || (lua_status(Thread) != LUA_OK && lua_status(Thread) != LUA_YIELD) || !lua_checkstack(L, 2))
+        {
+            break;
+        }
+        const int32 Num = lua_gettop(Thread);
+        for (int32 Slot = 1; Slot <= Num && lua_checkstack(Thread, 1); ++Slot)
+        {
+            lua_pushvalue(Thread, Slot);
+            lua_xmove(Thread, L, 1);
+            Visit(L, lua_gettop(L), Owner, GetChildPath(Path, "(stack)", 7));
+            lua_pop(L, 1);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+void FLuaHeapWalker::FinishTable()
+{
+    bIterating = false;
+    const int64 HashNum = FMath::Max<int64>(CurrentEntries - CurrentArrayNum, 0);
+    const int64 Size = LuaHeapTableSize + CurrentArrayNum * LuaHeapArraySlotSize
+        + (HashNum > 0 ? static_cast<int64>(FMath::RoundUpToPowerOfTwo64(HashNum)) * LuaHeapNodeSize : 0);
+    OnObject(CurrentTable, ELuaHeapType::Table, Size, CurrentOwner, CurrentPath);
+}
+
+uint32 FLuaHeapWalker::GetChildPath(uint32 Parent, const char* Key, int32 Length, bool bIndex)
+{
+    if (!bRecordPaths)
+    {
+        return 0;
+    }
+    Length = FMath::Min(Length, LuaHeapMaxPathKey);
+    const uint32 Path = static_cast<uint32>(CityHash64WithSeed(Key, Length, Parent));
+    // Names are kept per distinct path, not per object; past the cap paths are reported by hash.
+    if (PathNames.Num() < LuaHeapMaxPathNames && !PathNames.Contains(Path))
+    {
+        const FUTF8ToTCHAR Converted(Key, Length);
+        const FString KeyName(Converted.Length(), Converted.Get());
+        PathNames.Add(Path, Parent == 0 ? KeyName : GetPathName(Parent) + (bIndex ? TEXT("") : TEXT(".")) + KeyName);
+    }
+    return Path;
+}
+
+uint32 FLuaHeapWalker::GetKeyPath(lua_State* L, int32 KeyIndex, uint32 Parent)
+{
+    if (!bRecordPaths)
+    {
+        return 0;
+    }
+    const int32 KeyType = lua_type(L, KeyIndex);
+    if (KeyType == LUA_TSTRING)
+    {
+        // Runs of digits collapse to #, so generated keys such as Item12 and Item13 share one path.
+        size_t Length = 0;
+        const char* Key = lua_tolstring(L, KeyIndex, &Length);
+        ANSICHAR Normalized[LuaHeapMaxPathKey];
+        int32 NormalizedLength = 0;
+        for (size_t Index = 0; Index < Length && NormalizedLength < LuaHeapMaxPathKey; ++Index)
+        {
+            const bool bDigit = FCharAnsi::IsDigit(Key[Index]);
+            if (!bDigit || NormalizedLength == 0 || Normalized[NormalizedLength - 1] != '#' || !FCharAnsi::IsDigit(Key[Index - 1]))
+            {
+                Normalized[NormalizedLength++] = bDigit ? '#' : Key[Index];
+            }
+        }
+        return GetChildPath(Parent, Normalized, NormalizedLength);
+    }
+    if (KeyType == LUA_TNUMBER)
+    {
+        return GetChildPath(Parent, "[]", 2, true);
+    }
+    ANSICHAR Key[32];
+    const int32 Length = FCStringAnsi::Snprintf(Key, sizeof(Key), "[%s]", lua_typename(L, KeyType));
+    return GetChildPath(Parent, Key, FMath::Min<int32>(Length, sizeof(Key) - 1), true);
+}
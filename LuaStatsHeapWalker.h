@@ -0,0 +1,114 @@
+// LuaStatsHeapWalker.h
+#pragma once
+
+#include "CoreMinimal.h"
+#include "lua.hpp"
+
+enum class ELuaHeapType : uint8
+{
+    Table,
+    String,
+    Function,
+    Userdata,
+    Thread,
+    Count
+};
+
+static const TCHAR* const LuaHeapTypeNames[] =
+{
+    TEXT("Table"),
+    TEXT("String"),
+    TEXT("Function"),
+    TEXT("Userdata"),
+    TEXT("Thread"),
+};
+static_assert(UE_ARRAY_COUNT(LuaHeapTypeNames) == static_cast<int32>(ELuaHeapType::Count), "LuaHeapTypeNames out of sync");
+
+struct FLuaHeapPending
+{
+    int32 Owner;
+    uint32 Path;
+};
+
+// Walks everything reachable from package.loaded, the globals and the registry with the raw Lua API, so no
+// metamethod runs, in steps of a bounded number of work units. The walk state lives in a registry table: a
+// visited set with weak keys, so the walk does not keep garbage alive, the stack of objects whose references
+// are still to be followed, and the table being iterated with its last key. Each object is reported once,
+// with its approximate size and the root that reached it first: module tables are claimed before their
+// contents are followed, so an object belongs to the first module that references it. Walks that record
+// paths also report the chain of keys it was first reached through, hashed, e.g. _G.Actors[].Mesh: integer
+// keys collapse to [] so the elements of one array share a path.
+class FLuaHeapWalker
+{
+public:
+    virtual ~FLuaHeapWalker()
+    {
+    }
+
+    bool IsWalking() const
+    {
+        return State != nullptr;
+    }
+
+    lua_State* GetState() const
+    {
+        return State;
+    }
+
+    const TArray<FName>& GetOwners() const
+    {
+        return Owners;
+    }
+
+    FString GetPathName(uint32 Path) const
+    {
+        const FString* Found = PathNames.Find(Path);
+        return Found ? *Found : FString::Printf(TEXT("#%08x"), Path);
+    }
+
+    // Walks L's heap, and L's own stack is not followed; pass the main thread for walks spanning frames. Walks
+    // that keep the collector stopped until they finish can track visited objects by address, natively, so the
+    // visited set is not allocated in the heap being measured.
+    void Begin(lua_State* L, bool bInRecordPaths = false, bool bInNativeVisited = false);
+    // Follows references for at most Budget work units; returns true when the walk is complete.
+    bool Step(int32 Budget);
+    void Abort();
+    // Drops a walk of L's state without touching it, as the state is being closed.
+    void OnStateClosed(lua_State* L);
+
+protected:
+    virtual void OnObject(const void* Object, ELuaHeapType Type, int64 Size, int32 Owner, uint32 Path) = 0;
+
+private:
+    static int32 StepProtected(lua_State* L);
+    bool StepUnprotected(lua_State* L, int32 Budget);
+    void Visit(lua_State* L, int32 Index, int32 Owner, uint32 Path);
+    // Returns whether the value at Index was visited before, and marks it visited.
+    bool MarkVisited(lua_State* L, int32 Index);
+    void Expand(lua_State* L, int32 Index, int32 Owner, uint32 Path);
+    void FinishTable();
+    uint32 GetChildPath(uint32 Parent, const char* Key, int32 Length, bool bIndex = false);
+    uint32 GetKeyPath(lua_State* L, int32 KeyIndex, uint32 Parent);
+
+    lua_State* State = nullptr;
+    TArray<FName> Owners;
+    TArray<FLuaHeapPending> StackEntries;
+    int32 StackTop = 0;
+    bool bRecordPaths = false;
+    TMap<uint32, FString> PathNames;
+    bool bNativeVisited = false;
+    TSet<const void*> NativeVisited;
+    // Stack indices of the walk state while a step runs.
+    int32 WalkIndex = 0;
+    int32 VisitedIndex = 0;
+    int32 StackIndex = 0;
+
+    bool bIterating = false;
+    const void* CurrentTable = nullptr;
+    int32 CurrentOwner = INDEX_NONE;
+    uint32 CurrentPath = 0;
+    int64 CurrentArrayNum = 0;
+    int64 CurrentEntries = 0;
+    bool bCurrentWeakKeys = false;
+    bool bCurrentWeakValues = false;
+};
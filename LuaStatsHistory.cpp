@@ -0,0 +1,223 @@
+// LuaStatsHistory.cpp
+#include "LuaStatsHistory.h"
+
+void FLuaStatsHistory::Configure(double InMaxSeconds, int64 BudgetBytes)
+{
+    const int32 NewMaxBlocks = InMaxSeconds > 0.0 ? GetMaxBlocks(BudgetBytes) : 0;
+    if (NewMaxBlocks != MaxBlocks)
+    {
+        Blocks.Empty();
+        FreeBlocks.Empty();
+        Series.Empty();
+        Sealed.Empty();
+        SealedHead = 0;
+        NextSample = 0;
+        MaxBlocks = NewMaxBlocks;
+    }
+    MaxSeconds = FMath::Max(InMaxSeconds, 0.0);
+}
+
+void FLuaStatsHistory::Record(const TArray<double>& Values)
+{
+    const double Now = FPlatformTime::Seconds();
+    while (SealedHead < Sealed.Num() && Blocks[Series[Sealed[SealedHead]].Blocks[0]].LastSeconds < Now - MaxSeconds)
+    {
+        EvictOldest();
+    }
+    // Series 0 and 1 are the timeline every stat's samples are matched against.
+    while (Series.Num() < Values.Num() + 2)
+    {
+        const int32 Index = Series.AddDefaulted();
+        Series[Index].bInteger = Index < 2;
+    }
+    Append(0, GFrameCounter, Now);
+    Append(1, static_cast<uint64>(Now * 1000000.0), Now);
+    const uint64* Bits = reinterpret_cast<const uint64*>(Values.GetData());
+    for (int32 Index = 0; Index < Values.Num(); ++Index)
+    {
+        Append(Index + 2, Bits[Index], Now);
+    }
+    ++NextSample;
+}
+
+bool FLuaStatsHistory::GetWindow(double Seconds, double EndSecondsAgo, FLuaHistoryWindow& Out) const
+{
+    if (Series.Num() < 2)
+    {
+        return false;
+    }
+    const double Now = FPlatformTime::Seconds();
+    const int64 FromMicros = static_cast<int64>((Now - Seconds) * 1000000.0);
+    const int64 ToMicros = static_cast<int64>((Now - EndSecondsAgo) * 1000000.0);
+    uint32 FirstSample = MAX_uint32;
+    uint32 LastSample = 0;
+    Visit(Series[1], 0, MAX_uint32, Now - Seconds, [&](uint32 Sample, uint64 Raw)
+    {
+        if (static_cast<int64>(Raw) >= FromMicros && static_cast<int64>(Raw) <= ToMicros)
+        {
+            FirstSample = FMath::Min(FirstSample, Sample);
+            LastSample = FMath::Max(LastSample, Sample);
+        }
+    });
+    if (FirstSample > LastSample)
+    {
+        return false;
+    }
+    const int32 Num = LastSample - FirstSample + 1;
+    Out.FirstSample = FirstSample;
+    Out.SecondsAgo.Init(-1.0, Num);
+    Out.Frames.Init(0, Num);
+    Visit(Series[1], FirstSample, LastSample, 0.0, [&](uint32 Sample, uint64 Raw)
+    {
+        Out.SecondsAgo[Sample - FirstSample] = Now - static_cast<int64>(Raw) / 1000000.0;
+    });
+    Visit(Series[0], FirstSample, LastSample, 0.0, [&](uint32 Sample, uint64 Raw)
+    {
+        Out.Frames[Sample - FirstSample] = Raw;
+    });
+    return true;
+}
+
+bool FLuaStatsHistory::ReadSeries(int32 Definition, const FLuaHistoryWindow& Window, TBitArray<>& OutRecorded, TArray<double>& OutValues) const
+{
+    const int32 Num = Window.Frames.Num();
+    OutRecorded.Init(false, Num);
+    OutValues.SetNumZeroed(Num);
+    bool bAny = false;
+    if (Definition + 2 < Series.Num())
+    {
+        Visit(Series[Definition + 2], Window.FirstSample, Window.FirstSample + Num - 1, 0.0, [&](uint32 Sample, uint64 Raw)
+        {
+            OutRecorded[Sample - Window.FirstSample] = true;
+            FMemory::Memcpy(&OutValues[Sample - Window.FirstSample], &Raw, sizeof(double));
+            bAny = true;
+        });
+    }
+    return bAny;
+}
+
+void FLuaStatsHistory::Append(int32 SeriesIndex, uint64 Raw, double Now)
+{
+    FLuaHistorySeries& Target = Series[SeriesIndex];
+    if (Target.bOpen)
+    {
+        const FLuaHistoryBlock& Block = Blocks[Target.Blocks.Last()];
+        if (Block.BitCount + LuaHistoryMaxSampleBits > LuaHistoryBlockWords * 64 || Block.FirstSample + Block.Count != NextSample)
+        {
+            Sealed.Add(SeriesIndex);
+            Target.bOpen = false;
+        }
+    }
+    if (!Target.bOpen)
+    {
+        const int32 BlockIndex = AllocateBlock();
+        if (BlockIndex == INDEX_NONE)
+        {
+            // Every block is open in some series; this sample is dropped and the series resumes in a new block.
+            return;
+        }
+        Blocks[BlockIndex].Reset(NextSample);
+        Target.Blocks.Add(BlockIndex);
+        Target.bOpen = true;
+    }
+    FLuaHistoryBlock& Block = Blocks[Target.Blocks.Last()];
+    Encode(Target, Block, Raw);
+    Block.LastSeconds = Now;
+}
+
+void FLuaStatsHistory::Encode(FLuaHistorySeries& Target, FLuaHistoryBlock& Block, uint64 Raw)
+{
+    if (Block.Count == 0)
+    {
+        Block.Write(Raw, 64);
+        Target.PreviousDelta = 0;
+        Target.Leading = 0xff;
+    }
+    else if (Target.bInteger)
+    {
+        const int64 Delta = static_cast<int64>(Raw - Target.Previous);
+        const int64 DeltaOfDelta = Delta - Target.PreviousDelta;
+        if (DeltaOfDelta == 0)
+        {
+            Block.Write(0, 1);
+        }
+        else if (DeltaOfDelta >= -63 && DeltaOfDelta <= 64)
+        {
+            Block.Write(0b10, 2);
+            Block.Write(DeltaOfDelta + 63, 7);
+        }
+        else if (DeltaOfDelta >= -255 && DeltaOfDelta <= 256)
+        {
+            Block.Write(0b110, 3);
+            Block.Write(DeltaOfDelta + 255, 9);
+        }
+        else if (DeltaOfDelta >= -2047 && DeltaOfDelta <= 2048)
+        {
+            Block.Write(0b1110, 4);
+            Block.Write(DeltaOfDelta + 2047, 12);
+        }
+        else
+        {
+            Block.Write(0b1111, 4);
+            Block.Write(static_cast<uint64>(DeltaOfDelta), 64);
+        }
+        Target.PreviousDelta = Delta;
+    }
+    else
+    {
+        const uint64 Xor = Raw ^ Target.Previous;
+        if (Xor == 0)
+        {
+            Block.Write(0, 1);
+        }
+        else
+        {
+            const uint32 Leading = FMath::Min<uint32>(FMath::CountLeadingZeros64(Xor), 31);
+            const uint32 Trailing = FMath::CountTrailingZeros64(Xor);
+            if (Target.Leading != 0xff && Leading >= Target.Leading && Trailing >= Target.Trailing)
+            {
+                // Fits the previous window: only its bits are written.
+                Block.Write(0b10, 2);
+                Block.Write(Xor >> Target.Trailing, 64 - Target.Leading - Target.Trailing);
+            }
+            else
+            {
+                const uint32 Meaningful = 64 - Leading - Trailing;
+                Block.Write(0b11, 2);
+                Block.Write(Leading, 5);
+                Block.Write(Meaningful - 1, 6);
+                Block.Write(Xor >> Trailing, Meaningful);
+                Target.Leading = Leading;
+                Target.Trailing = Trailing;
+            }
+        }
+    }
+    Target.Previous = Raw;
+    ++Block.Count;
+}
+
+int32 FLuaStatsHistory::AllocateBlock()
+{
+    if (FreeBlocks.Num() == 0 && Blocks.Num() < MaxBlocks)
+    {
+        return Blocks.AddUninitialized();
+    }
+    if (FreeBlocks.Num() == 0 && SealedHead < Sealed.Num())
+    {
+        EvictOldest();
+    }
+    return FreeBlocks.Num() > 0 ? FreeBlocks.Pop() : INDEX_NONE;
+}
+
+void FLuaStatsHistory::EvictOldest()
+{
+    // Series seal their blocks in order, so the oldest sealed block of a series is always its first.
+    FLuaHistorySeries& Oldest = Series[Sealed[SealedHead++]];
+    FreeBlocks.Add(Oldest.Blocks[0]);
+    Oldest.Blocks.RemoveAt(0);
+    if (SealedHead >= 1024 && SealedHead * 2 >= Sealed.Num())
+    {
+        Sealed.RemoveAt(0, SealedHead);
+        SealedHead = 0;
+    }
+}
@@ -0,0 +1,185 @@
+// LuaStatsHistory.h
+#pragma once
+
+#include "CoreMinimal.h"
+
+static constexpr int32 LuaHistoryBlockWords = 128;
+// Worst case of one encoded sample: a new XOR window (2 + 5 + 6 bits) and 64 meaningful bits.
+static constexpr uint32 LuaHistoryMaxSampleBits = 80;
+
+// A run of consecutive samples of one series packed Gorilla-style: doubles XORed with the previous value,
+// integers as deltas of deltas. The first sample of a block is stored whole so each block decodes alone.
+struct FLuaHistoryBlock
+{
+    uint64 Words[LuaHistoryBlockWords];
+    uint32 FirstSample;
+    uint32 Count;
+    uint32 BitCount;
+    double LastSeconds;
+
+    void Reset(uint32 Sample)
+    {
+        FMemory::Memzero(Words, sizeof(Words));
+        FirstSample = Sample;
+        Count = 0;
+        BitCount = 0;
+        LastSeconds = 0.0;
+    }
+
+    void Write(uint64 Value, uint32 NumBits)
+    {
+        while (NumBits > 0)
+        {
+            const uint32 Offset = BitCount & 63;
+            const uint32 Take = FMath::Min(64 - Offset, NumBits);
+            const uint64 Chunk = Take == 64 ? Value : (Value >> (NumBits - Take)) & ((uint64(1) << Take) - 1);
+            Words[BitCount >> 6] |= Chunk << (64 - Offset - Take);
+            BitCount += Take;
+            NumBits -= Take;
+        }
+    }
+
+    uint64 Read(uint32& Position, uint32 NumBits) const
+    {
+        uint64 Value = 0;
+        while (NumBits > 0)
+        {
+            const uint32 Offset = Position & 63;
+            const uint32 Take = FMath::Min(64 - Offset, NumBits);
+            const uint64 Chunk = (Words[Position >> 6] << Offset) >> (64 - Take);
+            Value = Take == 64 ? Chunk : (Value << Take) | Chunk;
+            Position += Take;
+            NumBits -= Take;
+        }
+        return Value;
+    }
+};
+
+// The blocks of one stat, or of the frame timeline, oldest first, and the encoder state of the last one.
+struct FLuaHistorySeries
+{
+    TArray<int32> Blocks;
+    bool bInteger = false;
+    bool bOpen = false;
+    uint64 Previous = 0;
+    int64 PreviousDelta = 0;
+    uint8 Leading = 0xff;
+    uint8 Trailing = 0;
+};
+
+// The samples of a time window, in order, with the frame and age of each.
+struct FLuaHistoryWindow
+{
+    uint32 FirstSample = 0;
+    TArray<uint64> Frames;
+    TArray<double> SecondsAgo;
+};
+
+// Per-frame values of every stat over the last LuaStats.HistoryMinutes, kept compressed so it can stay on for a
+// whole session and be dumped after the fact. Blocks come from a pool capped by LuaStats.HistoryBudgetMB; the
+// block sealed first is evicted first, whether it aged out or the pool ran dry.
+class FLuaStatsHistory
+{
+public:
+    bool IsEnabled() const
+    {
+        return MaxSeconds > 0.0;
+    }
+
+    bool IsConfigured(double InMaxSeconds, int64 BudgetBytes) const
+    {
+        return InMaxSeconds == MaxSeconds && (MaxSeconds <= 0.0 || GetMaxBlocks(BudgetBytes) == MaxBlocks);
+    }
+
+    void Configure(double InMaxSeconds, int64 BudgetBytes);
+    void Record(const TArray<double>& Values);
+
+    // Finds the recorded samples between Seconds and EndSecondsAgo seconds ago.
+    bool GetWindow(double Seconds, double EndSecondsAgo, FLuaHistoryWindow& Out) const;
+
+    // Fills OutRecorded and OutValues with the window's samples of a definition; false when none was recorded.
+    bool ReadSeries(int32 Definition, const FLuaHistoryWindow& Window, TBitArray<>& OutRecorded, TArray<double>& OutValues) const;
+
+private:
+    static int32 GetMaxBlocks(int64 BudgetBytes)
+    {
+        return static_cast<int32>(FMath::Clamp<int64>(BudgetBytes / sizeof(FLuaHistoryBlock), 64, MAX_int32));
+    }
+
+    void Append(int32 SeriesIndex, uint64 Raw, double Now);
+    static void Encode(FLuaHistorySeries& Target, FLuaHistoryBlock& Block, uint64 Raw);
+
+    // Decodes the blocks of a series that overlap [FromSample, ToSample] and were written to after MinSeconds.
+    template<typename FuncType>
+    void Visit(const FLuaHistorySeries& Source, uint32 FromSample, uint32 ToSample, double MinSeconds, FuncType&& Func) const
+    {
+        for (const int32 BlockIndex : Source.Blocks)
+        {
+            const FLuaHistoryBlock& Block = Blocks[BlockIndex];
+            if (Block.Count == 0 || Block.LastSeconds < MinSeconds || Block.FirstSample > ToSample || Block.FirstSample + Block.Count <= FromSample)
+            {
+                continue;
+            }
+            uint32 Position = 0;
+            uint64 Value = Block.Read(Position, 64);
+            int64 Delta = 0;
+            uint32 Leading = 0;
+            uint32 Trailing = 0;
+            for (uint32 Index = 0; Index < Block.Count; ++Index)
+            {
+                if (Index > 0 && Source.bInteger)
+                {
+                    int64 DeltaOfDelta = 0;
+                    if (Block.Read(Position, 1) == 0)
+                    {
+                    }
+                    else if (Block.Read(Position, 1) == 0)
+                    {
+                        DeltaOfDelta = static_cast<int64>(Block.Read(Position, 7)) - 63;
+                    }
+                    else if (Block.Read(Position, 1) == 0)
+                    {
+                        DeltaOfDelta = static_cast<int64>(Block.Read(Position, 9)) - 255;
+                    }
+                    else if (Block.Read(Position, 1) == 0)
+                    {
+                        DeltaOfDelta = static_cast<int64>(Block.Read(Position, 12)) - 2047;
+                    }
+                    else
+                    {
+                        DeltaOfDelta = static_cast<int64>(Block.Read(Position, 64));
+                    }
+                    Delta += DeltaOfDelta;
+                    Value += Delta;
+                }
+                else if (Index > 0 && Block.Read(Position, 1) != 0)
+                {
+                    if (Block.Read(Position, 1) != 0)
+                    {
+                        Leading = static_cast<uint32>(Block.Read(Position, 5));
+                        Trailing = 64 - Leading - static_cast<uint32>(Block.Read(Position, 6) + 1);
+                    }
+                    Value ^= Block.Read(Position, 64 - Leading - Trailing) << Trailing;
+                }
+                const uint32 Sample = Block.FirstSample + Index;
+                if (Sample >= FromSample && Sample <= ToSample)
+                {
+                    Func(Sample, Value);
+                }
+            }
+        }
+    }
+
+    int32 AllocateBlock();
+    void EvictOldest();
+
+    double MaxSeconds = 0.0;
+    int32 MaxBlocks = 0;
+    uint32 NextSample = 0;
+    TArray<FLuaHistoryBlock> Blocks;
+    TArray<int32> FreeBlocks;
+    TArray<FLuaHistorySeries> Series;
+    // Series index of every sealed block, in the order they were sealed; entries before SealedHead are evicted.
+    TArray<int32> Sealed;
+    int32 SealedHead = 0;
+};
@@ -0,0 +1,93 @@
+// LuaStatsPerfCounters.cpp
+#include "LuaStatsPerfCounters.h"
+
+#if PLATFORM_LINUX
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+bool FLuaPerfCounters::Open()
+{
+    Close();
+#if PLATFORM_LINUX
+    static const uint64 HardwareConfigs[] = { PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES };
+    static const TCHAR* const HardwareSuffixes[] = { TEXT("@RetiredInstructions"), TEXT("@CacheMisses"), TEXT("@BranchMisses") };
+    static const uint64 SoftwareConfigs[] = { PERF_COUNT_SW_TASK_CLOCK, PERF_COUNT_SW_PAGE_FAULTS };
+    static const TCHAR* const SoftwareSuffixes[] = { TEXT("@TaskClockNs"), TEXT("@PageFaults") };
+    if (OpenGroup(PERF_TYPE_HARDWARE, HardwareConfigs, UE_ARRAY_COUNT(HardwareConfigs)))
+    {
+        Suffixes = HardwareSuffixes;
+        MapForRdpmc();
+        return true;
+    }
+    if (OpenGroup(PERF_TYPE_SOFTWARE, SoftwareConfigs, UE_ARRAY_COUNT(SoftwareConfigs)))
+    {
+        Suffixes = SoftwareSuffixes;
+        return true;
+    }
+#endif
+    return false;
+}
+
+void FLuaPerfCounters::Close()
+{
+#if PLATFORM_LINUX
+    for (int32 Event = 0; Event < NumEvents; ++Event)
+    {
+        if (Pages[Event])
+        {
+            munmap(Pages[Event], PageSize);
+            Pages[Event] = nullptr;
+        }
+        close(Fds[Event]);
+    }
+#endif
+    NumEvents = 0;
+    bRdpmc = false;
+}
+
+#if PLATFORM_LINUX
+bool FLuaPerfCounters::OpenGroup(uint32 Type, const uint64* Configs, int32 Num)
+{
+    for (int32 Event = 0; Event < Num; ++Event)
+    {
+        perf_event_attr Attr;
+        FMemory::Memzero(Attr);
+        Attr.size = sizeof(Attr);
+        Attr.type = Type;
+        Attr.config = Configs[Event];
+        Attr.read_format = PERF_FORMAT_GROUP;
+        // The leader starts disabled so the whole group is enabled at once below.
+        Attr.disabled = Event == 0 ? 1 : 0;
+        Attr.exclude_kernel = 1;
+        Attr.exclude_hv = 1;
+        const int Fd = static_cast<int>(syscall(__NR_perf_event_open, &Attr, 0, -1, Event == 0 ? -1 : Fds[0], PERF_FLAG_FD_CLOEXEC));
+        if (Fd < 0)
+        {
+            Close();
+            return false;
+        }
+        Fds[Event] = Fd;
+        Pages[Event] = nullptr;
+        NumEvents = Event + 1;
+    }
+    ioctl(Fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(Fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return true;
+}
+
+void FLuaPerfCounters::MapForRdpmc()
+{
+#if defined(__x86_64__)
+    PageSize = sysconf(_SC_PAGESIZE);
+    bRdpmc = true;
+    for (int32 Event = 0; Event < NumEvents; ++Event)
+    {
+        void* Page = mmap(nullptr, PageSize, PROT_READ, MAP_SHARED, Fds[Event], 0);
+        Pages[Event] = Page != MAP_FAILED ? static_cast<perf_event_mmap_page*>(Page) : nullptr;
+        bRdpmc &= Pages[Event] != nullptr && Pages[Event]->cap_user_rdpmc;
+    }
+#endif
+}
+#endif
@@ -0,0 +1,112 @@
+// LuaStatsPerfCounters.h
+#pragma once
+
+#include "CoreMinimal.h"
+
+#if PLATFORM_LINUX
+#include <linux/perf_event.h>
+#include <unistd.h>
+#endif
+
+// Most performance counters a cycle counter scope reads, see FLuaPerfCounters.
+static constexpr int32 LuaPerfMaxEvents = 3;
+
+// Counters of the game thread from perf_event_open, read as one group around each cycle counter scope while
+// LuaStats.PerfCounters is set. Hardware events are read with rdpmc when the kernel allows it in user space,
+// otherwise with one read() of the group; without hardware counters (most VMs and containers) the software
+// task clock and page faults stand in.
+class FLuaPerfCounters
+{
+public:
+    ~FLuaPerfCounters()
+    {
+        Close();
+    }
+
+    bool IsOpen() const
+    {
+        return NumEvents > 0;
+    }
+
+    int32 GetNumEvents() const
+    {
+        return NumEvents;
+    }
+
+    const TCHAR* GetSuffix(int32 Event) const
+    {
+        return Suffixes[Event];
+    }
+
+    bool Open();
+    void Close();
+
+    // Returns false, leaving OutValues alone, when the counters could not be read.
+    FORCEINLINE bool Read(uint64* OutValues) const
+    {
+#if PLATFORM_LINUX
+#if defined(__x86_64__)
+        if (bRdpmc && ReadRdpmc(OutValues))
+        {
+            return true;
+        }
+#endif
+        struct
+        {
+            uint64 Num;
+            uint64 Values[LuaPerfMaxEvents];
+        } Group;
+        if (read(Fds[0], &Group, sizeof(Group)) >= static_cast<ssize_t>(sizeof(uint64) * (1 + NumEvents)))
+        {
+            FMemory::Memcpy(OutValues, Group.Values, NumEvents * sizeof(uint64));
+            return true;
+        }
+#endif
+        return false;
+    }
+
+private:
+#if PLATFORM_LINUX
+    bool OpenGroup(uint32 Type, const uint64* Configs, int32 Num);
+    void MapForRdpmc();
+
+#if defined(__x86_64__)
+    // The seqlock protocol of perf_event_mmap_page. Fails while an event is not scheduled on a counter (index
+    // 0), e.g. when the PMU is multiplexed, and the group is then read through the kernel.
+    FORCEINLINE bool ReadRdpmc(uint64* OutValues) const
+    {
+        for (int32 Event = 0; Event < NumEvents; ++Event)
+        {
+            const volatile perf_event_mmap_page* Page = Pages[Event];
+            uint32 Sequence;
+            do
+            {
+                Sequence = Page->lock;
+                asm volatile("" ::: "memory");
+                const uint32 Index = Page->index;
+                if (Index == 0)
+                {
+                    return false;
+                }
+                uint32 Low;
+                uint32 High;
+                asm volatile("rdpmc" : "=a"(Low), "=d"(High) : "c"(Index - 1));
+                const uint32 Shift = 64 - Page->pmc_width;
+                const int64 Counter = static_cast<int64>((static_cast<uint64>(High) << 32 | Low) << Shift) >> Shift;
+                OutValues[Event] = static_cast<uint64>(Page->offset + Counter);
+                asm volatile("" ::: "memory");
+            }
+            while (Page->lock != Sequence);
+        }
+        return true;
+    }
+#endif
+
+    int Fds[LuaPerfMaxEvents];
+    perf_event_mmap_page* Pages[LuaPerfMaxEvents] = {};
+    long PageSize = 0;
+#endif
+    int32 NumEvents = 0;
+    bool bRdpmc = false;
+    const TCHAR* const* Suffixes = nullptr;
+};
@@ -0,0 +1,40 @@
+// LuaStatsPrivate.h
+//
+// What the parts of the module in files of their own share with the stat registry in LuaStats.cpp.
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Stats/Stats2.h"
+
+DECLARE_LOG_CATEGORY_EXTERN(LogLuaStats, Log, All);
+
+enum class ELuaStatType : uint8
+{
+    CycleCounter,
+    SimpleSeconds,
+    Int64Counter,
+    Int64Accumulator,
+    DoubleCounter,
+    DoubleAccumulator,
+    Memory,
+    AsyncSpan,
+    Count
+};
+
+struct FLuaStatDefinition
+{
+    FName Name;
+    FString Desc;
+    ELuaStatType Type;
+    double Scale;
+    int32 Group;
+    bool bCompanion;
+    int32 Parent = INDEX_NONE;
+};
+
+// The registry, GLuaStats in LuaStats.cpp, as seen from the other files of the module.
+FName GetLuaStatName(TStatIdData const* StatIdPtr);
+TStatIdData const* ResolveLuaStat(ELuaStatType Type, FName StatName);
+void FlushLuaStats();
+bool StopLuaCycleCounter();
+double GetLuaParentValue(FName ParentName);
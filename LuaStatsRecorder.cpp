@@ -0,0 +1,492 @@
+// LuaStatsRecorder.cpp
+#include "LuaStatsRecorder.h"
+#include "LuaStats.h"
+#include "LuaStatsPrivate.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "Hash/CityHash.h"
+#include "Misc/CoreDelegates.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+FLuaCallRecorder GLuaCallRecorder;
+
+bool FLuaCallRecorder::Start(const FString& Path)
+{
+    Stop();
+    Archive.Reset(IFileManager::Get().CreateFileWriter(*Path));
+    if (!Archive)
+    {
+        return false;
+    }
+    Buffer.Append(reinterpret_cast<const uint8*>("LSRC"), 4);
+    Append(LuaCallRecordingVersion);
+    if (!bFrameRegistered)
+    {
+        bFrameRegistered = true;
+        FCoreDelegates::OnEndFrame.AddRaw(this, &FLuaCallRecorder::EndFrame);
+    }
+    return true;
+}
+
+void FLuaCallRecorder::Stop()
+{
+    if (Archive)
+    {
+        Archive->Serialize(Buffer.GetData(), Buffer.Num());
+        Archive->Close();
+        Archive.Reset();
+        UE_LOG(LogLuaStats, Log, TEXT("Recorded %llu Lua stat calls"), Calls);
+    }
+    Buffer.Reset();
+    StringIds.Reset();
+    HandleIds.Reset();
+    ThreadIds.Reset();
+    CurrentThread = nullptr;
+    Calls = 0;
+}
+
+void FLuaCallRecorder::RecordCall(lua_State* L, ELuaRecordedCall Call)
+{
+    if (L != CurrentThread)
+    {
+        const uint32* Found = ThreadIds.Find(L);
+        const uint32 Thread = Found ? *Found : ThreadIds.Add(L, ThreadIds.Num());
+        Buffer.Add('T');
+        Append(Thread);
+        CurrentThread = L;
+    }
+
+    // Ids are assigned first: their definitions have to precede the call that uses them.
+    const int32 ArgNum = FMath::Min(lua_gettop(L), LuaCallRecordingMaxArgs);
+    uint32 Ids[LuaCallRecordingMaxArgs];
+    for (int32 Arg = 1; Arg <= ArgNum; ++Arg)
+    {
+        if (lua_type(L, Arg) == LUA_TSTRING)
+        {
+            size_t Length = 0;
+            const char* String = lua_tolstring(L, Arg, &Length);
+            Ids[Arg - 1] = GetStringId(String, static_cast<uint32>(Length));
+        }
+        else if (lua_islightuserdata(L, Arg))
+        {
+            Ids[Arg - 1] = GetHandleId(static_cast<TStatIdData const*>(lua_touserdata(L, Arg)));
+        }
+    }
+
+    Buffer.Add('C');
+    Buffer.Add(static_cast<uint8>(Call));
+    Buffer.Add(static_cast<uint8>(ArgNum));
+    for (int32 Arg = 1; Arg <= ArgNum; ++Arg)
+    {
+        switch (lua_type(L, Arg))
+        {
+        case LUA_TNIL:
+            Buffer.Add(static_cast<uint8>(ELuaRecordedArg::Nil));
+            break;
+        case LUA_TBOOLEAN:
+            Buffer.Add(static_cast<uint8>(lua_toboolean(L, Arg) ? ELuaRecordedArg::True : ELuaRecordedArg::False));
+            break;
+        case LUA_TNUMBER:
+            if (lua_isinteger(L, Arg))
+            {
+                Buffer.Add(static_cast<uint8>(ELuaRecordedArg::Integer));
+                Append(static_cast<int64>(lua_tointeger(L, Arg)));
+            }
+            else
+            {
+                Buffer.Add(static_cast<uint8>(ELuaRecordedArg::Number));
+                Append(static_cast<double>(lua_tonumber(L, Arg)));
+            }
+            break;
+        case LUA_TSTRING:
+            Buffer.Add(static_cast<uint8>(ELuaRecordedArg::String));
+            Append(Ids[Arg - 1]);
+            break;
+        case LUA_TLIGHTUSERDATA:
+            Buffer.Add(static_cast<uint8>(ELuaRecordedArg::Handle));
+            Append(Ids[Arg - 1]);
+            break;
+        default:
+            Buffer.Add(static_cast<uint8>(ELuaRecordedArg::Object));
+            Append(static_cast<uint64>(reinterpret_cast<UPTRINT>(lua_topointer(L, Arg))));
+            break;
+        }
+    }
+    ++Calls;
+    if (Buffer.Num() >= 1024 * 1024)
+    {
+        Archive->Serialize(Buffer.GetData(), Buffer.Num());
+        Buffer.Reset();
+    }
+}
+
+uint32 FLuaCallRecorder::GetStringId(const char* String, uint32 Length)
+{
+    const uint64 Hash = CityHash64(String, Length);
+    if (const uint32* Found = StringIds.Find(Hash))
+    {
+        return *Found;
+    }
+    const uint32 Id = StringIds.Add(Hash, StringIds.Num());
+    Buffer.Add('S');
+    Append(Id);
+    Append(Length);
+    Buffer.Append(reinterpret_cast<const uint8*>(String), Length);
+    return Id;
+}
+
+uint32 FLuaCallRecorder::GetHandleId(TStatIdData const* StatIdPtr)
+{
+    if (const uint32* Found = HandleIds.Find(StatIdPtr))
+    {
+        return *Found;
+    }
+    // Recorded by the name it was created under, which is what the replay resolves.
+    const FName StatName = GetLuaStatName(StatIdPtr);
+    if (StatName.IsNone())
+    {
+        return LuaCallRecordingNoHandle;
+    }
+    const FTCHARToUTF8 Name(*StatName.ToString());
+    const uint32 NameId = GetStringId(Name.Get(), Name.Length());
+    const uint32 Id = HandleIds.Add(StatIdPtr, HandleIds.Num());
+    Buffer.Add('H');
+    Append(Id);
+    Append(NameId);
+    return Id;
+}
+
+void FLuaCallRecorder::EndFrame()
+{
+    if (Archive)
+    {
+        Buffer.Add('F');
+        Archive->Serialize(Buffer.GetData(), Buffer.Num());
+        Buffer.Reset();
+    }
+}
+
+struct FLuaRecordedBinding
+{
+    const TCHAR* Name;
+    lua_CFunction Function;
+    // Handles are looked up again by name as this type; Count replays them as names.
+    ELuaStatType HandleType;
+};
+
+static const FLuaRecordedBinding LuaRecordedBindings[] =
+{
+    { TEXT("FCycleCounter.Create"), CycleCounter_Create, ELuaStatType::CycleCounter },
+    { TEXT("FCycleCounter.Start"), CycleCounter_Start, ELuaStatType::CycleCounter },
+    { TEXT("FCycleCounter.Stop"), CycleCounter_Stop, ELuaStatType::CycleCounter },
+    { TEXT("FCycleCounter.Set"), CycleCounter_Set, ELuaStatType::CycleCounter },
+    { TEXT("FCycleCounter.SetSampleRate"), CycleCounter_SetSampleRate, ELuaStatType::CycleCounter },
+    { TEXT("FSimpleSeconds.Create"), SimpleSeconds_Create, ELuaStatType::SimpleSeconds },
+    { TEXT("FSimpleSeconds.Start"), SimpleSeconds_Start, ELuaStatType::SimpleSeconds },
+    { TEXT("FSimpleSeconds.Stop"), SimpleSeconds_Stop, ELuaStatType::SimpleSeconds },
+    { TEXT("FSimpleSeconds.SetSampleRate"), SimpleSeconds_SetSampleRate, ELuaStatType::SimpleSeconds },
+    { TEXT("FInt64Stat.Create"), Int64Stat_Create, ELuaStatType::Int64Counter },
+    { TEXT("FInt64Stat.Add"), Int64Stat_Add, ELuaStatType::Int64Counter },
+    { TEXT("FInt64Stat.Subtract"), Int64Stat_Subtract, ELuaStatType::Int64Counter },
+    { TEXT("FInt64Stat.Set"), Int64Stat_Set, ELuaStatType::Int64Counter },
+    { TEXT("FDoubleStat.Create"), DoubleStat_Create, ELuaStatType::DoubleCounter },
+    { TEXT("FDoubleStat.Add"), DoubleStat_Add, ELuaStatType::DoubleCounter },
+    { TEXT("FDoubleStat.Subtract"), DoubleStat_Subtract, ELuaStatType::DoubleCounter },
+    { TEXT("FDoubleStat.Set"), DoubleStat_Set, ELuaStatType::DoubleCounter },
+    { TEXT("FNameStat.Set"), FNameStat_Set, ELuaStatType::Count },
+    { TEXT("FMemoryStat.Create"), MemoryStat_Create, ELuaStatType::Memory },
+    { TEXT("FMemoryStat.Add"), MemoryStat_Add, ELuaStatType::Memory },
+    { TEXT("FMemoryStat.Subtract"), MemoryStat_Subtract, ELuaStatType::Memory },
+    { TEXT("FMemoryStat.Set"), MemoryStat_Set, ELuaStatType::Memory },
+    { TEXT("FAsyncSpan.Create"), AsyncSpan_Create, ELuaStatType::AsyncSpan },
+    { TEXT("FAsyncSpan.Begin"), AsyncSpan_Begin, ELuaStatType::AsyncSpan },
+    { TEXT("FAsyncSpan.End"), AsyncSpan_End, ELuaStatType::AsyncSpan },
+};
+static_assert(UE_ARRAY_COUNT(LuaRecordedBindings) == static_cast<int32>(ELuaRecordedCall::Count), "LuaRecordedBindings out of sync");
+
+// Drives the recorded calls through the same binding functions, on a private Lua state with one thread per
+// recorded thread, as fast as they go. Frame ends run FLuaStats::Flush. Stats the recording created are
+// created again, so this is best run in a process of its own, e.g. with -nullrhi -ExecCmds.
+static bool ReplayLuaCalls(const FString& Path, int32 Repeat)
+{
+    TArray<uint8> Data;
+    if (!FFileHelper::LoadFileToArray(Data, *Path) || Data.Num() < 8 || FMemory::Memcmp(Data.GetData(), "LSRC", 4) != 0)
+    {
+        return false;
+    }
+    uint32 Version = 0;
+    FMemory::Memcpy(&Version, Data.GetData() + 4, sizeof(Version));
+    if (Version != LuaCallRecordingVersion)
+    {
+        UE_LOG(LogLuaStats, Warning, TEXT("%s has unsupported version %u"), *Path, Version);
+        return false;
+    }
+
+    // Never closed: FName stat labels stay pinned in the state that passed them.
+    static lua_State* ReplayState = luaL_newstate();
+    // The objects keys were recorded from, by identity, and the threads stay on the replay state's stack, which
+    // anchors them until the end of the replay.
+    lua_newtable(ReplayState);
+    const int32 ObjectsIndex = lua_gettop(ReplayState);
+    TArray<lua_State*> Threads;
+    Threads.Add(lua_newthread(ReplayState));
+    // Strings are views into Data; handles refer to strings.
+    TArray<TPair<int32, uint32>> Strings;
+    TArray<uint32> HandleNames;
+    TArray<TStatIdData const*> ResolvedHandles;
+    TMap<int64, int64> SpanIds;
+    FLuaCallLatency Latencies[static_cast<int32>(ELuaRecordedCall::Count)];
+    FLuaCallLatency FrameLatency;
+    int64 LastSpanId = 0;
+    bool bTruncated = false;
+
+    const double StartSeconds = FPlatformTime::Seconds();
+    for (int32 Pass = 0; Pass < Repeat && !bTruncated; ++Pass)
+    {
+        lua_State* L = Threads[0];
+        int32 Offset = 8;
+        auto Read = [&Data, &Offset, &bTruncated](void* Out, int32 Size)
+        {
+            if (Offset + Size > Data.Num())
+            {
+                bTruncated = true;
+                FMemory::Memzero(Out, Size);
+                return;
+            }
+            FMemory::Memcpy(Out, Data.GetData() + Offset, Size);
+            Offset += Size;
+        };
+        while (Offset < Data.Num() && !bTruncated)
+        {
+            const uint8 Tag = Data[Offset++];
+            if (Tag == 'S')
+            {
+                uint32 Id = 0;
+                uint32 Length = 0;
+                Read(&Id, sizeof(Id));
+                Read(&Length, sizeof(Length));
+                if (Pass == 0 && Id == static_cast<uint32>(Strings.Num()))
+                {
+                    Strings.Emplace(Offset, Length);
+                }
+                Offset += Length;
+                bTruncated |= Offset > Data.Num();
+            }
+            else if (Tag == 'H')
+            {
+                uint32 Id = 0;
+                uint32 NameId = 0;
+                Read(&Id, sizeof(Id));
+                Read(&NameId, sizeof(NameId));
+                if (Pass == 0 && Id == static_cast<uint32>(HandleNames.Num()))
+                {
+                    HandleNames.Add(NameId);
+                    ResolvedHandles.Add(nullptr);
+                }
+            }
+            else if (Tag == 'T')
+            {
+                uint32 Thread = 0;
+                Read(&Thread, sizeof(Thread));
+                while (Threads.Num() <= static_cast<int32>(Thread))
+                {
+                    Threads.Add(lua_newthread(ReplayState));
+                }
+                L = Threads[Thread];
+            }
+            else if (Tag == 'R')
+            {
+                int64 SpanId = 0;
+                Read(&SpanId, sizeof(SpanId));
+                SpanIds.Add(SpanId, LastSpanId);
+            }
+            else if (Tag == 'F')
+            {
+                const uint64 FrameStart = FPlatformTime::Cycles64();
+                FlushLuaStats();
+                FrameLatency.Add(FPlatformTime::Cycles64() - FrameStart);
+            }
+            else if (Tag == 'C')
+            {
+                uint8 Call = 0;
+                uint8 ArgNum = 0;
+                Read(&Call, sizeof(Call));
+                Read(&ArgNum, sizeof(ArgNum));
+                if (Call >= static_cast<uint8>(ELuaRecordedCall::Count))
+                {
+                    bTruncated = true;
+                    break;
+                }
+                const FLuaRecordedBinding& Binding = LuaRecordedBindings[Call];
+                lua_settop(L, 0);
+                for (uint8 Arg = 0; Arg < ArgNum && !bTruncated; ++Arg)
+                {
+                    uint8 ArgType = 0;
+                    Read(&ArgType, sizeof(ArgType));
+                    switch (static_cast<ELuaRecordedArg>(ArgType))
+                    {
+                    case ELuaRecordedArg::False:
+                    case ELuaRecordedArg::True:
+                        lua_pushboolean(L, ArgType == static_cast<uint8>(ELuaRecordedArg::True));
+                        break;
+                    case ELuaRecordedArg::Integer:
+                    {
+                        int64 Value = 0;
+                        Read(&Value, sizeof(Value));
+                        const int64* SpanId = Call == static_cast<uint8>(ELuaRecordedCall::AsyncSpanEnd) ? SpanIds.Find(Value) : nullptr;
+                        lua_pushinteger(L, SpanId ? *SpanId : Value);
+                        break;
+                    }
+                    case ELuaRecordedArg::Number:
+                    {
+                        double Value = 0.0;
+                        Read(&Value, sizeof(Value));
+                        lua_pushnumber(L, Value);
+                        break;
+                    }
+                    case ELuaRecordedArg::String:
+                    {
+                        uint32 Id = 0;
+                        Read(&Id, sizeof(Id));
+                        if (Strings.IsValidIndex(Id))
+                        {
+                            lua_pushlstring(L, reinterpret_cast<const char*>(Data.GetData() + Strings[Id].Key), Strings[Id].Value);
+                        }
+                        else
+                        {
+                            lua_pushnil(L);
+                        }
+                        break;
+                    }
+                    case ELuaRecordedArg::Handle:
+                    {
+                        uint32 Id = 0;
+                        Read(&Id, sizeof(Id));
+                        if (!HandleNames.IsValidIndex(Id) || !Strings.IsValidIndex(HandleNames[Id]))
+                        {
+                            lua_pushnil(L);
+                            break;
+                        }
+                        const TPair<int32, uint32>& Name = Strings[HandleNames[Id]];
+                        if (!ResolvedHandles[Id] && Binding.HandleType != ELuaStatType::Count)
+                        {
+                            const FUTF8ToTCHAR StatName(reinterpret_cast<const char*>(Data.GetData() + Name.Key), Name.Value);
+                            ResolvedHandles[Id] = ResolveLuaStat(Binding.HandleType, FName(*FString(StatName.Length(), StatName.Get())));
+                        }
+                        if (ResolvedHandles[Id])
+                        {
+                            lua_pushlightuserdata(L, const_cast<TStatIdData*>(ResolvedHandles[Id]));
+                        }
+                        else
+                        {
+                            lua_pushlstring(L, reinterpret_cast<const char*>(Data.GetData() + Name.Key), Name.Value);
+                        }
+                        break;
+                    }
+                    case ELuaRecordedArg::Object:
+                    {
+                        // Table and function keys only count by identity: each recorded identity replays as a table
+                        // of its own. Light userdata would be taken for a stat handle by the bindings.
+                        uint64 Identity = 0;
+                        Read(&Identity, sizeof(Identity));
+                        lua_pushvalue(ReplayState, ObjectsIndex);
+                        lua_xmove(ReplayState, L, 1);
+                        if (lua_rawgeti(L, -1, static_cast<lua_Integer>(Identity)) == LUA_TNIL)
+                        {
+                            lua_pop(L, 1);
+                            lua_newtable(L);
+                            lua_pushvalue(L, -1);
+                            lua_rawseti(L, -3, static_cast<lua_Integer>(Identity));
+                        }
+                        lua_remove(L, -2);
+                        break;
+                    }
+                    default:
+                        lua_pushnil(L);
+                        break;
+                    }
+                }
+                const uint64 CallStart = FPlatformTime::Cycles64();
+                Binding.Function(L);
+                Latencies[Call].Add(FPlatformTime::Cycles64() - CallStart);
+                if (Call == static_cast<uint8>(ELuaRecordedCall::AsyncSpanBegin))
+                {
+                    LastSpanId = lua_isinteger(L, -1) ? lua_tointeger(L, -1) : 0;
+                }
+                lua_settop(L, 0);
+            }
+            else
+            {
+                bTruncated = true;
+            }
+        }
+    }
+    const double Seconds = FPlatformTime::Seconds() - StartSeconds;
+    // A recording started inside a scope ends with Stops of scopes it never saw start, and the other way round.
+    while (StopLuaCycleCounter())
+    {
+    }
+    lua_settop(ReplayState, 0);
+
+    const double NanosecondsPerCycle = FPlatformTime::GetSecondsPerCycle64() * 1e9;
+    uint64 Calls = 0;
+    uint64 Cycles = 0;
+    UE_LOG(LogLuaStats, Log, TEXT("%-30s %12s %10s %10s %10s %10s"), TEXT("Call"), TEXT("Calls"), TEXT("Mean ns"), TEXT("P50 ns"), TEXT("P99 ns"), TEXT("Max ns"));
+    auto LogLatency = [NanosecondsPerCycle](const TCHAR* Name, const FLuaCallLatency& Latency)
+    {
+        UE_LOG(LogLuaStats, Log, TEXT("%-30s %12llu %10.1f %10.1f %10.1f %10.1f"), Name, Latency.Calls, Latency.Cycles * NanosecondsPerCycle / Latency.Calls,
+            Latency.GetPercentile(0.5) * NanosecondsPerCycle, Latency.GetPercentile(0.99) * NanosecondsPerCycle, Latency.MaxCycles * NanosecondsPerCycle);
+    };
+    for (int32 Call = 0; Call < static_cast<int32>(ELuaRecordedCall::Count); ++Call)
+    {
+        if (Latencies[Call].Calls > 0)
+        {
+            LogLatency(LuaRecordedBindings[Call].Name, Latencies[Call]);
+            Calls += Latencies[Call].Calls;
+            Cycles += Latencies[Call].Cycles;
+        }
+    }
+    if (FrameLatency.Calls > 0)
+    {
+        LogLatency(TEXT("Frame"), FrameLatency);
+    }
+    UE_LOG(LogLuaStats, Log, TEXT("Replayed %llu calls on %d threads, %d times in %.3f s: %.0f calls/s in the bindings, %.0f calls/s overall%s"),
+        Calls, Threads.Num(), Repeat, Seconds, Cycles > 0 ? Calls / (Cycles * NanosecondsPerCycle * 1e-9) : 0.0,
+        Seconds > 0.0 ? Calls / Seconds : 0.0, bTruncated ? TEXT(", stopped at a truncated record") : TEXT(""));
+    return true;
+}
+
+static FAutoConsoleCommand GLuaStatsRecordCallsCommand(
+    TEXT("LuaStats.RecordCalls"),
+    TEXT("Starts recording every call into the Lua stat bindings for LuaStats.ReplayCalls, or stops with \"stop\". Optional argument: file path."),
+    FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+    {
+        if (Args.Num() > 0 && Args[0] == TEXT("stop"))
+        {
+            GLuaCallRecorder.Stop();
+            return;
+        }
+        const FString Path = Args.Num() > 0 ? Args[0]
+            : FPaths::ProjectSavedDir() / TEXT("LuaStats") / FString::Printf(TEXT("Calls-%s.lsrc"), *FDateTime::Now().ToString());
+        if (!GLuaCallRecorder.Start(Path))
+        {
+            UE_LOG(LogLuaStats, Warning, TEXT("Failed to open Lua stat call recording %s"), *Path);
+        }
+    }));
+
+static FAutoConsoleCommand GLuaStatsReplayCallsCommand(
+    TEXT("LuaStats.ReplayCalls"),
+    TEXT("Replays a LuaStats.RecordCalls recording through the Lua stat bindings as fast as possible and logs per-call latency and throughput. Arguments: file path, optional repeat count."),
+    FConsoleCommandWithArgsDelegate::CreateLambda([](const TArray<FString>& Args)
+    {
+        if (Args.Num() == 0)
+        {
+            return;
+        }
+        const int32 Repeat = Args.Num() > 1 ? FMath::Max(FCString::Atoi(*Args[1]), 1) : 1;
+        if (!ReplayLuaCalls(Args[0], Repeat))
+        {
+            UE_LOG(LogLuaStats, Warning, TEXT("Failed to replay Lua stat calls from %s"), *Args[0]);
+        }
+    }));
@@ -0,0 +1,157 @@
+// LuaStatsRecorder.h
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Stats/Stats2.h"
+#include "lua.hpp"
+
+enum class ELuaRecordedCall : uint8
+{
+    CycleCounterCreate,
+    CycleCounterStart,
+    CycleCounterStop,
+    CycleCounterSet,
+    CycleCounterSetSampleRate,
+    SimpleSecondsCreate,
+    SimpleSecondsStart,
+    SimpleSecondsStop,
+    SimpleSecondsSetSampleRate,
+    Int64Create,
+    Int64Add,
+    Int64Subtract,
+    Int64Set,
+    DoubleCreate,
+    DoubleAdd,
+    DoubleSubtract,
+    DoubleSet,
+    FNameSet,
+    MemoryCreate,
+    MemoryAdd,
+    MemorySubtract,
+    MemorySet,
+    AsyncSpanCreate,
+    AsyncSpanBegin,
+    AsyncSpanEnd,
+    Count
+};
+
+enum class ELuaRecordedArg : uint8
+{
+    Nil,
+    False,
+    True,
+    Integer,
+    Number,
+    String,
+    Handle,
+    Object
+};
+
+static constexpr uint32 LuaCallRecordingVersion = 1;
+static constexpr int32 LuaCallRecordingMaxArgs = 3;
+static constexpr uint32 LuaCallRecordingNoHandle = MAX_uint32;
+
+// Records every call into the stat binding tables for LuaStats.ReplayCalls. The file starts with "LSRC" and a
+// uint32 version, then one-byte tagged records, little endian:
+//   'S' uint32 id, uint32 length, bytes: a string argument, the first time it is passed
+//   'H' uint32 id, uint32 string id: a stat handle, the first time it is passed, and the stat's name
+//   'T' uint32 thread: the calls that follow come from another Lua thread, numbered in order of appearance
+//   'C' uint8 ELuaRecordedCall, uint8 argument count, then per argument a uint8 ELuaRecordedArg and its value:
+//       int64, double, uint32 string or handle id, or the uint64 identity of a table or function key
+//   'R' int64: the id AsyncSpan.Begin returned, so that replayed Ends find their span
+//   'F': end of frame
+class FLuaCallRecorder
+{
+public:
+    bool IsRecording() const
+    {
+        return Archive.IsValid();
+    }
+
+    bool Start(const FString& Path);
+    void Stop();
+
+    void Record(lua_State* L, ELuaRecordedCall Call)
+    {
+        if (Archive)
+        {
+            RecordCall(L, Call);
+        }
+    }
+
+    void RecordResult(int64 Value)
+    {
+        if (Archive)
+        {
+            Buffer.Add('R');
+            Append(Value);
+        }
+    }
+
+private:
+    void RecordCall(lua_State* L, ELuaRecordedCall Call);
+    uint32 GetStringId(const char* String, uint32 Length);
+    uint32 GetHandleId(TStatIdData const* StatIdPtr);
+    void EndFrame();
+
+    template <typename T>
+    void Append(T Value)
+    {
+        Buffer.Append(reinterpret_cast<const uint8*>(&Value), sizeof(Value));
+    }
+
+    TUniquePtr<FArchive> Archive;
+    TArray<uint8> Buffer;
+    // Strings by a hash of their text: the same name passed from different strings is one id.
+    TMap<uint64, uint32> StringIds;
+    TMap<TStatIdData const*, uint32> HandleIds;
+    TMap<lua_State*, uint32> ThreadIds;
+    lua_State* CurrentThread = nullptr;
+    uint64 Calls = 0;
+    bool bFrameRegistered = false;
+};
+
+extern FLuaCallRecorder GLuaCallRecorder;
+
+// Latencies in power-of-two buckets of cycles; percentiles are bucket upper bounds.
+struct FLuaCallLatency
+{
+    uint64 Calls = 0;
+    uint64 Cycles = 0;
+    uint64 MaxCycles = 0;
+    uint64 Buckets[64] = {};
+
+    void Add(uint64 Elapsed)
+    {
+        ++Calls;
+        Cycles += Elapsed;
+        MaxCycles = FMath::Max(MaxCycles, Elapsed);
+        ++Buckets[Elapsed > 0 ? FMath::FloorLog2_64(Elapsed) : 0];
+    }
+
+    void Merge(const FLuaCallLatency& Other)
+    {
+        Calls += Other.Calls;
+        Cycles += Other.Cycles;
+        MaxCycles = FMath::Max(MaxCycles, Other.MaxCycles);
+        for (int32 Bucket = 0; Bucket < static_cast<int32>(UE_ARRAY_COUNT(Buckets)); ++Bucket)
+        {
+            Buckets[Bucket] += Other.Buckets[Bucket];
+        }
+    }
+
+    uint64 GetPercentile(double Fraction) const
+    {
+        const uint64 Target = FMath::Max<uint64>(static_cast<uint64>(Calls * Fraction), 1);
+        uint64 Seen = 0;
+        for (int32 Bucket = 0; Bucket < static_cast<int32>(UE_ARRAY_COUNT(Buckets)); ++Bucket)
+        {
+            Seen += Buckets[Bucket];
+            if (Seen >= Target)
+            {
+                return FMath::Min<uint64>((2ull << Bucket) - 1, MaxCycles);
+            }
+        }
+        return MaxCycles;
+    }
+};
@@ -0,0 +1,505 @@
+// LuaStatsRewriter.cpp
+#include "LuaStatsRewriter.h"
+#include "lua.hpp"
+
+enum class ELuaTokenKind : uint8
+{
+    Name,
+    Number,
+    String,
+    Symbol,
+};
+
+struct FLuaToken
+{
+    int32 Start;
+    int32 End;
+    ELuaTokenKind Kind;
+};
+
+// Level of the long bracket ("[[" or "[==[") opening at Pos, or -1 when Pos does not open one.
+static int32 GetLuaLongBracketLevel(const ANSICHAR* Source, int32 Length, int32 Pos)
+{
+    int32 End = Pos + 1;
+    while (End < Length && Source[End] == '=')
+    {
+        ++End;
+    }
+    return End < Length && Source[End] == '[' ? End - Pos - 1 : -1;
+}
+
+// Position after the closing long bracket of the given level, searching from Pos.
+static int32 SkipLuaLongBracket(const ANSICHAR* Source, int32 Length, int32 Pos, int32 Level)
+{
+    for (; Pos < Length; ++Pos)
+    {
+        if (Source[Pos] != ']')
+        {
+            continue;
+        }
+        int32 End = Pos + 1;
+        while (End < Length && Source[End] == '=')
+        {
+            ++End;
+        }
+        if (End < Length && Source[End] == ']' && End - Pos - 1 == Level)
+        {
+            return End + 1;
+        }
+    }
+    return Length;
+}
+
+// Splits a chunk into the tokens the rewriter needs to tell calls from strings, comments and field accesses.
+// Malformed source tokenizes to something; the rewritten chunk then fails to load and the original is used.
+static void TokenizeLuaChunk(const ANSICHAR* Source, int32 Length, TArray<FLuaToken>& OutTokens)
+{
+    static const ANSICHAR* const LongSymbols[] = { "...", "..", "::", "==", "~=", "<=", ">=", "//", "<<", ">>" };
+    int32 Pos = 0;
+    // The loader skips a first line starting with '#'.
+    if (Length > 0 && Source[0] == '#')
+    {
+        while (Pos < Length && Source[Pos] != '\n')
+        {
+            ++Pos;
+        }
+    }
+    while (Pos < Length)
+    {
+        const ANSICHAR Char = Source[Pos];
+        const ANSICHAR Next = Pos + 1 < Length ? Source[Pos + 1] : '\0';
+        const int32 Start = Pos;
+        ELuaTokenKind Kind = ELuaTokenKind::Symbol;
+        if (Char == '-' && Next == '-')
+        {
+            const int32 Level = Pos + 2 < Length && Source[Pos + 2] == '[' ? GetLuaLongBracketLevel(Source, Length, Pos + 2) : -1;
+            if (Level >= 0)
+            {
+                Pos = SkipLuaLongBracket(Source, Length, Pos + Level + 4, Level);
+            }
+            while (Level < 0 && Pos < Length && Source[Pos] != '\n')
+            {
+                ++Pos;
+            }
+            continue;
+        }
+        if (FCharAnsi::IsWhitespace(Char))
+        {
+            ++Pos;
+            continue;
+        }
+        if (FCharAnsi::IsAlpha(Char) || Char == '_')
+        {
+            while (Pos < Length && (FCharAnsi::IsAlnum(Source[Pos]) || Source[Pos] == '_'))
+            {
+                ++Pos;
+            }
+            Kind = ELuaTokenKind::Name;
+        }
+        else if (FCharAnsi::IsDigit(Char) || (Char == '.' && FCharAnsi::IsDigit(Next)))
+        {
+            const bool bHex = Char == '0' && (Next == 'x' || Next == 'X');
+            const ANSICHAR Exponent = bHex ? 'p' : 'e';
+            for (Pos += bHex ? 2 : 1; Pos < Length; ++Pos)
+            {
+                const ANSICHAR Digit = Source[Pos];
+                if ((Digit == '+' || Digit == '-') && FCharAnsi::ToLower(Source[Pos - 1]) == Exponent)
+                {
+                    continue;
+                }
+                if (!FCharAnsi::IsAlnum(Digit) && Digit != '.')
+                {
+                    break;
+                }
+            }
+            Kind = ELuaTokenKind::Number;
+        }
+        else if (Char == '"' || Char == '\'')
+        {
+            for (++Pos; Pos < Length && Source[Pos] != Char; ++Pos)
+            {
+                if (Source[Pos] == '\\')
+                {
+                    ++Pos;
+                }
+            }
+            Pos = FMath::Min(Pos + 1, Length);
+            Kind = ELuaTokenKind::String;
+        }
+        else if (Char == '[' && GetLuaLongBracketLevel(Source, Length, Pos) >= 0)
+        {
+            const int32 Level = GetLuaLongBracketLevel(Source, Length, Pos);
+            Pos = SkipLuaLongBracket(Source, Length, Pos + Level + 2, Level);
+            Kind = ELuaTokenKind::String;
+        }
+        else
+        {
+            Pos = Start + 1;
+            for (const ANSICHAR* Symbol : LongSymbols)
+            {
+                const int32 SymbolLength = FCStringAnsi::Strlen(Symbol);
+                if (Start + SymbolLength <= Length && FCStringAnsi::Strncmp(Source + Start, Symbol, SymbolLength) == 0)
+                {
+                    Pos = Start + SymbolLength;
+                    break;
+                }
+            }
+        }
+        OutTokens.Add({ Start, Pos, Kind });
+    }
+}
+
+static bool LuaTokenIs(const ANSICHAR* Source, const FLuaToken& Token, const ANSICHAR* Text)
+{
+    const int32 TextLength = FCStringAnsi::Strlen(Text);
+    return Token.End - Token.Start == TextLength && FCStringAnsi::Strncmp(Source + Token.Start, Text, TextLength) == 0;
+}
+
+template<int32 N>
+static bool LuaTokenIsAny(const ANSICHAR* Source, const FLuaToken& Token, const ANSICHAR* const (&Texts)[N])
+{
+    for (const ANSICHAR* Text : Texts)
+    {
+        if (LuaTokenIs(Source, Token, Text))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+struct FLuaStatLibrary
+{
+    const ANSICHAR* Name;
+    // Type LuaStats.Resolve looks literal stat names of the library up as; nullptr when they are left as names.
+    const ANSICHAR* TypeName;
+    bool bStrippable;
+};
+
+static const FLuaStatLibrary LuaStatLibraries[] =
+{
+    { "FCycleCounter", "CycleCounter", true },
+    { "FSimpleSeconds", "SimpleSeconds", true },
+    { "FInt64Stat", "Int64", true },
+    { "FDoubleStat", "Double", true },
+    { "FMemoryStat", "Memory", true },
+    { "FNameStat", nullptr, true },
+    // Span ids flow from Begin to End, so removing either half would leave the other counting expiries.
+    { "FAsyncSpan", "AsyncSpan", false },
+};
+
+static constexpr int32 LuaStatLibraryCycleCounter = 0;
+
+// Methods taking the stat as their first argument, by name or by handle.
+static const ANSICHAR* const LuaStatHandleMethods[] = { "Start", "Stop", "Set", "SetSampleRate", "Add", "Subtract", "Begin" };
+
+// Chunks share Lua's limit of 200 locals per function with the prologue, so it stays well below that.
+static constexpr int32 LuaRewriteMaxLocals = 60;
+
+static int32 FindLuaStatLibrary(const ANSICHAR* Source, const FLuaToken& Token)
+{
+    if (Token.Kind == ELuaTokenKind::Name)
+    {
+        for (int32 Index = 0; Index < static_cast<int32>(UE_ARRAY_COUNT(LuaStatLibraries)); ++Index)
+        {
+            if (LuaTokenIs(Source, Token, LuaStatLibraries[Index].Name))
+            {
+                return Index;
+            }
+        }
+    }
+    return INDEX_NONE;
+}
+
+// Whether a statement can start at token Index, i.e. everything before it ends a statement or opens a block.
+static bool IsLuaStatementBoundary(const ANSICHAR* Source, const TArray<FLuaToken>& Tokens, int32 Index)
+{
+    static const ANSICHAR* const ClosingSymbols[] = { ";", ")", "]", "}", "::" };
+    static const ANSICHAR* const BlockKeywords[] = { "break", "do", "else", "end", "false", "nil", "repeat", "then", "true" };
+    static const ANSICHAR* const OpenKeywords[] = { "and", "elseif", "for", "function", "goto", "if", "in", "local", "not", "or", "return", "until", "while" };
+    if (Index == 0)
+    {
+        return true;
+    }
+    const FLuaToken& Previous = Tokens[Index - 1];
+    switch (Previous.Kind)
+    {
+    case ELuaTokenKind::Number:
+    case ELuaTokenKind::String:
+        return true;
+    case ELuaTokenKind::Symbol:
+        return LuaTokenIsAny(Source, Previous, ClosingSymbols);
+    default:
+        return LuaTokenIsAny(Source, Previous, BlockKeywords) || !LuaTokenIsAny(Source, Previous, OpenKeywords);
+    }
+}
+
+// Index of the token closing the parenthesis at token Open, or INDEX_NONE. bOutPure is cleared when the
+// arguments call or define a function, whose side effects would be lost with the call.
+static int32 FindLuaClosingParenthesis(const ANSICHAR* Source, const TArray<FLuaToken>& Tokens, int32 Open, bool& bOutPure)
+{
+    static const ANSICHAR* const Opening[] = { "(", "[", "{" };
+    static const ANSICHAR* const Closing[] = { ")", "]", "}" };
+    int32 Depth = 0;
+    for (int32 Index = Open; Index < Tokens.Num(); ++Index)
+    {
+        const FLuaToken& Token = Tokens[Index];
+        if (LuaTokenIsAny(Source, Token, Opening))
+        {
+            bOutPure &= Index == Open || !LuaTokenIs(Source, Token, "(");
+            ++Depth;
+        }
+        else if (LuaTokenIsAny(Source, Token, Closing) && --Depth == 0)
+        {
+            return Index;
+        }
+        else if (LuaTokenIs(Source, Token, "function"))
+        {
+            bOutPure = false;
+        }
+    }
+    return INDEX_NONE;
+}
+
+// A string literal without escapes, so the same text names the stat wherever it is pasted.
+static bool IsPlainLuaString(const ANSICHAR* Source, const FLuaToken& Token)
+{
+    if (Token.Kind != ELuaTokenKind::String || Token.End - Token.Start < 2 || (Source[Token.Start] != '"' && Source[Token.Start] != '\''))
+    {
+        return false;
+    }
+    for (int32 Pos = Token.Start + 1; Pos < Token.End - 1; ++Pos)
+    {
+        if (Source[Pos] == '\\' || Source[Pos] == '\n')
+        {
+            return false;
+        }
+    }
+    return Source[Token.End - 1] == Source[Token.Start];
+}
+
+static void AppendLuaSource(TArray<ANSICHAR>& Out, const ANSICHAR* Text, int32 Length = -1)
+{
+    Out.Append(Text, Length < 0 ? FCStringAnsi::Strlen(Text) : Length);
+}
+
+// Replaces source that is dropped from a chunk by a space plus its line breaks, so line numbers stay put.
+static void AppendLuaLineBreaks(TArray<ANSICHAR>& Out, const ANSICHAR* Text, int32 Length)
+{
+    Out.Add(' ');
+    for (int32 Pos = 0; Pos < Length; ++Pos)
+    {
+        if (Text[Pos] == '\n')
+        {
+            Out.Add('\n');
+        }
+    }
+}
+
+struct FLuaRewriteLocal
+{
+    int32 Library;
+    // Method name of a function local, quoted stat name of a handle local.
+    FLuaToken Token;
+    bool bHandle;
+};
+
+static int32 FindOrAddLuaRewriteLocal(TArray<FLuaRewriteLocal>& Locals, const ANSICHAR* Source, int32 Library, const FLuaToken& Token, bool bHandle)
+{
+    const int32 Length = Token.End - Token.Start;
+    for (int32 Index = 0; Index < Locals.Num(); ++Index)
+    {
+        const FLuaRewriteLocal& Local = Locals[Index];
+        if (Local.Library == Library && Local.bHandle == bHandle && Local.Token.End - Local.Token.Start == Length
+            && FCStringAnsi::Strncmp(Source + Local.Token.Start, Source + Token.Start, Length) == 0)
+        {
+            return Index;
+        }
+    }
+    return Locals.Num() < LuaRewriteMaxLocals ? Locals.Add({ Library, Token, bHandle }) : INDEX_NONE;
+}
+
+static void AppendLuaRewriteLocalName(TArray<ANSICHAR>& Out, int32 Index, bool bHandle)
+{
+    ANSICHAR Name[32];
+    FCStringAnsi::Snprintf(Name, sizeof(Name), bHandle ? "__LuaStatsH%d" : "__LuaStatsF%d", Index);
+    AppendLuaSource(Out, Name);
+}
+
+int32 RewriteLuaChunk(const ANSICHAR* Source, int32 Length, ELuaChunkRewrite Mode, TArray<ANSICHAR>& OutSource)
+{
+    if (Mode == ELuaChunkRewrite::None || Length <= 0 || Source[0] == LUA_SIGNATURE[0])
+    {
+        return 0;
+    }
+    TArray<FLuaToken> Tokens;
+    TokenizeLuaChunk(Source, Length, Tokens);
+
+    // A chunk that declares or assigns a library name, or a method of one, does not mean ours by it.
+    uint32 ShadowedLibraries = 0;
+    for (int32 Index = 0; Index < Tokens.Num(); ++Index)
+    {
+        const int32 Library = FindLuaStatLibrary(Source, Tokens[Index]);
+        if (Library == INDEX_NONE)
+        {
+            continue;
+        }
+        const bool bDeclared = Index > 0 && (LuaTokenIs(Source, Tokens[Index - 1], "local") || LuaTokenIs(Source, Tokens[Index - 1], "for")
+            || LuaTokenIs(Source, Tokens[Index - 1], "function"));
+        const bool bAssigned = (Index + 1 < Tokens.Num() && LuaTokenIs(Source, Tokens[Index + 1], "="))
+            || (Index + 3 < Tokens.Num() && LuaTokenIs(Source, Tokens[Index + 1], ".") && LuaTokenIs(Source, Tokens[Index + 3], "="));
+        if (bDeclared || bAssigned)
+        {
+            ShadowedLibraries |= 1u << Library;
+        }
+    }
+
+    struct FSite
+    {
+        int32 First;
+        int32 Close;
+        int32 Library;
+        bool bStrippable;
+    };
+    static const ANSICHAR* const CallSuffixes[] = { ".", ":", "(", "[", "{" };
+    TArray<FSite> Sites;
+    bool bKeepCycleCounters = false;
+    for (int32 Index = 0; Index + 3 < Tokens.Num(); ++Index)
+    {
+        const int32 Library = FindLuaStatLibrary(Source, Tokens[Index]);
+        if (Library == INDEX_NONE || (ShadowedLibraries & (1u << Library)) != 0 || !LuaTokenIs(Source, Tokens[Index + 1], ".")
+            || Tokens[Index + 2].Kind != ELuaTokenKind::Name || !LuaTokenIs(Source, Tokens[Index + 3], "("))
+        {
+            continue;
+        }
+        if (Index > 0 && (LuaTokenIs(Source, Tokens[Index - 1], ".") || LuaTokenIs(Source, Tokens[Index - 1], ":")))
+        {
+            continue;
+        }
+        bool bPure = true;
+        const int32 Close = FindLuaClosingParenthesis(Source, Tokens, Index + 3, bPure);
+        if (Close == INDEX_NONE)
+        {
+            break;
+        }
+        FSite Site = { Index, Close, Library, false };
+        if (Mode == ELuaChunkRewrite::Strip)
+        {
+            const FLuaToken& Method = Tokens[Index + 2];
+            const bool bValueUsed = Close + 1 < Tokens.Num() && (Tokens[Close + 1].Kind == ELuaTokenKind::String || LuaTokenIsAny(Source, Tokens[Close + 1], CallSuffixes));
+            Site.bStrippable = LuaStatLibraries[Library].bStrippable && bPure && !bValueUsed && !LuaTokenIs(Source, Method, "Create")
+                && IsLuaStatementBoundary(Source, Tokens, Index);
+            // Stop pops whatever Start pushed last, so either every Start and Stop of a chunk goes or none does.
+            if (!Site.bStrippable && Library == LuaStatLibraryCycleCounter && (LuaTokenIs(Source, Method, "Start") || LuaTokenIs(Source, Method, "Stop")))
+            {
+                bKeepCycleCounters = true;
+            }
+        }
+        Sites.Add(Site);
+    }
+
+    TArray<FLuaRewriteLocal> Locals;
+    TArray<ANSICHAR> Body;
+    int32 Copied = 0;
+    int32 Rewritten = 0;
+    for (const FSite& Site : Sites)
+    {
+        const FLuaToken& First = Tokens[Site.First];
+        int32 End = Tokens[Site.Close].End;
+        if (Mode == ELuaChunkRewrite::Strip)
+        {
+            if (!Site.bStrippable || (bKeepCycleCounters && Site.Library == LuaStatLibraryCycleCounter))
+            {
+                continue;
+            }
+            AppendLuaSource(Body, Source + Copied, First.Start - Copied);
+            AppendLuaLineBreaks(Body, Source + First.Start, End - First.Start);
+        }
+        else
+        {
+            const int32 Function = FindOrAddLuaRewriteLocal(Locals, Source, Site.Library, Tokens[Site.First + 2], false);
+            if (Function == INDEX_NONE)
+            {
+                continue;
+            }
+            End = Tokens[Site.First + 3].End;
+            int32 Handle = INDEX_NONE;
+            const FLuaToken& Argument = Tokens[Site.First + 4];
+            if (LuaStatLibraries[Site.Library].TypeName && LuaTokenIsAny(Source, Tokens[Site.First + 2], LuaStatHandleMethods)
+                && Site.First + 5 <= Site.Close && IsPlainLuaString(Source, Argument)
+                && (LuaTokenIs(Source, Tokens[Site.First + 5], ",") || LuaTokenIs(Source, Tokens[Site.First + 5], ")")))
+            {
+                Handle = FindOrAddLuaRewriteLocal(Locals, Source, Site.Library, Argument, true);
+            }
+            AppendLuaSource(Body, Source + Copied, First.Start - Copied);
+            AppendLuaRewriteLocalName(Body, Function, false);
+            Body.Add('(');
+            if (Handle != INDEX_NONE)
+            {
+                AppendLuaRewriteLocalName(Body, Handle, true);
+                End = Argument.End;
+            }
+            // Calls spread over several lines keep their line breaks, as in Strip.
+            for (int32 Pos = First.Start; Pos < End; ++Pos)
+            {
+                if (Source[Pos] == '\n')
+                {
+                    Body.Add('\n');
+                }
+            }
+        }
+        Copied = End;
+        ++Rewritten;
+    }
+    if (Rewritten == 0)
+    {
+        return 0;
+    }
+    AppendLuaSource(Body, Source + Copied, Length - Copied);
+
+    // The prologue shares the first line with the chunk's own code, or follows the line the loader skips.
+    int32 PrologueAt = 0;
+    if (Source[0] == '#')
+    {
+        while (PrologueAt < Length && Source[PrologueAt++] != '\n')
+        {
+        }
+    }
+    OutSource.Reset();
+    AppendLuaSource(OutSource, Body.GetData(), PrologueAt);
+    if (Locals.Num() > 0)
+    {
+        AppendLuaSource(OutSource, "local ");
+        for (int32 Index = 0; Index < Locals.Num(); ++Index)
+        {
+            AppendLuaSource(OutSource, Index > 0 ? ", " : "");
+            AppendLuaRewriteLocalName(OutSource, Index, Locals[Index].bHandle);
+        }
+        AppendLuaSource(OutSource, " = ");
+        for (int32 Index = 0; Index < Locals.Num(); ++Index)
+        {
+            const FLuaRewriteLocal& Local = Locals[Index];
+            const FLuaStatLibrary& Library = LuaStatLibraries[Local.Library];
+            const int32 TokenLength = Local.Token.End - Local.Token.Start;
+            AppendLuaSource(OutSource, Index > 0 ? ", " : "");
+            if (Local.bHandle)
+            {
+                AppendLuaSource(OutSource, "LuaStats.Resolve(\"");
+                AppendLuaSource(OutSource, Library.TypeName);
+                AppendLuaSource(OutSource, "\", ");
+                AppendLuaSource(OutSource, Source + Local.Token.Start, TokenLength);
+                AppendLuaSource(OutSource, ") or ");
+                AppendLuaSource(OutSource, Source + Local.Token.Start, TokenLength);
+            }
+            else
+            {
+                AppendLuaSource(OutSource, Library.Name);
+                OutSource.Add('.');
+                AppendLuaSource(OutSource, Source + Local.Token.Start, TokenLength);
+            }
+        }
+        AppendLuaSource(OutSource, "; ");
+    }
+    AppendLuaSource(OutSource, Body.GetData() + PrologueAt, Body.Num() - PrologueAt);
+    return Rewritten;
+}
@@ -0,0 +1,20 @@
+// LuaStatsRewriter.h
+#pragma once
+
+#include "CoreMinimal.h"
+
+// Load-time rewriting of stat calls, see LuaStats.RewriteChunks and LuaStats.InstallRewriter.
+enum class ELuaChunkRewrite : int32
+{
+    None,
+    Resolve,
+    Strip,
+};
+
+// Rewrites the stat calls of a source chunk. Resolve binds every FXxxStat.Method to a local once per chunk
+// and replaces literal stat names by handles looked up when the chunk loads, falling back to the name for
+// stats that do not exist yet. Strip removes the calls that are whole statements and have no side effects
+// in their arguments. Replaced text keeps its line breaks and the prologue of locals goes on the first line,
+// so error messages and line profiles keep their line numbers. Returns the number of calls rewritten;
+// OutSource is only filled when there are any.
+int32 RewriteLuaChunk(const ANSICHAR* Source, int32 Length, ELuaChunkRewrite Mode, TArray<ANSICHAR>& OutSource);
@@ -0,0 +1,141 @@
+// LuaStatsSharedMemory.h
+//
+// Layout of the shared-memory segment FLuaStats publishes per-frame stat values into, shared with the
+// standalone reader in Tools/LuaStatsMonitor. Plain C++ so both sides can include it.
+//
+// The segment is a header, then fixed-size stat names, stat types and two value buffers (one double per
+// stat). The writer fills the buffer readers are not pointed at, then flips ActiveBuffer inside a seqlock.
+// Readers copy the active buffer and retry if Sequence moved meanwhile; they never block the writer.
+// Stats are append-only: the name and type of an index below NumStats never change.
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+namespace LuaStatsSharedMemory
+{
+    static constexpr uint32_t Magic = 0x4d53534c;
+    static constexpr uint32_t Version = 1;
+    static constexpr uint32_t NameSize = 96;
+
+    // Same order as ELuaStatType. Cycle counter values are raw cycles, see FHeader::MillisecondsPerCycle.
+    static const char* const TypeNames[] =
+    {
+        "CycleCounter",
+        "SimpleSeconds",
+        "Int64",
+        "Int64Accumulator",
+        "Double",
+        "DoubleAccumulator",
+        "Memory",
+        "AsyncSpan",
+    };
+
+    struct FHeader
+    {
+        uint32_t Magic;
+        uint32_t Version;
+        uint32_t Capacity;
+        uint32_t Reserved;
+        uint64_t NamesOffset;
+        uint64_t TypesOffset;
+        uint64_t ValuesOffset[2];
+        double MillisecondsPerCycle;
+        std::atomic<uint64_t> Sequence;
+        std::atomic<uint32_t> NumStats;
+        std::atomic<uint32_t> ActiveBuffer;
+        std::atomic<uint64_t> Frame;
+        std::atomic<double> Seconds;
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free && std::atomic<double>::is_always_lock_free,
+        "Shared-memory atomics must be lock free to be shared between processes");
+
+    inline uint64_t AlignUp(uint64_t Value)
+    {
+        return (Value + 63) & ~uint64_t(63);
+    }
+
+    inline uint64_t GetSegmentSize(uint32_t Capacity)
+    {
+        const uint64_t Names = AlignUp(sizeof(FHeader));
+        const uint64_t Types = AlignUp(Names + uint64_t(Capacity) * NameSize);
+        const uint64_t Values = AlignUp(Types + Capacity);
+        return Values + 2 * AlignUp(uint64_t(Capacity) * sizeof(double));
+    }
+
+    inline void InitHeader(void* Segment, uint32_t Capacity, double MillisecondsPerCycle)
+    {
+        FHeader* Header = new (Segment) FHeader();
+        Header->Version = Version;
+        Header->Capacity = Capacity;
+        Header->NamesOffset = AlignUp(sizeof(FHeader));
+        Header->TypesOffset = AlignUp(Header->NamesOffset + uint64_t(Capacity) * NameSize);
+        Header->ValuesOffset[0] = AlignUp(Header->TypesOffset + Capacity);
+        Header->ValuesOffset[1] = Header->ValuesOffset[0] + AlignUp(uint64_t(Capacity) * sizeof(double));
+        Header->MillisecondsPerCycle = MillisecondsPerCycle;
+        Header->Sequence.store(0, std::memory_order_relaxed);
+        Header->NumStats.store(0, std::memory_order_relaxed);
+        Header->ActiveBuffer.store(0, std::memory_order_relaxed);
+        Header->Frame.store(0, std::memory_order_relaxed);
+        Header->Seconds.store(0.0, std::memory_order_relaxed);
+        // Written last: a reader that sees the magic sees an initialised header.
+        std::atomic_thread_fence(std::memory_order_release);
+        Header->Magic = Magic;
+    }
+
+    inline char* GetName(FHeader* Header, uint32_t Index)
+    {
+        return reinterpret_cast<char*>(Header) + Header->NamesOffset + uint64_t(Index) * NameSize;
+    }
+
+    inline uint8_t* GetTypes(FHeader* Header)
+    {
+        return reinterpret_cast<uint8_t*>(Header) + Header->TypesOffset;
+    }
+
+    inline double* GetValues(FHeader* Header, uint32_t Buffer)
+    {
+        return reinterpret_cast<double*>(reinterpret_cast<char*>(Header) + Header->ValuesOffset[Buffer]);
+    }
+
+    // Writer side. The names and types of stats below Num are written before. Readers only copy the active
+    // buffer, so the inactive one is written outside the seqlock.
+    inline void PublishValues(FHeader* Header, const double* Values, uint32_t Num, uint64_t Frame, double Seconds)
+    {
+        const uint32_t Buffer = 1 - Header->ActiveBuffer.load(std::memory_order_relaxed);
+        std::memcpy(GetValues(Header, Buffer), Values, Num * sizeof(double));
+
+        const uint64_t Sequence = Header->Sequence.load(std::memory_order_relaxed);
+        Header->Sequence.store(Sequence + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        Header->NumStats.store(Num, std::memory_order_relaxed);
+        Header->ActiveBuffer.store(Buffer, std::memory_order_relaxed);
+        Header->Frame.store(Frame, std::memory_order_relaxed);
+        Header->Seconds.store(Seconds, std::memory_order_relaxed);
+        Header->Sequence.store(Sequence + 2, std::memory_order_release);
+    }
+
+    // Reader side: copies the published values into OutValues, which has room for Capacity of them. Returns
+    // false when a frame was being published meanwhile; the copy is then torn and the caller retries.
+    inline bool TryReadValues(FHeader* Header, double* OutValues, uint32_t& OutNum, uint64_t& OutFrame, double& OutSeconds)
+    {
+        const uint64_t Before = Header->Sequence.load(std::memory_order_acquire);
+        if (Before & 1)
+        {
+            return false;
+        }
+        const uint32_t Num = std::min(Header->NumStats.load(std::memory_order_relaxed), Header->Capacity);
+        const uint32_t Buffer = Header->ActiveBuffer.load(std::memory_order_relaxed) & 1;
+        OutFrame = Header->Frame.load(std::memory_order_relaxed);
+        OutSeconds = Header->Seconds.load(std::memory_order_relaxed);
+        std::memcpy(OutValues, GetValues(Header, Buffer), Num * sizeof(double));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        OutNum = Num;
+        return Header->Sequence.load(std::memory_order_relaxed) == Before;
+    }
+}
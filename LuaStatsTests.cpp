@@ -0,0 +1,638 @@
+// LuaStatsTests.cpp
+//
+// Round trips of what the module writes in formats of its own: the compressed history, .lscf captures, .lsrc
+// call recordings and rewritten chunks, and the sums of rollup parents. Run with Automation RunTests LuaStats. The shared-memory seqlock and
+// the fleet sketch are plain C++ and tested standalone, see Tools/LuaStatsTests.
+#include "CoreMinimal.h"
+#include "HAL/FileManager.h"
+#include "Math/RandomStream.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/Compression.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/MemoryReader.h"
+#include "LuaStats.h"
+#include "LuaStatsColumnar.h"
+#include "LuaStatsHistory.h"
+#include "LuaStatsPrivate.h"
+#include "LuaStatsRecorder.h"
+#include "LuaStatsRewriter.h"
+#include "lua.hpp"
+#include <limits>
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+static bool IsSameBits(double A, double B)
+{
+    return FMemory::Memcmp(&A, &B, sizeof(double)) == 0;
+}
+
+// Sets GFrameCounter for the tests that stamp samples with it, and puts the engine's back when done.
+struct FLuaTestFrameCounter
+{
+    uint64 Saved = GFrameCounter;
+
+    ~FLuaTestFrameCounter()
+    {
+        GFrameCounter = Saved;
+    }
+};
+
+// Values of column Column at sample Sample of the history and columnar tests: a constant, noise, a ramp, an
+// integer counter and the doubles bit-exact codecs get wrong first.
+static double GetLuaTestValue(int32 Column, int32 Sample, FRandomStream& Noise)
+{
+    static const double Special[] = { 0.0, -0.0, std::numeric_limits<double>::infinity(), std::numeric_limits<double>::denorm_min(),
+        std::numeric_limits<double>::quiet_NaN(), -1e300, 1.0 };
+    switch (Column)
+    {
+    case 0:
+        return 3.0;
+    case 1:
+        return Noise.FRandRange(-1000.0f, 1000.0f) / 3.0;
+    case 2:
+        return Sample * 0.5;
+    case 3:
+        return static_cast<double>(Sample / 7);
+    default:
+        return Special[Sample % UE_ARRAY_COUNT(Special)];
+    }
+}
+
+// Frame deltas covering every delta-of-delta bucket of the integer encoding, and a raw 64-bit jump.
+static uint64 GetLuaTestFrameDelta(int32 Sample)
+{
+    static const uint64 Deltas[] = { 1, 1, 1, 2, 1, 70, 1, 300, 1, 3000, 1, 1 };
+    return Sample == 2500 ? uint64(1) << 40 : Deltas[Sample % UE_ARRAY_COUNT(Deltas)];
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLuaStatsHistoryRoundTripTest, "LuaStats.History.RoundTrip",
+    EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FLuaStatsHistoryRoundTripTest::RunTest(const FString& /*Parameters*/)
+{
+    static constexpr int32 NumSamples = 4000;
+    // Column 5 is registered late, so its series starts after the timeline's.
+    static constexpr int32 LateColumnFrom = 1000;
+    FLuaTestFrameCounter FrameCounter;
+
+    TArray<TArray<double>> Expected;
+    TArray<uint64> ExpectedFrames;
+    FRandomStream Noise(1234);
+    for (int32 Sample = 0; Sample < NumSamples; ++Sample)
+    {
+        TArray<double>& Values = Expected.AddDefaulted_GetRef();
+        for (int32 Column = 0; Column < (Sample < LateColumnFrom ? 5 : 6); ++Column)
+        {
+            Values.Add(GetLuaTestValue(Column, Sample, Noise));
+        }
+        ExpectedFrames.Add(Sample == 0 ? 1000 : ExpectedFrames.Last() + GetLuaTestFrameDelta(Sample));
+    }
+
+    // A budget that keeps everything, then the smallest one, which evicts the oldest blocks while recording.
+    for (const int64 BudgetBytes : { int64(64) << 20, int64(0) })
+    {
+        FLuaStatsHistory History;
+        History.Configure(3600.0, BudgetBytes);
+        for (int32 Sample = 0; Sample < NumSamples; ++Sample)
+        {
+            GFrameCounter = ExpectedFrames[Sample];
+            History.Record(Expected[Sample]);
+        }
+        const bool bEvicting = BudgetBytes == 0;
+
+        FLuaHistoryWindow Window;
+        if (!TestTrue(TEXT("Window found"), History.GetWindow(1000000.0, -1.0, Window)))
+        {
+            return false;
+        }
+        const int32 Num = Window.Frames.Num();
+        TestEqual(TEXT("Last sample in window"), Window.FirstSample + Num, static_cast<uint32>(NumSamples));
+        if (!bEvicting)
+        {
+            TestEqual(TEXT("Whole timeline kept"), Window.FirstSample, 0u);
+        }
+        else
+        {
+            TestTrue(TEXT("Oldest samples evicted"), Window.FirstSample > 0);
+        }
+        for (int32 Index = 0; Index < Num; ++Index)
+        {
+            const uint64 Frame = Window.Frames[Index];
+            if (Frame != 0 && Frame != ExpectedFrames[Window.FirstSample + Index])
+            {
+                AddError(FString::Printf(TEXT("Sample %u has frame %llu, recorded %llu"), Window.FirstSample + Index, Frame, ExpectedFrames[Window.FirstSample + Index]));
+                break;
+            }
+            if (Index > 0 && Window.SecondsAgo[Index] >= 0.0 && Window.SecondsAgo[Index - 1] >= 0.0 && Window.SecondsAgo[Index] > Window.SecondsAgo[Index - 1])
+            {
+                AddError(FString::Printf(TEXT("Sample %u is older than the one before it"), Window.FirstSample + Index));
+                break;
+            }
+        }
+
+        for (int32 Column = 0; Column < 6; ++Column)
+        {
+            TBitArray<> Recorded;
+            TArray<double> Values;
+            TestTrue(FString::Printf(TEXT("Column %d recorded"), Column), History.ReadSeries(Column, Window, Recorded, Values));
+            TestTrue(FString::Printf(TEXT("Column %d has the last sample"), Column), Recorded[Num - 1]);
+            for (int32 Index = 0; Index < Num; ++Index)
+            {
+                const int32 Sample = Window.FirstSample + Index;
+                const bool bExpected = Column < Expected[Sample].Num();
+                if (Recorded[Index] != bExpected && (!bEvicting || Recorded[Index]))
+                {
+                    AddError(FString::Printf(TEXT("Column %d sample %d recorded %d"), Column, Sample, Recorded[Index] ? 1 : 0));
+                    break;
+                }
+                if (Recorded[Index] && !IsSameBits(Values[Index], Expected[Sample][Column]))
+                {
+                    AddError(FString::Printf(TEXT("Column %d sample %d decoded %.17g, recorded %.17g"), Column, Sample, Values[Index], Expected[Sample][Column]));
+                    break;
+                }
+            }
+        }
+        TBitArray<> Recorded;
+        TArray<double> Values;
+        TestFalse(TEXT("Unknown column"), History.ReadSeries(6, Window, Recorded, Values));
+    }
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLuaStatsColumnarRoundTripTest, "LuaStats.Columnar.RoundTrip",
+    EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FLuaStatsColumnarRoundTripTest::RunTest(const FString& /*Parameters*/)
+{
+    // Two full row groups, a column added in between and a partial group written by Close.
+    static constexpr int32 NumRows = 2 * LuaColumnarRowsPerGroup + 88;
+    static constexpr int32 LateColumnFrom = LuaColumnarRowsPerGroup + 44;
+    static constexpr int32 EventRow = 100;
+    static const ELuaStatType Types[] = { ELuaStatType::CycleCounter, ELuaStatType::DoubleCounter, ELuaStatType::Int64Counter };
+    FLuaTestFrameCounter FrameCounter;
+    const FString Path = FPaths::Combine(FPaths::AutomationTransientDir(), TEXT("LuaStatsTest.lscf"));
+
+    TArray<FLuaStatDefinition> Definitions;
+    TArray<TArray<double>> Expected;
+    FRandomStream Noise(5678);
+    {
+        FLuaStatsColumnarCapture Capture;
+        if (!TestTrue(TEXT("Capture opened"), Capture.Open(Path)))
+        {
+            return false;
+        }
+        for (int32 Row = 0; Row < NumRows; ++Row)
+        {
+            while (Definitions.Num() < (Row < LateColumnFrom ? 2 : 3))
+            {
+                FLuaStatDefinition& Definition = Definitions.AddDefaulted_GetRef();
+                Definition.Name = FName(*FString::Printf(TEXT("LuaStatsTest.Column%d"), Definitions.Num() - 1));
+                Definition.Type = Types[Definitions.Num() - 1];
+            }
+            TArray<double>& Values = Expected.AddDefaulted_GetRef();
+            for (int32 Column = 0; Column < Definitions.Num(); ++Column)
+            {
+                Values.Add(GetLuaTestValue(Column + 1, Row, Noise));
+            }
+            GFrameCounter = 5000 + Row;
+            Capture.Append(Definitions, Values);
+            if (Row == EventRow)
+            {
+                Capture.AddEvent(TEXT("LuaStatsTest.Name"), TEXT("Second"));
+            }
+        }
+        Capture.Close();
+    }
+
+    TArray<uint8> Bytes;
+    if (!TestTrue(TEXT("Capture written"), FFileHelper::LoadFileToArray(Bytes, *Path)))
+    {
+        return false;
+    }
+    IFileManager::Get().Delete(*Path);
+    FMemoryReader Reader(Bytes);
+    ANSICHAR Magic[4];
+    uint32 Version = 0;
+    double MillisecondsPerCycle = 0.0;
+    Reader.Serialize(Magic, sizeof(Magic));
+    Reader << Version << MillisecondsPerCycle;
+    TestTrue(TEXT("Magic"), FMemory::Memcmp(Magic, "LSCF", 4) == 0);
+    TestEqual(TEXT("Version"), Version, 2u);
+    TestTrue(TEXT("Milliseconds per cycle"), MillisecondsPerCycle > 0.0);
+
+    auto ReadString = [&Reader]()
+    {
+        uint32 Length = 0;
+        Reader << Length;
+        TArray<ANSICHAR> Utf8;
+        Utf8.SetNumUninitialized(Length);
+        Reader.Serialize(Utf8.GetData(), Length);
+        const FUTF8ToTCHAR Text(Utf8.GetData(), Length);
+        return FString(Text.Length(), Text.Get());
+    };
+
+    int32 NumColumns = 0;
+    int32 NumEvents = 0;
+    int32 Row = 0;
+    TArray<uint8> Raw;
+    TArray<uint8> Stored;
+    while (!Reader.AtEnd() && !Reader.IsError())
+    {
+        uint8 Tag = 0;
+        Reader << Tag;
+        if (Tag == 'C')
+        {
+            uint32 Column = 0;
+            uint8 Type = 0;
+            Reader << Column << Type;
+            const FString Name = ReadString();
+            TestEqual(TEXT("Columns are appended in order"), Column, static_cast<uint32>(NumColumns));
+            TestEqual(TEXT("Column written before its first row"), Row, NumColumns < 2 ? 0 : LateColumnFrom);
+            if (Definitions.IsValidIndex(Column))
+            {
+                TestEqual(TEXT("Column name"), Name, Definitions[Column].Name.ToString());
+                TestEqual(TEXT("Column type"), Type, static_cast<uint8>(Definitions[Column].Type));
+            }
+            ++NumColumns;
+        }
+        else if (Tag == 'E')
+        {
+            uint64 Frame = 0;
+            double Seconds = 0.0;
+            Reader << Frame << Seconds;
+            const FString Stat = ReadString();
+            const FString Value = ReadString();
+            TestEqual(TEXT("Event frame"), Frame, uint64(5000 + EventRow));
+            TestEqual(TEXT("Event stat"), Stat, FString(TEXT("LuaStatsTest.Name")));
+            TestEqual(TEXT("Event value"), Value, FString(TEXT("Second")));
+            ++NumEvents;
+        }
+        else if (Tag == 'G')
+        {
+            uint32 Rows = 0;
+            uint32 Columns = 0;
+            uint32 RawSize = 0;
+            uint32 StoredSize = 0;
+            Reader << Rows << Columns << RawSize << StoredSize;
+            if (!TestEqual(TEXT("Row group size"), RawSize, Rows * (2 + Columns) * static_cast<uint32>(sizeof(uint64)))
+                || !TestTrue(TEXT("Row group after its columns"), static_cast<int32>(Columns) <= NumColumns && Row + static_cast<int32>(Rows) <= NumRows))
+            {
+                return false;
+            }
+            Raw.SetNumUninitialized(RawSize);
+            if (StoredSize == 0)
+            {
+                Reader.Serialize(Raw.GetData(), RawSize);
+            }
+            else
+            {
+                Stored.SetNumUninitialized(StoredSize);
+                Reader.Serialize(Stored.GetData(), StoredSize);
+                if (!TestTrue(TEXT("Row group decompressed"), FCompression::UncompressMemory(NAME_Zlib, Raw.GetData(), RawSize, Stored.GetData(), StoredSize)))
+                {
+                    return false;
+                }
+            }
+            const uint64* Frames = reinterpret_cast<const uint64*>(Raw.GetData());
+            const uint64* Values = Frames + 2 * Rows;
+            for (uint32 Index = 0; Index < Rows; ++Index)
+            {
+                TestEqual(TEXT("Row frame"), Frames[Index], uint64(5000 + Row + Index));
+                TestEqual(TEXT("Row columns"), static_cast<int32>(Columns), Expected[Row + Index].Num());
+            }
+            for (uint32 Column = 0; Column < Columns; ++Column)
+            {
+                uint64 Previous = 0;
+                for (uint32 Index = 0; Index < Rows; ++Index)
+                {
+                    Previous ^= Values[Column * Rows + Index];
+                    double Value;
+                    FMemory::Memcpy(&Value, &Previous, sizeof(double));
+                    if (Expected[Row + Index].IsValidIndex(Column) && !IsSameBits(Value, Expected[Row + Index][Column]))
+                    {
+                        AddError(FString::Printf(TEXT("Column %u row %u decoded %.17g, appended %.17g"), Column, Row + Index, Value, Expected[Row + Index][Column]));
+                        return false;
+                    }
+                }
+            }
+            Row += Rows;
+        }
+        else
+        {
+            AddError(FString::Printf(TEXT("Unknown record '%c'"), Tag));
+            return false;
+        }
+    }
+    TestFalse(TEXT("Capture not truncated"), Reader.IsError());
+    TestEqual(TEXT("Columns"), NumColumns, 3);
+    TestEqual(TEXT("Events"), NumEvents, 1);
+    TestEqual(TEXT("Rows"), Row, NumRows);
+    return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLuaStatsCallRecordingTest, "LuaStats.Recorder.Format",
+    EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FLuaStatsCallRecordingTest::RunTest(const FString& /*Parameters*/)
+{
+    if (GLuaCallRecorder.IsRecording())
+    {
+        AddWarning(TEXT("Skipped while LuaStats.RecordCalls is recording"));
+        return true;
+    }
+    const FString Path = FPaths::Combine(FPaths::AutomationTransientDir(), TEXT("LuaStatsTest.lsrc"));
+    lua_State* L = luaL_newstate();
+    // Not a stat: recorded as a handle without an id, which replays as a no-op.
+    static TStatIdData Unregistered;
+
+    TArray<uint8> Expected;
+    auto Write = [&Expected](auto Value)
+    {
+        Expected.Append(reinterpret_cast<const uint8*>(&Value), sizeof(Value));
+    };
+    auto WriteString = [&Expected, &Write](uint32 Id, const ANSICHAR* String)
+    {
+        Expected.Add('S');
+        Write(Id);
+        Write(static_cast<uint32>(FCStringAnsi::Strlen(String)));
+        Expected.Append(reinterpret_cast<const uint8*>(String), FCStringAnsi::Strlen(String));
+    };
+    auto WriteCall = [&Expected](ELuaRecordedCall Call, uint8 ArgNum)
+    {
+        Expected.Add('C');
+        Expected.Add(static_cast<uint8>(Call));
+        Expected.Add(ArgNum);
+    };
+    Expected.Append(reinterpret_cast<const uint8*>("LSRC"), 4);
+    Write(LuaCallRecordingVersion);
+
+    if (!TestTrue(TEXT("Recording started"), GLuaCallRecorder.Start(Path)))
+    {
+        lua_close(L);
+        return false;
+    }
+
+    lua_pushstring(L, "LuaStatsTest.Name");
+    lua_pushinteger(L, 5);
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::Int64Add);
+    Expected.Add('T');
+    Write(uint32(0));
+    WriteString(0, "LuaStatsTest.Name");
+    WriteCall(ELuaRecordedCall::Int64Add, 2);
+    Expected.Add(static_cast<uint8>(ELuaRecordedArg::String));
+    Write(uint32(0));
+    Expected.Add(static_cast<uint8>(ELuaRecordedArg::Integer));
+    Write(int64(5));
+
+    // The same name from another string is not written again.
+    lua_settop(L, 0);
+    lua_pushstring(L, "LuaStatsTest.Name");
+    lua_pushnumber(L, 2.5);
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::DoubleSet);
+    WriteCall(ELuaRecordedCall::DoubleSet, 2);
+    Expected.Add(static_cast<uint8>(ELuaRecordedArg::String));
+    Write(uint32(0));
+    Expected.Add(static_cast<uint8>(ELuaRecordedArg::Number));
+    Write(2.5);
+
+    // Arguments past LuaCallRecordingMaxArgs are dropped.
+    lua_settop(L, 0);
+    lua_pushstring(L, "LuaStatsTest.Other");
+    lua_pushboolean(L, 0);
+    lua_newtable(L);
+    lua_pushinteger(L, 9);
+    const uint64 Table = static_cast<uint64>(reinterpret_cast<UPTRINT>(lua_topointer(L, 3)));
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::FNameSet);
+    WriteString(1, "LuaStatsTest.Other");
+    WriteCall(ELuaRecordedCall::FNameSet, LuaCallRecordingMaxArgs);
+    Expected.Add(static_cast<uint8>(ELuaRecordedArg::String));
+    Write(uint32(1));
+    Expected.Add(static_cast<uint8>(ELuaRecordedArg::False));
+    Expected.Add(static_cast<uint8>(ELuaRecordedArg::Object));
+    Write(Table);
+
+    lua_settop(L, 0);
+    lua_pushlightuserdata(L, &Unregistered);
+    lua_pushnil(L);
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::AsyncSpanBegin);
+    GLuaCallRecorder.RecordResult(42);
+    WriteCall(ELuaRecordedCall::AsyncSpanBegin, 2);
+    Expected.Add(static_cast<uint8>(ELuaRecordedArg::Handle));
+    Write(LuaCallRecordingNoHandle);
+    Expected.Add(static_cast<uint8>(ELuaRecordedArg::Nil));
+    Expected.Add('R');
+    Write(int64(42));
+
+    // A coroutine is a thread of its own; switching back to the main one names it again.
+    lua_settop(L, 0);
+    lua_State* Thread = lua_newthread(L);
+    lua_pushinteger(Thread, 42);
+    GLuaCallRecorder.Record(Thread, ELuaRecordedCall::AsyncSpanEnd);
+    GLuaCallRecorder.Record(L, ELuaRecordedCall::CycleCounterStop);
+    Expected.Add('T');
+    Write(uint32(1));
+    WriteCall(ELuaRecordedCall::AsyncSpanEnd, 1);
+    Expected.Add(static_cast<uint8>(ELuaRecordedArg::Integer));
+    Write(int64(42));
+    Expected.Add('T');
+    Write(uint32(0));
+    // The thread itself is the only value on the main stack.
+    WriteCall(ELuaRecordedCall::CycleCounterStop, 1);
+    Expected.Add(static_cast<uint8>(ELuaRecordedArg::Object));
+    Write(static_cast<uint64>(reinterpret_cast<UPTRINT>(lua_topointer(L, 1))));
+
+    GLuaCallRecorder.Stop();
+    lua_close(L);
+
+    TArray<uint8> Bytes;
+    if (!TestTrue(TEXT("Recording written"), FFileHelper::LoadFileToArray(Bytes, *Path)))
+    {
+        return false;
+    }
+    IFileManager::Get().Delete(*Path);
+    TestEqual(TEXT("Recording size"), Bytes.Num(), Expected.Num());
+    const int32 Num = FMath::Min(Bytes.Num(), Expected.Num());
+    for (int32 Index = 0; Index < Num; ++Index)
+    {
+        if (Bytes[Index] != Expected[Index])
+        {
+            AddError(FString::Printf(TEXT("Recording differs at byte %d: 0x%02x, expected 0x%02x"), Index, Bytes[Index], Expected[Index]));
+            break;
+        }
+    }
+    return true;
+}
+
+// Stat libraries that log their calls, and a LuaStats.Resolve that resolves nothing, so a rewritten chunk
+// runs against the same stubs as the original.
+static const ANSICHAR LuaRewriteTestStubs[] = R"Lua(
+Calls = {}
+function Log(...)
+    local Parts = {}
+    for Index = 1, select("#", ...) do
+        Parts[Index] = tostring((select(Index, ...)))
+    end
+    Calls[#Calls + 1] = table.concat(Parts, " ")
+end
+Resolves = 0
+LuaStats = { Resolve = function() Resolves = Resolves + 1 end }
+for _, Name in ipairs({ "FCycleCounter", "FInt64Stat", "FDoubleStat", "FAsyncSpan" }) do
+    _G[Name] = setmetatable({}, { __index = function(_, Method)
+        return function(...)
+            Log(Name .. "." .. Method, ...)
+            return 7
+        end
+    end })
+end
+)Lua";
+
+static const ANSICHAR LuaRewriteTestChunk[] = R"Lua(-- FCycleCounter.Start("InComment")
+local Text = "FCycleCounter.Start('InString')"
+local Handle = FInt64Stat.Create("Test.Created")
+local function Next() Log("Next") return 1 end
+for Index = 1, 2 do
+    FCycleCounter.Start("Test.Loop")
+    FInt64Stat.Add("Test.Count", Index)
+    FInt64Stat.Add("Test.Count", Next())
+    FCycleCounter.Stop()
+end
+FDoubleStat.Set(
+    "Test.Double",
+    1.5)
+local Id = FAsyncSpan.Begin("Test.Span")
+FAsyncSpan.End(Id)
+Log(Text)
+Log(debug.getinfo(1, "l").currentline)
+)Lua";
+
+// Runs a chunk against the stubs; returns its calls joined by '|', or the error.
+static FString RunLuaRewriteTestChunk(const ANSICHAR* Source, int32 Length, int32& OutResolves)
+{
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    FString Result;
+    if (luaL_dostring(L, LuaRewriteTestStubs) != LUA_OK || luaL_loadbuffer(L, Source, Length, "=LuaStatsTest") != LUA_OK
+        || lua_pcall(L, 0, 0, 0) != LUA_OK || luaL_dostring(L, "return table.concat(Calls, '|'), Resolves") != LUA_OK)
+    {
+        Result = FString(TEXT("error: ")) + UTF8_TO_TCHAR(lua_tostring(L, -1));
+    }
+    else
+    {
+        Result = UTF8_TO_TCHAR(lua_tostring(L, -2));
+        OutResolves = static_cast<int32>(lua_tointeger(L, -1));
+    }
+    lua_close(L);
+    return Result;
+}
+
+static int32 CountLuaLines(const ANSICHAR* Source, int32 Length)
+{
+    int32 Lines = 1;
+    for (int32 Pos = 0; Pos < Length; ++Pos)
+    {
+        Lines += Source[Pos] == '\n' ? 1 : 0;
+    }
+    return Lines;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLuaStatsRewriterTest, "LuaStats.Rewriter.Equivalence",
+    EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FLuaStatsRewriterTest::RunTest(const FString& /*Parameters*/)
+{
+    const int32 Length = FCStringAnsi::Strlen(LuaRewriteTestChunk);
+    const FString Original = TEXT("FInt64Stat.Create Test.Created|")
+        TEXT("FCycleCounter.Start Test.Loop|FInt64Stat.Add Test.Count 1|Next|FInt64Stat.Add Test.Count 1|FCycleCounter.Stop|")
+        TEXT("FCycleCounter.Start Test.Loop|FInt64Stat.Add Test.Count 2|Next|FInt64Stat.Add Test.Count 1|FCycleCounter.Stop|")
+        TEXT("FDoubleStat.Set Test.Double 1.5|FAsyncSpan.Begin Test.Span|FAsyncSpan.End 7|FCycleCounter.Start('InString')|17");
+    int32 Resolves = 0;
+    TestEqual(TEXT("Original chunk"), RunLuaRewriteTestChunk(LuaRewriteTestChunk, Length, Resolves), Original);
+
+    // Every call goes through a local; the four literal names of handle methods are resolved once, at load.
+    TArray<ANSICHAR> Resolved;
+    TestEqual(TEXT("Calls resolved"), RewriteLuaChunk(LuaRewriteTestChunk, Length, ELuaChunkRewrite::Resolve, Resolved), 8);
+    TestEqual(TEXT("Resolved chunk"), RunLuaRewriteTestChunk(Resolved.GetData(), Resolved.Num(), Resolves), Original);
+    TestEqual(TEXT("Names resolved"), Resolves, 4);
+    TestEqual(TEXT("Resolved lines"), CountLuaLines(Resolved.GetData(), Resolved.Num()), CountLuaLines(LuaRewriteTestChunk, Length));
+
+    // Create and the async spans stay, as does the Add whose argument calls a function.
+    TArray<ANSICHAR> Stripped;
+    TestEqual(TEXT("Calls stripped"), RewriteLuaChunk(LuaRewriteTestChunk, Length, ELuaChunkRewrite::Strip, Stripped), 4);
+    TestEqual(TEXT("Stripped chunk"), RunLuaRewriteTestChunk(Stripped.GetData(), Stripped.Num(), Resolves),
+        FString(TEXT("FInt64Stat.Create Test.Created|Next|FInt64Stat.Add Test.Count 1|Next|FInt64Stat.Add Test.Count 1|")
+            TEXT("FAsyncSpan.Begin Test.Span|FAsyncSpan.End 7|FCycleCounter.Start('InString')|17")));
+    TestEqual(TEXT("Stripped lines"), CountLuaLines(Stripped.GetData(), Stripped.Num()), CountLuaLines(LuaRewriteTestChunk, Length));
+    const FUTF8ToTCHAR StrippedText(Stripped.GetData(), Stripped.Num());
+    TestTrue(TEXT("Comment kept"), FString(StrippedText.Length(), StrippedText.Get()).Contains(TEXT("-- FCycleCounter.Start(\"InComment\")")));
+
+    // A Start that has to stay keeps every Start and Stop of the chunk.
+    const ANSICHAR KeptScopes[] = "FCycleCounter.Start(Name())\nFCycleCounter.Stop()\nFInt64Stat.Add(\"Test.Count\", 1)\n";
+    TestEqual(TEXT("Scopes kept together"), RewriteLuaChunk(KeptScopes, UE_ARRAY_COUNT(KeptScopes) - 1, ELuaChunkRewrite::Strip, Stripped), 1);
+
+    const ANSICHAR Unchanged[] = "local Value = 1\nreturn Value\n";
+    TestEqual(TEXT("Chunk without stat calls"), RewriteLuaChunk(Unchanged, UE_ARRAY_COUNT(Unchanged) - 1, ELuaChunkRewrite::Resolve, Resolved), 0);
+    const ANSICHAR Shadowed[] = "local FCycleCounter = {}\nFCycleCounter.Start(\"Test.Loop\")\n";
+    TestEqual(TEXT("Shadowed library"), RewriteLuaChunk(Shadowed, UE_ARRAY_COUNT(Shadowed) - 1, ELuaChunkRewrite::Strip, Stripped), 0);
+    const ANSICHAR Binary[] = "\x1bLuaT FCycleCounter.Start(\"Test.Loop\")";
+    TestEqual(TEXT("Precompiled chunk"), RewriteLuaChunk(Binary, UE_ARRAY_COUNT(Binary) - 1, ELuaChunkRewrite::Resolve, Resolved), 0);
+    return true;
+}
+
+static void SpinLuaTestCycles(uint64 Cycles)
+{
+    const uint64 Start = FPlatformTime::Cycles64();
+    while (FPlatformTime::Cycles64() - Start < Cycles)
+    {
+    }
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FLuaStatsNestedParentsTest, "LuaStats.Parents.NestedScopes",
+    EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FLuaStatsNestedParentsTest::RunTest(const FString& /*Parameters*/)
+{
+    lua_State* L = luaL_newstate();
+    auto Call = [L](lua_CFunction Function, const ANSICHAR* StatName)
+    {
+        lua_settop(L, 0);
+        if (StatName)
+        {
+            lua_pushstring(L, StatName);
+        }
+        Function(L);
+    };
+    // Counters are only timed while their group is on.
+    Call(LuaStats_EnableGroup, nullptr);
+    Call(CycleCounter_Create, "LuaStatsTest.AI.Update");
+    Call(CycleCounter_Create, "LuaStatsTest.AI.Pathing.Query");
+    FlushLuaStats();
+
+    // AI.Pathing.Query runs inside AI.Update: both roll up into AI@Sum, which must hold the outer scope only.
+    const uint64 Spin = static_cast<uint64>(0.002 / FPlatformTime::GetSecondsPerCycle64());
+    const uint64 Begin = FPlatformTime::Cycles64();
+    Call(CycleCounter_Start, "LuaStatsTest.AI.Update");
+    SpinLuaTestCycles(Spin);
+    Call(CycleCounter_Start, "LuaStatsTest.AI.Pathing.Query");
+    SpinLuaTestCycles(2 * Spin);
+    Call(CycleCounter_Stop, nullptr);
+    Call(CycleCounter_Stop, nullptr);
+    const double Outer = static_cast<double>(FPlatformTime::Cycles64() - Begin);
+    FlushLuaStats();
+    lua_close(L);
+
+    const double Pathing = GetLuaParentValue(TEXT("LuaStatsTest.AI.Pathing@Sum"));
+    const double AI = GetLuaParentValue(TEXT("LuaStatsTest.AI@Sum"));
+    if (Pathing == 0.0)
+    {
+        AddWarning(TEXT("Skipped: the Lua stat group is not collected"));
+        return true;
+    }
+    TestTrue(TEXT("Inner scope in its own parent"), Pathing >= 2.0 * Spin && Pathing <= Outer);
+    // Summing both inclusive times would give about 5 spins, more than the outer scope took.
+    TestTrue(TEXT("Nested scope counted once"), AI > Pathing + 0.5 * Spin && AI <= Outer);
+    TestEqual(TEXT("Grandparent"), GetLuaParentValue(TEXT("LuaStatsTest@Sum")), AI);
+    return true;
+}
+
+#endif
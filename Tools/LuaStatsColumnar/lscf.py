@@ -0,0 +1,115 @@
+"""Loads Lua stat captures written by the LuaStats.CaptureColumnar console command (.lscf) into pandas.
+
+    import lscf
+    stats = lscf.load("Capture.lscf")   # index: frame number, columns: Seconds and one per stat
+    events = lscf.load_events("Capture.lscf")   # columns: Frame, Seconds, Stat, Value
+
+Cycle counters are converted to milliseconds. A stat created mid-run is NaN in the frames before it existed.
+FName stats are not columns; each change of their value is an event instead.
+A capture cut short by a crash loads up to its last complete row group.
+
+From the command line, converts a capture to CSV or Parquet:
+
+    python lscf.py Capture.lscf out.csv
+"""
+
+import struct
+import sys
+import zlib
+
+import numpy as np
+import pandas as pd
+
+CYCLE_COUNTER = 0
+
+
+def _read(path):
+    with open(path, "rb") as file:
+        data = file.read()
+    if data[:4] != b"LSCF":
+        raise ValueError(f"{path} is not a Lua stats columnar capture")
+    version, ms_per_cycle = struct.unpack_from("<Id", data, 4)
+    if version not in (1, 2):
+        raise ValueError(f"{path} has unsupported version {version}")
+
+    names = []
+    types = []
+    groups = []
+    events = []
+    offset = 16
+    try:
+        while offset < len(data):
+            tag = data[offset]
+            offset += 1
+            if tag == ord("C"):
+                _, stat_type, length = struct.unpack_from("<IBI", data, offset)
+                offset += 9
+                if offset + length > len(data):
+                    break
+                names.append(data[offset:offset + length].decode("utf-8"))
+                types.append(stat_type)
+                offset += length
+            elif tag == ord("G"):
+                rows, columns, raw_size, stored_size = struct.unpack_from("<IIII", data, offset)
+                offset += 16
+                size = stored_size or raw_size
+                if offset + size > len(data):
+                    break
+                payload = data[offset:offset + size]
+                offset += size
+                raw = np.frombuffer(zlib.decompress(payload) if stored_size else payload, dtype="<u8")
+                values = np.bitwise_xor.accumulate(raw[2 * rows:].reshape(columns, rows), axis=1)
+                groups.append((raw[:rows], raw[rows:2 * rows].view("<f8"), values.view("<f8")))
+            elif tag == ord("E"):
+                frame, seconds, stat_length = struct.unpack_from("<QdI", data, offset)
+                offset += 20
+                stat = data[offset:offset + stat_length].decode("utf-8")
+                offset += stat_length
+                (value_length,) = struct.unpack_from("<I", data, offset)
+                offset += 4
+                if offset + value_length > len(data):
+                    break
+                events.append((frame, seconds, stat, data[offset:offset + value_length].decode("utf-8")))
+                offset += value_length
+            else:
+                raise ValueError(f"{path}: unknown record {tag!r} at offset {offset - 1}")
+    except struct.error:
+        pass
+    return names, types, groups, events, ms_per_cycle
+
+
+def load(path):
+    names, types, groups, _, ms_per_cycle = _read(path)
+    total = sum(len(frames) for frames, _, _ in groups)
+    table = np.full((total, len(names)), np.nan)
+    frames = np.empty(total, dtype=np.uint64)
+    seconds = np.empty(total)
+    row = 0
+    for group_frames, group_seconds, values in groups:
+        count = len(group_frames)
+        frames[row:row + count] = group_frames
+        seconds[row:row + count] = group_seconds
+        table[row:row + count, :values.shape[0]] = values.T
+        row += count
+    for column, stat_type in enumerate(types):
+        if stat_type == CYCLE_COUNTER:
+            table[:, column] *= ms_per_cycle
+
+    stats = pd.DataFrame(table, index=pd.Index(frames, name="Frame"), columns=names)
+    stats.insert(0, "Seconds", seconds)
+    return stats
+
+
+def load_events(path):
+    _, _, _, events, _ = _read(path)
+    return pd.DataFrame(events, columns=["Frame", "Seconds", "Stat", "Value"])
+
+
+if __name__ == "__main__":
+    if len(sys.argv) != 3:
+        sys.exit("Usage: python lscf.py Capture.lscf out.csv|out.parquet")
+    stats = load(sys.argv[1])
+    if sys.argv[2].endswith(".parquet"):
+        stats.to_parquet(sys.argv[2])
+    else:
+        stats.to_csv(sys.argv[2])
@@ -0,0 +1,105 @@
+"""Round trips of lscf.py against captures written record by record as FLuaStatsColumnarCapture writes them.
+
+    python -m unittest test_lscf
+"""
+
+import math
+import os
+import struct
+import tempfile
+import unittest
+import zlib
+
+import numpy as np
+
+import lscf
+
+MS_PER_CYCLE = 0.25
+
+
+def _column(index, stat_type, name):
+    encoded = name.encode("utf-8")
+    return b"C" + struct.pack("<IBI", index, stat_type, len(encoded)) + encoded
+
+
+def _event(frame, seconds, stat, value):
+    stat = stat.encode("utf-8")
+    value = value.encode("utf-8")
+    return b"E" + struct.pack("<QdI", frame, seconds, len(stat)) + stat + struct.pack("<I", len(value)) + value
+
+
+def _group(frames, seconds, rows, compress=True):
+    """rows holds one list of doubles per frame, all of the same length."""
+    columns = len(rows[0])
+    raw = np.empty(len(frames) * (2 + columns), dtype="<u8")
+    raw[:len(frames)] = frames
+    raw[len(frames):2 * len(frames)] = np.asarray(seconds, dtype="<f8").view("<u8")
+    bits = np.asarray(rows, dtype="<f8").view("<u8").T
+    previous = np.concatenate([np.zeros((columns, 1), dtype="<u8"), bits[:, :-1]], axis=1)
+    raw[2 * len(frames):] = (bits ^ previous).ravel()
+    payload = raw.tobytes()
+    stored = zlib.compress(payload) if compress else payload
+    header = struct.pack("<IIII", len(frames), columns, len(payload), len(stored) if compress else 0)
+    return b"G" + header + stored
+
+
+def _capture(*records):
+    return b"LSCF" + struct.pack("<Id", 2, MS_PER_CYCLE) + b"".join(records)
+
+
+class LscfTest(unittest.TestCase):
+    def setUp(self):
+        handle, self.path = tempfile.mkstemp(suffix=".lscf")
+        os.close(handle)
+
+    def tearDown(self):
+        os.remove(self.path)
+
+    def _load(self, data):
+        with open(self.path, "wb") as file:
+            file.write(data)
+        return lscf.load(self.path), lscf.load_events(self.path)
+
+    def test_round_trip(self):
+        first = [[100.0, 1.5], [100.0, float("inf")], [104.0, -0.0]]
+        second = [[8.0, 2.5, 7.0], [8.0, 2.5, float("nan")]]
+        stats, events = self._load(_capture(
+            _column(0, lscf.CYCLE_COUNTER, "Lua.Tick"),
+            _column(1, 4, "Lua.Memory"),
+            _event(11, 0.5, "Lua.Map", "Arena"),
+            _group([10, 11, 12], [0.0, 0.5, 1.0], first),
+            _column(2, 2, "Lua.Late"),
+            _group([13, 14], [1.5, 2.0], second, compress=False),
+        ))
+
+        self.assertEqual(list(stats.columns), ["Seconds", "Lua.Tick", "Lua.Memory", "Lua.Late"])
+        self.assertEqual(list(stats.index), [10, 11, 12, 13, 14])
+        self.assertEqual(list(stats["Seconds"]), [0.0, 0.5, 1.0, 1.5, 2.0])
+        # Cycle counters are converted to milliseconds, other types are kept as written.
+        self.assertEqual(list(stats["Lua.Tick"]), [25.0, 25.0, 26.0, 2.0, 2.0])
+        self.assertEqual(list(stats["Lua.Memory"][:4]), [1.5, math.inf, 0.0, 2.5])
+        self.assertTrue(math.copysign(1.0, stats["Lua.Memory"].iloc[2]) < 0)
+        # A column added mid-capture is NaN before it existed.
+        self.assertTrue(stats["Lua.Late"][:3].isna().all())
+        self.assertEqual(stats["Lua.Late"].iloc[3], 7.0)
+        self.assertTrue(math.isnan(stats["Lua.Late"].iloc[4]))
+
+        self.assertEqual(events.values.tolist(), [[11, 0.5, "Lua.Map", "Arena"]])
+
+    def test_truncated_tail(self):
+        complete = _capture(_column(0, 4, "Lua.Value"), _group([1, 2], [0.0, 0.1], [[1.0], [2.0]]))
+        partial = _group([3, 4], [0.2, 0.3], [[3.0], [4.0]])
+        for cut in (1, 9, len(partial) - 1):
+            stats, _ = self._load(complete + partial[:cut])
+            self.assertEqual(list(stats.index), [1, 2], f"cut at {cut}")
+            self.assertEqual(list(stats["Lua.Value"]), [1.0, 2.0])
+
+    def test_rejects_other_files(self):
+        with open(self.path, "wb") as file:
+            file.write(b"LSRC" + struct.pack("<I", 1))
+        with self.assertRaises(ValueError):
+            lscf.load(self.path)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,623 @@
+// LuaStatsCompare.cpp
+//
+// Compares Lua stat captures of a baseline and a candidate build and ranks the stats whose per-frame cost
+// regressed. Captures are CSV files with one column per stat and one row per frame, as written by the CSV
+// profiler. Rows and cells that are not numeric (metadata rows, event columns) are skipped.
+//
+// Build: c++ -std=c++17 -O2 -pthread LuaStatsCompare.cpp -o LuaStatsCompare
+//
+// Usage: LuaStatsCompare --baseline a.csv [b.csv ...] --candidate c.csv [d.csv ...]
+//            [--json report.json] [--md report.md] [--alpha 0.01] [--threshold 5]
+//            [--include Substring] [--skip-frames N] [--samples N] [--threads N]
+//
+// Exit code: 0 when no stat regressed, 1 when at least one stat regressed significantly by more than the
+// threshold, 2 on bad arguments or unreadable input.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace
+{
+
+struct FOptions
+{
+    std::vector<std::string> Baseline;
+    std::vector<std::string> Candidate;
+    std::string JsonPath;
+    std::string MarkdownPath;
+    std::string Include;
+    double Alpha = 0.01;
+    double ThresholdPercent = 5.0;
+    size_t SkipFrames = 0;
+    size_t MaxSamples = 20000;
+    unsigned Threads = 0;
+};
+
+// Bounded uniform sample of a stat's per-frame values plus exact running moments, so hour-long captures
+// stream through in constant memory per stat.
+struct FStatSamples
+{
+    std::vector<double> Reservoir;
+    uint64_t Count = 0;
+    double Sum = 0.0;
+    double Max = 0.0;
+
+    void Add(double Value, size_t MaxSamples, std::mt19937_64& Random)
+    {
+        ++Count;
+        Sum += Value;
+        Max = Count == 1 ? Value : std::max(Max, Value);
+        if (Reservoir.size() < MaxSamples)
+        {
+            Reservoir.push_back(Value);
+        }
+        else
+        {
+            const uint64_t Slot = std::uniform_int_distribution<uint64_t>(0, Count - 1)(Random);
+            if (Slot < MaxSamples)
+            {
+                Reservoir[Slot] = Value;
+            }
+        }
+    }
+
+    // Merges another reservoir, keeping each side's share proportional to the frames it saw.
+    void Merge(FStatSamples&& Other, size_t MaxSamples, std::mt19937_64& Random)
+    {
+        if (Other.Count == 0)
+        {
+            return;
+        }
+        if (Count == 0)
+        {
+            *this = std::move(Other);
+            return;
+        }
+        const uint64_t Total = Count + Other.Count;
+        std::vector<double> Merged;
+        if (Reservoir.size() + Other.Reservoir.size() <= MaxSamples)
+        {
+            Merged = std::move(Reservoir);
+            Merged.insert(Merged.end(), Other.Reservoir.begin(), Other.Reservoir.end());
+        }
+        else
+        {
+            const size_t FromThis = std::min(Reservoir.size(), static_cast<size_t>(std::llround(MaxSamples * static_cast<double>(Count) / Total)));
+            const size_t FromOther = std::min(Other.Reservoir.size(), MaxSamples - FromThis);
+            std::shuffle(Reservoir.begin(), Reservoir.end(), Random);
+            std::shuffle(Other.Reservoir.begin(), Other.Reservoir.end(), Random);
+            Merged.assign(Reservoir.begin(), Reservoir.begin() + FromThis);
+            Merged.insert(Merged.end(), Other.Reservoir.begin(), Other.Reservoir.begin() + FromOther);
+        }
+        Reservoir = std::move(Merged);
+        Max = std::max(Max, Other.Max);
+        Sum += Other.Sum;
+        Count = Total;
+    }
+};
+
+using FCapture = std::unordered_map<std::string, FStatSamples>;
+
+struct FComparison
+{
+    std::string Name;
+    uint64_t BaselineFrames = 0;
+    uint64_t CandidateFrames = 0;
+    double BaselineMean = 0.0;
+    double CandidateMean = 0.0;
+    double BaselineMedian = 0.0;
+    double CandidateMedian = 0.0;
+    double BaselineP90 = 0.0;
+    double CandidateP90 = 0.0;
+    double BaselineP99 = 0.0;
+    double CandidateP99 = 0.0;
+    double DeltaPercent = 0.0;
+    // Probability that a candidate frame costs more than a baseline frame, 0.5 when unchanged.
+    double Superiority = 0.5;
+    double PValue = 1.0;
+    bool bSignificant = false;
+    bool bRegression = false;
+    bool bImprovement = false;
+};
+
+void SplitCsvLine(const std::string& Line, std::vector<std::string>& OutCells)
+{
+    OutCells.clear();
+    std::string Cell;
+    bool bQuoted = false;
+    for (size_t Index = 0; Index < Line.size(); ++Index)
+    {
+        const char Char = Line[Index];
+        if (bQuoted)
+        {
+            if (Char == '"' && Index + 1 < Line.size() && Line[Index + 1] == '"')
+            {
+                Cell += '"';
+                ++Index;
+            }
+            else if (Char == '"')
+            {
+                bQuoted = false;
+            }
+            else
+            {
+                Cell += Char;
+            }
+        }
+        else if (Char == '"')
+        {
+            bQuoted = true;
+        }
+        else if (Char == ',')
+        {
+            OutCells.push_back(std::move(Cell));
+            Cell.clear();
+        }
+        else if (Char != '\r' && Char != '\n')
+        {
+            Cell += Char;
+        }
+    }
+    OutCells.push_back(std::move(Cell));
+}
+
+bool ParseNumber(const std::string& Cell, double& OutValue)
+{
+    if (Cell.empty())
+    {
+        return false;
+    }
+    char* End = nullptr;
+    OutValue = std::strtod(Cell.c_str(), &End);
+    return End != Cell.c_str() && *End == '\0' && std::isfinite(OutValue);
+}
+
+bool ReadCsvCapture(const std::string& Path, const FOptions& Options, FCapture& OutCapture, std::string& OutError)
+{
+    std::ifstream File(Path, std::ios::binary);
+    if (!File)
+    {
+        OutError = "cannot open " + Path;
+        return false;
+    }
+    std::mt19937_64 Random(std::hash<std::string>()(Path));
+    std::vector<std::string> Header;
+    std::vector<FStatSamples*> Columns;
+    std::vector<std::string> Cells;
+    std::string Line;
+    size_t Frame = 0;
+    while (std::getline(File, Line))
+    {
+        if (Header.empty())
+        {
+            SplitCsvLine(Line, Header);
+            Columns.resize(Header.size(), nullptr);
+            for (size_t Column = 0; Column < Header.size(); ++Column)
+            {
+                if (!Header[Column].empty() && (Options.Include.empty() || Header[Column].find(Options.Include) != std::string::npos))
+                {
+                    Columns[Column] = &OutCapture[Header[Column]];
+                }
+            }
+            continue;
+        }
+        SplitCsvLine(Line, Cells);
+        if (Cells.empty() || (!Cells[0].empty() && Cells[0][0] == '['))
+        {
+            continue;
+        }
+        // A frame counts only if it carries at least one number; a repeated header row at the end does not.
+        bool bNumericRow = false;
+        double Value;
+        for (const std::string& Cell : Cells)
+        {
+            if (ParseNumber(Cell, Value))
+            {
+                bNumericRow = true;
+                break;
+            }
+        }
+        if (!bNumericRow || Frame++ < Options.SkipFrames)
+        {
+            continue;
+        }
+        const size_t NumCells = std::min(Cells.size(), Columns.size());
+        for (size_t Column = 0; Column < NumCells; ++Column)
+        {
+            if (Columns[Column] && ParseNumber(Cells[Column], Value))
+            {
+                Columns[Column]->Add(Value, Options.MaxSamples, Random);
+            }
+        }
+    }
+    if (Header.empty())
+    {
+        OutError = Path + " is empty";
+        return false;
+    }
+    return true;
+}
+
+double Percentile(const std::vector<double>& Sorted, double Fraction)
+{
+    if (Sorted.empty())
+    {
+        return 0.0;
+    }
+    const double Position = Fraction * (Sorted.size() - 1);
+    const size_t Lower = static_cast<size_t>(Position);
+    const size_t Upper = std::min(Lower + 1, Sorted.size() - 1);
+    return Sorted[Lower] + (Sorted[Upper] - Sorted[Lower]) * (Position - Lower);
+}
+
+// Two-sided Mann-Whitney U test with the normal approximation and tie correction. Both inputs are sorted.
+void MannWhitney(const std::vector<double>& Baseline, const std::vector<double>& Candidate, double& OutPValue, double& OutSuperiority)
+{
+    const double N1 = static_cast<double>(Baseline.size());
+    const double N2 = static_cast<double>(Candidate.size());
+    OutPValue = 1.0;
+    OutSuperiority = 0.5;
+    if (N1 < 2 || N2 < 2)
+    {
+        return;
+    }
+    // Merge walk over both sorted samples: rank sum of the candidate plus the tie term.
+    double CandidateRankSum = 0.0;
+    double TieTerm = 0.0;
+    size_t I = 0;
+    size_t J = 0;
+    double Rank = 1.0;
+    while (I < Baseline.size() || J < Candidate.size())
+    {
+        const double Value = J >= Candidate.size() || (I < Baseline.size() && Baseline[I] < Candidate[J]) ? Baseline[I] : Candidate[J];
+        size_t TiedBaseline = 0;
+        size_t TiedCandidate = 0;
+        while (I < Baseline.size() && Baseline[I] == Value)
+        {
+            ++I;
+            ++TiedBaseline;
+        }
+        while (J < Candidate.size() && Candidate[J] == Value)
+        {
+            ++J;
+            ++TiedCandidate;
+        }
+        const double Tied = static_cast<double>(TiedBaseline + TiedCandidate);
+        const double MeanRank = Rank + (Tied - 1.0) / 2.0;
+        CandidateRankSum += MeanRank * TiedCandidate;
+        TieTerm += Tied * Tied * Tied - Tied;
+        Rank += Tied;
+    }
+    const double U = CandidateRankSum - N2 * (N2 + 1.0) / 2.0;
+    OutSuperiority = U / (N1 * N2);
+    const double N = N1 + N2;
+    const double Variance = N1 * N2 / 12.0 * ((N + 1.0) - TieTerm / (N * (N - 1.0)));
+    if (Variance <= 0.0)
+    {
+        return;
+    }
+    const double Z = (std::fabs(U - N1 * N2 / 2.0) - 0.5) / std::sqrt(Variance);
+    OutPValue = std::min(1.0, std::erfc(std::max(Z, 0.0) / std::sqrt(2.0)));
+}
+
+void Compare(FStatSamples& Baseline, FStatSamples& Candidate, FComparison& Out)
+{
+    std::sort(Baseline.Reservoir.begin(), Baseline.Reservoir.end());
+    std::sort(Candidate.Reservoir.begin(), Candidate.Reservoir.end());
+    Out.BaselineFrames = Baseline.Count;
+    Out.CandidateFrames = Candidate.Count;
+    Out.BaselineMean = Baseline.Count ? Baseline.Sum / Baseline.Count : 0.0;
+    Out.CandidateMean = Candidate.Count ? Candidate.Sum / Candidate.Count : 0.0;
+    Out.BaselineMedian = Percentile(Baseline.Reservoir, 0.5);
+    Out.CandidateMedian = Percentile(Candidate.Reservoir, 0.5);
+    Out.BaselineP90 = Percentile(Baseline.Reservoir, 0.9);
+    Out.CandidateP90 = Percentile(Candidate.Reservoir, 0.9);
+    Out.BaselineP99 = Percentile(Baseline.Reservoir, 0.99);
+    Out.CandidateP99 = Percentile(Candidate.Reservoir, 0.99);
+    // Medians of sparse stats are often zero, so fall back to the means to express the change.
+    const double BaselineCentre = Out.BaselineMedian != 0.0 ? Out.BaselineMedian : Out.BaselineMean;
+    const double CandidateCentre = Out.BaselineMedian != 0.0 ? Out.CandidateMedian : Out.CandidateMean;
+    Out.DeltaPercent = BaselineCentre != 0.0 ? (CandidateCentre - BaselineCentre) / std::fabs(BaselineCentre) * 100.0
+        : (CandidateCentre != 0.0 ? 100.0 : 0.0);
+    MannWhitney(Baseline.Reservoir, Candidate.Reservoir, Out.PValue, Out.Superiority);
+}
+
+template <typename FunctionType>
+void ParallelFor(size_t Num, unsigned Threads, FunctionType&& Function)
+{
+    std::atomic<size_t> Next(0);
+    std::vector<std::thread> Workers;
+    const unsigned NumWorkers = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(Threads, Num)));
+    for (unsigned Worker = 0; Worker < NumWorkers; ++Worker)
+    {
+        Workers.emplace_back([&]()
+        {
+            for (size_t Index = Next++; Index < Num; Index = Next++)
+            {
+                Function(Index);
+            }
+        });
+    }
+    for (std::thread& Worker : Workers)
+    {
+        Worker.join();
+    }
+}
+
+bool ReadSide(const std::vector<std::string>& Paths, const FOptions& Options, FCapture& OutSide)
+{
+    std::vector<FCapture> Captures(Paths.size());
+    std::vector<std::string> Errors(Paths.size());
+    std::vector<char> Succeeded(Paths.size(), 0);
+    ParallelFor(Paths.size(), Options.Threads, [&](size_t Index)
+    {
+        Succeeded[Index] = ReadCsvCapture(Paths[Index], Options, Captures[Index], Errors[Index]);
+    });
+    std::mt19937_64 Random(0x4c756153);
+    for (size_t Index = 0; Index < Paths.size(); ++Index)
+    {
+        if (!Succeeded[Index])
+        {
+            std::fprintf(stderr, "LuaStatsCompare: %s\n", Errors[Index].c_str());
+            return false;
+        }
+        for (auto& Pair : Captures[Index])
+        {
+            OutSide[Pair.first].Merge(std::move(Pair.second), Options.MaxSamples, Random);
+        }
+    }
+    return true;
+}
+
+// Benjamini-Hochberg: controls the false discovery rate across the hundreds of stats compared at once.
+void MarkSignificant(std::vector<FComparison>& Comparisons, double Alpha)
+{
+    std::vector<size_t> Order(Comparisons.size());
+    for (size_t Index = 0; Index < Order.size(); ++Index)
+    {
+        Order[Index] = Index;
+    }
+    std::sort(Order.begin(), Order.end(), [&](size_t A, size_t B)
+    {
+        return Comparisons[A].PValue < Comparisons[B].PValue;
+    });
+    size_t Cutoff = 0;
+    for (size_t Rank = 0; Rank < Order.size(); ++Rank)
+    {
+        if (Comparisons[Order[Rank]].PValue <= Alpha * (Rank + 1) / Order.size())
+        {
+            Cutoff = Rank + 1;
+        }
+    }
+    for (size_t Rank = 0; Rank < Cutoff; ++Rank)
+    {
+        Comparisons[Order[Rank]].bSignificant = true;
+    }
+}
+
+std::string JsonEscape(const std::string& Text)
+{
+    std::string Result;
+    for (const char Char : Text)
+    {
+        if (Char == '"' || Char == '\\')
+        {
+            Result += '\\';
+            Result += Char;
+        }
+        else if (static_cast<unsigned char>(Char) < 0x20)
+        {
+            char Buffer[8];
+            std::snprintf(Buffer, sizeof(Buffer), "\\u%04x", Char);
+            Result += Buffer;
+        }
+        else
+        {
+            Result += Char;
+        }
+    }
+    return Result;
+}
+
+void WriteJson(std::ostream& Out, const std::vector<FComparison>& Comparisons, const FOptions& Options, size_t NumRegressions)
+{
+    Out << "{\n  \"alpha\": " << Options.Alpha << ",\n  \"thresholdPercent\": " << Options.ThresholdPercent
+        << ",\n  \"regressions\": " << NumRegressions << ",\n  \"stats\": [\n";
+    for (size_t Index = 0; Index < Comparisons.size(); ++Index)
+    {
+        const FComparison& C = Comparisons[Index];
+        Out << "    {\"name\": \"" << JsonEscape(C.Name) << "\", \"verdict\": \""
+            << (C.bRegression ? "regression" : C.bImprovement ? "improvement" : "unchanged") << "\""
+            << ", \"deltaPercent\": " << C.DeltaPercent << ", \"pValue\": " << C.PValue << ", \"superiority\": " << C.Superiority
+            << ", \"baseline\": {\"frames\": " << C.BaselineFrames << ", \"mean\": " << C.BaselineMean << ", \"median\": " << C.BaselineMedian
+            << ", \"p90\": " << C.BaselineP90 << ", \"p99\": " << C.BaselineP99 << "}"
+            << ", \"candidate\": {\"frames\": " << C.CandidateFrames << ", \"mean\": " << C.CandidateMean << ", \"median\": " << C.CandidateMedian
+            << ", \"p90\": " << C.CandidateP90 << ", \"p99\": " << C.CandidateP99 << "}}"
+            << (Index + 1 < Comparisons.size() ? ",\n" : "\n");
+    }
+    Out << "  ]\n}\n";
+}
+
+void WriteMarkdown(std::ostream& Out, const std::vector<FComparison>& Comparisons, const FOptions& Options, size_t NumRegressions)
+{
+    Out << "# Lua stat comparison\n\n";
+    Out << NumRegressions << " significant regression(s) above " << Options.ThresholdPercent << "% (alpha " << Options.Alpha
+        << ", Mann-Whitney U, Benjamini-Hochberg).\n\n";
+    Out << "| Stat | Verdict | Median delta | Baseline median | Candidate median | Baseline p99 | Candidate p99 | p-value |\n";
+    Out << "|---|---|---:|---:|---:|---:|---:|---:|\n";
+    char Buffer[512];
+    for (const FComparison& C : Comparisons)
+    {
+        std::snprintf(Buffer, sizeof(Buffer), "| `%s` | %s | %+.2f%% | %.4g | %.4g | %.4g | %.4g | %.2g |\n", C.Name.c_str(),
+            C.bRegression ? "**regression**" : C.bImprovement ? "improvement" : "unchanged",
+            C.DeltaPercent, C.BaselineMedian, C.CandidateMedian, C.BaselineP99, C.CandidateP99, C.PValue);
+        Out << Buffer;
+    }
+}
+
+bool ParseArguments(int Argc, char** Argv, FOptions& Options)
+{
+    std::vector<std::string>* Inputs = nullptr;
+    for (int Index = 1; Index < Argc; ++Index)
+    {
+        const std::string Argument = Argv[Index];
+        const bool bHasValue = Index + 1 < Argc;
+        if (Argument == "--baseline")
+        {
+            Inputs = &Options.Baseline;
+        }
+        else if (Argument == "--candidate")
+        {
+            Inputs = &Options.Candidate;
+        }
+        else if (Argument == "--json" && bHasValue)
+        {
+            Options.JsonPath = Argv[++Index];
+        }
+        else if (Argument == "--md" && bHasValue)
+        {
+            Options.MarkdownPath = Argv[++Index];
+        }
+        else if (Argument == "--include" && bHasValue)
+        {
+            Options.Include = Argv[++Index];
+        }
+        else if (Argument == "--alpha" && bHasValue)
+        {
+            Options.Alpha = std::atof(Argv[++Index]);
+        }
+        else if (Argument == "--threshold" && bHasValue)
+        {
+            Options.ThresholdPercent = std::atof(Argv[++Index]);
+        }
+        else if (Argument == "--skip-frames" && bHasValue)
+        {
+            Options.SkipFrames = static_cast<size_t>(std::atoll(Argv[++Index]));
+        }
+        else if (Argument == "--samples" && bHasValue)
+        {
+            Options.MaxSamples = std::max<size_t>(16, static_cast<size_t>(std::atoll(Argv[++Index])));
+        }
+        else if (Argument == "--threads" && bHasValue)
+        {
+            Options.Threads = static_cast<unsigned>(std::atoi(Argv[++Index]));
+        }
+        else if (Argument.compare(0, 2, "--") != 0 && Inputs)
+        {
+            Inputs->push_back(Argument);
+        }
+        else
+        {
+            std::fprintf(stderr, "LuaStatsCompare: unknown argument %s\n", Argument.c_str());
+            return false;
+        }
+    }
+    if (Options.Threads == 0)
+    {
+        Options.Threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return !Options.Baseline.empty() && !Options.Candidate.empty();
+}
+
+}
+
+int main(int Argc, char** Argv)
+{
+    FOptions Options;
+    if (!ParseArguments(Argc, Argv, Options))
+    {
+        std::fprintf(stderr, "Usage: LuaStatsCompare --baseline a.csv [...] --candidate b.csv [...] [--json out.json] [--md out.md]\n"
+            "       [--alpha 0.01] [--threshold 5] [--include Substring] [--skip-frames N] [--samples N] [--threads N]\n");
+        return 2;
+    }
+
+    FCapture Baseline;
+    FCapture Candidate;
+    bool bBaselineRead = false;
+    bool bCandidateRead = false;
+    std::thread BaselineReader([&]() { bBaselineRead = ReadSide(Options.Baseline, Options, Baseline); });
+    bCandidateRead = ReadSide(Options.Candidate, Options, Candidate);
+    BaselineReader.join();
+    if (!bBaselineRead || !bCandidateRead)
+    {
+        return 2;
+    }
+
+    // Stats present on one side only are compared against zero: a stat that appears is a cost that appeared.
+    std::vector<std::string> Names;
+    for (const auto& Pair : Baseline)
+    {
+        Names.push_back(Pair.first);
+    }
+    for (const auto& Pair : Candidate)
+    {
+        if (Baseline.find(Pair.first) == Baseline.end())
+        {
+            Names.push_back(Pair.first);
+        }
+    }
+    std::vector<FComparison> Comparisons(Names.size());
+    ParallelFor(Names.size(), Options.Threads, [&](size_t Index)
+    {
+        FStatSamples Empty;
+        auto BaselineFound = Baseline.find(Names[Index]);
+        auto CandidateFound = Candidate.find(Names[Index]);
+        Comparisons[Index].Name = Names[Index];
+        Compare(BaselineFound != Baseline.end() ? BaselineFound->second : Empty,
+            CandidateFound != Candidate.end() ? CandidateFound->second : Empty, Comparisons[Index]);
+    });
+
+    // Columns that never held a number (event or label columns) are not stats.
+    Comparisons.erase(std::remove_if(Comparisons.begin(), Comparisons.end(), [](const FComparison& C)
+    {
+        return C.BaselineFrames == 0 && C.CandidateFrames == 0;
+    }), Comparisons.end());
+
+    MarkSignificant(Comparisons, Options.Alpha);
+    size_t NumRegressions = 0;
+    for (FComparison& C : Comparisons)
+    {
+        C.bRegression = C.bSignificant && C.DeltaPercent > Options.ThresholdPercent;
+        C.bImprovement = C.bSignificant && C.DeltaPercent < -Options.ThresholdPercent;
+        NumRegressions += C.bRegression ? 1 : 0;
+    }
+    // Regressions first, largest first; then improvements; then the rest by size of change.
+    std::sort(Comparisons.begin(), Comparisons.end(), [](const FComparison& A, const FComparison& B)
+    {
+        const int RankA = A.bRegression ? 0 : A.bImprovement ? 1 : 2;
+        const int RankB = B.bRegression ? 0 : B.bImprovement ? 1 : 2;
+        if (RankA != RankB)
+        {
+            return RankA < RankB;
+        }
+        return std::fabs(A.DeltaPercent) > std::fabs(B.DeltaPercent);
+    });
+
+    if (!Options.JsonPath.empty())
+    {
+        std::ofstream Json(Options.JsonPath);
+        WriteJson(Json, Comparisons, Options, NumRegressions);
+    }
+    if (!Options.MarkdownPath.empty())
+    {
+        std::ofstream Markdown(Options.MarkdownPath);
+        WriteMarkdown(Markdown, Comparisons, Options, NumRegressions);
+    }
+    if (Options.JsonPath.empty() && Options.MarkdownPath.empty())
+    {
+        WriteMarkdown(std::cout, Comparisons, Options, NumRegressions);
+    }
+    std::fprintf(stderr, "LuaStatsCompare: %zu stats compared, %zu regression(s)\n", Comparisons.size(), NumRegressions);
+    return NumRegressions > 0 ? 1 : 0;
+}
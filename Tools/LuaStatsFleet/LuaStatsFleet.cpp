@@ -0,0 +1,674 @@
+// LuaStatsFleet.cpp
+//
+// Merges Lua stat captures of many server processes into fleet-wide per-stat distributions, broken down by map
+// and by build, and ranks the stats that cost the most over all frames of all servers. Captures are CSV files
+// as written by the CSV profiler (see LuaStatsCompare) or .lscf files written by LuaStats.CaptureColumnar.
+//
+// Each capture is streamed into one quantile sketch per stat: logarithmic buckets with 1% relative accuracy
+// and a bounded bucket count, merged exactly by adding bucket counts. Memory is one sketch per stat and map
+// or build per worker thread, however many frames and files there are.
+//
+// A capture's map and build come from the metadata row of a CSV capture ([Map], [BuildVersion], see --map-key
+// and --build-key), or from map=Name and build=Name directories in its path, which take precedence:
+//     captures/build=1234/map=Arena/server07.lscf
+//
+// Build: c++ -std=c++17 -O2 -pthread LuaStatsFleet.cpp -o LuaStatsFleet -lz
+//
+// Usage: LuaStatsFleet capture.csv|capture.lscf [...] [--csv out.csv] [--md out.md] [--top N]
+//            [--include Substring] [--skip-frames N] [--map-key Key] [--build-key Key] [--threads N]
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <zlib.h>
+
+#include "LuaStatsSketch.h"
+
+namespace
+{
+
+using LuaStatsSketch::FQuantileSketch;
+using LuaStatsSketch::RelativeAccuracy;
+
+struct FOptions
+{
+    std::vector<std::string> Inputs;
+    std::string CsvPath;
+    std::string MarkdownPath;
+    std::string Include;
+    std::string MapKey = "Map";
+    std::string BuildKey = "BuildVersion";
+    size_t SkipFrames = 0;
+    size_t Top = 50;
+    unsigned Threads = 0;
+};
+
+struct FDistribution
+{
+    FQuantileSketch Sketch;
+    uint64_t Files = 0;
+
+    void Merge(const FDistribution& Other)
+    {
+        Sketch.Merge(Other.Sketch);
+        Files += Other.Files;
+    }
+};
+
+struct FStatAggregate
+{
+    FDistribution All;
+    std::unordered_map<std::string, FDistribution> ByMap;
+    std::unordered_map<std::string, FDistribution> ByBuild;
+
+    void Merge(const FStatAggregate& Other)
+    {
+        All.Merge(Other.All);
+        for (const auto& Pair : Other.ByMap)
+        {
+            ByMap[Pair.first].Merge(Pair.second);
+        }
+        for (const auto& Pair : Other.ByBuild)
+        {
+            ByBuild[Pair.first].Merge(Pair.second);
+        }
+    }
+};
+
+using FFleet = std::unordered_map<std::string, FStatAggregate>;
+
+// One capture: a sketch per stat and the labels it is broken down by.
+struct FCapture
+{
+    std::unordered_map<std::string, FQuantileSketch> Stats;
+    std::string Map;
+    std::string Build;
+};
+
+bool Matches(const FOptions& Options, const std::string& Name)
+{
+    return Options.Include.empty() || Name.find(Options.Include) != std::string::npos;
+}
+
+void SplitCsvLine(const std::string& Line, std::vector<std::string>& OutCells)
+{
+    OutCells.clear();
+    std::string Cell;
+    bool bQuoted = false;
+    for (size_t Index = 0; Index < Line.size(); ++Index)
+    {
+        const char Char = Line[Index];
+        if (bQuoted)
+        {
+            if (Char == '"' && Index + 1 < Line.size() && Line[Index + 1] == '"')
+            {
+                Cell += '"';
+                ++Index;
+            }
+            else if (Char == '"')
+            {
+                bQuoted = false;
+            }
+            else
+            {
+                Cell += Char;
+            }
+        }
+        else if (Char == '"')
+        {
+            bQuoted = true;
+        }
+        else if (Char == ',')
+        {
+            OutCells.push_back(std::move(Cell));
+            Cell.clear();
+        }
+        else if (Char != '\r' && Char != '\n')
+        {
+            Cell += Char;
+        }
+    }
+    OutCells.push_back(std::move(Cell));
+}
+
+bool ParseNumber(const std::string& Cell, double& OutValue)
+{
+    if (Cell.empty())
+    {
+        return false;
+    }
+    char* End = nullptr;
+    OutValue = std::strtod(Cell.c_str(), &End);
+    return End != Cell.c_str() && *End == '\0' && std::isfinite(OutValue);
+}
+
+// The CSV profiler's metadata row is [Key],Value pairs, e.g. [BuildVersion],1234,[Map],Arena.
+void ReadCsvMetadata(const std::vector<std::string>& Cells, const FOptions& Options, FCapture& OutCapture)
+{
+    for (size_t Index = 0; Index + 1 < Cells.size(); ++Index)
+    {
+        const std::string& Key = Cells[Index];
+        if (Key.size() > 2 && Key.front() == '[' && Key.back() == ']')
+        {
+            const std::string Name = Key.substr(1, Key.size() - 2);
+            if (Name == Options.MapKey)
+            {
+                OutCapture.Map = Cells[Index + 1];
+            }
+            else if (Name == Options.BuildKey)
+            {
+                OutCapture.Build = Cells[Index + 1];
+            }
+        }
+    }
+}
+
+bool ReadCsvCapture(const std::string& Path, const FOptions& Options, FCapture& OutCapture, std::string& OutError)
+{
+    std::ifstream File(Path, std::ios::binary);
+    if (!File)
+    {
+        OutError = "cannot open " + Path;
+        return false;
+    }
+    std::vector<std::string> Header;
+    std::vector<FQuantileSketch*> Columns;
+    std::vector<std::string> Cells;
+    std::string Line;
+    size_t Frame = 0;
+    while (std::getline(File, Line))
+    {
+        if (Header.empty())
+        {
+            SplitCsvLine(Line, Header);
+            Columns.resize(Header.size(), nullptr);
+            for (size_t Column = 0; Column < Header.size(); ++Column)
+            {
+                if (!Header[Column].empty() && Matches(Options, Header[Column]))
+                {
+                    Columns[Column] = &OutCapture.Stats[Header[Column]];
+                }
+            }
+            continue;
+        }
+        SplitCsvLine(Line, Cells);
+        if (Cells.empty() || (!Cells[0].empty() && Cells[0][0] == '['))
+        {
+            ReadCsvMetadata(Cells, Options, OutCapture);
+            continue;
+        }
+        bool bNumericRow = false;
+        double Value;
+        for (const std::string& Cell : Cells)
+        {
+            if (ParseNumber(Cell, Value))
+            {
+                bNumericRow = true;
+                break;
+            }
+        }
+        if (!bNumericRow || Frame++ < Options.SkipFrames)
+        {
+            continue;
+        }
+        const size_t NumCells = std::min(Cells.size(), Columns.size());
+        for (size_t Column = 0; Column < NumCells; ++Column)
+        {
+            if (Columns[Column] && ParseNumber(Cells[Column], Value))
+            {
+                Columns[Column]->Add(Value);
+            }
+        }
+    }
+    if (Header.empty())
+    {
+        OutError = Path + " is empty";
+        return false;
+    }
+    return true;
+}
+
+template <typename Type>
+bool ReadValue(FILE* File, Type& OutValue)
+{
+    return std::fread(&OutValue, sizeof(Type), 1, File) == 1;
+}
+
+bool ReadString(FILE* File, uint32_t Length, std::string& OutString)
+{
+    OutString.resize(Length);
+    return Length == 0 || std::fread(&OutString[0], Length, 1, File) == 1;
+}
+
+// Streams the row groups of an .lscf capture, see FLuaStatsColumnarCapture. Only one row group is in memory
+// at a time; a capture cut short by a crash is read up to its last complete row group.
+bool ReadColumnarCapture(const std::string& Path, const FOptions& Options, FCapture& OutCapture, std::string& OutError)
+{
+    FILE* File = std::fopen(Path.c_str(), "rb");
+    if (!File)
+    {
+        OutError = "cannot open " + Path;
+        return false;
+    }
+    char Magic[4];
+    uint32_t Version = 0;
+    double MillisecondsPerCycle = 0.0;
+    if (std::fread(Magic, sizeof(Magic), 1, File) != 1 || std::memcmp(Magic, "LSCF", 4) != 0
+        || !ReadValue(File, Version) || !ReadValue(File, MillisecondsPerCycle) || Version < 1 || Version > 2)
+    {
+        std::fclose(File);
+        OutError = Path + " is not a Lua stats columnar capture of version 1 or 2";
+        return false;
+    }
+
+    std::vector<FQuantileSketch*> Columns;
+    std::vector<double> Scales;
+    std::vector<unsigned char> Stored;
+    std::vector<uint64_t> Raw;
+    std::string Text;
+    size_t Frame = 0;
+    int Tag;
+    while ((Tag = std::fgetc(File)) != EOF)
+    {
+        if (Tag == 'C')
+        {
+            uint32_t Column = 0;
+            uint8_t Type = 0;
+            uint32_t Length = 0;
+            if (!ReadValue(File, Column) || !ReadValue(File, Type) || !ReadValue(File, Length) || !ReadString(File, Length, Text))
+            {
+                break;
+            }
+            Columns.push_back(Matches(Options, Text) ? &OutCapture.Stats[Text] : nullptr);
+            // Cycle counters are stored in cycles.
+            Scales.push_back(Type == 0 ? MillisecondsPerCycle : 1.0);
+        }
+        else if (Tag == 'G')
+        {
+            uint32_t Rows = 0;
+            uint32_t NumColumns = 0;
+            uint32_t RawSize = 0;
+            uint32_t StoredSize = 0;
+            if (!ReadValue(File, Rows) || !ReadValue(File, NumColumns) || !ReadValue(File, RawSize) || !ReadValue(File, StoredSize))
+            {
+                break;
+            }
+            Stored.resize(StoredSize ? StoredSize : RawSize);
+            if (!Stored.empty() && std::fread(Stored.data(), Stored.size(), 1, File) != 1)
+            {
+                break;
+            }
+            const uint64_t Expected = (2 + uint64_t(NumColumns)) * Rows;
+            if (RawSize != Expected * sizeof(uint64_t) || NumColumns > Columns.size())
+            {
+                OutError = Path + " has a malformed row group";
+                std::fclose(File);
+                return false;
+            }
+            Raw.resize(Expected);
+            uLongf Size = RawSize;
+            if (StoredSize == 0)
+            {
+                std::memcpy(Raw.data(), Stored.data(), RawSize);
+            }
+            else if (uncompress(reinterpret_cast<Bytef*>(Raw.data()), &Size, Stored.data(), StoredSize) != Z_OK || Size != RawSize)
+            {
+                OutError = Path + " has a corrupt row group";
+                std::fclose(File);
+                return false;
+            }
+            // Rows skipped at the start of the capture still seed each column's XOR chain.
+            const size_t Skipped = Frame < Options.SkipFrames ? std::min<size_t>(Rows, Options.SkipFrames - Frame) : 0;
+            Frame += Rows;
+            for (uint32_t Column = 0; Column < NumColumns; ++Column)
+            {
+                if (!Columns[Column])
+                {
+                    continue;
+                }
+                const uint64_t* Values = Raw.data() + (2 + uint64_t(Column)) * Rows;
+                uint64_t Bits = 0;
+                for (uint32_t Row = 0; Row < Rows; ++Row)
+                {
+                    Bits ^= Values[Row];
+                    double Value;
+                    std::memcpy(&Value, &Bits, sizeof(Value));
+                    if (Row >= Skipped && std::isfinite(Value))
+                    {
+                        Columns[Column]->Add(Value * Scales[Column]);
+                    }
+                }
+            }
+        }
+        else if (Tag == 'E')
+        {
+            uint64_t EventFrame = 0;
+            double Seconds = 0.0;
+            uint32_t Length = 0;
+            if (!ReadValue(File, EventFrame) || !ReadValue(File, Seconds) || !ReadValue(File, Length) || !ReadString(File, Length, Text)
+                || !ReadValue(File, Length) || !ReadString(File, Length, Text))
+            {
+                break;
+            }
+        }
+        else
+        {
+            OutError = Path + ": unknown record " + std::to_string(Tag);
+            std::fclose(File);
+            return false;
+        }
+    }
+    std::fclose(File);
+    return true;
+}
+
+// map=Name and build=Name directory components of the path override the capture's own metadata.
+void ReadPathLabels(const std::string& Path, FCapture& OutCapture)
+{
+    size_t Start = 0;
+    while (Start < Path.size())
+    {
+        size_t End = Path.find_first_of("/\\", Start);
+        End = End == std::string::npos ? Path.size() : End;
+        const std::string Component = Path.substr(Start, End - Start);
+        if (Component.compare(0, 4, "map=") == 0)
+        {
+            OutCapture.Map = Component.substr(4);
+        }
+        else if (Component.compare(0, 6, "build=") == 0)
+        {
+            OutCapture.Build = Component.substr(6);
+        }
+        Start = End + 1;
+    }
+}
+
+bool EndsWith(const std::string& Text, const char* Suffix)
+{
+    const size_t Length = std::strlen(Suffix);
+    return Text.size() >= Length && Text.compare(Text.size() - Length, Length, Suffix) == 0;
+}
+
+void AddCapture(FFleet& Fleet, const FCapture& Capture)
+{
+    for (const auto& Pair : Capture.Stats)
+    {
+        if (Pair.second.GetCount() == 0)
+        {
+            continue;
+        }
+        FStatAggregate& Aggregate = Fleet[Pair.first];
+        FDistribution Distribution;
+        Distribution.Sketch = Pair.second;
+        Distribution.Files = 1;
+        Aggregate.All.Merge(Distribution);
+        Aggregate.ByMap[Capture.Map.empty() ? "(unknown)" : Capture.Map].Merge(Distribution);
+        Aggregate.ByBuild[Capture.Build.empty() ? "(unknown)" : Capture.Build].Merge(Distribution);
+    }
+}
+
+template <typename FunctionType>
+void ParallelFor(size_t Num, unsigned Threads, FunctionType&& Function)
+{
+    std::atomic<size_t> Next(0);
+    std::vector<std::thread> Workers;
+    const unsigned NumWorkers = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(Threads, Num)));
+    for (unsigned Worker = 0; Worker < NumWorkers; ++Worker)
+    {
+        Workers.emplace_back([&, Worker]()
+        {
+            for (size_t Index = Next++; Index < Num; Index = Next++)
+            {
+                Function(Worker, Index);
+            }
+        });
+    }
+    for (std::thread& Worker : Workers)
+    {
+        Worker.join();
+    }
+}
+
+// Each worker folds the captures it reads into a fleet of its own, so only one capture per worker is held
+// unmerged at any time; the per-worker fleets are merged at the end.
+bool ReadFleet(const FOptions& Options, FFleet& OutFleet)
+{
+    std::vector<FFleet> Fleets(Options.Threads);
+    std::atomic<bool> bFailed(false);
+    ParallelFor(Options.Inputs.size(), Options.Threads, [&](unsigned Worker, size_t Index)
+    {
+        const std::string& Path = Options.Inputs[Index];
+        FCapture Capture;
+        std::string Error;
+        const bool bRead = EndsWith(Path, ".lscf") ? ReadColumnarCapture(Path, Options, Capture, Error)
+            : ReadCsvCapture(Path, Options, Capture, Error);
+        if (!bRead)
+        {
+            std::fprintf(stderr, "LuaStatsFleet: %s\n", Error.c_str());
+            bFailed = true;
+            return;
+        }
+        ReadPathLabels(Path, Capture);
+        AddCapture(Fleets[Worker], Capture);
+    });
+    for (FFleet& Fleet : Fleets)
+    {
+        for (const auto& Pair : Fleet)
+        {
+            OutFleet[Pair.first].Merge(Pair.second);
+        }
+        Fleet.clear();
+    }
+    return !bFailed;
+}
+
+// Breakdown rows sorted by label, so builds and dated map names read in order.
+std::vector<std::pair<std::string, const FDistribution*>> SortBreakdown(const std::unordered_map<std::string, FDistribution>& Breakdown)
+{
+    std::vector<std::pair<std::string, const FDistribution*>> Rows;
+    for (const auto& Pair : Breakdown)
+    {
+        Rows.emplace_back(Pair.first, &Pair.second);
+    }
+    std::sort(Rows.begin(), Rows.end(), [](const auto& A, const auto& B) { return A.first < B.first; });
+    return Rows;
+}
+
+void WriteCsvRow(std::ostream& Out, const std::string& Name, const char* Dimension, const std::string& Label, const FDistribution& D)
+{
+    const FQuantileSketch& S = D.Sketch;
+    char Buffer[256];
+    std::snprintf(Buffer, sizeof(Buffer), ",%s,\"%s\",%llu,%llu,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g\n", Dimension, Label.c_str(),
+        static_cast<unsigned long long>(D.Files), static_cast<unsigned long long>(S.GetCount()), S.GetSum(), S.GetMean(),
+        S.GetQuantile(0.5), S.GetQuantile(0.9), S.GetQuantile(0.99), S.GetQuantile(0.999), S.GetMax());
+    Out << '"' << Name << '"' << Buffer;
+}
+
+// Long format: one row per stat for the whole fleet, then one per map and one per build.
+void WriteCsv(std::ostream& Out, const std::vector<std::pair<std::string, const FStatAggregate*>>& Ranked)
+{
+    Out << "Stat,Dimension,Label,Files,Frames,Total,Mean,P50,P90,P99,P999,Max\n";
+    for (const auto& Pair : Ranked)
+    {
+        WriteCsvRow(Out, Pair.first, "all", "", Pair.second->All);
+        for (const auto& Row : SortBreakdown(Pair.second->ByMap))
+        {
+            WriteCsvRow(Out, Pair.first, "map", Row.first, *Row.second);
+        }
+        for (const auto& Row : SortBreakdown(Pair.second->ByBuild))
+        {
+            WriteCsvRow(Out, Pair.first, "build", Row.first, *Row.second);
+        }
+    }
+}
+
+void WriteBreakdown(std::ostream& Out, const char* Title, const std::vector<std::pair<std::string, const FStatAggregate*>>& Ranked,
+    size_t Top, std::unordered_map<std::string, FDistribution> FStatAggregate::*Member)
+{
+    Out << "\n## By " << Title << "\n\n| Stat | " << Title << " | Files | Frames | Mean | P50 | P99 | Max |\n";
+    Out << "|---|---|---:|---:|---:|---:|---:|---:|\n";
+    char Buffer[512];
+    for (size_t Rank = 0; Rank < Ranked.size() && Rank < Top; ++Rank)
+    {
+        for (const auto& Row : SortBreakdown(Ranked[Rank].second->*Member))
+        {
+            const FQuantileSketch& S = Row.second->Sketch;
+            std::snprintf(Buffer, sizeof(Buffer), "| `%s` | %s | %llu | %llu | %.4g | %.4g | %.4g | %.4g |\n", Ranked[Rank].first.c_str(),
+                Row.first.c_str(), static_cast<unsigned long long>(Row.second->Files), static_cast<unsigned long long>(S.GetCount()),
+                S.GetMean(), S.GetQuantile(0.5), S.GetQuantile(0.99), S.GetMax());
+            Out << Buffer;
+        }
+    }
+}
+
+void WriteMarkdown(std::ostream& Out, const std::vector<std::pair<std::string, const FStatAggregate*>>& Ranked, const FOptions& Options,
+    size_t NumMaps, size_t NumBuilds)
+{
+    Out << "# Lua stats across the fleet\n\n";
+    Out << Options.Inputs.size() << " capture(s), " << Ranked.size() << " stats, ranked by total over all frames of all captures. "
+        << "Percentiles are per frame, within " << RelativeAccuracy * 100.0 << "%.\n\n";
+    Out << "| Stat | Files | Frames | Total | Mean | P50 | P90 | P99 | P99.9 | Max |\n";
+    Out << "|---|---:|---:|---:|---:|---:|---:|---:|---:|---:|\n";
+    char Buffer[512];
+    for (size_t Rank = 0; Rank < Ranked.size() && Rank < Options.Top; ++Rank)
+    {
+        const FDistribution& D = Ranked[Rank].second->All;
+        const FQuantileSketch& S = D.Sketch;
+        std::snprintf(Buffer, sizeof(Buffer), "| `%s` | %llu | %llu | %.4g | %.4g | %.4g | %.4g | %.4g | %.4g | %.4g |\n",
+            Ranked[Rank].first.c_str(), static_cast<unsigned long long>(D.Files), static_cast<unsigned long long>(S.GetCount()),
+            S.GetSum(), S.GetMean(), S.GetQuantile(0.5), S.GetQuantile(0.9), S.GetQuantile(0.99), S.GetQuantile(0.999), S.GetMax());
+        Out << Buffer;
+    }
+    // A breakdown with a single label repeats the table above.
+    if (NumMaps > 1)
+    {
+        WriteBreakdown(Out, "map", Ranked, Options.Top, &FStatAggregate::ByMap);
+    }
+    if (NumBuilds > 1)
+    {
+        WriteBreakdown(Out, "build", Ranked, Options.Top, &FStatAggregate::ByBuild);
+    }
+}
+
+bool ParseArguments(int Argc, char** Argv, FOptions& Options)
+{
+    for (int Index = 1; Index < Argc; ++Index)
+    {
+        const std::string Argument = Argv[Index];
+        const bool bHasValue = Index + 1 < Argc;
+        if (Argument == "--csv" && bHasValue)
+        {
+            Options.CsvPath = Argv[++Index];
+        }
+        else if (Argument == "--md" && bHasValue)
+        {
+            Options.MarkdownPath = Argv[++Index];
+        }
+        else if (Argument == "--include" && bHasValue)
+        {
+            Options.Include = Argv[++Index];
+        }
+        else if (Argument == "--map-key" && bHasValue)
+        {
+            Options.MapKey = Argv[++Index];
+        }
+        else if (Argument == "--build-key" && bHasValue)
+        {
+            Options.BuildKey = Argv[++Index];
+        }
+        else if (Argument == "--skip-frames" && bHasValue)
+        {
+            Options.SkipFrames = static_cast<size_t>(std::atoll(Argv[++Index]));
+        }
+        else if (Argument == "--top" && bHasValue)
+        {
+            Options.Top = static_cast<size_t>(std::atoll(Argv[++Index]));
+        }
+        else if (Argument == "--threads" && bHasValue)
+        {
+            Options.Threads = static_cast<unsigned>(std::atoi(Argv[++Index]));
+        }
+        else if (Argument.compare(0, 2, "--") != 0)
+        {
+            Options.Inputs.push_back(Argument);
+        }
+        else
+        {
+            std::fprintf(stderr, "LuaStatsFleet: unknown argument %s\n", Argument.c_str());
+            return false;
+        }
+    }
+    if (Options.Threads == 0)
+    {
+        Options.Threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    return !Options.Inputs.empty();
+}
+
+}
+
+int main(int Argc, char** Argv)
+{
+    FOptions Options;
+    if (!ParseArguments(Argc, Argv, Options))
+    {
+        std::fprintf(stderr, "Usage: LuaStatsFleet capture.csv|capture.lscf [...] [--csv out.csv] [--md out.md] [--top N]\n"
+            "       [--include Substring] [--skip-frames N] [--map-key Key] [--build-key Key] [--threads N]\n");
+        return 2;
+    }
+
+    FFleet Fleet;
+    if (!ReadFleet(Options, Fleet))
+    {
+        return 2;
+    }
+
+    std::vector<std::pair<std::string, const FStatAggregate*>> Ranked;
+    std::unordered_map<std::string, bool> Maps;
+    std::unordered_map<std::string, bool> Builds;
+    for (const auto& Pair : Fleet)
+    {
+        Ranked.emplace_back(Pair.first, &Pair.second);
+        for (const auto& Map : Pair.second.ByMap)
+        {
+            Maps[Map.first] = true;
+        }
+        for (const auto& Build : Pair.second.ByBuild)
+        {
+            Builds[Build.first] = true;
+        }
+    }
+    std::sort(Ranked.begin(), Ranked.end(), [](const auto& A, const auto& B)
+    {
+        return A.second->All.Sketch.GetSum() > B.second->All.Sketch.GetSum();
+    });
+
+    if (!Options.CsvPath.empty())
+    {
+        std::ofstream Csv(Options.CsvPath);
+        WriteCsv(Csv, Ranked);
+    }
+    if (!Options.MarkdownPath.empty())
+    {
+        std::ofstream Markdown(Options.MarkdownPath);
+        WriteMarkdown(Markdown, Ranked, Options, Maps.size(), Builds.size());
+    }
+    if (Options.CsvPath.empty() && Options.MarkdownPath.empty())
+    {
+        WriteMarkdown(std::cout, Ranked, Options, Maps.size(), Builds.size());
+    }
+    std::fprintf(stderr, "LuaStatsFleet: %zu capture(s), %zu stats, %zu map(s), %zu build(s)\n", Options.Inputs.size(), Ranked.size(),
+        Maps.size(), Builds.size());
+    return 0;
+}
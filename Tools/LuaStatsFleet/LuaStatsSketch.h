@@ -0,0 +1,188 @@
+// LuaStatsSketch.h
+//
+// The quantile sketch LuaStatsFleet streams each stat's per-frame values into: logarithmic buckets with 1%
+// relative accuracy and a bounded bucket count, merged exactly by adding bucket counts. Plain C++, header only,
+// so the tests can include it.
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace LuaStatsSketch
+{
+    static constexpr double RelativeAccuracy = 0.01;
+    static constexpr size_t MaxBins = 2048;
+    // Magnitudes below this are counted as zero.
+    static constexpr double MinIndexable = 1e-9;
+
+    inline const double Gamma = (1.0 + RelativeAccuracy) / (1.0 - RelativeAccuracy);
+    inline const double LogGamma = std::log(Gamma);
+
+    // Contiguous bucket counts from Offset on. Past MaxBins the lowest buckets are folded together, which only
+    // loses accuracy on the smallest magnitudes, far below the percentiles that matter for cost.
+    struct FBins
+    {
+        int32_t Offset = 0;
+        std::vector<uint64_t> Counts;
+
+        void Add(int32_t Index, uint64_t Count)
+        {
+            if (Counts.empty())
+            {
+                Offset = Index;
+                Counts.assign(1, 0);
+            }
+            else if (Index < Offset)
+            {
+                Counts.insert(Counts.begin(), static_cast<size_t>(Offset - Index), 0);
+                Offset = Index;
+            }
+            else if (Index >= Offset + static_cast<int32_t>(Counts.size()))
+            {
+                Counts.resize(static_cast<size_t>(Index - Offset) + 1, 0);
+            }
+            Counts[Index - Offset] += Count;
+            if (Counts.size() > MaxBins)
+            {
+                const size_t Excess = Counts.size() - MaxBins;
+                for (size_t Bin = 0; Bin < Excess; ++Bin)
+                {
+                    Counts[Excess] += Counts[Bin];
+                }
+                Counts.erase(Counts.begin(), Counts.begin() + Excess);
+                Offset += static_cast<int32_t>(Excess);
+            }
+        }
+
+        void Merge(const FBins& Other)
+        {
+            for (size_t Bin = 0; Bin < Other.Counts.size(); ++Bin)
+            {
+                if (Other.Counts[Bin])
+                {
+                    Add(Other.Offset + static_cast<int32_t>(Bin), Other.Counts[Bin]);
+                }
+            }
+        }
+    };
+
+    // DDSketch-style quantile sketch: a value is within RelativeAccuracy of the true value at the same rank.
+    class FQuantileSketch
+    {
+    public:
+        void Add(double Value)
+        {
+            if (Value > MinIndexable)
+            {
+                Positive.Add(GetIndex(Value), 1);
+            }
+            else if (Value < -MinIndexable)
+            {
+                Negative.Add(GetIndex(-Value), 1);
+            }
+            else
+            {
+                ++Zeros;
+            }
+            Min = Count == 0 ? Value : std::min(Min, Value);
+            Max = Count == 0 ? Value : std::max(Max, Value);
+            Sum += Value;
+            ++Count;
+        }
+
+        void Merge(const FQuantileSketch& Other)
+        {
+            if (Other.Count == 0)
+            {
+                return;
+            }
+            Positive.Merge(Other.Positive);
+            Negative.Merge(Other.Negative);
+            Zeros += Other.Zeros;
+            Min = Count == 0 ? Other.Min : std::min(Min, Other.Min);
+            Max = Count == 0 ? Other.Max : std::max(Max, Other.Max);
+            Sum += Other.Sum;
+            Count += Other.Count;
+        }
+
+        double GetQuantile(double Fraction) const
+        {
+            if (Count == 0)
+            {
+                return 0.0;
+            }
+            const uint64_t Rank = static_cast<uint64_t>(Fraction * (Count - 1));
+            uint64_t Seen = 0;
+            // Most negative first: the highest negative bucket holds the largest magnitudes.
+            for (size_t Bin = Negative.Counts.size(); Bin-- > 0;)
+            {
+                Seen += Negative.Counts[Bin];
+                if (Seen > Rank)
+                {
+                    return Clamp(-GetValue(Negative.Offset + static_cast<int32_t>(Bin)));
+                }
+            }
+            Seen += Zeros;
+            if (Seen > Rank)
+            {
+                return 0.0;
+            }
+            for (size_t Bin = 0; Bin < Positive.Counts.size(); ++Bin)
+            {
+                Seen += Positive.Counts[Bin];
+                if (Seen > Rank)
+                {
+                    return Clamp(GetValue(Positive.Offset + static_cast<int32_t>(Bin)));
+                }
+            }
+            return Max;
+        }
+
+        uint64_t GetCount() const
+        {
+            return Count;
+        }
+
+        double GetSum() const
+        {
+            return Sum;
+        }
+
+        double GetMean() const
+        {
+            return Count ? Sum / Count : 0.0;
+        }
+
+        double GetMax() const
+        {
+            return Max;
+        }
+
+    private:
+        static int32_t GetIndex(double Magnitude)
+        {
+            return static_cast<int32_t>(std::ceil(std::log(Magnitude) / LogGamma));
+        }
+
+        // Midpoint of the bucket (Gamma^(Index-1), Gamma^Index] in relative terms.
+        static double GetValue(int32_t Index)
+        {
+            return 2.0 * std::pow(Gamma, Index) / (Gamma + 1.0);
+        }
+
+        double Clamp(double Value) const
+        {
+            return std::min(Max, std::max(Min, Value));
+        }
+
+        FBins Positive;
+        FBins Negative;
+        uint64_t Zeros = 0;
+        uint64_t Count = 0;
+        double Sum = 0.0;
+        double Min = 0.0;
+        double Max = 0.0;
+    };
+}
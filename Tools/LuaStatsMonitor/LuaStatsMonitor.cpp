@@ -0,0 +1,354 @@
+// LuaStatsMonitor.cpp
+//
+// Attaches to the shared-memory segment a game publishes its Lua stats into (LuaStats.SharedMemory console
+// command or -LuaStatsSharedMemory=/Name) and shows the most expensive stats top-style, or dumps every frame it
+// sees to CSV. The monitor only reads the segment and never blocks the game: a frame published while a
+// snapshot is being copied makes it retry. Cycle counters are shown in milliseconds.
+//
+// Build: c++ -std=c++17 -O2 -I../.. LuaStatsMonitor.cpp -o LuaStatsMonitor   (add -lrt on older glibc)
+//
+// Usage: LuaStatsMonitor [/Name] [--top N] [--include Substring] [--interval ms]
+//        LuaStatsMonitor [/Name] --csv out.csv [--frames N] [--include Substring]
+//
+// Without a name the monitor attaches to the only /dev/shm/LuaStats.* segment, or lists them if there are
+// several.
+
+#include "LuaStatsSharedMemory.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+using namespace LuaStatsSharedMemory;
+
+struct FOptions
+{
+    std::string Name;
+    std::string CsvPath;
+    std::string Include;
+    size_t Top = 30;
+    unsigned IntervalMs = 1000;
+    uint64_t Frames = 0;
+};
+
+struct FSnapshot
+{
+    uint64_t Frame = 0;
+    double Seconds = 0.0;
+    std::vector<double> Values;
+};
+
+class FSegment
+{
+public:
+    ~FSegment()
+    {
+        Detach();
+    }
+
+    bool Attach(const std::string& InName)
+    {
+        Detach();
+        const int Fd = shm_open(InName.c_str(), O_RDONLY, 0);
+        if (Fd < 0)
+        {
+            return false;
+        }
+        struct stat Stat;
+        void* Segment = MAP_FAILED;
+        if (fstat(Fd, &Stat) == 0 && static_cast<size_t>(Stat.st_size) >= sizeof(FHeader))
+        {
+            Segment = mmap(nullptr, Stat.st_size, PROT_READ, MAP_SHARED, Fd, 0);
+        }
+        close(Fd);
+        if (Segment == MAP_FAILED)
+        {
+            return false;
+        }
+        Header = static_cast<FHeader*>(Segment);
+        Size = Stat.st_size;
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (Header->Magic != Magic || Header->Version != Version || GetSegmentSize(Header->Capacity) > Size)
+        {
+            std::fprintf(stderr, "%s is not a Lua stats segment of version %u\n", InName.c_str(), Version);
+            Detach();
+            return false;
+        }
+        Names.clear();
+        Types.clear();
+        return true;
+    }
+
+    void Detach()
+    {
+        if (Header)
+        {
+            munmap(Header, Size);
+        }
+        Header = nullptr;
+        Size = 0;
+    }
+
+    double GetMillisecondsPerCycle() const
+    {
+        return Header->MillisecondsPerCycle;
+    }
+
+    const std::vector<std::string>& GetNames() const
+    {
+        return Names;
+    }
+
+    const std::vector<uint8_t>& GetTypes() const
+    {
+        return Types;
+    }
+
+    // Seqlock read: copy the published buffer, then check no frame was published meanwhile.
+    bool Read(FSnapshot& Out)
+    {
+        for (int Attempt = 0; Attempt < 1000; ++Attempt)
+        {
+            uint32_t Num = 0;
+            Out.Values.resize(Header->Capacity);
+            if (!TryReadValues(Header, Out.Values.data(), Num, Out.Frame, Out.Seconds))
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            Out.Values.resize(Num);
+            {
+                // Names below a published NumStats are final, so they are copied once.
+                for (uint32_t Index = static_cast<uint32_t>(Names.size()); Index < Num; ++Index)
+                {
+                    const char* Name = LuaStatsSharedMemory::GetName(Header, Index);
+                    Names.emplace_back(Name, strnlen(Name, NameSize));
+                    Types.push_back(LuaStatsSharedMemory::GetTypes(Header)[Index]);
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    FHeader* Header = nullptr;
+    size_t Size = 0;
+    std::vector<std::string> Names;
+    std::vector<uint8_t> Types;
+};
+
+const char* GetTypeName(uint8_t Type)
+{
+    return Type < sizeof(TypeNames) / sizeof(TypeNames[0]) ? TypeNames[Type] : "?";
+}
+
+bool FindDefaultSegment(std::string& OutName)
+{
+    std::vector<std::string> Found;
+    if (DIR* Dir = opendir("/dev/shm"))
+    {
+        while (dirent* Entry = readdir(Dir))
+        {
+            if (std::strncmp(Entry->d_name, "LuaStats.", 9) == 0)
+            {
+                Found.push_back(std::string("/") + Entry->d_name);
+            }
+        }
+        closedir(Dir);
+    }
+    if (Found.size() == 1)
+    {
+        OutName = Found[0];
+        return true;
+    }
+    std::fprintf(stderr, Found.empty() ? "No Lua stats segment found in /dev/shm\n" : "Several Lua stats segments, pass one of:\n");
+    for (const std::string& Name : Found)
+    {
+        std::fprintf(stderr, "  %s\n", Name.c_str());
+    }
+    return false;
+}
+
+bool ParseArguments(int Argc, char** Argv, FOptions& Options)
+{
+    for (int Index = 1; Index < Argc; ++Index)
+    {
+        const std::string Arg = Argv[Index];
+        const bool bHasValue = Index + 1 < Argc;
+        if (Arg == "--top" && bHasValue)
+        {
+            Options.Top = std::strtoul(Argv[++Index], nullptr, 10);
+        }
+        else if (Arg == "--include" && bHasValue)
+        {
+            Options.Include = Argv[++Index];
+        }
+        else if (Arg == "--interval" && bHasValue)
+        {
+            Options.IntervalMs = std::max(1ul, std::strtoul(Argv[++Index], nullptr, 10));
+        }
+        else if (Arg == "--csv" && bHasValue)
+        {
+            Options.CsvPath = Argv[++Index];
+        }
+        else if (Arg == "--frames" && bHasValue)
+        {
+            Options.Frames = std::strtoull(Argv[++Index], nullptr, 10);
+        }
+        else if (!Arg.empty() && Arg[0] == '/' && Options.Name.empty())
+        {
+            Options.Name = Arg;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+double ToDisplay(const FSegment& Segment, uint8_t Type, double Value)
+{
+    return Type == 0 ? Value * Segment.GetMillisecondsPerCycle() : Value;
+}
+
+bool Matches(const FOptions& Options, const std::string& Name)
+{
+    return Options.Include.empty() || Name.find(Options.Include) != std::string::npos;
+}
+
+// Polls for new frames and writes each one it sees. Columns are the stats published when the dump starts.
+int DumpCsv(FSegment& Segment, const FOptions& Options)
+{
+    FILE* File = std::fopen(Options.CsvPath.c_str(), "w");
+    if (!File)
+    {
+        std::fprintf(stderr, "Cannot write %s\n", Options.CsvPath.c_str());
+        return 2;
+    }
+    FSnapshot Snapshot;
+    std::vector<size_t> Columns;
+    uint64_t LastFrame = 0;
+    uint64_t Written = 0;
+    uint64_t Missed = 0;
+    while (Options.Frames == 0 || Written < Options.Frames)
+    {
+        if (!Segment.Read(Snapshot) || Snapshot.Frame == LastFrame)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+        if (Columns.empty())
+        {
+            std::fprintf(File, "Frame,Seconds");
+            for (size_t Index = 0; Index < Snapshot.Values.size(); ++Index)
+            {
+                if (Matches(Options, Segment.GetNames()[Index]))
+                {
+                    Columns.push_back(Index);
+                    std::fprintf(File, ",%s", Segment.GetNames()[Index].c_str());
+                }
+            }
+            std::fprintf(File, "\n");
+        }
+        else if (Snapshot.Frame > LastFrame + 1)
+        {
+            Missed += Snapshot.Frame - LastFrame - 1;
+        }
+        LastFrame = Snapshot.Frame;
+        std::fprintf(File, "%llu,%.6f", static_cast<unsigned long long>(Snapshot.Frame), Snapshot.Seconds);
+        for (const size_t Index : Columns)
+        {
+            std::fprintf(File, ",%.6g", ToDisplay(Segment, Segment.GetTypes()[Index], Snapshot.Values[Index]));
+        }
+        std::fprintf(File, "\n");
+        ++Written;
+    }
+    std::fclose(File);
+    std::fprintf(stderr, "Wrote %llu frames to %s, %llu frames published in between were missed\n",
+        static_cast<unsigned long long>(Written), Options.CsvPath.c_str(), static_cast<unsigned long long>(Missed));
+    return 0;
+}
+
+int ShowTop(FSegment& Segment, const FOptions& Options)
+{
+    FSnapshot Snapshot;
+    FSnapshot Previous;
+    std::vector<size_t> Order;
+    for (;;)
+    {
+        if (Segment.Read(Snapshot))
+        {
+            Order.clear();
+            for (size_t Index = 0; Index < Snapshot.Values.size(); ++Index)
+            {
+                if (Matches(Options, Segment.GetNames()[Index]))
+                {
+                    Order.push_back(Index);
+                }
+            }
+            const auto Display = [&](size_t Index) { return ToDisplay(Segment, Segment.GetTypes()[Index], Snapshot.Values[Index]); };
+            std::sort(Order.begin(), Order.end(), [&](size_t A, size_t B) { return Display(A) > Display(B); });
+
+            const double Elapsed = Snapshot.Seconds - Previous.Seconds;
+            const double FramesPerSecond = Previous.Frame > 0 && Elapsed > 0.0 ? (Snapshot.Frame - Previous.Frame) / Elapsed : 0.0;
+            std::printf("\033[H\033[2J%s  frame %llu  %.1f fps  %zu stats\n\n%-64s %-18s %14s\n", Options.Name.c_str(),
+                static_cast<unsigned long long>(Snapshot.Frame), FramesPerSecond, Snapshot.Values.size(), "Stat", "Type", "Value");
+            for (size_t Rank = 0; Rank < Order.size() && Rank < Options.Top; ++Rank)
+            {
+                const size_t Index = Order[Rank];
+                std::printf("%-64.64s %-18s %14.4f%s\n", Segment.GetNames()[Index].c_str(), GetTypeName(Segment.GetTypes()[Index]),
+                    Display(Index), Segment.GetTypes()[Index] == 0 ? " ms" : "");
+            }
+            std::fflush(stdout);
+
+            // A game that stopped publishing may have restarted under the same name with a new segment.
+            if (Previous.Frame == Snapshot.Frame && !Segment.Attach(Options.Name))
+            {
+                std::fprintf(stderr, "%s is gone\n", Options.Name.c_str());
+                return 0;
+            }
+            Previous = Snapshot;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(Options.IntervalMs));
+    }
+}
+
+}
+
+int main(int Argc, char** Argv)
+{
+    FOptions Options;
+    if (!ParseArguments(Argc, Argv, Options))
+    {
+        std::fprintf(stderr, "Usage: LuaStatsMonitor [/Name] [--top N] [--include Substring] [--interval ms]\n"
+            "       LuaStatsMonitor [/Name] --csv out.csv [--frames N] [--include Substring]\n");
+        return 2;
+    }
+    if (Options.Name.empty() && !FindDefaultSegment(Options.Name))
+    {
+        return 2;
+    }
+    FSegment Segment;
+    if (!Segment.Attach(Options.Name))
+    {
+        std::fprintf(stderr, "Cannot attach to %s\n", Options.Name.c_str());
+        return 2;
+    }
+    return Options.CsvPath.empty() ? ShowTop(Segment, Options) : DumpCsv(Segment, Options);
+}
@@ -0,0 +1,267 @@
+// LuaStatsToolsTests.cpp
+//
+// Tests of the plain C++ shared by the plugin and the standalone tools: the seqlock protocol of the
+// shared-memory segment (LuaStatsSharedMemory.h) and the quantile sketch of LuaStatsFleet (LuaStatsSketch.h).
+// The capture formats written inside the engine are covered by the automation tests in LuaStatsTests.cpp.
+//
+// Build: c++ -std=c++17 -O2 -pthread -I../.. -I../LuaStatsFleet LuaStatsToolsTests.cpp -o LuaStatsToolsTests
+//
+// Usage: LuaStatsToolsTests
+//     Exits with 1 after printing the checks that failed.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "LuaStatsSharedMemory.h"
+#include "LuaStatsSketch.h"
+
+namespace
+{
+
+int Failures = 0;
+
+#define CHECK(Condition) \
+    do \
+    { \
+        if (!(Condition)) \
+        { \
+            std::fprintf(stderr, "%s:%d: %s failed\n", __FILE__, __LINE__, #Condition); \
+            ++Failures; \
+        } \
+    } \
+    while (0)
+
+// The writer publishes frames whose values all equal the frame number while a reader copies concurrently:
+// every copy the seqlock accepts must be a whole frame, and frames never go backwards.
+void TestSeqlockPublishesWholeFrames()
+{
+    using namespace LuaStatsSharedMemory;
+    static constexpr uint32_t Capacity = 512;
+    static constexpr uint64_t Frames = 200000;
+
+    std::vector<uint64_t> Segment(GetSegmentSize(Capacity) / sizeof(uint64_t) + 1);
+    InitHeader(Segment.data(), Capacity, 1.0);
+    FHeader* Header = reinterpret_cast<FHeader*>(Segment.data());
+    CHECK(Header->Magic == Magic);
+
+    std::atomic<bool> bDone { false };
+    std::thread Writer([&]
+    {
+        std::vector<double> Values(Capacity);
+        for (uint64_t Frame = 1; Frame <= Frames; ++Frame)
+        {
+            // Stats are appended over time, as in a session that registers them late.
+            const uint32_t Num = static_cast<uint32_t>(std::min<uint64_t>(Capacity, 16 + Frame / 256));
+            std::fill(Values.begin(), Values.begin() + Num, static_cast<double>(Frame));
+            PublishValues(Header, Values.data(), Num, Frame, static_cast<double>(Frame));
+        }
+        bDone.store(true, std::memory_order_release);
+    });
+
+    std::vector<double> Values(Capacity);
+    uint64_t Reads = 0;
+    uint64_t LastFrame = 0;
+    uint32_t LastNum = 0;
+    bool bTorn = false;
+    while (!bDone.load(std::memory_order_acquire))
+    {
+        uint32_t Num = 0;
+        uint64_t Frame = 0;
+        double Seconds = 0.0;
+        if (!TryReadValues(Header, Values.data(), Num, Frame, Seconds))
+        {
+            continue;
+        }
+        ++Reads;
+        if (Frame == 0)
+        {
+            continue;
+        }
+        bTorn |= Seconds != static_cast<double>(Frame) || Frame < LastFrame || Num < LastNum;
+        for (uint32_t Index = 0; Index < Num; ++Index)
+        {
+            bTorn |= Values[Index] != static_cast<double>(Frame);
+        }
+        LastFrame = Frame;
+        LastNum = Num;
+    }
+    Writer.join();
+    CHECK(!bTorn);
+    CHECK(Reads > 0);
+
+    uint32_t Num = 0;
+    uint64_t Frame = 0;
+    double Seconds = 0.0;
+    CHECK(TryReadValues(Header, Values.data(), Num, Frame, Seconds));
+    CHECK(Frame == Frames);
+    CHECK(Num == Capacity);
+    CHECK(Values[Capacity - 1] == static_cast<double>(Frames));
+}
+
+// A publish in progress (odd sequence) fails the read until it completes.
+void TestSeqlockRejectsConcurrentPublish()
+{
+    using namespace LuaStatsSharedMemory;
+    static constexpr uint32_t Capacity = 4;
+
+    std::vector<uint64_t> Segment(GetSegmentSize(Capacity) / sizeof(uint64_t) + 1);
+    InitHeader(Segment.data(), Capacity, 1.0);
+    FHeader* Header = reinterpret_cast<FHeader*>(Segment.data());
+    const double Published[Capacity] = { 1.0, 2.0, 3.0, 4.0 };
+    PublishValues(Header, Published, Capacity, 7, 0.5);
+
+    double Values[Capacity] = {};
+    uint32_t Num = 0;
+    uint64_t Frame = 0;
+    double Seconds = 0.0;
+    CHECK(TryReadValues(Header, Values, Num, Frame, Seconds));
+    CHECK(Num == Capacity && Frame == 7 && Seconds == 0.5);
+    CHECK(std::equal(Values, Values + Capacity, Published));
+
+    Header->Sequence.fetch_add(1);
+    CHECK(!TryReadValues(Header, Values, Num, Frame, Seconds));
+    Header->Sequence.fetch_add(1);
+    CHECK(TryReadValues(Header, Values, Num, Frame, Seconds));
+
+    // NumStats past the capacity, e.g. from a newer writer, is clamped rather than overrunning the copy.
+    Header->NumStats.store(Capacity + 100);
+    CHECK(TryReadValues(Header, Values, Num, Frame, Seconds));
+    CHECK(Num == Capacity);
+}
+
+double GetExactQuantile(const std::vector<double>& Sorted, double Fraction)
+{
+    return Sorted[static_cast<size_t>(Fraction * (Sorted.size() - 1))];
+}
+
+bool IsWithinAccuracy(double Estimate, double Exact)
+{
+    return std::fabs(Estimate - Exact) <= LuaStatsSketch::RelativeAccuracy * std::fabs(Exact) + 1e-12;
+}
+
+// Frame times are roughly log-normal with a long tail, plus exact zeros for frames a stat did not run in and
+// a few negative deltas.
+std::vector<double> MakeFrameValues(uint32_t Seed, size_t Num)
+{
+    std::mt19937_64 Random(Seed);
+    std::lognormal_distribution<double> Distribution(0.0, 1.5);
+    std::vector<double> Values(Num);
+    for (size_t Index = 0; Index < Num; ++Index)
+    {
+        const double Value = Distribution(Random);
+        Values[Index] = Index % 10 == 0 ? 0.0 : Index % 37 == 0 ? -Value : Value;
+    }
+    return Values;
+}
+
+void TestSketchQuantilesWithinAccuracy()
+{
+    const std::vector<double> Values = MakeFrameValues(1, 100000);
+    LuaStatsSketch::FQuantileSketch Sketch;
+    for (double Value : Values)
+    {
+        Sketch.Add(Value);
+    }
+    std::vector<double> Sorted = Values;
+    std::sort(Sorted.begin(), Sorted.end());
+
+    CHECK(Sketch.GetCount() == Values.size());
+    CHECK(Sketch.GetMax() == Sorted.back());
+    for (double Fraction : { 0.0, 0.001, 0.01, 0.1, 0.25, 0.5, 0.75, 0.9, 0.99, 0.999, 1.0 })
+    {
+        const double Estimate = Sketch.GetQuantile(Fraction);
+        const double Exact = GetExactQuantile(Sorted, Fraction);
+        if (!IsWithinAccuracy(Estimate, Exact))
+        {
+            std::fprintf(stderr, "p%g: sketch %.9g, exact %.9g\n", Fraction * 100.0, Estimate, Exact);
+        }
+        CHECK(IsWithinAccuracy(Estimate, Exact));
+    }
+}
+
+// Merging adds bucket counts, so sketching parts and merging them gives the sketch of the whole.
+void TestSketchMergeEqualsUnion()
+{
+    const std::vector<double> First = MakeFrameValues(2, 30000);
+    const std::vector<double> Second = MakeFrameValues(3, 50000);
+    LuaStatsSketch::FQuantileSketch Union;
+    LuaStatsSketch::FQuantileSketch Merged;
+    LuaStatsSketch::FQuantileSketch Part;
+    for (double Value : First)
+    {
+        Union.Add(Value);
+        Merged.Add(Value);
+    }
+    for (double Value : Second)
+    {
+        Union.Add(Value);
+        Part.Add(Value);
+    }
+    Merged.Merge(Part);
+    Merged.Merge(LuaStatsSketch::FQuantileSketch());
+
+    CHECK(Merged.GetCount() == Union.GetCount());
+    CHECK(Merged.GetMax() == Union.GetMax());
+    CHECK(std::fabs(Merged.GetSum() - Union.GetSum()) <= 1e-9 * std::fabs(Union.GetSum()));
+    for (int Percent = 0; Percent <= 100; ++Percent)
+    {
+        CHECK(Merged.GetQuantile(Percent / 100.0) == Union.GetQuantile(Percent / 100.0));
+    }
+
+    LuaStatsSketch::FQuantileSketch Empty;
+    Empty.Merge(Part);
+    CHECK(Empty.GetCount() == Part.GetCount());
+    CHECK(Empty.GetQuantile(0.5) == Part.GetQuantile(0.5));
+}
+
+// Past MaxBins the smallest magnitudes are folded together: counts are kept and the upper quantiles stay
+// within accuracy.
+void TestSketchFoldsLowestBins()
+{
+    LuaStatsSketch::FQuantileSketch Sketch;
+    std::vector<double> Values;
+    for (int Exponent = -8; Exponent <= 30; ++Exponent)
+    {
+        for (int Step = 0; Step < 100; ++Step)
+        {
+            Values.push_back(std::pow(10.0, Exponent + Step / 100.0));
+        }
+    }
+    for (double Value : Values)
+    {
+        Sketch.Add(Value);
+    }
+    std::sort(Values.begin(), Values.end());
+
+    CHECK(Sketch.GetCount() == Values.size());
+    for (double Fraction : { 0.75, 0.9, 0.99, 1.0 })
+    {
+        CHECK(IsWithinAccuracy(Sketch.GetQuantile(Fraction), GetExactQuantile(Values, Fraction)));
+    }
+    // Folded buckets are reported at the lowest kept bucket, never below the minimum.
+    CHECK(Sketch.GetQuantile(0.0) >= Values.front());
+}
+
+}
+
+int main()
+{
+    TestSeqlockPublishesWholeFrames();
+    TestSeqlockRejectsConcurrentPublish();
+    TestSketchQuantilesWithinAccuracy();
+    TestSketchMergeEqualsUnion();
+    TestSketchFoldsLowestBins();
+    if (Failures > 0)
+    {
+        std::fprintf(stderr, "%d checks failed\n", Failures);
+        return 1;
+    }
+    std::printf("All tests passed\n");
+    return 0;
+}